@@ -0,0 +1,129 @@
+// Allocation benchmark: parse + generate a synthetic program with AST nodes
+// from individual malloc calls (heap) and from a context arena, reporting
+// allocator calls and peak RSS for each. Linux/glibc only (malloc is
+// interposed and forwarded to the __libc_* entry points).
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "parse.h"
+#include "codegen_vhdl.h"
+#include "compi_context.h"
+#include "synth_source.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t s_allocs = 0;
+static size_t s_frees = 0;
+
+void *malloc(size_t size) {
+    s_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    s_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    s_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (ptr) s_frees++;
+    __libc_free(ptr);
+}
+
+static double now_ms(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Runs in a forked child so each mode starts from the same heap and RSS
+static int run_mode(const char *src, size_t len, int use_arena) {
+
+    CompiContext ctx;
+    FILE *in = fmemopen((void*)src, len, "r");
+    FILE *out = fopen("/dev/null", "w");
+    ASTNode *program = NULL;
+    struct rusage ru;
+    double start = 0;
+    size_t allocs = 0;
+    size_t frees = 0;
+
+    if (!in || !out) {
+        perror("alloc_bench");
+        return EXIT_FAILURE;
+    }
+    s_allocs = 0;
+    s_frees = 0;
+    start = now_ms();
+    compi_context_init(&ctx);
+    ctx.heap_nodes = !use_arena;
+    if (compi_context_load_file(&ctx, in) != 0) {
+        perror("alloc_bench");
+        return EXIT_FAILURE;
+    }
+    program = parse_program(&ctx);
+    if (!program) {
+        fprintf(stderr, "alloc_bench: parse failed\n");
+        return EXIT_FAILURE;
+    }
+    generate_vhdl(&ctx, program, out);
+    free_node(program); // No-op for arena nodes
+    compi_context_free(&ctx);
+    allocs = s_allocs;
+    frees = s_frees;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%-6s %12zu %12zu %12ld %10.1f\n", use_arena ? "arena" : "heap",
+           allocs, frees, ru.ru_maxrss, now_ms() - start);
+    fflush(stdout);
+    fclose(in);
+    fclose(out);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+
+    SynthParams params = SYNTH_DEFAULTS;
+    size_t len = 0;
+    char *src = NULL;
+    pid_t pid = 0;
+    int status = 0;
+    int mode = 0;
+
+    params.functions = argc > 1 ? atoi(argv[1]) : 5000;
+    src = synth_source(&params, &len);
+    printf("%d functions, %zu bytes of source\n", params.functions, len);
+    printf("%-6s %12s %12s %12s %10s\n", "mode", "allocs", "frees", "peak_rss_kb", "ms");
+    fflush(stdout);
+
+    for (mode = 0; mode < 2; mode++) {
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+        }
+        if (pid == 0) {
+            exit(run_mode(src, len, mode));
+        }
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "alloc_bench: %s run failed\n", mode ? "arena" : "heap");
+            return EXIT_FAILURE;
+        }
+    }
+    free(src);
+    return EXIT_SUCCESS;
+}
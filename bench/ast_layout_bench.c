@@ -0,0 +1,128 @@
+// AST layout benchmark: per-node footprint and traversal/codegen time of the
+// pointer tree versus the compact FlatAst (and its ASTNode view).
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parse.h"
+#include "codegen_vhdl.h"
+#include "compi_context.h"
+#include "ast_flat.h"
+#include "synth_source.h"
+
+static double now_ms(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Touch what a codegen walk reads: type, value and children
+static size_t walk_tree(const ASTNode *node) {
+
+    size_t sum = (size_t)node->type + (node->value ? (unsigned char)node->value[0] : 0);
+    int i = 0;
+
+    for (i = 0; i < node->num_children; i++) {
+        sum += walk_tree(node->children[i]);
+    }
+    return sum;
+}
+
+static size_t walk_flat(const FlatAst *ast, AstId id) {
+
+    const FlatNode *flat = &ast->nodes[id];
+    const char *value = flat_value(ast, id);
+    size_t sum = (size_t)flat->type + (value ? (unsigned char)value[0] : 0);
+    uint32_t i = 0;
+
+    for (i = 0; i < flat->num_children; i++) {
+        sum += walk_flat(ast, flat_child(ast, id, i));
+    }
+    return sum;
+}
+
+static double time_codegen(CompiContext *ctx, ASTNode *root) {
+
+    FILE *out = fopen("/dev/null", "w");
+    double start = now_ms();
+
+    generate_vhdl(ctx, root, out);
+    fclose(out);
+    return now_ms() - start;
+}
+
+int main(int argc, char *argv[]) {
+
+    SynthParams params = SYNTH_DEFAULTS;
+    CompiContext ctx;
+    FlatAst flat;
+    ASTNode *program = NULL;
+    ASTNode *view = NULL;
+    FILE *in = NULL;
+    size_t len = 0;
+    size_t check_tree = 0;
+    size_t check_flat = 0;
+    size_t check_view = 0;
+    char *src = NULL;
+    double start = 0;
+    double t_tree = 0;
+    double t_flat = 0;
+    double t_view = 0;
+    double t_build = 0;
+    int rounds = 5;
+    int r = 0;
+
+    params.functions = argc > 1 ? atoi(argv[1]) : 100000;
+    src = synth_source(&params, &len);
+    in = fmemopen(src, len, "r");
+    if (!in) {
+        perror("ast_layout_bench");
+        return EXIT_FAILURE;
+    }
+    compi_context_init(&ctx);
+    if (compi_context_load_file(&ctx, in) != 0) {
+        perror("ast_layout_bench");
+        return EXIT_FAILURE;
+    }
+    program = parse_program(&ctx);
+    if (!program) {
+        fprintf(stderr, "ast_layout_bench: parse failed\n");
+        return EXIT_FAILURE;
+    }
+
+    start = now_ms();
+    if (flat_ast_build(&flat, program) != 0) {
+        fprintf(stderr, "ast_layout_bench: flatten failed\n");
+        return EXIT_FAILURE;
+    }
+    t_build = now_ms() - start;
+    view = flat_ast_view(&flat);
+
+    for (r = 0; r < rounds; r++) {
+        start = now_ms(); check_tree = walk_tree(program); t_tree += now_ms() - start;
+        start = now_ms(); check_flat = walk_flat(&flat, 0); t_flat += now_ms() - start;
+        start = now_ms(); check_view = walk_tree(view); t_view += now_ms() - start;
+    }
+    if (check_tree != check_flat || check_tree != check_view) {
+        fprintf(stderr, "ast_layout_bench: traversal mismatch\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%d functions, %zu nodes\n", params.functions, flat.count);
+    printf("bytes/node: tree %.1f (arena), flat %.1f\n",
+           (double)ctx.arena.bytes_used / flat.count,
+           (double)(flat.count * sizeof(FlatNode) + flat.child_count * sizeof(AstId)) / flat.count);
+    printf("flatten: %.1f ms\n", t_build);
+    printf("walk (avg of %d): tree %.2f ms, flat %.2f ms, view %.2f ms\n",
+           rounds, t_tree / rounds, t_flat / rounds, t_view / rounds);
+    printf("codegen: tree %.1f ms, view %.1f ms\n", time_codegen(&ctx, program), time_codegen(&ctx, view));
+
+    flat_ast_free(&flat);
+    compi_context_free(&ctx);
+    fclose(in);
+    free(src);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+// Microbenchmarks (Google Benchmark) for the lexer, the expression and
+// program parsers, the VHDL generator and the in-process compile API on
+// synthetic inputs. Besides time
+// they report throughput (tokens/s, nodes/s, bytes/s) and heap allocator
+// calls per iteration; malloc is interposed, so glibc only.
+#include <benchmark/benchmark.h>
+extern "C" {
+#include "compi_context.h"
+#include "codegen_vhdl.h"
+#include "parse.h"
+#include "token.h"
+#include "out_sink.h"
+#include "synth_source.h"
+#include "compi_api.h"
+}
+#include <atomic>
+#include <cstdlib>
+#include <string>
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+static std::atomic<size_t> s_allocs{0};
+
+void *malloc(size_t size) {
+    s_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    s_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    s_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+
+// Program shape from the benchmark arguments: functions, expression depth,
+// arrays per function and structs
+static std::string make_source(const benchmark::State& state) {
+
+    SynthParams params = SYNTH_DEFAULTS;
+    size_t len = 0;
+
+    params.functions = (int)state.range(0);
+    params.expr_depth = (int)state.range(1);
+    params.arrays = (int)state.range(2);
+    params.structs = (int)state.range(3);
+    char *text = synth_source(&params, &len);
+    std::string src(text, len);
+    free(text);
+    return src;
+}
+
+static size_t count_nodes(const ASTNode *node) {
+
+    size_t n = 1;
+
+    for (int i = 0; i < node->num_children; i++) {
+        n += count_nodes(node->children[i]);
+    }
+    return n;
+}
+
+static void report_allocs(benchmark::State& state, size_t before) {
+    state.counters["allocs"] = benchmark::Counter((double)(s_allocs.load() - before), benchmark::Counter::kAvgIterations);
+}
+
+static size_t discard_output(void *user, const char *data, size_t len) {
+
+    (void)data;
+    *(size_t*)user += len;
+    return len;
+}
+
+static void BM_Lexer(benchmark::State& state) {
+
+    std::string src = make_source(state);
+    CompiContext ctx;
+    size_t tokens = 0;
+
+    compi_context_init(&ctx);
+    size_t before = s_allocs.load();
+    for (auto _ : state) {
+        compi_context_load_buffer(&ctx, src.data(), src.size());
+        while (get_next_token(&ctx).type != TOKEN_EOF) {
+            tokens++;
+        }
+    }
+    report_allocs(state, before);
+    state.counters["tokens/s"] = benchmark::Counter((double)tokens, benchmark::Counter::kIsRate);
+    state.SetBytesProcessed((int64_t)(state.iterations() * src.size()));
+    compi_context_free(&ctx);
+}
+
+static void BM_ParseExpression(benchmark::State& state) {
+
+    SynthParams params = SYNTH_DEFAULTS;
+    CompiContext ctx;
+    size_t len = 0;
+
+    params.expr_depth = (int)state.range(0);
+    char *text = synth_expression(&params, &len);
+    std::string src(text, len);
+    free(text);
+
+    // Every iteration builds the same tree: count it once, outside the timing
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, src.data(), src.size());
+    advance(&ctx);
+    size_t nodes = count_nodes(parse_expression(&ctx));
+
+    size_t before = s_allocs.load();
+    for (auto _ : state) {
+        compi_context_reset(&ctx);
+        compi_context_load_buffer(&ctx, src.data(), src.size());
+        advance(&ctx);
+        ASTNode *expr = parse_expression(&ctx);
+        benchmark::DoNotOptimize(expr);
+    }
+    report_allocs(state, before);
+    state.counters["nodes/s"] = benchmark::Counter((double)(nodes * state.iterations()), benchmark::Counter::kIsRate);
+    state.SetBytesProcessed((int64_t)(state.iterations() * src.size()));
+    compi_context_free(&ctx);
+}
+
+static void BM_ParseProgram(benchmark::State& state) {
+
+    std::string src = make_source(state);
+    CompiContext ctx;
+
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, src.data(), src.size());
+    size_t nodes = count_nodes(parse_program(&ctx));
+
+    size_t before = s_allocs.load();
+    for (auto _ : state) {
+        compi_context_reset(&ctx);
+        compi_context_load_buffer(&ctx, src.data(), src.size());
+        ASTNode *program = parse_program(&ctx);
+        benchmark::DoNotOptimize(program);
+    }
+    report_allocs(state, before);
+    state.counters["nodes/s"] = benchmark::Counter((double)(nodes * state.iterations()), benchmark::Counter::kIsRate);
+    state.SetBytesProcessed((int64_t)(state.iterations() * src.size()));
+    compi_context_free(&ctx);
+}
+
+static void BM_GenerateVhdl(benchmark::State& state) {
+
+    std::string src = make_source(state);
+    CompiContext ctx;
+    OutSink sink;
+    size_t bytes = 0;
+
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, src.data(), src.size());
+    ASTNode *program = parse_program(&ctx);
+    size_t nodes = count_nodes(program);
+
+    size_t before = s_allocs.load();
+    for (auto _ : state) {
+        sink_init_callback(&sink, discard_output, &bytes);
+        generate_vhdl_sink(&ctx, program, &sink);
+        sink_close(&sink);
+    }
+    report_allocs(state, before);
+    state.counters["nodes/s"] = benchmark::Counter((double)(nodes * state.iterations()), benchmark::Counter::kIsRate);
+    state.SetBytesProcessed((int64_t)bytes);   // Bytes of VHDL written
+    compi_context_free(&ctx);
+}
+
+// Whole compilations through the library API, one warm session (Compile) or
+// a new one per call (CompileOneShot): the per-call cost of embedding
+static void BM_SessionCompile(benchmark::State& state) {
+
+    std::string src = make_source(state);
+    CompiSession *session = compi_session_new(nullptr);
+    CompiResult result;
+    size_t bytes = 0;
+
+    size_t before = s_allocs.load();
+    for (auto _ : state) {
+        compi_session_compile(session, src.data(), src.size(), &result);
+        bytes += result.vhdl_len;
+        compi_result_free(&result);
+    }
+    report_allocs(state, before);
+    state.SetBytesProcessed((int64_t)bytes);
+    compi_session_free(session);
+}
+
+static void BM_CompileOneShot(benchmark::State& state) {
+
+    std::string src = make_source(state);
+    CompiResult result;
+    size_t bytes = 0;
+
+    size_t before = s_allocs.load();
+    for (auto _ : state) {
+        compi_compile(src.data(), src.size(), nullptr, &result);
+        bytes += result.vhdl_len;
+        compi_result_free(&result);
+    }
+    report_allocs(state, before);
+    state.SetBytesProcessed((int64_t)bytes);
+}
+
+// {functions, expression depth, arrays, structs}
+static void program_shapes(benchmark::internal::Benchmark *b) {
+
+    b->ArgNames({"fn", "depth", "arrays", "structs"});
+    b->Args({100, 4, 2, 2});
+    b->Args({1000, 4, 2, 2});
+    b->Args({10000, 4, 2, 2});
+    b->Args({1000, 16, 2, 2});
+    b->Args({1000, 4, 16, 2});
+    b->Args({1000, 4, 2, 16});
+}
+
+BENCHMARK(BM_Lexer)->Apply(program_shapes);
+BENCHMARK(BM_ParseExpression)->ArgName("depth")->RangeMultiplier(4)->Range(4, 1024);
+BENCHMARK(BM_ParseProgram)->Apply(program_shapes);
+BENCHMARK(BM_GenerateVhdl)->Apply(program_shapes);
+BENCHMARK(BM_SessionCompile)->ArgNames({"fn", "depth", "arrays", "structs"})->Args({1, 4, 1, 1})->Args({100, 4, 2, 2});
+BENCHMARK(BM_CompileOneShot)->ArgNames({"fn", "depth", "arrays", "structs"})->Args({1, 4, 1, 1})->Args({100, 4, 2, 2});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,204 @@
+// Deep-nesting stress benchmark: parse, generate and free programs whose
+// if/while blocks, parentheses, unary chains or array indexes nest up to 100k levels deep.
+// Each compile runs on a thread with a fixed, pre-painted stack, so the
+// report shows the stack high-water mark next to the time per node; both
+// should stay flat as the depth grows.
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parse.h"
+#include "codegen_vhdl.h"
+#include "compi_context.h"
+#include "out_sink.h"
+#include "utils.h"
+
+#define BENCH_STACK (1024 * 1024)
+#define STACK_PAINT 0xA5
+
+typedef enum { SHAPE_IF, SHAPE_WHILE, SHAPE_PARENS, SHAPE_UNARY, SHAPE_INDEX, SHAPE_COUNT } Shape;
+
+static const char *s_shape_names[SHAPE_COUNT] = { "if", "while", "parens", "unary", "index" };
+
+typedef struct {
+    const char *src;
+    size_t len;
+    size_t nodes;
+    double parse_ms;
+    double codegen_ms;
+    double free_ms;
+    int ok;
+} NestRun;
+
+static double now_ms(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// One function whose body nests depth levels of the given shape
+static char* nested_source(Shape shape, int depth) {
+
+    StrBuf sb = {0};
+    int i = 0;
+
+    strbuf_append_str(&sb, "int f(int a) {\n");
+    switch (shape) {
+        case SHAPE_IF:
+        case SHAPE_WHILE:
+            for (i = 0; i < depth; i++) {
+                strbuf_append_str(&sb, shape == SHAPE_IF ? "if (a < 7) { " : "while (a < 7) { ");
+            }
+            strbuf_append_str(&sb, shape == SHAPE_IF ? "a = a + 1; " : "a = a + 1; break; ");
+            for (i = 0; i < depth; i++) {
+                strbuf_append_str(&sb, "} ");
+            }
+            break;
+        case SHAPE_PARENS:
+            // a + (a + (a + ... )): a right-leaning tree depth levels deep
+            strbuf_append_str(&sb, "int r = ");
+            for (i = 0; i < depth; i++) {
+                strbuf_append_str(&sb, "(a + ");
+            }
+            strbuf_append_str(&sb, "1");
+            for (i = 0; i < depth; i++) {
+                strbuf_append_str(&sb, ")");
+            }
+            strbuf_append_str(&sb, ";");
+            break;
+        case SHAPE_UNARY:
+            strbuf_append_str(&sb, "int r = ");
+            for (i = 0; i < depth; i++) {
+                strbuf_append_str(&sb, i % 2 ? "~" : "!");
+            }
+            strbuf_append_str(&sb, "a;");
+            break;
+        case SHAPE_INDEX:
+            strbuf_append_str(&sb, "int arr[4] = {0, 0, 0, 0}; int r = ");
+            for (i = 0; i < depth; i++) {
+                strbuf_append_str(&sb, "arr[");
+            }
+            strbuf_append_str(&sb, "0");
+            for (i = 0; i < depth; i++) {
+                strbuf_append_str(&sb, "]");
+            }
+            strbuf_append_str(&sb, ";");
+            break;
+        default:
+            break;
+    }
+    strbuf_append_str(&sb, "\nreturn a;\n}\n");
+    return strbuf_detach(&sb);
+}
+
+static size_t discard_output(void *user, const char *data, size_t len) {
+
+    (void)user;
+    (void)data;
+    return len;
+}
+
+static void count_node(const ASTNode *node, int depth, void *arg) {
+
+    (void)node;
+    (void)depth;
+    (*(size_t*)arg)++;
+}
+
+// Thread body: heap nodes, so free_node tears the tree down
+static void* compile_nested(void *arg) {
+
+    NestRun *run = (NestRun*)arg;
+    CompiContext ctx;
+    OutSink sink;
+    ASTNode *program = NULL;
+    double start = 0;
+
+    compi_context_init(&ctx);
+    ctx.heap_nodes = 1;
+    compi_context_load_buffer(&ctx, run->src, run->len);
+    start = now_ms();
+    program = parse_program(&ctx);
+    run->parse_ms = now_ms() - start;
+    if (program) {
+        ast_walk(program, count_node, &run->nodes);
+        sink_init_callback(&sink, discard_output, NULL);
+        start = now_ms();
+        generate_vhdl_sink(&ctx, program, &sink);
+        sink_close(&sink);
+        run->codegen_ms = now_ms() - start;
+        start = now_ms();
+        free_node(program);
+        run->free_ms = now_ms() - start;
+        run->ok = 1;
+    }
+    compi_context_free(&ctx);
+    return NULL;
+}
+
+// Run one compile on a painted stack; returns the bytes of stack it touched
+static size_t run_on_stack(NestRun *run) {
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    unsigned char *stack = NULL;
+    size_t used = 0;
+
+    if (posix_memalign((void**)&stack, 4096, BENCH_STACK) != 0) {
+        perror("nesting_bench");
+        exit(EXIT_FAILURE);
+    }
+    memset(stack, STACK_PAINT, BENCH_STACK);
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, BENCH_STACK);
+    if (pthread_create(&thread, &attr, compile_nested, run) != 0) {
+        perror("nesting_bench: pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    // The stack grows down: the lowest repainted byte marks the high-water
+    while (used < BENCH_STACK && stack[used] == STACK_PAINT) used++;
+    used = BENCH_STACK - used;
+    free(stack);
+    return used;
+}
+
+int main(int argc, char *argv[]) {
+
+    int max_depth = argc > 1 ? atoi(argv[1]) : 100000;
+    NestRun run;
+    size_t stack_used = 0;
+    char *src = NULL;
+    int shape = 0;
+    int depth = 0;
+
+    printf("Each compile runs on a %d KiB thread stack (thread descriptor and TLS included)\n", BENCH_STACK / 1024);
+    printf("%-7s %8s %9s %10s %10s %10s %9s %11s\n",
+           "shape", "depth", "nodes", "parse_ms", "codegen_ms", "free_ms", "ns/node", "stack_kib");
+    for (shape = 0; shape < SHAPE_COUNT; shape++) {
+        for (depth = 1000; depth <= max_depth; depth *= 10) {
+            memset(&run, 0, sizeof(run));
+            src = nested_source((Shape)shape, depth);
+            run.src = src;
+            run.len = strlen(src);
+            stack_used = run_on_stack(&run);
+            if (!run.ok) {
+                fprintf(stderr, "nesting_bench: %s depth %d failed to parse\n", s_shape_names[shape], depth);
+                return EXIT_FAILURE;
+            }
+            printf("%-7s %8d %9zu %10.2f %10.2f %10.2f %9.1f %11.1f\n", s_shape_names[shape], depth, run.nodes,
+                   run.parse_ms, run.codegen_ms, run.free_ms,
+                   (run.parse_ms + run.codegen_ms + run.free_ms) * 1e6 / (double)run.nodes,
+                   stack_used / 1024.0);
+            fflush(stdout);
+            free(src);
+        }
+    }
+    return EXIT_SUCCESS;
+}
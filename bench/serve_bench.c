@@ -0,0 +1,162 @@
+// Compile-server latency benchmark: per-request cost of a fresh compi
+// process, of the thin client (compi --connect) and of a request on an open
+// connection to compi --serve.
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "compile_server.h"
+#include "synth_source.h"
+
+extern char **environ;
+
+static double now_ms(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Run compi with the given arguments, stdout discarded; returns its status
+static int run_compi(char *const args[], pid_t *background) {
+
+    posix_spawn_file_actions_t actions;
+    pid_t pid = 0;
+    int status = 0;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    if (posix_spawn(&pid, COMPI_EXE, &actions, NULL, args, environ) != 0) {
+        perror("serve_bench: spawn");
+        exit(EXIT_FAILURE);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    if (background) {
+        *background = pid;
+        return 0;
+    }
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+static int compare_ms(const void *a, const void *b) {
+
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+static void report(const char *label, double *ms, int n) {
+
+    double sum = 0;
+    int i = 0;
+
+    for (i = 0; i < n; i++) sum += ms[i];
+    qsort(ms, (size_t)n, sizeof(double), compare_ms);
+    printf("%-22s mean %7.3f ms   median %7.3f ms   p90 %7.3f ms\n", label, sum / n, ms[n / 2], ms[n * 9 / 10]);
+}
+
+int main(int argc, char *argv[]) {
+
+    SynthParams params = SYNTH_DEFAULTS;
+    CompileRequest req;
+    CompileReply reply;
+    char in_path[] = "/tmp/compi_serve_bench_XXXXXX";
+    char sock_path[64];
+    char out_path[64];
+    double *ms = NULL;
+    char *src = NULL;
+    FILE *f = NULL;
+    size_t len = 0;
+    pid_t server = 0;
+    double start = 0;
+    int requests = 0;
+    int fd = -1;
+    int tries = 0;
+    int r = 0;
+
+    requests = argc > 1 ? atoi(argv[1]) : 200;
+    params.functions = argc > 2 ? atoi(argv[2]) : 20;
+    if (requests <= 0) requests = 1;
+    ms = (double*)malloc((size_t)requests * sizeof(double));
+    src = synth_source(&params, &len);
+    fd = mkstemp(in_path);
+    f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!ms || !f || fwrite(src, 1, len, f) != len || fclose(f) != 0) {
+        perror("serve_bench");
+        return EXIT_FAILURE;
+    }
+    snprintf(sock_path, sizeof(sock_path), "/tmp/compi_serve_bench_%d.sock", (int)getpid());
+    snprintf(out_path, sizeof(out_path), "/tmp/compi_serve_bench_%d.vhdl", (int)getpid());
+    printf("%d requests, %d functions (%zu bytes of source)\n", requests, params.functions, len);
+
+    {
+        char *args[] = { "compi", in_path, out_path, NULL };
+        for (r = 0; r < requests; r++) {
+            start = now_ms();
+            if (run_compi(args, NULL) != 0) {
+                fprintf(stderr, "serve_bench: compi failed\n");
+                return EXIT_FAILURE;
+            }
+            ms[r] = now_ms() - start;
+        }
+        report("fresh process", ms, requests);
+    }
+
+    {
+        char *args[] = { "compi", "--serve", sock_path, "--jobs", "2", NULL };
+        run_compi(args, &server);
+    }
+    for (tries = 0; tries < 500 && (fd = compile_client_connect(sock_path)) < 0; tries++) {
+        usleep(10000);
+    }
+    if (fd < 0) {
+        perror("serve_bench: connect");
+        return EXIT_FAILURE;
+    }
+    close(fd);   // Server is up; an idle connection would tie up a worker
+
+    {
+        char *args[] = { "compi", "--connect", sock_path, in_path, out_path, NULL };
+        for (r = 0; r < requests; r++) {
+            start = now_ms();
+            if (run_compi(args, NULL) != 0) {
+                fprintf(stderr, "serve_bench: compi --connect failed\n");
+                return EXIT_FAILURE;
+            }
+            ms[r] = now_ms() - start;
+        }
+        report("thin client process", ms, requests);
+    }
+
+    fd = compile_client_connect(sock_path);
+    memset(&req, 0, sizeof(req));
+    req.source = src;
+    req.len = len;
+    for (r = 0; r < requests; r++) {
+        start = now_ms();
+        if (compile_client_request(fd, &req, &reply) != 0 || !reply.ok) {
+            fprintf(stderr, "serve_bench: request failed\n");
+            return EXIT_FAILURE;
+        }
+        ms[r] = now_ms() - start;
+        free(reply.text);
+    }
+    report("open connection", ms, requests);
+
+    close(fd);
+    compile_client_shutdown(sock_path);
+    waitpid(server, NULL, 0);
+    unlink(in_path);
+    unlink(out_path);
+    free(src);
+    free(ms);
+    return EXIT_SUCCESS;
+}
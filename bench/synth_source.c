@@ -0,0 +1,106 @@
+#include "synth_source.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils.h"
+
+static unsigned s_state = 1;
+
+static unsigned next_rand(void) {
+    s_state = s_state * 1103515245u + 12345u;
+    return (s_state >> 16) & 0x7fff;
+}
+
+static void emitf(StrBuf *sb, const char *fmt, ...) {
+
+    char line[256];
+    va_list ap;
+    int n = 0;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n > 0) strbuf_append(sb, line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+// Operators accepted both at top level and inside parentheses
+static const char *s_ops[] = { "+", "-", "*", "<<", ">>", "&", "^", "==", "!=", "<", ">" };
+
+static void emit_atom(StrBuf *sb, const SynthParams *p) {
+
+    switch (next_rand() % 5) {
+        case 0: strbuf_append_str(sb, "a"); break;
+        case 1: strbuf_append_str(sb, "b"); break;
+        case 2: emitf(sb, "%u", next_rand() % 100); break;
+        case 3:
+            if (p->arrays > 0) {
+                emitf(sb, "arr%u[%u]", next_rand() % (unsigned)p->arrays, next_rand() % 4);
+            } else {
+                strbuf_append_str(sb, "t");
+            }
+            break;
+        default:
+            if (p->structs > 0) {
+                strbuf_append_str(sb, "s0.f1");
+            } else {
+                strbuf_append_str(sb, "t");
+            }
+            break;
+    }
+}
+
+static void emit_expr(StrBuf *sb, const SynthParams *p, int depth) {
+
+    if (depth <= 0) {
+        emit_atom(sb, p);
+        return;
+    }
+    strbuf_append_str(sb, "(");
+    emit_expr(sb, p, depth - 1);
+    emitf(sb, " %s ", s_ops[next_rand() % (sizeof(s_ops) / sizeof(s_ops[0]))]);
+    emit_atom(sb, p);
+    strbuf_append_str(sb, ")");
+}
+
+char* synth_expression(const SynthParams *p, size_t *len) {
+
+    StrBuf sb = {0};
+
+    s_state = p->seed ? p->seed : 1u;
+    emit_expr(&sb, p, p->expr_depth);
+    strbuf_append_str(&sb, ";\n");
+    if (len) *len = sb.len;
+    return strbuf_detach(&sb);
+}
+
+char* synth_source(const SynthParams *p, size_t *len) {
+
+    StrBuf sb = {0};
+    int f = 0;
+    int i = 0;
+
+    s_state = p->seed ? p->seed : 1u;
+    for (i = 0; i < p->structs; i++) {
+        emitf(&sb, "struct S%d { int f0; int f1; int f2; };\n", i);
+    }
+    for (f = 0; f < p->functions; f++) {
+        emitf(&sb, "\nint fn_%d(int a, int b", f);
+        for (i = 0; i < p->structs; i++) {
+            emitf(&sb, ", struct S%d s%d", i, i);
+        }
+        strbuf_append_str(&sb, ") {\n    int t = ");
+        emit_expr(&sb, p, p->expr_depth);
+        strbuf_append_str(&sb, ";\n    int i = 0;\n");
+        for (i = 0; i < p->arrays; i++) {
+            emitf(&sb, "    int arr%d[4] = {1, 2, 3, 4};\n", i);
+        }
+        strbuf_append_str(&sb, "    if (t > a) {\n        t = ");
+        emit_expr(&sb, p, p->expr_depth);
+        strbuf_append_str(&sb, ";\n    } else {\n        t = t + 1;\n    }\n");
+        strbuf_append_str(&sb, "    while (i < 4) {\n        t = t + ");
+        emit_expr(&sb, p, p->expr_depth / 2);
+        strbuf_append_str(&sb, ";\n        i = i + 1;\n    }\n    return t;\n}\n");
+    }
+    if (len) *len = sb.len;
+    return strbuf_detach(&sb);
+}
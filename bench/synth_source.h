@@ -0,0 +1,26 @@
+#ifndef SYNTH_SOURCE_H
+#define SYNTH_SOURCE_H
+
+#include <stddef.h>
+
+// Shape of a generated C program for the benchmarks
+typedef struct {
+    int functions;     // Number of function definitions
+    int expr_depth;    // Nesting depth of generated expressions
+    int arrays;        // Array declarations per function
+    int structs;       // Struct declarations (each used as a parameter)
+    unsigned seed;     // Deterministic pseudo-random seed
+} SynthParams;
+
+// Defaults used when a benchmark does not override them
+#define SYNTH_DEFAULTS { 200, 4, 2, 2, 1u }
+
+// Generate a program the parser accepts; caller frees the result.
+// *len receives the source length (excluding the terminator).
+char* synth_source(const SynthParams *params, size_t *len);
+
+// A single expression of params->expr_depth nested operators followed by
+// ';' (for parse_expression benchmarks); caller frees the result
+char* synth_expression(const SynthParams *params, size_t *len);
+
+#endif // SYNTH_SOURCE_H
@@ -0,0 +1,57 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdalign.h>
+
+// Bump allocator with chunked growth. Individual allocations are never
+// freed; the whole arena is released at once in O(chunks).
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;   // Previously filled chunk
+    size_t size;               // Usable bytes in data
+    size_t used;               // Bytes handed out so far
+    alignas(max_align_t) unsigned char data[]; // Allocation space
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *head;          // Chunk currently being filled
+    size_t chunk_size;         // Default size of new chunks
+    size_t chunk_count;        // Chunks obtained from malloc (and still held)
+    size_t bytes_used;         // Bytes handed out (including alignment padding)
+    void *last;                // Most recent allocation (can grow in place)
+    ArenaChunk *spare;         // Emptied chunks kept by arena_reset for reuse
+} Arena;
+
+// Saved fill position (arena_mark / arena_rewind)
+typedef struct {
+    ArenaChunk *chunk;         // Head at mark time (NULL: arena was empty)
+    ArenaChunk *behind;        // Chunk that followed it
+    size_t used;
+    size_t bytes_used;
+} ArenaMark;
+
+#define ARENA_DEFAULT_CHUNK (64 * 1024)
+
+void arena_init(Arena *arena, size_t chunk_size);
+void arena_free(Arena *arena);
+
+// Release every allocation but keep the standard-size chunks for reuse,
+// so a long-lived arena stops calling malloc once it is warm
+void arena_reset(Arena *arena);
+
+// Release everything allocated since the mark, with arena_reset's chunk
+// reuse. Marks taken after it become invalid.
+ArenaMark arena_mark(const Arena *arena);
+void arena_rewind(Arena *arena, ArenaMark mark);
+
+// Allocate size bytes aligned for any fundamental type
+void* arena_alloc(Arena *arena, size_t size);
+
+// Resize the block at ptr (old_size bytes). Grows in place when ptr is the
+// most recent allocation and the chunk has room; otherwise copies.
+void* arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+char* arena_strdup(Arena *arena, const char *s);
+char* arena_strndup(Arena *arena, const char *s, size_t len);
+
+#endif // ARENA_H
@@ -0,0 +1,112 @@
+#ifndef AST_FLAT_H
+#define AST_FLAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "astnode.h"
+
+// Compact AST: nodes in one contiguous vector in preorder (a subtree is a
+// contiguous id range), 32-bit ids for parent/children, and each node's
+// children stored as a range of a shared side array. Nothing in it is a
+// pointer (values and lexemes are offsets), so the arrays can be written
+// to disk as they are and mapped back (see flat_ast_save / flat_ast_load).
+typedef uint32_t AstId;
+#define AST_NO_ID ((AstId)0xffffffffu)
+#define FLAT_NO_VALUE ((uint32_t)0xffffffffu)
+
+// Version of the .cast file written by flat_ast_save; bump on any change
+// to FlatNode, FlatStruct, FlatField or the file layout
+#define FLAT_AST_VERSION 1
+
+// Node flags
+#define FLAT_HAS_TOKEN 0x01   // Node token points into the source buffer
+
+typedef struct {
+    uint8_t type;          // NodeType
+    uint8_t op;            // OperatorKind of the node
+    uint8_t token_type;    // TokenType of the node token
+    uint8_t token_kw;      // KeywordKind of the node token
+    uint8_t token_op;      // OperatorKind of the node token
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t line;         // Token line
+    uint32_t offset;       // Token lexeme, relative to FlatAst.source
+    uint32_t length;
+    AstId parent;
+    uint32_t first_child;  // Index into FlatAst.child_ids
+    uint32_t num_children;
+    uint32_t value;        // Node value: offset into FlatAst.strings
+} FlatNode;
+
+// Struct table of the flattened tree (names are offsets into strings)
+typedef struct {
+    uint32_t name;
+    uint32_t first_field;  // Index into FlatAst.fields
+    uint32_t field_count;
+} FlatStruct;
+
+typedef struct {
+    uint32_t name;
+    uint32_t type;
+} FlatField;
+
+typedef struct {
+    FlatNode *nodes;
+    size_t count;
+    size_t capacity;
+    AstId *child_ids;
+    size_t child_count;
+    size_t child_capacity;
+    char *strings;            // NUL-terminated node values, deduplicated
+    size_t strings_len;
+    size_t strings_capacity;
+    FlatStruct *structs;
+    size_t struct_count;
+    FlatField *fields;
+    size_t field_count;
+    const char *source;       // Base of token offsets
+    size_t source_len;        // Bytes of source the tokens cover
+    CompiContext *ctx;        // Context of the flattened tree (symbols live in it)
+    ASTNode *views;           // ASTNode view of node n is views[n] (see flat_ast_view)
+    ASTNode **view_children;  // Children arrays of the views, same layout as child_ids
+    void *file;               // Loaded file backing the arrays (NULL: built)
+    size_t file_len;
+    int file_mapped;          // file is mmap'd (else malloc'd)
+} FlatAst;
+
+// Flatten the tree under root, with the struct table of root's context.
+// Returns 0 on success, -1 when the tokens do not all come from one source
+// buffer or the tree is too large for 32-bit offsets.
+int flat_ast_build(FlatAst *ast, const ASTNode *root);
+void flat_ast_free(FlatAst *ast);
+
+static inline AstId flat_child(const FlatAst *ast, AstId id, uint32_t i) {
+    return ast->child_ids[ast->nodes[id].first_child + i];
+}
+
+static inline const char* flat_value(const FlatAst *ast, AstId id) {
+    return ast->nodes[id].value == FLAT_NO_VALUE ? NULL : ast->strings + ast->nodes[id].value;
+}
+
+// Token of node id, rebuilt from the compact fields
+Token flat_token(const FlatAst *ast, AstId id);
+
+// Contiguous ASTNode view of the whole tree for code that still takes
+// ASTNode* (root is node 0). Views are read-only, owned by ast and must not
+// be passed to free_node.
+ASTNode* flat_ast_view(FlatAst *ast);
+
+// Write ast as a .cast file: a header, then the node, child, string,
+// struct and source sections, each 8-byte aligned. Returns 0 on success.
+int flat_ast_save(const FlatAst *ast, FILE *out);
+
+// Map a .cast file (regular files are mmap'd, other streams are read) and
+// use its sections in place; the struct table is registered in ctx, which
+// must be fresh and becomes the tree's context. Returns 0 on success, -1
+// when the stream cannot be read (errno set) and -2 when it is not a valid
+// version FLAT_AST_VERSION file for this platform. The loaded AST is
+// read-only.
+int flat_ast_load(FlatAst *ast, CompiContext *ctx, FILE *in);
+
+#endif // AST_FLAT_H
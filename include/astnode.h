@@ -1,8 +1,11 @@
 #ifndef ASTNODE_H
 #define ASTNODE_H
 
+#include <stddef.h>
 #include "token.h"
 
+typedef struct CompiContext CompiContext;
+
 // AST Node Types
 typedef enum {
     NODE_PROGRAM,
@@ -22,25 +25,44 @@ typedef enum {
     NODE_WHILE_STATEMENT,
     NODE_FOR_STATEMENT,
     NODE_BREAK_STATEMENT,
-    NODE_CONTINUE_STATEMENT
+    NODE_CONTINUE_STATEMENT,
+    NODE_INDEX,                // children: indexed value, index expression
+    NODE_MEMBER,               // child: record value; value is the field name
+    NODE_CACHED_FUNCTION,      // Function reused from the cache: value is its VHDL
+    NODE_TYPE_COUNT            // Number of node types (not a node)
 } NodeType;
 
 
 // AST Node structure
 typedef struct ASTNode {
     NodeType type;
+    OperatorKind op;           // Operator of unary/binary expression nodes
     Token token;               // Original token (if applicable)
     char *value;               // Value or additional info
     struct ASTNode *parent;    // Parent node
     struct ASTNode **children; // Child nodes
     int num_children;          // Number of children
     int capacity;              // Capacity of children array
+    CompiContext *ctx;         // Owning context (NULL: individually malloc'd)
 } ASTNode;
 
 
-// Missing function declarations for AST node management
-ASTNode* create_node(NodeType type);
+// AST node management. Nodes created with a context live in its arena and
+// are released with it (free_node ignores them); ctx == NULL gives a
+// stand-alone heap node.
+ASTNode* create_node(CompiContext *ctx, NodeType type);
 void free_node(ASTNode* node);
 void add_child(ASTNode* parent, ASTNode* child);
 
+// Preorder walk on an explicit stack (safe for any nesting depth): visit
+// gets each node with its depth below root, children in order
+typedef void (*AstVisitor)(const ASTNode *node, int depth, void *arg);
+void ast_walk(const ASTNode *root, AstVisitor visit, void *arg);
+
+// Node values are copied into node storage (interned in the context for
+// context nodes, which must be treated as read-only; heap copies otherwise)
+void node_set_value(ASTNode *node, const char *text);
+void node_set_value_n(ASTNode *node, const char *text, size_t len);
+void node_set_value_token(ASTNode *node, const Token *tok);
+
 #endif // ASTNODE_H
\ No newline at end of file
@@ -3,8 +3,23 @@
 
 #include <stdio.h>
 #include "astnode.h"
+#include "out_sink.h"
 
-// Generate VHDL code from an AST root node
-void generate_vhdl(ASTNode* node, FILE* output);
+// Generate VHDL code from an AST root node; struct and array information
+// comes from ctx (the context the tree was parsed in). Returns 0, or -1
+// when a write to output failed (the VHDL is then incomplete).
+int generate_vhdl(CompiContext *ctx, ASTNode* node, FILE* output);
+
+// Same, into any sink (file, memory buffer or callback); the caller
+// flushes or closes the sink. Returns -1 once the sink has an error.
+int generate_vhdl_sink(CompiContext *ctx, ASTNode* node, OutSink* output);
+
+// Streaming form (see parse_program_stream): the file header once, then
+// each top-level item as it is parsed. The header carries the records of
+// the structs registered so far (those of #included headers); any other
+// struct's record is written where the struct is defined, so the output
+// matches generate_vhdl whenever the structs come before the functions.
+void generate_vhdl_header(CompiContext *ctx, OutSink* output);
+void generate_vhdl_item(CompiContext *ctx, ASTNode* item, OutSink* output);
 
 #endif // CODEGEN_VHDL_H
@@ -0,0 +1,56 @@
+#ifndef COMPI_API_H
+#define COMPI_API_H
+
+#include <stddef.h>
+
+// In-process compiler API: C source in memory, VHDL text and diagnostics
+// back in caller-owned buffers. Nothing touches the disk except #include'd
+// headers (relative to the current directory) and a function cache
+// directory when one is set, and nothing exits the process on a parse
+// error: every error is reported and the other functions are still
+// generated.
+typedef struct {
+    int jobs;               // Threads for parsing and codegen (<= 1: serial)
+    const char *cache_dir;  // Function cache directory (NULL: off)
+} CompiOptions;
+
+// One error or warning. text points into CompiResult.diagnostics and is
+// len bytes long, '\n' included ("Error (line N): ..." / "Warning: ...").
+typedef struct {
+    int is_error;
+    int line;
+    const char *text;
+    size_t len;
+} CompiDiagnostic;
+
+typedef struct {
+    int ok;                 // 1: no errors; 0: see diagnostics
+    char *vhdl;             // NUL-terminated VHDL; with errors, the functions
+    size_t vhdl_len;        // that had none (NULL when out of memory)
+    char *diagnostics;      // NUL-terminated errors and warnings ("" if none)
+    size_t diagnostics_len;
+    CompiDiagnostic *diag_list;  // The same, one entry per message
+    size_t diag_count;
+    size_t error_count;
+} CompiResult;
+
+// A session keeps one warm context (arena, interner, symbol tables) across
+// compilations, for callers that compile many small inputs. Sessions share
+// nothing, so each thread can drive its own.
+typedef struct CompiSession CompiSession;
+
+// opts may be NULL (serial, no cache); it is copied. NULL when out of memory.
+CompiSession* compi_session_new(const CompiOptions *opts);
+void compi_session_free(CompiSession *session);
+
+// Compile len bytes of src (no NUL needed). Returns 0 without errors, -1
+// otherwise; result is filled in either way and must be released with
+// compi_result_free.
+int compi_session_compile(CompiSession *session, const char *src, size_t len, CompiResult *result);
+
+// One-shot form of the above on a temporary session
+int compi_compile(const char *src, size_t len, const CompiOptions *opts, CompiResult *result);
+
+void compi_result_free(CompiResult *result);
+
+#endif // COMPI_API_H
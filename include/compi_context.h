@@ -0,0 +1,95 @@
+#ifndef COMPI_CONTEXT_H
+#define COMPI_CONTEXT_H
+
+#include <stdio.h>
+#include <setjmp.h>
+#include "arena.h"
+#include "intern.h"
+#include "lexer.h"
+#include "token.h"
+#include "symbol_arrays.h"
+#include "symbol_structs.h"
+#include "func_cache.h"
+#include "compi_stats.h"
+#include "out_sink.h"
+#include "diag.h"
+
+// Per-compilation state: lexer and lookahead token, symbol tables and the
+// allocators backing the AST. Nodes and child arrays come from the arena,
+// node strings and symbol names from the interner, and freeing the context
+// releases the whole tree in O(chunks). Contexts share nothing, so separate
+// inputs can be compiled concurrently on different threads.
+typedef struct CompiContext CompiContext;
+
+struct CompiContext {
+    Lexer lexer;
+    Token current_token;
+    TokenBuffer tokens;      // Lookahead/rewind tokens (peek_token, token_mark)
+    Arena arena;
+    Interner names;
+    ArrayTable arrays;       // Arrays of the function being parsed, by scope
+    StructTable structs;     // Struct definitions seen so far
+    int loop_depth;          // Enclosing while/for loops (break/continue checks)
+    int heap_nodes;          // Allocate stand-alone heap nodes instead (caller
+                             // frees them with free_node; for allocator debugging)
+    jmp_buf *fail_env;       // Where compi_fail jumps (NULL: exit the process)
+    int recover;             // Resync after an error instead of unwinding
+                             // (parse_program sets it; see parse_statement)
+    int parse_jobs;          // Threads for parse_program (<= 1: serial)
+    int codegen_jobs;        // Threads for generate_vhdl (<= 1: serial)
+    CompiContext *shards;    // Worker contexts whose arenas/interners back
+    int shard_count;         // parts of this AST (parallel parse)
+    FuncCache cache;         // Per-function output cache (cache.dir NULL: off)
+    CompiStats *stats;       // Timing and counters (NULL: off; shared by shards)
+    OutSink *diag;           // Parse errors and warnings (NULL: stdout)
+    DiagList diags;          // Every error and warning reported so far
+    int diag_hold;           // Record without printing (shards; the parent
+                             // prints their diagnostics in source order)
+};
+
+void compi_context_init(CompiContext *ctx);
+void compi_context_free(CompiContext *ctx);
+
+// Drop the source, AST and symbols of the last compilation but keep the
+// options and the warm allocators, for contexts that compile many inputs
+void compi_context_reset(CompiContext *ctx);
+
+// Source to parse: a stream (mapped or read in one pass; returns 0 on
+// success) or a caller-owned buffer that must outlive the context
+int compi_context_load_file(CompiContext *ctx, FILE *input);
+void compi_context_load_buffer(CompiContext *ctx, const char *src, size_t len);
+
+// Same with a malloc'd buffer the context takes over (preprocessor output)
+void compi_context_take_buffer(CompiContext *ctx, char *src, size_t len);
+
+// Set up a worker context over the parent's source buffer, with the
+// parent's struct table copied in. The worker allocates on its own arena
+// and interner; it is owned by the parent (see ctx->shards).
+void compi_context_init_shard(CompiContext *shard, const CompiContext *parent);
+
+// Report a parse error ("Error (line N): ...") or warning ("Warning: ...")
+// at the current token. fmt is the message alone, without a '\n'.
+void compi_error(CompiContext *ctx, const char *fmt, ...)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+void compi_warning(CompiContext *ctx, const char *fmt, ...)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+// Record a finished diagnostic in ctx->diags and print it to ctx->diag
+// (stdout when NULL) unless ctx->diag_hold is set
+void compi_report(CompiContext *ctx, DiagSeverity severity, int line, const char *text, size_t len);
+
+// Abandon the construct being parsed after an error: longjmp to
+// ctx->fail_env (inside parse_program, a resync point), exit otherwise
+#ifdef __cplusplus
+[[noreturn]] void compi_fail(CompiContext *ctx);
+#else
+_Noreturn void compi_fail(CompiContext *ctx);
+#endif
+
+#endif // COMPI_CONTEXT_H
@@ -0,0 +1,66 @@
+#ifndef COMPI_STATS_H
+#define COMPI_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "astnode.h"
+
+// Per-compilation timing and counters for compi --time-report / --stats.
+// The driver times the phases; symbol-table calls time themselves when
+// ctx->stats is set (shards and codegen workers share the parent's stats,
+// so those counters are updated atomically).
+typedef enum {
+    PHASE_READ,       // Loading the source
+    PHASE_LEX,        // A separate lexing pass over the whole source
+    PHASE_PARSE,      // parse_program (includes its own lexing and symbols)
+    PHASE_SYMBOLS,    // Symbol-table calls made during parse and codegen
+    PHASE_CODEGEN,    // generate_vhdl, including its buffered writes
+    PHASE_WRITE,      // Final flush and close of the output
+    PHASE_COUNT
+} CompiPhase;
+
+typedef struct {
+    double phase_ms[PHASE_COUNT];
+    double total_ms;
+    size_t tokens;
+    size_t nodes;
+    size_t nodes_by_type[NODE_TYPE_COUNT];
+    size_t arrays;            // register_array calls
+    size_t structs;
+    size_t struct_fields;
+    size_t symbol_ops;        // Timed symbol-table calls
+    uint64_t symbol_ns;       // Their raw time, timer overhead included
+    size_t bytes_emitted;
+} CompiStats;
+
+void compi_stats_init(CompiStats *stats);
+
+// Monotonic clock for phase timing
+double compi_stats_now_ms(void);
+
+// Symbol-table instrumentation: start = compi_stats_symbol_begin(stats),
+// then compi_stats_symbol_end(stats, start) (both no-ops for NULL stats)
+uint64_t compi_stats_symbol_begin(const CompiStats *stats);
+void compi_stats_symbol_end(CompiStats *stats, uint64_t start);
+
+// Atomically bump a counter of a shared stats block
+void compi_stats_add(size_t *counter, size_t n);
+
+// Lex src once (timed as PHASE_LEX) and count its tokens
+void compi_stats_lex(CompiStats *stats, const char *src, size_t len);
+
+// Count the nodes of a parsed tree by type
+void compi_stats_count_nodes(CompiStats *stats, const ASTNode *root);
+
+// Peak resident set size of the process in KiB (0 if unknown)
+long compi_stats_peak_rss_kb(void);
+
+// Human-readable report; counts adds the --stats section
+void compi_stats_print(const CompiStats *stats, FILE *out, int counts);
+
+// One JSON object for a file (no trailing newline)
+void compi_stats_print_json(const CompiStats *stats, FILE *out, int counts,
+                            const char *input, const char *output, int ok);
+
+#endif // COMPI_STATS_H
@@ -0,0 +1,48 @@
+#ifndef COMPILE_SERVER_H
+#define COMPILE_SERVER_H
+
+#include <stddef.h>
+
+// Long-lived compile daemon on a Unix domain socket (compi --serve) and the
+// client side of its protocol (compi --connect).
+//
+// A request is a block of "key value" header lines ended by an empty line:
+//   source <bytes>     the C source follows the header (exactly <bytes>,
+//                      at most 256 MiB; a bad length closes the connection)
+//   path <file>        or: the server reads the file itself; with source,
+//                      the file the source came from (for #include "...")
+//   jobs <n>           threads for this file (default 1)
+//   cache-dir <dir>    function cache directory (see func_cache.h)
+//   shutdown 1         stop the server once this request is answered
+// The reply is "ok <bytes>\n" followed by the VHDL, or "error <bytes>\n"
+// followed by the diagnostics. A connection may carry several requests.
+typedef struct {
+    const char *source;     // Source text (len bytes), or NULL to send path
+    size_t len;
+    const char *path;       // With source: its file, for includes (absolute,
+                            // the server's directory may differ; NULL: none)
+    int jobs;               // 0: server default (1)
+    const char *cache_dir;  // NULL: no cache
+} CompileRequest;
+
+typedef struct {
+    int ok;                 // 1: text is VHDL, 0: text is diagnostics
+    char *text;             // NUL-terminated; caller frees
+    size_t len;
+} CompileReply;
+
+// Serve until a shutdown request arrives, with jobs worker threads (<= 0:
+// one per CPU), each holding a warm context. Returns 0 on clean shutdown.
+int compile_server_run(const char *socket_path, int jobs);
+
+// Connect to a server; returns the socket or -1 (errno set)
+int compile_client_connect(const char *socket_path);
+
+// Send one request on a connection and wait for its reply. Returns 0 when
+// a reply arrived (check reply->ok), -1 on a transport error.
+int compile_client_request(int fd, const CompileRequest *req, CompileReply *reply);
+
+// Ask the server at socket_path to stop; returns 0 when it acknowledged
+int compile_client_shutdown(const char *socket_path);
+
+#endif // COMPILE_SERVER_H
@@ -0,0 +1,39 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stddef.h>
+#include "arena.h"
+
+// Parse errors and warnings of one compilation, in the order they were
+// reported. Each text is the message line as printed ("Error (line N): ..."
+// or "Warning: ..."), '\n' included.
+typedef enum {
+    DIAG_ERROR,
+    DIAG_WARNING
+} DiagSeverity;
+
+typedef struct {
+    DiagSeverity severity;
+    int line;              // Line of the token being parsed when reported
+    const char *text;      // NUL-terminated, owned by the list
+    size_t len;
+} Diagnostic;
+
+typedef struct {
+    Diagnostic *items;
+    size_t count;
+    size_t capacity;
+    size_t errors;         // Entries with DIAG_ERROR
+    Arena text;            // Message storage
+} DiagList;
+
+void diag_init(DiagList *list);
+void diag_free(DiagList *list);
+
+// Forget every entry but keep the storage for reuse
+void diag_reset(DiagList *list);
+
+// Append a copy of text; returns the stored entry
+const Diagnostic* diag_add(DiagList *list, DiagSeverity severity, int line, const char *text, size_t len);
+
+#endif // DIAG_H
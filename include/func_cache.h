@@ -0,0 +1,70 @@
+#ifndef FUNC_CACHE_H
+#define FUNC_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// In-memory store for a process that recompiles the same input many
+// times (compi --watch): key -> text in an open-addressing table. Entries
+// not used by a compilation are dropped by func_memo_sweep.
+typedef struct {
+    uint64_t key;         // 0: empty slot
+    char *text;           // NUL-terminated, owned
+    size_t len;
+    unsigned pass;        // Last compilation that loaded or stored it
+} FuncMemoEntry;
+
+typedef struct {
+    FuncMemoEntry *slots; // Power-of-two capacity, load <= 1/2
+    size_t capacity;
+    size_t count;
+    unsigned pass;
+} FuncMemo;
+
+// Cache of generated VHDL, one entry per function: on disk (one file per
+// function) or in a FuncMemo. The key is a content hash of the function's
+// source bytes and of the struct definitions it names, so an unchanged
+// function is neither parsed nor generated again. A zeroed FuncCache
+// (dir and memory NULL) is disabled.
+typedef struct {
+    const char *dir;      // Cache directory (created on first store)
+    FuncMemo *memory;     // In-memory store used instead of dir (not owned)
+    uint64_t *keys;       // Key per top-level child still to generate (0: none)
+    size_t key_count;
+    char **fragments;     // Text of the hits, owned until func_cache_free
+    size_t fragment_count;
+    size_t fragment_capacity;
+    size_t hits;
+    size_t misses;
+} FuncCache;
+
+// Bump when the generated text changes so stale entries stop matching
+#define FUNC_CACHE_VERSION "compi-func-cache-2"
+
+// FNV-1a, chainable: start from func_cache_hash(FUNC_CACHE_SEED, ...)
+#define FUNC_CACHE_SEED 14695981039346656037ULL
+uint64_t func_cache_hash(uint64_t h, const void *data, size_t len);
+
+// Cached text for key, or NULL on a miss. The text stays owned by the
+// cache and is released by func_cache_free (by the next func_memo_sweep
+// for the memory store).
+const char* func_cache_load(FuncCache *cache, uint64_t key);
+
+// Write text under key (temp file + rename, so concurrent compilers never
+// see a partial entry). Returns 0 on success; failures only cost a hit.
+int func_cache_store(FuncCache *cache, uint64_t key, const char *text, size_t len);
+
+void func_cache_free(FuncCache *cache);
+
+static inline int func_cache_enabled(const FuncCache *cache) {
+    return cache->dir != NULL || cache->memory != NULL;
+}
+
+void func_memo_init(FuncMemo *memo);
+void func_memo_free(FuncMemo *memo);
+
+// End of a compilation: drop the entries it did not use (functions that
+// were edited or removed) and start the next pass
+void func_memo_sweep(FuncMemo *memo);
+
+#endif // FUNC_CACHE_H
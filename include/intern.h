@@ -0,0 +1,40 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "token.h"
+
+// String interner: each distinct string is stored once and the returned
+// pointer is its identity, so interned names compare with ==.
+typedef struct {
+    const char *str;
+    uint32_t hash;
+    uint32_t len;
+} InternEntry;
+
+typedef struct {
+    Arena strings;         // Storage for the interned bytes
+    InternEntry *slots;    // Open-addressed table (power-of-two capacity)
+    size_t capacity;
+    size_t count;
+} Interner;
+
+void interner_init(Interner *in);
+void interner_free(Interner *in);
+
+// Forget every string but keep the table and string storage for reuse
+void interner_reset(Interner *in);
+
+// Return the canonical copy of text, inserting it if new
+const char* intern_n(Interner *in, const char *text, size_t len);
+const char* intern(Interner *in, const char *text);
+
+// Canonical copy of text if already interned, NULL otherwise (no insert)
+const char* intern_find_n(const Interner *in, const char *text, size_t len);
+
+// Intern the text of a token
+const char* intern_token(Interner *in, const Token *tok);
+
+#endif // INTERN_H
@@ -0,0 +1,42 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "token.h"
+
+// Buffered lexer: the whole input is mapped (or bulk-read for pipes) once
+// and scanned as a contiguous buffer instead of one fgetc per character.
+typedef struct {
+    const char *src;   // Start of source text
+    const char *cur;   // Current scan position
+    const char *end;   // One past the last byte of source text
+    int line;          // Line number at the scan position
+    void *map_base;    // mmap'd region (NULL when not mapped)
+    size_t map_len;    // Length of the mmap'd region
+    char *owned;       // Heap copy when the input could not be mapped
+} Lexer;
+
+// Saved scan position used for backtracking (see lexer_mark/lexer_reset)
+typedef struct {
+    size_t offset;
+    int line;
+} LexerMark;
+
+// Scan a caller-owned buffer; it must outlive the lexer
+void lexer_init_buffer(Lexer *lx, const char *src, size_t len);
+
+// Load the remaining contents of input (mmap for regular files, one bulk
+// read otherwise). Leaves the stream at EOF. Returns 0 on success.
+int lexer_init_file(Lexer *lx, FILE *input);
+
+// Release any mapping or heap copy owned by the lexer
+void lexer_release(Lexer *lx);
+
+// Scan the next token from the buffer
+Token lexer_next(Lexer *lx);
+
+LexerMark lexer_mark(const Lexer *lx);
+void lexer_reset(Lexer *lx, LexerMark mark);
+
+#endif // LEXER_H
@@ -0,0 +1,87 @@
+#ifndef OUT_SINK_H
+#define OUT_SINK_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Append buffer for generated text. Small appends are plain memcpys into
+// the buffer; the backend only sees large blocks (file: one fwrite per
+// OUT_SINK_BLOCK bytes, callback: one call per block) or, for the memory
+// backend, the whole text at the end.
+typedef size_t (*SinkWriteFn)(void *user, const char *data, size_t len);
+
+typedef enum {
+    SINK_FILE,
+    SINK_MEMORY,
+    SINK_CALLBACK
+} SinkKind;
+
+typedef struct {
+    char *buf;            // Pending bytes (memory backend: the whole text)
+    size_t len;
+    size_t cap;
+    SinkKind kind;
+    FILE *file;           // SINK_FILE
+    SinkWriteFn write;    // SINK_CALLBACK
+    void *user;
+    int error;            // Sticky: a backend write or allocation failed
+} OutSink;
+
+#define OUT_SINK_BLOCK (64 * 1024)
+
+void sink_init_file(OutSink *sink, FILE *file);
+void sink_init_memory(OutSink *sink);
+void sink_init_callback(OutSink *sink, SinkWriteFn write, void *user);
+
+// Hand pending bytes to the backend (no-op for the memory backend)
+void sink_flush(OutSink *sink);
+
+// Flush and release the buffer. Returns 0 if every write succeeded.
+int sink_close(OutSink *sink);
+
+// Memory backend: detach the NUL-terminated text (caller frees) and reset
+char* sink_take(OutSink *sink, size_t *len);
+
+// Slow paths behind the inline appends
+void sink_reserve(OutSink *sink, size_t extra);
+void sink_printf(OutSink *sink, const char *fmt, ...)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+void sink_vprintf(OutSink *sink, const char *fmt, va_list args);
+void sink_put_int(OutSink *sink, long value);
+
+static inline void sink_write(OutSink *sink, const char *data, size_t len) {
+
+    if (len == 0) return;   // data may be NULL (an empty buffer)
+    if (sink->cap - sink->len < len) {
+        sink_reserve(sink, len);
+        if (sink->cap - sink->len < len) return;
+    }
+    memcpy(sink->buf + sink->len, data, len);
+    sink->len += len;
+}
+
+static inline void sink_putc(OutSink *sink, char c) {
+
+    if (sink->len == sink->cap) {
+        sink_reserve(sink, 1);
+        if (sink->len == sink->cap) return;
+    }
+    sink->buf[sink->len++] = c;
+}
+
+// NULL prints as "(null)", like the printf family on glibc
+static inline void sink_puts(OutSink *sink, const char *s) {
+
+    if (!s) s = "(null)";
+    sink_write(sink, s, strlen(s));
+}
+
+// String literal append with the length known at compile time
+#define sink_lit(sink, lit) sink_write((sink), "" lit, sizeof(lit) - 1)
+
+#endif // OUT_SINK_H
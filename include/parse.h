@@ -6,7 +6,13 @@
 // Parsing interface (monolithic for now; will be split further)
 
 // Forward declarations still needed locally
-ASTNode* parse_program(FILE *input);
+ASTNode* parse_program(CompiContext *ctx);
+
+// Streaming parse: each finished top-level item (struct or function) is
+// passed to emit and then released, so only one item's nodes are alive at
+// a time. Always serial, without the function cache.
+typedef void (*ParseItemFn)(void *user, CompiContext *ctx, ASTNode *item);
+void parse_program_stream(CompiContext *ctx, ParseItemFn emit, void *user);
 
 // Other parsing entry points are in their own headers now
 #include "parse_struct.h"
@@ -14,10 +20,10 @@ ASTNode* parse_program(FILE *input);
 #include "parse_statement.h"
 #include "parse_expression.h"
 
-ASTNode* create_node(NodeType type);
+ASTNode* create_node(CompiContext *ctx, NodeType type);
 void add_child(ASTNode *parent, ASTNode *child);
 void free_node(ASTNode *node);
-void generate_vhdl(ASTNode* node, FILE* output);
+int generate_vhdl(CompiContext *ctx, ASTNode* node, FILE* output);
 void print_ast(ASTNode* node, int level);
 // Expression helpers now in parse_expression.h
 
@@ -4,8 +4,12 @@
 #include <stdio.h>
 #include "astnode.h"
 
-ASTNode* parse_primary(FILE *input);
-ASTNode* parse_expression_prec(FILE *input, int min_prec);
-ASTNode* parse_expression(FILE *input);
+ASTNode* parse_primary(CompiContext *ctx);
+ASTNode* parse_expression_prec(CompiContext *ctx, int min_prec);
+ASTNode* parse_expression(CompiContext *ctx);
+
+// Parse an expression and fold it to an integer constant (literals,
+// #define'd constants and arithmetic on them); 0 if it is not one
+int parse_const_expression(CompiContext *ctx, long long *value);
 
 #endif // PARSE_EXPRESSION_H
@@ -5,6 +5,6 @@
 #include "astnode.h"
 #include "token.h"
 
-ASTNode* parse_function(FILE *input, Token return_type, Token func_name);
+ASTNode* parse_function(CompiContext *ctx, Token return_type, Token func_name);
 
 #endif // PARSE_FUNCTION_H
@@ -4,6 +4,14 @@
 #include <stdio.h>
 #include "astnode.h"
 
-ASTNode* parse_statement(FILE *input);
+// Parse one statement, including any nested blocks. With ctx->recover set,
+// an error inside resyncs (see parse_resync) and parsing goes on after it;
+// the statement is then NULL or incomplete.
+ASTNode* parse_statement(CompiContext *ctx);
+
+// Panic-mode resync after an error: skip to just past the next ';', or past
+// a whole '{ ... }' group, or up to (not past) a '}' closing the enclosing
+// block, or EOF
+void parse_resync(CompiContext *ctx);
 
 #endif // PARSE_STATEMENT_H
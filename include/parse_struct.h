@@ -6,6 +6,6 @@
 #include "token.h"
 
 // Parse struct definition: struct Name { ... };
-ASTNode* parse_struct(FILE *input, Token struct_name_tok);
+ASTNode* parse_struct(CompiContext *ctx, Token struct_name_tok);
 
 #endif // PARSE_STRUCT_H
@@ -0,0 +1,34 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include "compi_context.h"
+
+// Headers included during a batch. Each one is read, preprocessed and
+// parsed once; every file that includes it then gets its structs and
+// macros from here. Safe to share between the batch workers.
+typedef struct IncludeCache IncludeCache;
+
+// NULL when out of memory
+IncludeCache* include_cache_new(void);
+void include_cache_free(IncludeCache *cache);
+
+// Resolved paths of the headers in the cache (index < include_cache_count),
+// e.g. to watch them for changes
+size_t include_cache_count(IncludeCache *cache);
+const char* include_cache_path(IncludeCache *cache, size_t index);
+
+// Built-in preprocessor, run on the loaded source before parsing when it
+// contains a '#'. Handles object-like #define / #undef, #ifdef / #ifndef /
+// #else / #endif, #include "file", #pragma once and #error. A header may
+// only hold struct definitions, macros and includes; it is preprocessed on
+// its own (it does not see the includer's macros, which is what makes it
+// cacheable) and included at most once per file. Directive lines become
+// blank lines and macros are replaced in place, so line numbers do not
+// change; the structs of included headers are registered in ctx.
+//
+// path locates "..." includes (NULL or "-": the current directory).
+// includes may be NULL for a cache private to this call. Errors and
+// warnings are reported like parse errors (ctx->diags).
+void preprocess_source(CompiContext *ctx, const char *path, IncludeCache *includes);
+
+#endif // PREPROCESS_H
@@ -1,16 +1,44 @@
 #ifndef SYMBOL_ARRAYS_H
 #define SYMBOL_ARRAYS_H
 
-// Simple per-function array table info (used for static bounds checking)
+#include <stddef.h>
+#include "symbol_map.h"
+
+typedef struct CompiContext CompiContext;
+
+// One array declaration of the function being parsed (used for static
+// bounds checking)
 typedef struct {
-    char name[64];
-    int size; // number of elements
+    const char *name; // interned (see intern.h)
+    int size;         // number of elements
+    int shadowed;     // Binding of the same name this one hides (-1: none)
+    int depth;        // Block scope depth it was declared at
 } ArrayInfo;
 
-extern ArrayInfo g_arrays[128];
-extern int g_array_count;
+// Growable table with nested block scopes. Bindings are kept in declaration
+// order; the map points each name at its innermost visible binding, and
+// leaving a scope unwinds the bindings made inside it.
+typedef struct {
+    ArrayInfo *items;
+    int count;
+    int capacity;
+    SymbolMap visible;   // name -> index of the visible binding (-1: none)
+    int *scope_starts;   // Binding count when each open scope was entered
+    int depth;           // Open scopes (0: function level)
+    int scope_capacity;
+} ArrayTable;
+
+// Tables live in the CompiContext (ctx->arrays)
+void register_array(CompiContext *ctx, const char *name, int size);
+int find_array_size(const CompiContext *ctx, const char *name);
+int find_array_size_n(const CompiContext *ctx, const char *name, size_t len);
+
+// Block scopes: arrays registered after push_scope are dropped by pop_scope
+void push_scope(CompiContext *ctx);
+void pop_scope(CompiContext *ctx);
 
-void register_array(const char *name, int size);
-int find_array_size(const char *name);
+// Drop every binding and scope (start of a function) / release the memory
+void reset_arrays(CompiContext *ctx);
+void free_arrays(CompiContext *ctx);
 
 #endif // SYMBOL_ARRAYS_H
@@ -0,0 +1,36 @@
+#ifndef SYMBOL_MAP_H
+#define SYMBOL_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hash map from an interned name (compared by pointer) plus a small integer
+// qualifier to an int. Open addressing with linear probing, load <= 1/2,
+// so lookups and inserts are O(1) however many symbols there are. Entries
+// are never deleted; a caller marks a name unbound by storing a negative
+// value (see pop_scope).
+typedef struct {
+    const char *name;      // Interned key (NULL: empty slot)
+    uintptr_t qualifier;   // Second key part (e.g. the struct of a field)
+    int value;
+} SymbolSlot;
+
+typedef struct {
+    SymbolSlot *slots;     // Power-of-two capacity, allocated on first put
+    size_t capacity;
+    size_t count;
+} SymbolMap;
+
+void symbol_map_init(SymbolMap *map);
+void symbol_map_free(SymbolMap *map);
+
+// Forget every entry but keep the table for reuse
+void symbol_map_clear(SymbolMap *map);
+
+// Value stored for (name, qualifier), or -1 when absent
+int symbol_map_get(const SymbolMap *map, const char *name, uintptr_t qualifier);
+
+// Insert or overwrite
+void symbol_map_put(SymbolMap *map, const char *name, uintptr_t qualifier, int value);
+
+#endif // SYMBOL_MAP_H
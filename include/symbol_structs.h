@@ -1,19 +1,44 @@
 #ifndef SYMBOL_STRUCTS_H
 #define SYMBOL_STRUCTS_H
 
-// Struct metadata description
+#include <stddef.h>
+#include "symbol_map.h"
+
+typedef struct CompiContext CompiContext;
+
+// Struct metadata description; names are interned (see intern.h)
+typedef struct {
+    const char *field_name;
+    const char *field_type;
+} StructField;
+
 typedef struct {
-    char name[64];
-    struct { char field_name[64]; char field_type[32]; } fields[32];
+    const char *name;
+    StructField *fields;   // Declaration order
     int field_count;
+    int field_capacity;
 } StructInfo;
 
-// Global struct table (simple flat array for now)
-extern StructInfo g_structs[64];
-extern int g_struct_count;
+// Growable table of struct definitions in source order, with hashed lookup
+// of a struct by name and of a field by (struct, name)
+typedef struct {
+    StructInfo *items;
+    int count;
+    int capacity;
+    SymbolMap by_name;     // name -> first struct with that name
+    SymbolMap fields;      // (field name, struct index) -> field index
+} StructTable;
+
+// Register a struct (name interned in ctx->names) and append its fields;
+// add_struct returns the new struct's index
+int add_struct(CompiContext *ctx, const char *name);
+void add_struct_field(CompiContext *ctx, int struct_index, const char *field_name, const char *field_type);
 
-// Lookup helpers
-int find_struct_index(const char *name);
-const char* struct_field_type(const char *struct_name, const char *field_name);
+// Lookup helpers over ctx->structs
+int find_struct_index(const CompiContext *ctx, const char *name);
+int find_struct_index_n(const CompiContext *ctx, const char *name, size_t len);
+const char* struct_field_type(const CompiContext *ctx, const char *struct_name, const char *field_name);
+void reset_structs(CompiContext *ctx);
+void free_structs(CompiContext *ctx);
 
 #endif // SYMBOL_STRUCTS_H
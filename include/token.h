@@ -1,5 +1,7 @@
 #ifndef TOKEN_H
 #define TOKEN_H
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
@@ -22,26 +24,128 @@ typedef enum {
     TOKEN_EOF
 } TokenType;
 
-// Token structure
+// Keyword codes assigned by the lexer (see src/parser/keyword_table.h)
+typedef enum {
+    KW_NONE,
+    KW_IF,
+    KW_ELSE,
+    KW_WHILE,
+    KW_FOR,
+    KW_RETURN,
+    KW_BREAK,
+    KW_CONTINUE,
+    KW_STRUCT,
+    KW_INT,
+    KW_FLOAT,
+    KW_CHAR,
+    KW_DOUBLE,
+    KW_VOID
+} KeywordKind;
+
+// Operator codes assigned by the lexer; parser and codegen dispatch on these
+typedef enum {
+    OP_NONE,
+    OP_MUL,
+    OP_DIV,
+    OP_ADD,
+    OP_SUB,
+    OP_SHL,
+    OP_SHR,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_BIT_AND,
+    OP_BIT_XOR,
+    OP_BIT_OR,
+    OP_LOG_AND,
+    OP_LOG_OR,
+    OP_ASSIGN,
+    OP_NOT,
+    OP_BIT_NOT,
+    OP_INC,
+    OP_DEC,
+    OP_DOT,
+    OP_OTHER,   // Any other single character
+    OP_COUNT
+} OperatorKind;
+
+// Token structure: a small POD record pointing into the source buffer.
+// The lexeme is not NUL-terminated; materialize it with token_strdup /
+// token_copy or print it with TOKEN_FMT / TOKEN_ARG.
 typedef struct {
     TokenType type;
-    char value[256];
-    int line; // Add this field
+    KeywordKind kw;    // Keyword code (TOKEN_KEYWORD only)
+    OperatorKind op;   // Operator code (TOKEN_OPERATOR only)
+    int line;
+    uint32_t offset;   // Byte offset of the lexeme in the source buffer
+    uint32_t length;   // Lexeme length in bytes
+    const char *text;  // Start of the lexeme (src + offset)
 } Token;
 
-// Current token (shared parsing state - to be moved into ParserContext later)
-extern Token current_token;
+#define TOKEN_FMT "%.*s"
+#define TOKEN_ARG(tok) (int)(tok).length, (tok).text
+
+// Compare token text against a NUL-terminated string
+static inline int token_is(const Token *tok, const char *s) {
+    size_t n = strlen(s);
+    return tok->length == n && memcmp(tok->text, s, n) == 0;
+}
+
+// Heap copy of the token text (caller frees)
+char* token_strdup(const Token *tok);
+
+// Copy token text into buf (truncated to size - 1); returns buf
+char* token_copy(const Token *tok, char *buf, size_t size);
 
 // Keyword check
 int is_keyword(const char *str);
+KeywordKind keyword_lookup(const char *str, size_t len);
+
+// Operator helpers
+OperatorKind operator_from_text(const char *str);
+const char* operator_text(OperatorKind op);
+
+// Token stream of a compilation context (ctx->lexer / ctx->current_token)
+typedef struct CompiContext CompiContext;
+
+// Lookahead/rewind buffer between the lexer and the parser. Tokens are
+// lexed once: peeked tokens wait here until consumed, and while a mark is
+// held consumed tokens are kept so token_reset can replay them. With no
+// marks and nothing peeked the buffer is empty and costs nothing.
+typedef struct {
+    Token *items;
+    size_t count;      // Tokens held
+    size_t pos;        // Next token handed out by get_next_token
+    size_t capacity;
+    int marks;         // Marks not yet reset or released
+} TokenBuffer;
+
+// Saved stream position: the current token plus the buffer index after it
+typedef struct {
+    Token current;
+    size_t pos;
+} TokenMark;
+
+Token get_next_token(CompiContext *ctx);
+
+// Token k places after the current one (k >= 1), lexing it if needed
+Token peek_token(CompiContext *ctx, size_t k);
 
-// Tokenizer function
-Token get_next_token(FILE* input);
+// Every mark must end in exactly one token_reset (rewind) or
+// token_release (keep the current position)
+TokenMark token_mark(CompiContext *ctx);
+void token_reset(CompiContext *ctx, TokenMark mark);
+void token_release(CompiContext *ctx, TokenMark mark);
 
-void advance(FILE *input);
-int match(TokenType type);
-int consume(FILE *input, TokenType type);
+void token_buffer_free(TokenBuffer *tb);
 
-extern int current_line;
+void advance(CompiContext *ctx);
+int match(const CompiContext *ctx, TokenType type);
+int match_kw(const CompiContext *ctx, KeywordKind kw);
+int match_op(const CompiContext *ctx, OperatorKind op);
+int consume(CompiContext *ctx, TokenType type);
 
 #endif // TOKEN_H
\ No newline at end of file
@@ -1,12 +1,31 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
 #include "astnode.h"  // ASTNode definition
 
+// Growable string used to assemble node values without fixed-size buffers
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+void strbuf_append(StrBuf *sb, const char *s, size_t n);
+void strbuf_append_str(StrBuf *sb, const char *s);
+void strbuf_append_token(StrBuf *sb, const Token *tok);
+const char* strbuf_cstr(const StrBuf *sb);
+char* strbuf_detach(StrBuf *sb);
+void strbuf_free(StrBuf *sb);
+
 char* ctype_to_vhdl(const char* ctype);
+char* ctype_to_vhdl_n(const char* ctype, size_t len);
+char* keyword_to_vhdl(KeywordKind kw);
 void print_ast(ASTNode* node, int level);
 int is_number_str(const char *s);
 int is_negative_literal(const char* value);
 int get_precedence(const char *op);
+int operator_precedence(OperatorKind op);
+int operator_is_boolean(OperatorKind op);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <stddef.h>
+
+// Parallel for: run fn(arg, i) for every i in [0, count) on up to jobs
+// threads (the calling thread included). Items are handed out in index
+// order from a shared counter, so slow items do not stall a fixed slice.
+typedef void (*WorkFn)(void *arg, size_t index);
+
+void work_pool_run(int jobs, size_t count, WorkFn fn, void *arg);
+
+// Number of online CPUs (at least 1)
+int work_pool_default_jobs(void);
+
+#endif // WORK_POOL_H
@@ -2,62 +2,1008 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "parse.h"
 #include "codegen_vhdl.h"
+#include "compi_context.h"
+#include "work_pool.h"
+#include "compile_server.h"
+#include "ast_flat.h"
+#include "preprocess.h"
 
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
-int main(int argc, char *argv[]) {
+// One input/output pair; status and reason are filled in by compile_job
+typedef struct {
+    const char *input;
+    const char *output;
+    int failed;
+    const char *reason;   // Static description of the failure
+    int err;              // errno of a failed open/read, 0 otherwise
+    int file_jobs;        // Threads for parsing/generating this one file
+    const char *cache_dir; // Function cache directory (NULL: no cache)
+    int stream;           // Generate and free each function as it is parsed
+    const char *emit_ast; // Also save the AST to this file (NULL: no)
+    int from_ast;         // input is a saved AST: generate without parsing
+    IncludeCache *includes; // Headers shared by the batch (NULL: per file)
+    CompiStats *stats;    // Phase times and counters (NULL: not requested)
+} CompileJob;
+
+typedef struct {
+    CompileJob *items;
+    size_t count;
+    size_t capacity;
+} JobList;
+
+static void print_usage(const char *prog) {
+
+    printf("Usage: %s <input.c> <output.vhdl>      (input '-' reads stdin)\n", prog);
+    printf("       %s --jobs N <input.c> <output.vhdl> [<input.c> <output.vhdl> ...]\n", prog);
+    printf("       %s --jobs N --manifest <file>   (one \"input output\" pair per line)\n", prog);
+    printf("       %s --serve <socket> [--jobs N]   (compile server)\n", prog);
+    printf("       %s --connect <socket> <input.c> <output.vhdl>\n", prog);
+    printf("       %s --connect <socket> --shutdown\n", prog);
+    printf("Options: --cache-dir DIR   reuse the VHDL of unchanged functions across runs\n");
+    printf("         --stream          generate and free each function as soon as it is parsed\n");
+    printf("         --watch           recompile the changed functions whenever the input is saved\n");
+    printf("         --time-report     print the wall time of each phase\n");
+    printf("         --stats           also print token, node, symbol and output counts\n");
+    printf("         --report-json F   write the report as JSON to F ('-' for stdout)\n");
+    printf("AST files: %s --emit-ast <out.cast> <input.c> [<output.vhdl>]   (save the parsed AST)\n", prog);
+    printf("           %s --from-ast <in.cast> <output.vhdl>            (generate without parsing)\n", prog);
+}
+
+static void add_job(JobList *list, const char *input, const char *output) {
+
+    CompileJob *grown = NULL;
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        grown = (CompileJob*)realloc(list->items, list->capacity * sizeof(CompileJob));
+        if (!grown) {
+            perror("Failed to allocate job list");
+            exit(EXIT_FAILURE);
+        }
+        list->items = grown;
+    }
+    memset(&list->items[list->count], 0, sizeof(CompileJob));
+    list->items[list->count].input = input;
+    list->items[list->count].output = output;
+    list->count++;
+}
+
+// Read "input output" pairs, one per line; blank lines and '#' comments are
+// skipped. The returned text backs the job paths and must outlive them.
+static char* read_manifest(const char *path, JobList *list) {
+
+    FILE *f = fopen(path, "r");
+    char *text = NULL;
+    char *line = NULL;
+    char *next = NULL;
+    char *input = NULL;
+    char *output = NULL;
+    long size = 0;
+    int line_no = 0;
+
+    if (!f) {
+        perror("Error opening manifest");
+        exit(EXIT_FAILURE);
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        perror("Error reading manifest");
+        exit(EXIT_FAILURE);
+    }
+    text = (char*)malloc((size_t)size + 1);
+    if (!text) {
+        perror("Failed to allocate manifest");
+        exit(EXIT_FAILURE);
+    }
+    size = (long)fread(text, 1, (size_t)size, f);
+    text[size] = '\0';
+    fclose(f);
+
+    for (line = text; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        line_no++;
+        input = strtok(line, " \t\r");
+        if (!input || input[0] == '#') continue;
+        output = strtok(NULL, " \t\r");
+        if (!output || strtok(NULL, " \t\r")) {
+            printf("Error: %s:%d: expected \"<input.c> <output.vhdl>\"\n", path, line_no);
+            exit(EXIT_FAILURE);
+        }
+        add_job(list, input, output);
+    }
+    return text;
+}
+
+// Charge the time since *mark to a phase and restart the clock
+static void phase_done(CompiStats *stats, CompiPhase phase, double *mark) {
+
+    double now = 0;
+
+    if (!stats) return;
+    now = compi_stats_now_ms();
+    stats->phase_ms[phase] += now - *mark;
+    *mark = now;
+}
+
+// Output of a --stream compile. Codegen runs inside the parse, so its time
+// is summed here and taken out of the parse phase afterwards.
+typedef struct {
+    OutSink sink;
+    CompiStats *stats;
+    double codegen_ms;
+} StreamOutput;
+
+static void stream_item(void *user, CompiContext *ctx, ASTNode *item) {
+
+    StreamOutput *so = (StreamOutput*)user;
+    double start = 0;
+
+    if (so->stats) {
+        compi_stats_count_nodes(so->stats, item);
+        start = compi_stats_now_ms();
+    }
+    generate_vhdl_item(ctx, item, &so->sink);
+    if (so->stats) so->codegen_ms += compi_stats_now_ms() - start;
+}
+
+// Struct and field counts for --stats
+static void count_structs(CompiStats *stats, const CompiContext *ctx) {
+
+    stats->structs = (size_t)ctx->structs.count;
+    for (int s = 0; s < ctx->structs.count; s++) {
+        stats->struct_fields += (size_t)ctx->structs.items[s].field_count;
+    }
+}
+
+// Flatten the tree and save it for a later --from-ast run
+static void save_ast(CompileJob *job, const ASTNode *program) {
+
+    FlatAst flat;
+    FILE *out = NULL;
+    int rc = 0;
+
+    if (flat_ast_build(&flat, program) != 0) {
+        job->failed = 1;
+        job->reason = "AST is too large to save";
+        return;
+    }
+    out = fopen(job->emit_ast, "wb");
+    if (!out) {
+        job->failed = 1;
+        job->reason = "Error opening AST file";
+        job->err = errno;
+        flat_ast_free(&flat);
+        return;
+    }
+    rc = flat_ast_save(&flat, out);
+    if (fclose(out) != 0 || rc != 0) {
+        job->failed = 1;
+        job->reason = "Error writing AST file";
+        job->err = errno;
+    }
+    flat_ast_free(&flat);
+}
+
+// Remove a failed output, unless it is not a regular file (/dev/full, a FIFO)
+static void remove_output(const char *path) {
+
+    struct stat st;
+
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        remove(path);
+    }
+}
+
+// Parse and generate one file in its own context. Parse errors do not stop
+// the run: every error is reported, the functions without errors are still
+// generated, and the job is marked failed. With from_ast the input is a
+// saved AST, which is mapped and generated without parsing; without an
+// output only the AST is saved.
+static void compile_job(CompileJob *job, int quiet) {
 
     FILE *fin = NULL;
     FILE *fout = NULL;
     ASTNode *program = NULL;
+    CompiStats *stats = job->stats;
+    CompiContext ctx;
+    FlatAst flat;
+    StreamOutput stream;
+    double start = stats ? compi_stats_now_ms() : 0;
+    double mark = start;
+    long emitted = 0;
+    int loaded = 0;
+    int io_failed = 0;    // Reading or writing failed: the output is not usable
+    int rc = 0;
 
-    // Check arguments
-    if (argc < 3) {
-        printf("Usage: %s <input.c> <output.vhdl>\n", argv[0]);
-        exit(EXIT_FAILURE);
+    // Open input file ("-" reads the source from stdin)
+    fin = strcmp(job->input, "-") == 0 ? stdin : fopen(job->input, job->from_ast ? "rb" : "r");
+    if (!fin) {
+        job->failed = 1;
+        job->reason = "Error opening input file";
+        job->err = errno;
+        return;
+    }
+
+    // Open output file
+    fout = job->output ? fopen(job->output, "w") : NULL;
+    if (job->output && !fout) {
+        job->failed = 1;
+        job->reason = "Error opening output file";
+        job->err = errno;
+        if (fin != stdin) fclose(fin);
+        return;
+    }
+
+    if (!quiet) printf(job->from_ast ? "Loading AST...\n" : "Parsing input file...\n");
+
+    // The context owns the source, symbol tables and the AST
+    compi_context_init(&ctx);
+    memset(&flat, 0, sizeof(flat));
+    ctx.parse_jobs = job->file_jobs;
+    ctx.codegen_jobs = job->file_jobs;
+    ctx.cache.dir = job->cache_dir;
+    ctx.stats = stats;
+    if (job->from_ast) {
+        // The view is the only pass over the mapped nodes
+        rc = flat_ast_load(&flat, &ctx, fin);
+        if (rc != 0) {
+            job->failed = 1;
+            job->reason = rc == -1 ? "Error reading input file" : "Not an AST file of this compi version";
+            job->err = rc == -1 ? errno : 0;
+            io_failed = 1;
+        } else {
+            program = flat_ast_view(&flat);
+            loaded = 1;
+            phase_done(stats, PHASE_READ, &mark);
+            if (stats) {
+                compi_stats_count_nodes(stats, program);
+                count_structs(stats, &ctx);
+                mark = compi_stats_now_ms();
+            }
+        }
+    } else if (compi_context_load_file(&ctx, fin) != 0) {
+        job->failed = 1;
+        job->reason = "Error reading input file";
+        job->err = errno;
+        io_failed = 1;
+    } else {
+        // Macros and includes; nothing to do for a source without a '#'
+        preprocess_source(&ctx, job->input, job->includes);
+        phase_done(stats, PHASE_READ, &mark);
+        if (stats) {
+            // Lexing is interleaved with parsing, so time it on its own
+            compi_stats_lex(stats, ctx.lexer.src, (size_t)(ctx.lexer.end - ctx.lexer.src));
+            mark = compi_stats_now_ms();
+        }
+        if (job->stream) {
+            // Only the item being parsed is alive; the rest is already written
+            memset(&stream, 0, sizeof(stream));
+            stream.stats = stats;
+            sink_init_file(&stream.sink, fout);
+            generate_vhdl_header(&ctx, &stream.sink);
+            parse_program_stream(&ctx, stream_item, &stream);
+            if (stats) {
+                phase_done(stats, PHASE_PARSE, &mark);
+                stats->phase_ms[PHASE_PARSE] -= stream.codegen_ms;
+                stats->phase_ms[PHASE_CODEGEN] += stream.codegen_ms;
+                count_structs(stats, &ctx);
+            }
+            if (sink_close(&stream.sink) != 0) {
+                job->failed = 1;
+                job->reason = "Error writing output file";
+                job->err = errno;
+                io_failed = 1;
+            }
+            emitted = ftell(fout);
+        } else {
+            // Parse the program and build the AST
+            program = parse_program(&ctx);
+            loaded = 1;
+            phase_done(stats, PHASE_PARSE, &mark);
+            if (stats) {
+                compi_stats_count_nodes(stats, program);
+                count_structs(stats, &ctx);
+                mark = compi_stats_now_ms();
+            }
+            // A tree with errors is not worth saving; the job fails below
+            if (job->emit_ast && program && !ctx.diags.errors) {
+                save_ast(job, program);
+                phase_done(stats, PHASE_WRITE, &mark);
+            }
+        }
+        if (ctx.diags.errors && !job->failed) {
+            job->failed = 1;
+            job->reason = "Parse error";
+        }
+        if (!quiet && ctx.diags.errors) {
+            printf("%zu error%s\n", ctx.diags.errors, ctx.diags.errors == 1 ? "" : "s");
+        }
+    }
+
+    #ifdef DEBUG
+        if (program) print_ast(program, 0); // Print the AST for debugging if -d is passed
+    #endif
+
+    // Generate VHDL code from the AST
+    if (loaded && fout) {
+        if (program) {
+            if (!quiet) printf("Generating VHDL code...\n");
+            if (generate_vhdl(&ctx, program, fout) != 0) {
+                job->failed = 1;
+                job->reason = "Error writing output file";
+                job->err = errno;
+                io_failed = 1;
+            }
+            phase_done(stats, PHASE_CODEGEN, &mark);
+            emitted = ftell(fout);
+            if (!quiet && ctx.cache.dir) {
+                printf("Function cache: %zu reused, %zu regenerated\n", ctx.cache.hits, ctx.cache.misses);
+            }
+        } else {
+            fprintf(fout, "-- VHDL code generation failed\n");
+            fprintf(fout, "-- AST was not generated successfully\n");
+            if (!job->failed) {
+                job->failed = 1;
+                job->reason = "AST was not generated successfully";
+            }
+        }
+    }
+
+    flat_ast_free(&flat);
+    compi_context_free(&ctx);
+    if (fin != stdin) fclose(fin);
+    if (stats) mark = compi_stats_now_ms();
+    if (fout && fclose(fout) != 0) {
+        job->failed = 1;
+        job->reason = "Error writing output file";
+        job->err = errno;
+        io_failed = 1;
+    }
+    if (stats) {
+        phase_done(stats, PHASE_WRITE, &mark);
+        stats->bytes_emitted = emitted > 0 ? (size_t)emitted : 0;
+        stats->total_ms = mark - start;
+    }
+    // Parse errors keep the VHDL of the functions without errors (the job
+    // still fails); a truncated or empty output is removed, in every mode
+    if (io_failed && job->output) {
+        remove_output(job->output);
     }
+}
+
+static void compile_job_at(void *arg, size_t index) {
+    compile_job(&((JobList*)arg)->items[index], 1);
+}
+
+static double now_seconds(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Compile every job on a worker pool, then report failures and a summary
+static int run_batch(JobList *list, int jobs) {
+
+    double start = now_seconds();
+    IncludeCache *includes = include_cache_new();
+    size_t failed = 0;
+    size_t i = 0;
+
+    if (jobs <= 0) {
+        jobs = work_pool_default_jobs();
+    }
+    // Threads left over when there are fewer files than jobs parse
+    // and generate the functions of each file in parallel. A header
+    // included by many files is read and parsed once for all of them.
+    for (i = 0; i < list->count; i++) {
+        list->items[i].file_jobs = list->count < (size_t)jobs ? jobs / (int)list->count : 1;
+        list->items[i].includes = includes;
+    }
+    work_pool_run(jobs, list->count, compile_job_at, list);
+    include_cache_free(includes);
+
+    for (i = 0; i < list->count; i++) {
+        if (!list->items[i].failed) continue;
+        failed++;
+        if (list->items[i].err) {
+            fprintf(stderr, "compi: %s: %s: %s\n", list->items[i].input, list->items[i].reason, strerror(list->items[i].err));
+        } else {
+            fprintf(stderr, "compi: %s: %s\n", list->items[i].input, list->items[i].reason);
+        }
+    }
+    printf("Compiled %zu of %zu files (%zu failed) in %.3f s with %d jobs\n",
+           list->count - failed, list->count, failed, now_seconds() - start, jobs);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Report levels for --time-report and --stats
+enum { REPORT_NONE, REPORT_TIME, REPORT_STATS };
+
+// Report of each compiled file, as text on stdout and/or as JSON
+static int print_reports(const CompileJob *items, size_t count, int report, const char *json_path) {
+
+    FILE *out = NULL;
+    size_t k = 0;
+
+    for (k = 0; k < count && report != REPORT_NONE; k++) {
+        if (count > 1) printf("%s:\n", items[k].input);
+        compi_stats_print(items[k].stats, stdout, report == REPORT_STATS);
+    }
+    if (!json_path) return 0;
+
+    out = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+    if (!out) {
+        perror("Error opening JSON report");
+        return -1;
+    }
+    fprintf(out, "{\"files\": [");
+    for (k = 0; k < count; k++) {
+        fprintf(out, k ? ",\n  " : "\n  ");
+        compi_stats_print_json(items[k].stats, out, 1, items[k].input, items[k].output, !items[k].failed);
+    }
+    fprintf(out, "\n], \"peak_rss_kb\": %ld}\n", compi_stats_peak_rss_kb());
+    if (out != stdout && fclose(out) != 0) {
+        perror("Error writing JSON report");
+        return -1;
+    }
+    return 0;
+}
+
+// Read a whole stream (the client sends the source itself, so '-' works)
+static char* read_source(FILE *in, size_t *len) {
 
-    // Open input file
-    fin = fopen(argv[1], "r");
+    size_t cap = 64 * 1024;
+    size_t n = 0;
+    char *text = (char*)malloc(cap);
+    char *grown = NULL;
+
+    while (text) {
+        n += fread(text + n, 1, cap - n, in);
+        if (n < cap) break;
+        cap *= 2;
+        grown = (char*)realloc(text, cap);
+        if (!grown) free(text);
+        text = grown;
+    }
+    if (!text || ferror(in)) {
+        free(text);
+        return NULL;
+    }
+    *len = n;
+    return text;
+}
+
+// Thin client: hand one file to a compile server and write its reply
+static int run_client(const char *socket_path, const char *input, const char *output, int jobs, const char *cache_dir) {
+
+    CompileRequest req;
+    CompileReply reply;
+    FILE *fin = NULL;
+    FILE *fout = NULL;
+    char *source = NULL;
+    char base[PATH_MAX + 2];
+    size_t len = 0;
+    int fd = -1;
+    int rc = 0;
+
+    fin = strcmp(input, "-") == 0 ? stdin : fopen(input, "r");
     if (!fin) {
         perror("Error opening input file");
-        exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
+    }
+    source = read_source(fin, &len);
+    if (fin != stdin) fclose(fin);
+    if (!source) {
+        perror("Error reading input file");
+        return EXIT_FAILURE;
     }
 
-    // Open output file
-    fout = fopen(argv[2], "w");
+    fd = compile_client_connect(socket_path);
+    if (fd < 0) {
+        perror("Error connecting to compile server");
+        free(source);
+        return EXIT_FAILURE;
+    }
+    memset(&req, 0, sizeof(req));
+    req.source = source;
+    req.len = len;
+    req.jobs = jobs;
+    req.cache_dir = cache_dir;
+    // The server resolves #include "..." next to this path, as compi would:
+    // the input's absolute path, or a name in the current directory for stdin
+    if (strcmp(input, "-") == 0 ? getcwd(base, PATH_MAX) && strcat(base, "/-")
+                                : realpath(input, base) != NULL) {
+        req.path = base;
+    }
+    rc = compile_client_request(fd, &req, &reply);
+    close(fd);
+    free(source);
+    if (rc != 0) {
+        printf("Error: no reply from compile server\n");
+        return EXIT_FAILURE;
+    }
+    if (!reply.ok) {
+        printf("%s", reply.text);
+        free(reply.text);
+        return EXIT_FAILURE;
+    }
+
+    fout = fopen(output, "w");
     if (!fout) {
         perror("Error opening output file");
-        fclose(fin);
-        exit(EXIT_FAILURE);
+        free(reply.text);
+        return EXIT_FAILURE;
     }
+    rc = fwrite(reply.text, 1, reply.len, fout) == reply.len;
+    if (fclose(fout) != 0 || !rc) {
+        perror("Error writing output file");
+        free(reply.text);
+        return EXIT_FAILURE;
+    }
+    free(reply.text);
+    return EXIT_SUCCESS;
+}
 
-    printf("Parsing input file...\n");
+// State kept by --watch between compilations
+typedef struct {
+    char *source;         // Input of the last compilation (the tree points into it)
+    char *vhdl;           // Last output written
+    size_t vhdl_len;
+    IncludeCache *includes; // Headers of the last compilation (also watched)
+} WatchState;
 
-    // Parse the program and build the AST
-    program = parse_program(fin);
+// Write text to path through a temporary file and a rename, so readers of
+// the output never see it half written
+static int replace_file(const char *path, const char *text, size_t len) {
 
-    #ifdef DEBUG
-        print_ast(program, 0); // Print the AST for debugging if -d is passed
-    #endif
+    char tmp[4096];
+    FILE *f = NULL;
+    int ok = 0;
 
-    // Generate VHDL code from the AST
-    if (program) {
-        printf("Generating VHDL code...\n");
-        generate_vhdl(program, fout);
-        free_node(program);
+    snprintf(tmp, sizeof(tmp), "%s.compi-tmp", path);
+    f = fopen(tmp, "w");
+    if (!f) return -1;
+    ok = fwrite(text, 1, len, f) == len;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// One --watch compilation on the warm context. Functions found in the
+// memo are neither parsed nor generated; the output is only replaced when
+// the compile has no errors and its text changed.
+static void watch_compile(CompiContext *ctx, WatchState *state, const char *input, const char *output) {
+
+    double start = now_seconds();
+    FILE *fin = NULL;
+    ASTNode *program = NULL;
+    OutSink out;
+    char *source = NULL;
+    char *vhdl = NULL;
+    size_t len = 0;
+    size_t vhdl_len = 0;
+
+    fin = fopen(input, "r");
+    if (!fin) {
+        perror("Error opening input file");
+        return;
+    }
+    // Read rather than mapped: the editor may truncate the file at any time
+    source = read_source(fin, &len);
+    fclose(fin);
+    if (!source) {
+        perror("Error reading input file");
+        return;
+    }
+    compi_context_reset(ctx);
+    free(state->source);
+    state->source = source;
+    compi_context_load_buffer(ctx, source, len);
+    // Headers are read again on every compile; run_watch watches the ones
+    // listed in state->includes, so saving a header recompiles too
+    include_cache_free(state->includes);
+    state->includes = include_cache_new();
+    preprocess_source(ctx, input, state->includes);
+    program = parse_program(ctx);
+    if (!ctx->diags.errors) {
+        sink_init_memory(&out);
+        generate_vhdl_sink(ctx, program, &out);
+        vhdl = sink_take(&out, &vhdl_len);
+        sink_close(&out);
+    }
+    func_memo_sweep(ctx->cache.memory);
+
+    if (ctx->diags.errors) {
+        printf("%zu error%s; %s not updated\n", ctx->diags.errors, ctx->diags.errors == 1 ? "" : "s", output);
+    } else if (!vhdl) {
+        printf("Error: out of memory generating %s\n", output);
+    } else if (state->vhdl && vhdl_len == state->vhdl_len && memcmp(vhdl, state->vhdl, vhdl_len) == 0) {
+        free(vhdl);
+    } else if (replace_file(output, vhdl, vhdl_len) != 0) {
+        perror("Error writing output file");
+        free(vhdl);
+    } else {
+        free(state->vhdl);
+        state->vhdl = vhdl;
+        state->vhdl_len = vhdl_len;
+    }
+    printf("%s: %zu of %zu functions regenerated in %.1f ms\n", input, ctx->cache.misses,
+           ctx->cache.hits + ctx->cache.misses, (now_seconds() - start) * 1e3);
+    fflush(stdout);
+}
+
+// Milliseconds without further events before a change is compiled;
+// editors often save in several writes
+#define WATCH_SETTLE_MS 20
+
+// compi --watch: compile, then compile again after every change to input
+// until interrupted. The directory is watched rather than the file, since
+// many editors save by renaming a new file over the old one.
+#ifdef __linux__
+// Directories watched by run_watch, by inotify watch descriptor
+typedef struct {
+    int *wds;
+    char **dirs;          // Resolved paths
+    size_t count;
+} WatchDirs;
+
+// Watch the directory of path (already resolved); 0 on success
+static int watch_dir_of(int fd, WatchDirs *dirs, const char *path) {
+
+    const char *slash = strrchr(path, '/');
+    char dir[PATH_MAX];
+    int *wds = NULL;
+    char **names = NULL;
+    size_t k = 0;
+    int wd = -1;
+
+    snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) return -1;
+    for (k = 0; k < dirs->count; k++) {
+        if (dirs->wds[k] == wd) return 0;
+    }
+    wds = (int*)realloc(dirs->wds, (dirs->count + 1) * sizeof(int));
+    if (wds) dirs->wds = wds;
+    names = (char**)realloc(dirs->dirs, (dirs->count + 1) * sizeof(char*));
+    if (names) dirs->dirs = names;
+    if (!wds || !names || !(dirs->dirs[dirs->count] = strdup(dir))) return -1;
+    dirs->wds[dirs->count++] = wd;
+    return 0;
+}
+
+// Whether an event names the input or one of its headers
+static int watch_event_matches(const WatchDirs *dirs, const struct inotify_event *ev,
+                               const char *input, IncludeCache *includes) {
+
+    char path[PATH_MAX];
+    size_t count = includes ? include_cache_count(includes) : 0;
+    size_t k = 0;
+
+    if (!ev->len) return 0;
+    for (k = 0; k < dirs->count && dirs->wds[k] != ev->wd; k++) {}
+    if (k == dirs->count) return 0;
+    snprintf(path, sizeof(path), "%s/%s", strcmp(dirs->dirs[k], "/") == 0 ? "" : dirs->dirs[k], ev->name);
+    if (strcmp(path, input) == 0) return 1;
+    for (k = 0; k < count; k++) {
+        if (strcmp(path, include_cache_path(includes, k)) == 0) return 1;
+    }
+    return 0;
+}
+
+// Add watches for the headers of the last compilation
+static void watch_headers(int fd, WatchDirs *dirs, IncludeCache *includes) {
+
+    size_t count = includes ? include_cache_count(includes) : 0;
+    size_t k = 0;
+
+    for (k = 0; k < count; k++) {
+        if (watch_dir_of(fd, dirs, include_cache_path(includes, k)) != 0) {
+            fprintf(stderr, "compi: %s: cannot watch for changes\n", include_cache_path(includes, k));
+        }
+    }
+}
+#endif
+
+static int run_watch(const char *input, const char *output, int jobs) {
+
+#ifdef __linux__
+    CompiContext ctx;
+    FuncMemo memo;
+    WatchState state;
+    struct pollfd pfd;
+    char events[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev = NULL;
+    const char *slash = strrchr(input, '/');
+    const char *name = slash ? slash + 1 : input;
+    WatchDirs dirs;
+    char dir[PATH_MAX];
+    char real_dir[PATH_MAX];
+    char input_path[PATH_MAX];   // Resolved, to compare with event paths
+    ssize_t n = 0;
+    ssize_t k = 0;
+    size_t d = 0;
+    int changed = 0;
+    int fd = -1;
+
+    // The input may be replaced by a rename, so its directory is resolved
+    // rather than the file itself
+    if (slash) {
+        snprintf(dir, sizeof(dir), "%.*s", slash == input ? 1 : (int)(slash - input), input);
     } else {
-        fprintf(fout, "-- VHDL code generation failed\n");
-        fprintf(fout, "-- AST was not generated successfully\n");
-        fclose(fin);
-        fclose(fout);
+        snprintf(dir, sizeof(dir), ".");
+    }
+    memset(&dirs, 0, sizeof(dirs));
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || !realpath(dir, real_dir) ||
+        snprintf(input_path, sizeof(input_path), "%s/%s", strcmp(real_dir, "/") == 0 ? "" : real_dir, name) >= (int)sizeof(input_path) ||
+        watch_dir_of(fd, &dirs, input_path) != 0) {
+        perror("Error watching input file");
+        return EXIT_FAILURE;
+    }
+
+    compi_context_init(&ctx);
+    func_memo_init(&memo);
+    memset(&state, 0, sizeof(state));
+    ctx.parse_jobs = jobs;
+    ctx.codegen_jobs = jobs;
+    ctx.cache.memory = &memo;
+    watch_compile(&ctx, &state, input, output);
+    watch_headers(fd, &dirs, state.includes);
+    printf("Watching %s (Ctrl-C to stop)\n", input);
+    fflush(stdout);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        n = read(fd, events, sizeof(events));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("Error watching input file");
+            break;
+        }
+        changed = 0;
+        do {
+            for (k = 0; k < n; k += (ssize_t)(sizeof(struct inotify_event) + ev->len)) {
+                ev = (const struct inotify_event*)(events + k);
+                if (watch_event_matches(&dirs, ev, input_path, state.includes)) changed = 1;
+            }
+        } while (poll(&pfd, 1, WATCH_SETTLE_MS) > 0 && (n = read(fd, events, sizeof(events))) > 0);
+        if (changed) {
+            watch_compile(&ctx, &state, input, output);
+            watch_headers(fd, &dirs, state.includes);
+        }
+    }
+
+    close(fd);
+    for (d = 0; d < dirs.count; d++) {
+        free(dirs.dirs[d]);
+    }
+    free(dirs.dirs);
+    free(dirs.wds);
+    include_cache_free(state.includes);
+    compi_context_free(&ctx);
+    func_memo_free(&memo);
+    free(state.source);
+    free(state.vhdl);
+    return EXIT_FAILURE;
+#else
+    (void)input;
+    (void)output;
+    (void)jobs;
+    printf("Error: --watch needs inotify (Linux)\n");
+    return EXIT_FAILURE;
+#endif
+}
+
+int main(int argc, char *argv[]) {
+
+    JobList list = {0};
+    CompileJob single;
+    const char *manifest = NULL;
+    const char *cache_dir = NULL;
+    const char *serve_path = NULL;
+    const char *connect_path = NULL;
+    const char *json_path = NULL;
+    const char *emit_ast = NULL;
+    const char *from_ast = NULL;
+    CompiStats *stats = NULL;
+    char *manifest_text = NULL;
+    char *end = NULL;
+    int batch = 0;
+    int stop_server = 0;
+    int stream = 0;
+    int watch = 0;
+    int report = REPORT_NONE;
+    int jobs = 0;
+    int status = EXIT_SUCCESS;
+    size_t k = 0;
+    int i = 1;
+
+    // Options: --jobs N, --manifest FILE, --cache-dir DIR, --stream, --watch,
+    // --serve SOCKET, --connect SOCKET, --shutdown, --time-report, --stats,
+    // --report-json F, --emit-ast F, --from-ast F;
+    // the rest are input/output pairs
+    while (i < argc && strncmp(argv[i], "--", 2) == 0) {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = (int)strtol(argv[i + 1], &end, 10);
+            if (*end != '\0' || jobs < 0) {
+                printf("Error: invalid job count '%s'\n", argv[i + 1]);
+                exit(EXIT_FAILURE);
+            }
+            batch = 1;
+            i += 2;
+        } else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            manifest = argv[i + 1];
+            batch = 1;
+            i += 2;
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            cache_dir = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+            i++;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = 1;
+            i++;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connect_path = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--shutdown") == 0) {
+            stop_server = 1;
+            i++;
+        } else if (strcmp(argv[i], "--time-report") == 0) {
+            if (report < REPORT_TIME) report = REPORT_TIME;
+            i++;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            report = REPORT_STATS;
+            i++;
+        } else if (strcmp(argv[i], "--report-json") == 0 && i + 1 < argc) {
+            json_path = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--emit-ast") == 0 && i + 1 < argc) {
+            emit_ast = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--from-ast") == 0 && i + 1 < argc) {
+            from_ast = argv[i + 1];
+            i += 2;
+        } else {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Server and client modes
+    if (serve_path && i == argc) {
+        exit(compile_server_run(serve_path, jobs) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (connect_path && stop_server && i == argc) {
+        if (compile_client_shutdown(connect_path) != 0) {
+            perror("Error stopping compile server");
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
+    }
+    if (connect_path && !stop_server && argc - i == 2) {
+        exit(run_client(connect_path, argv[i], argv[i + 1], jobs, cache_dir));
+    }
+    if (serve_path || connect_path || stop_server) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    // Streaming parses serially and keeps no tree for the cache to reuse
+    if (stream && cache_dir) {
+        printf("Error: --stream cannot be combined with --cache-dir\n");
         exit(EXIT_FAILURE);
     }
 
-    fclose(fin);
-    fclose(fout);
+    // Watch mode: one input/output pair, recompiled until interrupted
+    if (watch) {
+        if (stream || manifest || cache_dir || emit_ast || from_ast || argc - i != 2) {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        exit(run_watch(argv[i], argv[i + 1], !batch ? 1 : jobs > 0 ? jobs : work_pool_default_jobs()));
+    }
+
+    // AST files: one input (and an optional output for --emit-ast)
+    memset(&single, 0, sizeof(single));
+    if (emit_ast || from_ast) {
+        if ((emit_ast && from_ast) || stream || manifest ||
+            (emit_ast && argc - i != 1 && argc - i != 2) || (from_ast && argc - i != 1)) {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        single.input = from_ast ? from_ast : argv[i];
+        single.output = from_ast ? argv[i] : (argc - i == 2 ? argv[i + 1] : NULL);
+        single.emit_ast = emit_ast;
+        single.from_ast = from_ast != NULL;
+        single.file_jobs = !batch ? 1 : jobs > 0 ? jobs : work_pool_default_jobs();
+    }
 
-    printf("Compilation finished.\n");
-    exit(EXIT_SUCCESS);
+    // Check arguments
+    if (!single.input && ((argc - i) % 2 != 0 || (!manifest && argc - i < 2))) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (single.input || (!batch && argc - i == 2)) {
+        if (!single.input) {
+            single.input = argv[i];
+            single.output = argv[i + 1];
+            single.stream = stream;
+        }
+        single.cache_dir = cache_dir;
+        if (report != REPORT_NONE || json_path) {
+            stats = (CompiStats*)malloc(sizeof(CompiStats));
+            if (!stats) {
+                perror("Failed to allocate stats");
+                exit(EXIT_FAILURE);
+            }
+            compi_stats_init(stats);
+            single.stats = stats;
+        }
+        compile_job(&single, 0);
+        if (single.failed) {
+            if (single.err) {
+                errno = single.err;
+                perror(single.reason);
+            } else if (single.emit_ast || single.from_ast) {
+                fprintf(stderr, "compi: %s: %s\n", single.input, single.reason);
+            }
+            exit(EXIT_FAILURE);
+        }
+        printf("Compilation finished.\n");
+        if (stats && print_reports(&single, 1, report, json_path) != 0) {
+            status = EXIT_FAILURE;
+        }
+        free(stats);
+        exit(status);
+    }
+
+    if (manifest) {
+        manifest_text = read_manifest(manifest, &list);
+    }
+    for (; i + 1 < argc; i += 2) {
+        add_job(&list, argv[i], argv[i + 1]);
+    }
+    if (report != REPORT_NONE || json_path) {
+        stats = (CompiStats*)calloc(list.count ? list.count : 1, sizeof(CompiStats));
+        if (!stats) {
+            perror("Failed to allocate stats");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (k = 0; k < list.count; k++) {
+        list.items[k].cache_dir = cache_dir;
+        list.items[k].stream = stream;
+        list.items[k].stats = stats ? &stats[k] : NULL;
+    }
+    status = run_batch(&list, jobs);
+    if (stats && print_reports(list.items, list.count, report, json_path) != 0) {
+        status = EXIT_FAILURE;
+    }
+    free(stats);
+    free(list.items);
+    free(manifest_text);
+    exit(status);
 }
@@ -21,104 +21,311 @@
 #include <ctype.h>
 
 #include "codegen_vhdl.h"      // ASTNode definition and external helpers
-#include "symbol_structs.h"     // g_structs / g_struct_count
+#include "compi_context.h"      // ctx->structs
+#include "symbol_structs.h"
 #include "symbol_arrays.h"
 #include "utils.h"              // is_negative_literal
 #include "parse_expression.h"   // ctype_to_vhdl, etc.
+#include "work_pool.h"
+#include "out_sink.h"              // All output goes through the append buffer
+#include "func_cache.h"
+
+// -------------------------------------------------------------
+// Work stack
+// -------------------------------------------------------------
+// Generators do not recurse into child nodes. They queue the children, and
+// the text that goes between them, on an explicit stack that gen_node
+// drains, so the C stack stays flat however deeply the tree nests. Items
+// are queued in output order and gen_node reverses each generator's batch.
+// Until a generator queues its first item, text and leaf expressions are
+// written straight to the sink instead.
+typedef enum {
+    GEN_NODE,             // Generate node
+    GEN_STATEMENT_ITEM,   // Generate node as a child of the statement stmt
+    GEN_TEXT              // Write text (which must outlive the generation)
+} GenKind;
+
+typedef struct {
+    GenKind kind;
+    ASTNode *node;
+    ASTNode *stmt;
+    const char *text;
+    size_t len;
+} GenItem;
+
+typedef struct {
+    GenItem *items;
+    size_t count;
+    size_t capacity;
+    size_t mark;          // Start of the running generator's batch
+    OutSink *out;
+} GenStack;
+
+static void gen_expression(ASTNode *node, OutSink *out);
+
+static void defer_item(GenStack *work, GenItem item) {
+
+    GenItem *grown = NULL;
+
+    if (work->count == work->capacity) {
+        work->capacity = work->capacity ? work->capacity * 2 : 64;
+        grown = (GenItem*)realloc(work->items, work->capacity * sizeof(GenItem));
+        if (!grown) {
+            perror("Failed to allocate codegen work stack");
+            exit(EXIT_FAILURE);
+        }
+        work->items = grown;
+    }
+    work->items[work->count++] = item;
+}
+
+static void defer_node(GenStack *work, ASTNode *node) {
+
+    if (!node) return;
+    if (node->type == NODE_EXPRESSION && work->count == work->mark) {
+        gen_expression(node, work->out);
+        return;
+    }
+    defer_item(work, (GenItem){ GEN_NODE, node, NULL, NULL, 0 });
+}
+
+static void defer_write(GenStack *work, const char *text, size_t len) {
+
+    if (work->count == work->mark) {
+        sink_write(work->out, text, len);
+        return;
+    }
+    defer_item(work, (GenItem){ GEN_TEXT, NULL, NULL, text, len });
+}
+
+// Same NULL handling as sink_puts
+static void defer_puts(GenStack *work, const char *text) {
+
+    if (!text) text = "(null)";
+    defer_write(work, text, strlen(text));
+}
+
+#define defer_lit(work, lit) defer_write((work), "" lit, sizeof(lit) - 1)
 
 // -------------------------------------------------------------
 // Forward declarations of internal helpers
 // -------------------------------------------------------------
-static void gen_node(ASTNode *node, FILE *out);
-static void gen_program(ASTNode *node, FILE *out);
-static void gen_function(ASTNode *node, FILE *out);
-static void gen_statement(ASTNode *node, FILE *out);
-static void gen_while(ASTNode *node, FILE *out);
-static void gen_for(ASTNode *node, FILE *out);
-static void gen_if(ASTNode *node, FILE *out);
-static void gen_break(ASTNode *node, FILE *out);
-static void gen_continue(ASTNode *node, FILE *out);
-static void gen_binary_expr(ASTNode *node, FILE *out);
-static void gen_expression(ASTNode *node, FILE *out);
-static void gen_unary_op(ASTNode *node, FILE *out);
+static void gen_node(CompiContext *ctx, ASTNode *node, OutSink *out);
+static void gen_program(CompiContext *ctx, ASTNode *node, OutSink *out, GenStack *work);
+static void gen_children_parallel(CompiContext *ctx, ASTNode *node, OutSink *out);
+static void gen_function(CompiContext *ctx, ASTNode *node, OutSink *out, GenStack *work);
+static void gen_statement(ASTNode *node, GenStack *work);
+static void gen_statement_item(CompiContext *ctx, ASTNode *node, ASTNode *child, OutSink *out, GenStack *work);
+static void gen_while(ASTNode *node, GenStack *work);
+static void gen_for(ASTNode *node, GenStack *work);
+static void gen_if(ASTNode *node, GenStack *work);
+static void gen_break(ASTNode *node, OutSink *out);
+static void gen_continue(ASTNode *node, OutSink *out);
+static void gen_binary_expr(ASTNode *node, GenStack *work);
+static void gen_unary_op(ASTNode *node, GenStack *work);
+static void gen_index(ASTNode *node, GenStack *work);
+static void gen_member(ASTNode *node, GenStack *work);
 
 // Utility sub-helpers
-static int  is_bool_comparison(const char *op);
 static int  node_is_boolean(ASTNode *node);
-static void emit_initializer(ASTNode *decl, FILE *out, const char *indent);
-static void emit_assignment(ASTNode *assign, FILE *out, const char *indent);
-static void emit_array_element(const char *value, FILE *out);
-static void emit_condition(ASTNode *cond, FILE *out);
-static void emit_boolean_gate(ASTNode *left, ASTNode *right, const char *logical, FILE *out);
-static void emit_struct_declarations(FILE *out);
-static void emit_local_signals(ASTNode *function_decl, FILE *out);
-static void emit_struct_return_copy(ASTNode *expr, ASTNode *function_stmt_node, FILE *out, const char *indent);
+static void emit_initializer(ASTNode *decl, GenStack *work, const char *indent);
+static void emit_assignment(ASTNode *assign, GenStack *work, const char *indent);
+static void emit_condition(ASTNode *cond, GenStack *work);
+static void emit_boolean_gate(ASTNode *left, ASTNode *right, const char *logical, GenStack *work);
+static void emit_struct_declaration(const StructInfo *si, OutSink *out);
+static void emit_struct_declarations(CompiContext *ctx, OutSink *out);
+static void emit_local_signals(CompiContext *ctx, ASTNode *function_decl, OutSink *out);
+static void emit_struct_return_copy(CompiContext *ctx, ASTNode *expr, ASTNode *function_stmt_node, OutSink *out, const char *indent);
+static void emit_signed_literal(OutSink *out, const char *value);
+static void defer_signed_literal(GenStack *work, const char *value);
+static void defer_unsigned_operand(GenStack *work, const char *value);
+static void emit_field_assignment(OutSink *out, const char *var, const char *field, const char *val);
+static void emit_signal(OutSink *out, const char *prefix, const char *name, const char *type);
+
+// Type names live in node tokens, which point into the source buffer
+static inline int token_struct_index(const CompiContext *ctx, const Token *tok) { return find_struct_index_n(ctx, tok->text, tok->length); }
+static inline const char* token_vhdl_type(const Token *tok) { return keyword_to_vhdl(tok->kw); }
 
 // -------------------------------------------------------------
 // Public entry point
 // -------------------------------------------------------------
-void generate_vhdl(ASTNode *root, FILE *out) {
-    gen_node(root, out);
+int generate_vhdl(CompiContext *ctx, ASTNode *root, FILE *out) {
+
+    OutSink sink;
+    int rc = 0;
+
+    sink_init_file(&sink, out);
+    rc = generate_vhdl_sink(ctx, root, &sink);
+    if (sink_close(&sink) != 0) rc = -1;
+    return rc;
+}
+
+int generate_vhdl_sink(CompiContext *ctx, ASTNode *root, OutSink *out) {
+    gen_node(ctx, root, out);
+    return out->error ? -1 : 0;
+}
+
+void generate_vhdl_header(CompiContext *ctx, OutSink *out) {
+
+    sink_lit(out, "-- VHDL generated by compi (readable variant)\n\n");
+    sink_lit(out, "library IEEE;\n");
+    sink_lit(out, "use IEEE.STD_LOGIC_1164.ALL;\n");
+    sink_lit(out, "use IEEE.NUMERIC_STD.ALL;\n\n");
+    emit_struct_declarations(ctx, out);
+}
+
+void generate_vhdl_item(CompiContext *ctx, ASTNode *item, OutSink *out) {
+
+    int s = 0;
+
+    if (item->type != NODE_STRUCT_DECL) {
+        gen_node(ctx, item, out);
+        return;
+    }
+    s = find_struct_index_n(ctx, item->value, strlen(item->value));
+    if (s >= 0) emit_struct_declaration(&ctx->structs.items[s], out);
 }
 
 // -------------------------------------------------------------
 // Dispatch
 // -------------------------------------------------------------
-static void gen_node(ASTNode *node, FILE *out) {
-
-    if (!node) return;
+static void gen_dispatch(CompiContext *ctx, ASTNode *node, OutSink *out, GenStack *work) {
 
     switch (node->type) {
-        case NODE_PROGRAM:          gen_program(node, out); break;
-        case NODE_FUNCTION_DECL:    gen_function(node, out); break;
-        case NODE_STATEMENT:        gen_statement(node, out); break;
-        case NODE_WHILE_STATEMENT:  gen_while(node, out); break;
-        case NODE_FOR_STATEMENT:    gen_for(node, out); break;
-        case NODE_IF_STATEMENT:     gen_if(node, out); break;
+        case NODE_PROGRAM:          gen_program(ctx, node, out, work); break;
+        case NODE_FUNCTION_DECL:    gen_function(ctx, node, out, work); break;
+        case NODE_STATEMENT:        gen_statement(node, work); break;
+        case NODE_WHILE_STATEMENT:  gen_while(node, work); break;
+        case NODE_FOR_STATEMENT:    gen_for(node, work); break;
+        case NODE_IF_STATEMENT:     gen_if(node, work); break;
         case NODE_BREAK_STATEMENT:  gen_break(node, out); break;
         case NODE_CONTINUE_STATEMENT: gen_continue(node, out); break;
-        case NODE_BINARY_EXPR:      gen_binary_expr(node, out); break;
-        case NODE_BINARY_OP:        gen_unary_op(node, out); break; // unary ops live in BINARY_OP nodes in original parser
+        case NODE_BINARY_EXPR:      gen_binary_expr(node, work); break;
+        case NODE_BINARY_OP:        gen_unary_op(node, work); break; // unary ops live in BINARY_OP nodes in original parser
         case NODE_EXPRESSION:       gen_expression(node, out); break;
+        case NODE_INDEX:            gen_index(node, work); break;
+        case NODE_MEMBER:           gen_member(node, work); break;
+        case NODE_CACHED_FUNCTION:  sink_puts(out, node->value); break;
         default: /* intentionally ignored */ break;
     }
 }
 
+// Generate node and everything below it
+static void gen_node(CompiContext *ctx, ASTNode *node, OutSink *out) {
+
+    GenStack work = {0};
+    GenItem item;
+    GenItem swap;
+    size_t lo = 0;
+    size_t hi = 0;
+
+    if (!node) return;
+    work.out = out;
+    defer_item(&work, (GenItem){ GEN_NODE, node, NULL, NULL, 0 });
+    while (work.count > 0) {
+        item = work.items[--work.count];
+        work.mark = work.count;
+        switch (item.kind) {
+            case GEN_NODE:           gen_dispatch(ctx, item.node, out, &work); break;
+            case GEN_STATEMENT_ITEM: gen_statement_item(ctx, item.stmt, item.node, out, &work); break;
+            case GEN_TEXT:           sink_write(out, item.text, item.len); break;
+        }
+        // The batch was queued in output order; the stack pops from the end
+        for (lo = work.mark, hi = work.count; hi > lo + 1; lo++, hi--) {
+            swap = work.items[lo];
+            work.items[lo] = work.items[hi - 1];
+            work.items[hi - 1] = swap;
+        }
+    }
+    free(work.items);
+}
+
 // -------------------------------------------------------------
 // Program (top-level)
 // -------------------------------------------------------------
-static void gen_program(ASTNode *node, FILE *out) {
+static void gen_program(CompiContext *ctx, ASTNode *node, OutSink *out, GenStack *work) {
 
     int i;
 
-    fprintf(out, "-- VHDL generated by compi (readable variant)\n\n");
-    fprintf(out, "library IEEE;\n");
-    fprintf(out, "use IEEE.STD_LOGIC_1164.ALL;\n");
-    fprintf(out, "use IEEE.NUMERIC_STD.ALL;\n\n");
-
-    emit_struct_declarations(out);
+    generate_vhdl_header(ctx, out);
 
+    // The cache needs each function's text on its own, as the buffered path has it
+    if (ctx->cache.keys || (ctx->codegen_jobs > 1 && node->num_children > 1)) {
+        gen_children_parallel(ctx, node, out);
+        return;
+    }
     for (i = 0; i < node->num_children; ++i) {
-        gen_node(node->children[i], out);
+        defer_node(work, node->children[i]);
+    }
+
+}
+
+// Top-level items generated on workers, one memory sink each. Generation
+// only reads the tree and the struct table, so items are independent.
+// Cached functions are copied straight through; fresh ones are stored.
+typedef struct {
+    CompiContext *ctx;
+    ASTNode **children;
+    OutSink *sinks;
+} ChildOutputs;
+
+static void gen_child_to_buffer(void *arg, size_t index) {
+
+    ChildOutputs *co = (ChildOutputs*)arg;
+
+    sink_init_memory(&co->sinks[index]);
+    if (co->children[index]->type == NODE_CACHED_FUNCTION) return;
+    gen_node(co->ctx, co->children[index], &co->sinks[index]);
+}
+
+static void gen_children_parallel(CompiContext *ctx, ASTNode *node, OutSink *out) {
+
+    ChildOutputs co;
+    size_t count = (size_t)node->num_children;
+    size_t i = 0;
+
+    co.ctx = ctx;
+    co.children = node->children;
+    co.sinks = (OutSink*)calloc(count, sizeof(OutSink));
+    if (!co.sinks) {
+        perror("Failed to allocate output buffers");
+        exit(EXIT_FAILURE);
     }
+    work_pool_run(ctx->codegen_jobs, count, gen_child_to_buffer, &co);
 
+    // Concatenate in source order so the output matches the serial mode
+    for (i = 0; i < count; ++i) {
+        if (co.children[i]->type == NODE_CACHED_FUNCTION) {
+            sink_puts(out, co.children[i]->value);
+            continue;
+        }
+        if (co.sinks[i].error) {
+            out->error = 1;
+        } else if (i < ctx->cache.key_count && ctx->cache.keys[i]) {
+            func_cache_store(&ctx->cache, ctx->cache.keys[i], co.sinks[i].buf ? co.sinks[i].buf : "", co.sinks[i].len);
+        }
+        sink_write(out, co.sinks[i].buf, co.sinks[i].len);
+        // A failed buffer makes the whole output fail (out->error is sticky)
+        if (sink_close(&co.sinks[i]) != 0) out->error = 1;
+    }
+    free(co.sinks);
 }
 
 // -------------------------------------------------------------
 // Function declaration -> entity + architecture
 // -------------------------------------------------------------
-static void gen_function(ASTNode *node, FILE *out) {
+static void gen_function(CompiContext *ctx, ASTNode *node, OutSink *out, GenStack *work) {
 
     const char *fname = node->value ? node->value : "anon";
     ASTNode *params[128] = {0};
     int pcount = 0;
     int i = 0;
 
-    fprintf(out, "-- Function: %s\n", fname);
-    fprintf(out, "entity %s is\n", fname);
-    fprintf(out, "  port (\n");
-    fprintf(out, "    clk   : in  std_logic;\n");
-    fprintf(out, "    reset : in  std_logic;\n");
+    sink_lit(out, "-- Function: "); sink_puts(out, fname); sink_lit(out, "\n");
+    sink_lit(out, "entity "); sink_puts(out, fname); sink_lit(out, " is\n");
+    sink_lit(out, "  port (\n");
+    sink_lit(out, "    clk   : in  std_logic;\n");
+    sink_lit(out, "    reset : in  std_logic;\n");
 
     // Collect parameters (var decl children at top level)
     for (i = 0; i < node->num_children; ++i) {
@@ -128,167 +335,164 @@ static void gen_function(ASTNode *node, FILE *out) {
 
     for (i = 0; i < pcount; ++i) {
         ASTNode *p = params[i];
-        int is_struct = find_struct_index(p->token.value) >= 0;
+        int is_struct = token_struct_index(ctx, &p->token) >= 0;
         if (is_struct) {
-            fprintf(out, "    %s : in %s_t;\n", p->value, p->token.value);
+            sink_lit(out, "    "); sink_puts(out, p->value); sink_lit(out, " : in "); sink_write(out, p->token.text, p->token.length); sink_lit(out, "_t;\n");
         } else {
-            fprintf(out, "    %s : in %s;\n", p->value, ctype_to_vhdl(p->token.value));
+            sink_lit(out, "    "); sink_puts(out, p->value); sink_lit(out, " : in "); sink_puts(out, token_vhdl_type(&p->token)); sink_lit(out, ";\n");
         }
     }
 
     // Return port
-    if (node->token.value && strlen(node->token.value) > 0) {
+    if (node->token.length > 0) {
 
-        if (find_struct_index(node->token.value) >= 0) {
-            fprintf(out, "    result : out %s_t\n", node->token.value);
+        if (token_struct_index(ctx, &node->token) >= 0) {
+            sink_lit(out, "    result : out "); sink_write(out, node->token.text, node->token.length); sink_lit(out, "_t\n");
         } else {
-            fprintf(out, "    result : out %s\n", ctype_to_vhdl(node->token.value));
+            sink_lit(out, "    result : out "); sink_puts(out, token_vhdl_type(&node->token)); sink_lit(out, "\n");
         }
 
     } else {
 
-        fprintf(out, "    result : out std_logic_vector(31 downto 0)\n");
+        sink_lit(out, "    result : out std_logic_vector(31 downto 0)\n");
 
     }
-    fprintf(out, "  );\nend entity;\n\n");
+    sink_lit(out, "  );\nend entity;\n\n");
 
     // Architecture
-    fprintf(out, "architecture behavioral of %s is\n", fname);
-    emit_local_signals(node, out);
-    fprintf(out, "begin\n");
-    fprintf(out, "  process(clk, reset)\n");
-    fprintf(out, "  begin\n");
-    fprintf(out, "    if reset = '1' then\n");
+    sink_lit(out, "architecture behavioral of "); sink_puts(out, fname); sink_lit(out, " is\n");
+    emit_local_signals(ctx, node, out);
+    sink_lit(out, "begin\n");
+    sink_lit(out, "  process(clk, reset)\n");
+    sink_lit(out, "  begin\n");
+    sink_lit(out, "    if reset = '1' then\n");
 
-    fprintf(out, "      -- Reset logic (user-defined)\n");
+    sink_lit(out, "      -- Reset logic (user-defined)\n");
 
-    fprintf(out, "    elsif rising_edge(clk) then\n");
+    sink_lit(out, "    elsif rising_edge(clk) then\n");
 
     // Body statements
     for (i = 0; i < node->num_children; ++i) {
         ASTNode *child = node->children[i];
-        if (child->type == NODE_STATEMENT) gen_node(child, out);
+        if (child->type == NODE_STATEMENT) defer_node(work, child);
     }
 
-    fprintf(out, "    end if;\n");
-    fprintf(out, "  end process;\n");
-    fprintf(out, "end architecture;\n\n");
+    defer_lit(work, "    end if;\n");
+    defer_lit(work, "  end process;\n");
+    defer_lit(work, "end architecture;\n\n");
 
 }
 
 // -------------------------------------------------------------
 // Statement block
 // -------------------------------------------------------------
-static void gen_statement(ASTNode *node, FILE *out) {
+static void gen_statement(ASTNode *node, GenStack *work) {
 
     int i = 0;
     for (i = 0; i < node->num_children; ++i) {
+        defer_item(work, (GenItem){ GEN_STATEMENT_ITEM, node->children[i], node, NULL, 0 });
+    }
+}
 
-        ASTNode *child = node->children[i];
-
-        switch (child->type) {
-
-            case NODE_VAR_DECL: {
-                // Handle struct init or simple init
-                char *arr_bracket = child->value ? strchr(child->value, '[') : NULL;
-                int struct_idx = find_struct_index(child->token.value);
-                if (child->num_children > 0 && !arr_bracket && struct_idx >= 0) {
-                    ASTNode *init = child->children[0];
-                    if (init && init->value && strcmp(init->value, "struct_init") == 0) {
-                        for (int f = 0; f < g_structs[struct_idx].field_count; ++f) {
-                            const char *field = g_structs[struct_idx].fields[f].field_name;
-                            const char *val = (f < init->num_children) ? init->children[f]->value : "0";
-                            if (strcmp(g_structs[struct_idx].fields[f].field_type, "int") == 0) {
-                                if (isdigit(val[0]) || (val[0] == '-' && isdigit(val[1]))) {
-                                    fprintf(out, "      %s.%s <= to_unsigned(%s, 32);\n", child->value, field, val);
-                                } else {
-                                    fprintf(out, "      %s.%s <= %s;\n", child->value, field, val);
-                                }
+// One child of a statement; its leading text is written directly
+static void gen_statement_item(CompiContext *ctx, ASTNode *node, ASTNode *child, OutSink *out, GenStack *work) {
+
+    switch (child->type) {
+
+        case NODE_VAR_DECL: {
+            // Handle struct init or simple init
+            char *arr_bracket = child->value ? strchr(child->value, '[') : NULL;
+            int struct_idx = token_struct_index(ctx, &child->token);
+            if (child->num_children > 0 && !arr_bracket && struct_idx >= 0) {
+                ASTNode *init = child->children[0];
+                if (init && init->value && strcmp(init->value, "struct_init") == 0) {
+                    for (int f = 0; f < ctx->structs.items[struct_idx].field_count; ++f) {
+                        const char *field = ctx->structs.items[struct_idx].fields[f].field_name;
+                        const char *val = (f < init->num_children) ? init->children[f]->value : "0";
+                        if (strcmp(ctx->structs.items[struct_idx].fields[f].field_type, "int") == 0) {
+                            if (isdigit(val[0]) || (val[0] == '-' && isdigit(val[1]))) {
+                                sink_lit(out, "      "); sink_puts(out, child->value); sink_putc(out, '.'); sink_puts(out, field);
+                                sink_lit(out, " <= to_unsigned("); sink_puts(out, val); sink_lit(out, ", 32);\n");
                             } else {
-                                fprintf(out, "      %s.%s <= %s;\n", child->value, field, val);
+                                emit_field_assignment(out, child->value, field, val);
                             }
+                        } else {
+                            emit_field_assignment(out, child->value, field, val);
                         }
-                    } else {
-                        fprintf(out, "      %s <= ", child->value ? child->value : "unknown");
-                        gen_node(init, out);
-                        fprintf(out, ";\n");
-                    }
-                } else if (child->num_children > 0 && !arr_bracket) {
-                    emit_initializer(child, out, "      ");
-                }
-                break; }
-            case NODE_ASSIGNMENT:
-                emit_assignment(child, out, "      ");
-                break;
-            case NODE_IF_STATEMENT:
-            case NODE_WHILE_STATEMENT:
-            case NODE_FOR_STATEMENT:
-            case NODE_BREAK_STATEMENT:
-            case NODE_CONTINUE_STATEMENT:
-                gen_node(child, out);
-                break;
-
-            case NODE_EXPRESSION: {
-                // Expression acting as function result
-                int is_struct_ret = 0;
-                const char *struct_ret_name = NULL;
-                if (node->parent && node->parent->type == NODE_FUNCTION_DECL) {
-                    struct_ret_name = node->parent->token.value;
-                    is_struct_ret = struct_ret_name && find_struct_index(struct_ret_name) >= 0;
-                }
-                int plain_ident = 1;
-                if (child->value) {
-                    for (const char *p = child->value; *p; ++p) {
-                        if (*p == '[' || *p == ']' || *p == '.') { plain_ident = 0; break; }
                     }
-                    if (strstr(child->value, "__")) plain_ident = 0;
-                } else plain_ident = 0;
-
-                if (is_struct_ret && child->value && plain_ident) {
-                    emit_struct_return_copy(child, node->parent, out, "      ");
                 } else {
-                    fprintf(out, "      result <= ");
-                    if (child->value && child->value[0] == '-' && strlen(child->value) > 1) {
-                        if (isalpha(child->value[1]) || child->value[1] == '_') {
-                            fprintf(out, "-unsigned(%s)", child->value + 1);
-                        } else {
-                            fprintf(out, "to_signed(%s, 32)", child->value);
-                        }
+                    sink_lit(out, "      "); sink_puts(out, child->value ? child->value : "unknown"); sink_lit(out, " <= ");
+                    defer_node(work, init);
+                    defer_lit(work, ";\n");
+                }
+            } else if (child->num_children > 0 && !arr_bracket) {
+                emit_initializer(child, work, "      ");
+            }
+            break; }
+        case NODE_ASSIGNMENT:
+            emit_assignment(child, work, "      ");
+            break;
+        case NODE_IF_STATEMENT:
+        case NODE_WHILE_STATEMENT:
+        case NODE_FOR_STATEMENT:
+        case NODE_BREAK_STATEMENT:
+        case NODE_CONTINUE_STATEMENT:
+            defer_node(work, child);
+            break;
+
+        case NODE_EXPRESSION: {
+            // Expression acting as function result
+            int is_struct_ret = 0;
+            if (node->parent && node->parent->type == NODE_FUNCTION_DECL) {
+                is_struct_ret = token_struct_index(ctx, &node->parent->token) >= 0;
+            }
+            if (is_struct_ret && child->value) {
+                emit_struct_return_copy(ctx, child, node->parent, out, "      ");
+            } else {
+                sink_lit(out, "      result <= ");
+                if (child->value && child->value[0] == '-' && strlen(child->value) > 1) {
+                    if (isalpha(child->value[1]) || child->value[1] == '_') {
+                        sink_lit(out, "-unsigned("); sink_puts(out, child->value + 1); sink_putc(out, ')');
                     } else {
-                        gen_node(child, out);
+                        emit_signed_literal(out, child->value);
                     }
-                    fprintf(out, ";\n");
+                    sink_lit(out, ";\n");
+                } else {
+                    defer_node(work, child);
+                    defer_lit(work, ";\n");
                 }
-                break; }
-            case NODE_BINARY_EXPR:
-            case NODE_BINARY_OP:
-                fprintf(out, "      result <= ");
-                gen_node(child, out);
-                fprintf(out, ";\n");
-                break;
-            default:
-                break; // ignore
-        }
+            }
+            break; }
+        case NODE_BINARY_EXPR:
+        case NODE_BINARY_OP:
+        case NODE_INDEX:
+        case NODE_MEMBER:
+            sink_lit(out, "      result <= ");
+            defer_node(work, child);
+            defer_lit(work, ";\n");
+            break;
+        default:
+            break; // ignore
     }
 }
 
 // -------------------------------------------------------------
 // While loop
 // -------------------------------------------------------------
-static void gen_while(ASTNode *node, FILE *out) {
+static void gen_while(ASTNode *node, GenStack *work) {
 
     ASTNode *cond = node->children[0];
-    fprintf(out, "      while ");
-    emit_condition(cond, out);
-    fprintf(out, " loop\n");
-    for (int j = 1; j < node->num_children; ++j) gen_node(node->children[j], out);
-    fprintf(out, "      end loop;\n");
+    defer_lit(work, "      while ");
+    emit_condition(cond, work);
+    defer_lit(work, " loop\n");
+    for (int j = 1; j < node->num_children; ++j) defer_node(work, node->children[j]);
+    defer_lit(work, "      end loop;\n");
 }
 
 // -------------------------------------------------------------
 // For loop rewritten as while (mirrors original logic)
 // -------------------------------------------------------------
-static void gen_for(ASTNode *node, FILE *out) {
+static void gen_for(ASTNode *node, GenStack *work) {
 
     if (node->num_children == 0) return;
 
@@ -303,9 +507,9 @@ static void gen_for(ASTNode *node, FILE *out) {
 
     if (first->type == NODE_ASSIGNMENT || first->type == NODE_VAR_DECL) {
         if (first->type == NODE_ASSIGNMENT && first->num_children == 2) {
-            emit_assignment(first, out, "      ");
+            emit_assignment(first, work, "      ");
         } else if (first->type == NODE_VAR_DECL && first->num_children > 0) {
-            emit_initializer(first, out, "      ");
+            emit_initializer(first, work, "      ");
         }
         cond_index = 1;
     }
@@ -321,331 +525,312 @@ static void gen_for(ASTNode *node, FILE *out) {
         incr_index = -1;
     }
 
-    fprintf(out, "      while ");
-    emit_condition(cond, out);
-    fprintf(out, " loop\n");
+    defer_lit(work, "      while ");
+    emit_condition(cond, work);
+    defer_lit(work, " loop\n");
 
     for (int j = cond_index + 1; j < node->num_children; ++j) {
         if (j == incr_index) continue; // skip increment here
-        gen_node(node->children[j], out);
+        defer_node(work, node->children[j]);
     }
 
     if (incr && incr->num_children == 2) {
-        emit_assignment(incr, out, "        ");
+        emit_assignment(incr, work, "        ");
     }
 
-    fprintf(out, "      end loop;\n");
+    defer_lit(work, "      end loop;\n");
 }
 
 // -------------------------------------------------------------
 // If / ElseIf / Else
 // -------------------------------------------------------------
-static void gen_if(ASTNode *node, FILE *out) {
+static void gen_if(ASTNode *node, GenStack *work) {
 
     ASTNode *cond = node->children[0];
 
-    fprintf(out, "      if ");
-    emit_condition(cond, out);
-    fprintf(out, " then\n");
+    defer_lit(work, "      if ");
+    emit_condition(cond, work);
+    defer_lit(work, " then\n");
 
     for (int j = 1; j < node->num_children; ++j) {
         ASTNode *branch = node->children[j];
         if (branch->type == NODE_ELSE_IF_STATEMENT) {
             ASTNode *elseif_cond = branch->children[0];
-            fprintf(out, "      elsif ");
-            emit_condition(elseif_cond, out);
-            fprintf(out, " then\n");
-            for (int k = 1; k < branch->num_children; ++k) gen_node(branch->children[k], out);
+            defer_lit(work, "      elsif ");
+            emit_condition(elseif_cond, work);
+            defer_lit(work, " then\n");
+            for (int k = 1; k < branch->num_children; ++k) defer_node(work, branch->children[k]);
         } else if (branch->type == NODE_ELSE_STATEMENT) {
-            fprintf(out, "      else\n");
-            for (int k = 0; k < branch->num_children; ++k) gen_node(branch->children[k], out);
+            defer_lit(work, "      else\n");
+            for (int k = 0; k < branch->num_children; ++k) defer_node(work, branch->children[k]);
         } else {
-            gen_node(branch, out);
+            defer_node(work, branch);
         }
     }
-    fprintf(out, "      end if;\n");
+    defer_lit(work, "      end if;\n");
 }
 
 // -------------------------------------------------------------
-static void gen_break(ASTNode *node, FILE *out) { (void)node; fprintf(out, "      exit;\n"); }
-static void gen_continue(ASTNode *node, FILE *out) { (void)node; fprintf(out, "      next;\n"); }
+static void gen_break(ASTNode *node, OutSink *out) { (void)node; sink_lit(out, "      exit;\n"); }
+static void gen_continue(ASTNode *node, OutSink *out) { (void)node; sink_lit(out, "      next;\n"); }
 
 // -------------------------------------------------------------
 // Binary expression (both arithmetic and comparison)
 // -------------------------------------------------------------
-static void gen_binary_expr(ASTNode *node, FILE *out) {
+static void gen_binary_expr(ASTNode *node, GenStack *work) {
 
-    const char *op = node->value;
     ASTNode *left  = node->children[0];
     ASTNode *right = node->children[1];
-
-    // Normalize op
-    if (strcmp(op, "==") == 0) op = "=";
-    else if (strcmp(op, "!=") == 0) op = "/=";
-
-    // Logical short-circuit style (&&, ||) converted to boolean expressions
-    if (strcmp(node->value, "&&") == 0 || strcmp(node->value, "||") == 0) {
-        emit_boolean_gate(left, right, strcmp(node->value, "&&") == 0 ? " and " : " or ", out);
-        return;
-    }
-
-    // Comparison operations produce booleans
-    if (strcmp(op, "=") == 0 || strcmp(op, "/=") == 0 || strcmp(op, "<") == 0 ||
-        strcmp(op, "<=") == 0 || strcmp(op, ">") == 0 || strcmp(op, ">=") == 0) {
-        // Left
-        if (left->type == NODE_EXPRESSION && left->value) {
-            if (is_negative_literal(left->value)) {
-                fprintf(out, "to_signed(%s, 32)", left->value);
+    const char *op = operator_text(node->op);
+
+    switch (node->op) {
+        // Logical short-circuit style (&&, ||) converted to boolean expressions
+        case OP_LOG_AND:
+        case OP_LOG_OR:
+            emit_boolean_gate(left, right, node->op == OP_LOG_AND ? " and " : " or ", work);
+            return;
+
+        // Comparison operations produce booleans
+        case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+            if (node->op == OP_EQ) op = "=";
+            else if (node->op == OP_NE) op = "/=";
+            // Left
+            if (left->type == NODE_EXPRESSION && left->value) {
+                defer_unsigned_operand(work, left->value);
             } else {
-                int is_num = 1; const char *p = left->value; if (!*p) is_num = 0; while (*p) { if (!isdigit(*p) && *p != '.') { is_num = 0; break; } ++p; }
-                if (is_num) fprintf(out, "to_unsigned(%s, 32)", left->value); else fprintf(out, "unsigned(%s)", left->value);
+                defer_lit(work, "unsigned("); defer_node(work, left); defer_lit(work, ")");
             }
-        } else {
-            fprintf(out, "unsigned("); gen_node(left, out); fprintf(out, ")");
-        }
-        fprintf(out, " %s ", op);
-        // Right
-        if (right->type == NODE_EXPRESSION && right->value) {
-            if (is_negative_literal(right->value)) {
-                fprintf(out, "to_signed(%s, 32)", right->value);
+            defer_lit(work, " "); defer_puts(work, op); defer_lit(work, " ");
+            // Right
+            if (right->type == NODE_EXPRESSION && right->value) {
+                defer_unsigned_operand(work, right->value);
             } else {
-                int is_num = 1; const char *p = right->value; if (!*p) is_num = 0; while (*p) { if (!isdigit(*p) && *p != '.') { is_num = 0; break; } ++p; }
-                if (is_num) fprintf(out, "to_unsigned(%s, 32)", right->value); else fprintf(out, "unsigned(%s)", right->value);
+                defer_lit(work, "unsigned("); defer_node(work, right); defer_lit(work, ")");
             }
-        } else {
-            fprintf(out, "unsigned("); gen_node(right, out); fprintf(out, ")");
-        }
-        return;
+            return;
+
+        // Bitwise
+        case OP_BIT_AND:
+            defer_lit(work, "unsigned("); defer_node(work, left); defer_lit(work, ") and unsigned("); defer_node(work, right); defer_lit(work, ")"); return;
+        case OP_BIT_OR:
+            defer_lit(work, "unsigned("); defer_node(work, left); defer_lit(work, ") or unsigned("); defer_node(work, right); defer_lit(work, ")"); return;
+        case OP_BIT_XOR:
+            defer_lit(work, "unsigned("); defer_node(work, left); defer_lit(work, ") xor unsigned("); defer_node(work, right); defer_lit(work, ")"); return;
+        case OP_SHL:
+            defer_lit(work, "shift_left(unsigned("); defer_node(work, left); defer_lit(work, "), to_integer(unsigned("); defer_node(work, right); defer_lit(work, "))))"); return;
+        case OP_SHR:
+            defer_lit(work, "shift_right(unsigned("); defer_node(work, left); defer_lit(work, "), to_integer(unsigned("); defer_node(work, right); defer_lit(work, "))))"); return;
+
+        // Fallback arithmetic or unknown
+        default:
+            defer_node(work, left);
+            defer_lit(work, " "); defer_puts(work, op); defer_lit(work, " ");
+            defer_node(work, right);
+            return;
     }
-
-    // Bitwise
-    if (strcmp(op, "&") == 0) {
-        fprintf(out, "unsigned("); gen_node(left, out); fprintf(out, ") and unsigned("); gen_node(right, out); fprintf(out, ")"); return; }
-    if (strcmp(op, "|") == 0) {
-        fprintf(out, "unsigned("); gen_node(left, out); fprintf(out, ") or unsigned("); gen_node(right, out); fprintf(out, ")"); return; }
-    if (strcmp(op, "^") == 0) {
-        fprintf(out, "unsigned("); gen_node(left, out); fprintf(out, ") xor unsigned("); gen_node(right, out); fprintf(out, ")"); return; }
-    if (strcmp(op, "<<") == 0) {
-        fprintf(out, "shift_left(unsigned("); gen_node(left, out); fprintf(out, "), to_integer(unsigned("); gen_node(right, out); fprintf(out, "))))"); return; }
-    if (strcmp(op, ">>") == 0) {
-        fprintf(out, "shift_right(unsigned("); gen_node(left, out); fprintf(out, "), to_integer(unsigned("); gen_node(right, out); fprintf(out, "))))"); return; }
-
-    // Fallback arithmetic or unknown
-    gen_node(left, out);
-    fprintf(out, " %s ", op);
-    gen_node(right, out);
 }
 
 // -------------------------------------------------------------
-// Expression (identifier / literal / array access / struct field)
+// Expression (identifier / literal)
 // -------------------------------------------------------------
-static void gen_expression(ASTNode *node, FILE *out) {
+static void gen_expression(ASTNode *node, OutSink *out) {
 
     if (!node->value) { 
-        fprintf(out, "unknown"); 
+        sink_lit(out, "unknown"); 
         return; 
     }
 
-    // Array element like name[index]
-    if (strchr(node->value, '[')) {
-        emit_array_element(node->value, out);
-        return;
-    }
-
     if (is_negative_literal(node->value)) {
         if (isalpha(node->value[1]) || node->value[1] == '_') {
-            fprintf(out, "-unsigned(%s)", node->value + 1);
+            sink_lit(out, "-unsigned("); sink_puts(out, node->value + 1); sink_putc(out, ')');
         } else {
-            fprintf(out, "to_signed(%s, 32)", node->value);
+            emit_signed_literal(out, node->value);
         }
         return;
     }
 
-    // Struct field encoded as a__b -> a.b
-    if (strstr(node->value, "__")) {
-        char buf[256];
-        strncpy(buf, node->value, sizeof(buf) - 1);
-        buf[sizeof(buf) - 1] = '\0';
-        for (char *p = buf; *p; ++p) {
-            if (*p == '_' && *(p + 1) == '_') {
-                *p = '.';
-                memmove(p + 1, p + 2, strlen(p + 2) + 1);
-            }
-        }
-        fprintf(out, "%s", buf);
+    sink_puts(out, node->value);
+}
+
+// -------------------------------------------------------------
+// Array element name(index) and record field name.field
+// -------------------------------------------------------------
+static void gen_index(ASTNode *node, GenStack *work) {
+
+    if (node->num_children != 2) {
+        defer_lit(work, "-- Invalid array index");
         return;
     }
+    defer_node(work, node->children[0]);
+    defer_lit(work, "(");
+    defer_node(work, node->children[1]);
+    defer_lit(work, ")");
+}
 
-    fprintf(out, "%s", node->value);
+static void gen_member(ASTNode *node, GenStack *work) {
+
+    if (node->num_children != 1) {
+        defer_lit(work, "-- Invalid field access");
+        return;
+    }
+    defer_node(work, node->children[0]);
+    defer_lit(work, ".");
+    defer_puts(work, node->value);
 }
 
 // -------------------------------------------------------------
-// Unary operations (stored as NODE_BINARY_OP w/ value '!','~')
+// Unary operations (stored as NODE_BINARY_OP w/ value '!', '~', '-')
 // -------------------------------------------------------------
-static void gen_unary_op(ASTNode *node, FILE *out) {
+static void gen_unary_op(ASTNode *node, GenStack *work) {
 
-    if (!node->value || node->num_children != 1) { 
-        fprintf(out, "-- unsupported unary op"); 
+    if (node->num_children != 1) { 
+        defer_lit(work, "-- unsupported unary op"); 
         return; 
     }
 
     ASTNode *inner = node->children[0];
 
-    if (strcmp(node->value, "!") == 0) {
+    if (node->op == OP_NOT) {
         if (node_is_boolean(inner)) {
-            fprintf(out, "not ("); gen_node(inner, out); fprintf(out, ")");
+            defer_lit(work, "not ("); defer_node(work, inner); defer_lit(work, ")");
         } else {
-            fprintf(out, "(unsigned("); gen_node(inner, out); fprintf(out, ") = 0)");
+            defer_lit(work, "(unsigned("); defer_node(work, inner); defer_lit(work, ") = 0)");
         }
-    } else if (strcmp(node->value, "~") == 0) {
-        fprintf(out, "not unsigned("); gen_node(inner, out); fprintf(out, ")");
+    } else if (node->op == OP_BIT_NOT) {
+        defer_lit(work, "not unsigned("); defer_node(work, inner); defer_lit(work, ")");
+    } else if (node->op == OP_SUB) {
+        defer_lit(work, "-unsigned("); defer_node(work, inner); defer_lit(work, ")");
     } else {
-        fprintf(out, "-- unsupported unary op");
+        defer_lit(work, "-- unsupported unary op");
     }
 }
 
 // -------------------------------------------------------------
 // Helper implementations
 // -------------------------------------------------------------
-static int is_bool_comparison(const char *op) {
-
-    if (!op) return 0;
-
-    return (strcmp(op, "==") == 0 || strcmp(op, "!=") == 0 || strcmp(op, "<") == 0 ||
-            strcmp(op, "<=") == 0 || strcmp(op, ">") == 0 || strcmp(op, ">=") == 0 ||
-            strcmp(op, "&&") == 0 || strcmp(op, "||") == 0);
-}
-
 static int node_is_boolean(ASTNode *node) {
 
     if (!node) return 0;
-    if (node->type == NODE_BINARY_EXPR && node->value) return is_bool_comparison(node->value);
-    if (node->type == NODE_BINARY_OP && node->value && strcmp(node->value, "!") == 0) return 1;
+    if (node->type == NODE_BINARY_EXPR) return operator_is_boolean(node->op);
+    if (node->type == NODE_BINARY_OP && node->op == OP_NOT) return 1;
     return 0;
 }
 
-static void emit_initializer(ASTNode *decl, FILE *out, const char *indent) {
-
-    if (!decl || decl->num_children == 0) return;
+static void emit_signed_literal(OutSink *out, const char *value) {
+    sink_lit(out, "to_signed("); sink_puts(out, value); sink_lit(out, ", 32)");
+}
 
-    ASTNode *init = decl->children[0];
-    fprintf(out, "%s%s <= ", indent, decl->value ? decl->value : "unknown");
-    gen_node(init, out);
-    fprintf(out, ";\n");
+static void defer_signed_literal(GenStack *work, const char *value) {
+    defer_lit(work, "to_signed("); defer_puts(work, value); defer_lit(work, ", 32)");
 }
 
-static void emit_assignment(ASTNode *assign, FILE *out, const char *indent) {
+// Comparison operand held in an expression node: negative literal, number
+// or name
+static void defer_unsigned_operand(GenStack *work, const char *value) {
 
-    if (!assign || assign->num_children != 2) return;
-    ASTNode *lhs = assign->children[0];
-    ASTNode *rhs = assign->children[1];
+    const char *p = value;
+    int is_num = *p != '\0';
 
-    fprintf(out, "%s", indent);
-
-    if (lhs->value && strchr(lhs->value, '[')) {
-        // Array element
-        char arr_name[64] = {0};
-        char arr_idx[64]  = {0};
-        const char *lbr = strchr(lhs->value, '[');
-        if (lbr) {
-            int name_len = (int)(lbr - lhs->value);
-            strncpy(arr_name, lhs->value, name_len);
-            const char *idx_start = lbr + 1;
-            const char *idx_end   = strchr(idx_start, ']');
-            if (idx_end && idx_end > idx_start) {
-                strncpy(arr_idx, idx_start, idx_end - idx_start);
-                fprintf(out, "%s(%s) <= ", arr_name, arr_idx);
-                gen_node(rhs, out);
-                fprintf(out, ";\n");
-                return;
-            }
-        }
-        fprintf(out, "-- Invalid array index\n");
+    if (is_negative_literal(value)) {
+        defer_signed_literal(work, value);
         return;
     }
+    for (; *p; ++p) {
+        if (!isdigit((unsigned char)*p) && *p != '.') { is_num = 0; break; }
+    }
+    if (is_num) {
+        defer_lit(work, "to_unsigned("); defer_puts(work, value); defer_lit(work, ", 32)");
+    } else {
+        defer_lit(work, "unsigned("); defer_puts(work, value); defer_lit(work, ")");
+    }
+}
 
-    fprintf(out, "%s <= ", lhs->value ? lhs->value : "unknown");
-    gen_node(rhs, out);
-    fprintf(out, ";\n");
+static void emit_field_assignment(OutSink *out, const char *var, const char *field, const char *val) {
+    sink_lit(out, "      "); sink_puts(out, var); sink_putc(out, '.'); sink_puts(out, field);
+    sink_lit(out, " <= "); sink_puts(out, val); sink_lit(out, ";\n");
 }
 
-static void emit_array_element(const char *value, FILE *out) {
+static void emit_signal(OutSink *out, const char *prefix, const char *name, const char *type) {
+    sink_lit(out, "  signal "); sink_puts(out, prefix); sink_puts(out, name);
+    sink_lit(out, " : "); sink_puts(out, type); sink_lit(out, ";\n");
+}
 
-    if (!value) { 
-        fprintf(out, "-- Invalid array ref");
-        return; 
-    }
+static void emit_initializer(ASTNode *decl, GenStack *work, const char *indent) {
 
-    char arr_name[64] = {0};
-    char arr_idx[64]  = {0};
-    const char *lbr = strchr(value, '[');
+    if (!decl || decl->num_children == 0) return;
 
-    if (!lbr) { 
-        fprintf(out, "%s", value); 
-        return; 
-    }
+    ASTNode *init = decl->children[0];
+    defer_puts(work, indent); defer_puts(work, decl->value ? decl->value : "unknown"); defer_lit(work, " <= ");
+    defer_node(work, init);
+    defer_lit(work, ";\n");
+}
 
-    int name_len = (int)(lbr - value);
-    strncpy(arr_name, value, name_len);
-    const char *idx_start = lbr + 1;
-    const char *idx_end   = strchr(idx_start, ']');
+static void emit_assignment(ASTNode *assign, GenStack *work, const char *indent) {
 
-    if (idx_end && idx_end > idx_start) {
-        strncpy(arr_idx, idx_start, idx_end - idx_start);
-        fprintf(out, "%s(%s)", arr_name, arr_idx);
-    } else {
-        fprintf(out, "-- Invalid array index");
-    }
+    if (!assign || assign->num_children != 2) return;
+    ASTNode *lhs = assign->children[0];
+    ASTNode *rhs = assign->children[1];
+
+    defer_puts(work, indent);
+    defer_node(work, lhs);
+    defer_lit(work, " <= ");
+    defer_node(work, rhs);
+    defer_lit(work, ";\n");
 }
 
-static void emit_condition(ASTNode *cond, FILE *out) {
+static void emit_condition(ASTNode *cond, GenStack *work) {
     
-    if (!cond) { fprintf(out, "(false)"); return; }
+    if (!cond) { defer_lit(work, "(false)"); return; }
     if (cond->type == NODE_BINARY_EXPR) {
-        if (is_bool_comparison(cond->value)) {
-            gen_node(cond, out);
+        if (operator_is_boolean(cond->op)) {
+            defer_node(work, cond);
         } else {
-            fprintf(out, "unsigned("); gen_node(cond, out); fprintf(out, ") /= 0");
+            defer_lit(work, "unsigned("); defer_node(work, cond); defer_lit(work, ") /= 0");
         }
-    } else if (cond->type == NODE_BINARY_OP) {
-        gen_node(cond, out);
+    } else if (cond->type == NODE_BINARY_OP && cond->op != OP_SUB) {
+        defer_node(work, cond);
     } else if (cond->type == NODE_EXPRESSION && cond->value) {
-        fprintf(out, "unsigned(%s) /= 0", cond->value);
+        defer_lit(work, "unsigned("); defer_puts(work, cond->value); defer_lit(work, ") /= 0");
+    } else if (cond->type == NODE_INDEX || cond->type == NODE_MEMBER || cond->type == NODE_BINARY_OP) {
+        defer_lit(work, "unsigned("); defer_node(work, cond); defer_lit(work, ") /= 0");
     } else {
-        fprintf(out, "(%s)", cond->value ? cond->value : "false");
+        defer_lit(work, "("); defer_puts(work, cond->value ? cond->value : "false"); defer_lit(work, ")");
     }
 }
 
-static void emit_boolean_gate(ASTNode *left, ASTNode *right, const char *logical, FILE *out) {
-    fprintf(out, "(");
+static void emit_boolean_gate(ASTNode *left, ASTNode *right, const char *logical, GenStack *work) {
+    defer_lit(work, "(");
     if (node_is_boolean(left)) {
-        fprintf(out, "("); gen_node(left, out); fprintf(out, ")");
+        defer_lit(work, "("); defer_node(work, left); defer_lit(work, ")");
     } else {
-        fprintf(out, "unsigned("); gen_node(left, out); fprintf(out, ") /= 0");
+        defer_lit(work, "unsigned("); defer_node(work, left); defer_lit(work, ") /= 0");
     }
-    fprintf(out, "%s", logical);
+    defer_puts(work, logical);
     if (node_is_boolean(right)) {
-        fprintf(out, "("); gen_node(right, out); fprintf(out, ")");
+        defer_lit(work, "("); defer_node(work, right); defer_lit(work, ")");
     } else {
-        fprintf(out, "unsigned("); gen_node(right, out); fprintf(out, ") /= 0");
+        defer_lit(work, "unsigned("); defer_node(work, right); defer_lit(work, ") /= 0");
     }
-    fprintf(out, ")");
+    defer_lit(work, ")");
 }
 
-static void emit_struct_declarations(FILE *out) {
+static void emit_struct_declaration(const StructInfo *si, OutSink *out) {
+    sink_printf(out, "-- Struct %s as VHDL record\n", si->name);
+    sink_printf(out, "type %s_t is record\n", si->name);
+    for (int f = 0; f < si->field_count; ++f) {
+        sink_printf(out, "  %s : %s;\n", si->fields[f].field_name, ctype_to_vhdl(si->fields[f].field_type));
+    }
+    sink_lit(out, "end record;\n\n");
+}
+
+static void emit_struct_declarations(CompiContext *ctx, OutSink *out) {
     int s = 0;
-    for (s = 0; s < g_struct_count; ++s) {
-        StructInfo *si = &g_structs[s];
-        fprintf(out, "-- Struct %s as VHDL record\n", si->name);
-        fprintf(out, "type %s_t is record\n", si->name);
-        for (int f = 0; f < si->field_count; ++f) {
-            fprintf(out, "  %s : %s;\n", si->fields[f].field_name, ctype_to_vhdl(si->fields[f].field_type));
-        }
-        fprintf(out, "end record;\n\n");
+    for (s = 0; s < ctx->structs.count; ++s) {
+        emit_struct_declaration(&ctx->structs.items[s], out);
     }
 }
 
-static void emit_local_signals(ASTNode *function_decl, FILE *out) {
+static void emit_local_signals(CompiContext *ctx, ASTNode *function_decl, OutSink *out) {
     // Iterate through statements to discover declarations hidden inside
     int i = 0;
     for (i = 0; i < function_decl->num_children; ++i) {
@@ -654,52 +839,50 @@ static void emit_local_signals(ASTNode *function_decl, FILE *out) {
         for (int j = 0; j < child->num_children; ++j) {
             ASTNode *stmt_child = child->children[j];
             if (stmt_child->type == NODE_VAR_DECL) {
-                if (find_struct_index(stmt_child->token.value) >= 0) {
-                    fprintf(out, "  signal %s : %s_t;\n", stmt_child->value, stmt_child->token.value);
+                if (token_struct_index(ctx, &stmt_child->token) >= 0) {
+                    sink_printf(out, "  signal %s : " TOKEN_FMT "_t;\n", stmt_child->value, TOKEN_ARG(stmt_child->token));
                     continue;
                 }
                 char *arr_bracket = stmt_child->value ? strchr(stmt_child->value, '[') : NULL;
                 if (arr_bracket) {
                     // Array declaration
-                    int name_len = (int)(arr_bracket - stmt_child->value);
-                    char arr_name[64] = {0}; strncpy(arr_name, stmt_child->value, name_len);
-                    char arr_size[32] = {0};
+                    const char *name = stmt_child->value;
+                    int name_len = (int)(arr_bracket - name);
                     const char *size_start = arr_bracket + 1;
                     const char *size_end = strchr(size_start, ']');
                     if (size_end && size_end > size_start) {
-                        strncpy(arr_size, size_start, size_end - size_start);
-                        const char *vhdl_elem_type = ctype_to_vhdl(stmt_child->token.value);
-                        fprintf(out, "  type %s_type is array (0 to %d) of %s;\n", arr_name, atoi(arr_size) - 1, vhdl_elem_type);
-                        fprintf(out, "  signal %s : %s_type;\n", arr_name, arr_name);
+                        const char *vhdl_elem_type = token_vhdl_type(&stmt_child->token);
+                        sink_printf(out, "  type %.*s_type is array (0 to %d) of %s;\n", name_len, name, atoi(size_start) - 1, vhdl_elem_type);
+                        sink_printf(out, "  signal %.*s : %.*s_type;\n", name_len, name, name_len, name);
                         // Optional array initializers
                         if (stmt_child->num_children > 0 && stmt_child->children[0]->value && strcmp(stmt_child->children[0]->value, "array_init") == 0) {
                             ASTNode *init_list = stmt_child->children[0];
-                            fprintf(out, "  -- Array initialization\n");
-                            fprintf(out, "  constant %s_init : %s_type := (", arr_name, arr_name);
+                            sink_lit(out, "  -- Array initialization\n");
+                            sink_printf(out, "  constant %.*s_init : %.*s_type := (", name_len, name, name_len, name);
                             for (int k = 0; k < init_list->num_children; ++k) {
                                 const char *val = init_list->children[k]->value;
-                                if (strcmp(stmt_child->token.value, "int") == 0) {
+                                if (stmt_child->token.kw == KW_INT) {
                                     char bitstr[40] = {0};
                                     int num = atoi(val);
                                     for (int b = 31; b >= 0; --b) bitstr[31 - b] = ((num >> b) & 1) ? '1' : '0';
                                     bitstr[32] = '\0';
-                                    fprintf(out, "\"%s\"%s", bitstr, (k < init_list->num_children - 1) ? ", " : "");
-                                } else if (strcmp(stmt_child->token.value, "float") == 0 || strcmp(stmt_child->token.value, "double") == 0) {
-                                    fprintf(out, "%s%s", val, (k < init_list->num_children - 1) ? ", " : "");
-                                } else if (strcmp(stmt_child->token.value, "char") == 0) {
-                                    fprintf(out, "'%s'%s", val, (k < init_list->num_children - 1) ? ", " : "");
+                                    sink_printf(out, "\"%s\"%s", bitstr, (k < init_list->num_children - 1) ? ", " : "");
+                                } else if (stmt_child->token.kw == KW_FLOAT || stmt_child->token.kw == KW_DOUBLE) {
+                                    sink_puts(out, val); if (k < init_list->num_children - 1) sink_lit(out, ", ");
+                                } else if (stmt_child->token.kw == KW_CHAR) {
+                                    sink_printf(out, "'%s'%s", val, (k < init_list->num_children - 1) ? ", " : "");
                                 } else {
-                                    fprintf(out, "%s%s", val, (k < init_list->num_children - 1) ? ", " : "");
+                                    sink_puts(out, val); if (k < init_list->num_children - 1) sink_lit(out, ", ");
                                 }
                             }
-                            fprintf(out, ");\n");
-                            fprintf(out, "  signal %s : %s_type := %s_init;\n", arr_name, arr_name, arr_name);
+                            sink_lit(out, ");\n");
+                            sink_printf(out, "  signal %.*s : %.*s_type := %.*s_init;\n", name_len, name, name_len, name, name_len, name);
                         }
                     }
                 } else if (strcmp(stmt_child->value, "result") == 0) {
-                    fprintf(out, "  signal internal_%s : %s;\n", stmt_child->value, ctype_to_vhdl(stmt_child->token.value));
+                    emit_signal(out, "internal_", stmt_child->value, token_vhdl_type(&stmt_child->token));
                 } else {
-                    fprintf(out, "  signal %s : %s;\n", stmt_child->value, ctype_to_vhdl(stmt_child->token.value));
+                    emit_signal(out, "", stmt_child->value, token_vhdl_type(&stmt_child->token));
                 }
             }
             // Decls inside for loops
@@ -709,19 +892,17 @@ static void emit_local_signals(ASTNode *function_decl, FILE *out) {
                     if (for_child->type == NODE_VAR_DECL) {
                         char *arr_br = for_child->value ? strchr(for_child->value, '[') : NULL;
                         if (arr_br) {
-                            int name_len = (int)(arr_br - for_child->value);
-                            char arr_name[64] = {0}; strncpy(arr_name, for_child->value, name_len);
-                            char arr_size[32] = {0};
+                            const char *name = for_child->value;
+                            int name_len = (int)(arr_br - name);
                             const char *size_start = arr_br + 1;
                             const char *size_end = strchr(size_start, ']');
                             if (size_end && size_end > size_start) {
-                                strncpy(arr_size, size_start, size_end - size_start);
-                                const char *vhdl_elem_type = ctype_to_vhdl(for_child->token.value);
-                                fprintf(out, "  type %s_type is array (0 to %d) of %s;\n", arr_name, atoi(arr_size) - 1, vhdl_elem_type);
-                                fprintf(out, "  signal %s : %s_type;\n", arr_name, arr_name);
+                                const char *vhdl_elem_type = token_vhdl_type(&for_child->token);
+                                sink_printf(out, "  type %.*s_type is array (0 to %d) of %s;\n", name_len, name, atoi(size_start) - 1, vhdl_elem_type);
+                                sink_printf(out, "  signal %.*s : %.*s_type;\n", name_len, name, name_len, name);
                             }
                         } else {
-                            fprintf(out, "  signal %s : %s;\n", for_child->value, ctype_to_vhdl(for_child->token.value));
+                            emit_signal(out, "", for_child->value, token_vhdl_type(&for_child->token));
                         }
                     }
                 }
@@ -730,22 +911,21 @@ static void emit_local_signals(ASTNode *function_decl, FILE *out) {
     }
 }
 
-static void emit_struct_return_copy(ASTNode *expr, ASTNode *function_decl, FILE *out, const char *indent) {
+static void emit_struct_return_copy(CompiContext *ctx, ASTNode *expr, ASTNode *function_decl, OutSink *out, const char *indent) {
 
     if (!function_decl || !expr || !expr->value) return;
 
-    const char *struct_ret_name = function_decl->token.value;
-    int sidx = find_struct_index(struct_ret_name);
+    int sidx = token_struct_index(ctx, &function_decl->token);
 
     if (sidx < 0) return;
     
     int f = 0;
 
-    for (f = 0; f < g_structs[sidx].field_count; ++f) {
-        fprintf(out, "%sresult.%s <= %s.%s;\n", indent,
-                g_structs[sidx].fields[f].field_name,
+    for (f = 0; f < ctx->structs.items[sidx].field_count; ++f) {
+        sink_printf(out, "%sresult.%s <= %s.%s;\n", indent,
+                ctx->structs.items[sidx].fields[f].field_name,
                 expr->value,
-                g_structs[sidx].fields[f].field_name);
+                ctx->structs.items[sidx].fields[f].field_name);
     }
 }
 
@@ -0,0 +1,202 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+static inline size_t align_up(size_t n, size_t align) {
+    return (n + (align - 1)) & ~(align - 1);
+}
+
+void arena_init(Arena *arena, size_t chunk_size) {
+
+    memset(arena, 0, sizeof(*arena));
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK;
+}
+
+static void free_chunks(ArenaChunk *chunk) {
+
+    ArenaChunk *next = NULL;
+
+    while (chunk) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+void arena_free(Arena *arena) {
+
+    free_chunks(arena->head);
+    free_chunks(arena->spare);
+    arena_init(arena, arena->chunk_size);
+}
+
+// Keep a standard chunk for reuse; free an oversized one
+static void retire_chunk(Arena *arena, ArenaChunk *chunk) {
+
+    if (chunk->size == arena->chunk_size) {
+        chunk->used = 0;
+        chunk->next = arena->spare;
+        arena->spare = chunk;
+    } else {
+        free(chunk);
+        arena->chunk_count--;
+    }
+}
+
+void arena_reset(Arena *arena) {
+
+    ArenaChunk *chunk = arena->head;
+    ArenaChunk *next = NULL;
+
+    while (chunk) {
+        next = chunk->next;
+        retire_chunk(arena, chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+    arena->bytes_used = 0;
+    arena->last = NULL;
+}
+
+ArenaMark arena_mark(const Arena *arena) {
+
+    ArenaMark mark;
+
+    mark.chunk = arena->head;
+    mark.behind = arena->head ? arena->head->next : NULL;
+    mark.used = arena->head ? arena->head->used : 0;
+    mark.bytes_used = arena->bytes_used;
+    return mark;
+}
+
+void arena_rewind(Arena *arena, ArenaMark mark) {
+
+    ArenaChunk *chunk = arena->head;
+    ArenaChunk *next = NULL;
+
+    if (!mark.chunk) {
+        arena_reset(arena);
+        return;
+    }
+    // Chunks started after the mark sit in front of it
+    while (chunk != mark.chunk) {
+        next = chunk->next;
+        retire_chunk(arena, chunk);
+        chunk = next;
+    }
+    // Oversized blocks allocated while it was the head sit right behind it
+    chunk = mark.chunk->next;
+    while (chunk != mark.behind) {
+        next = chunk->next;
+        retire_chunk(arena, chunk);
+        chunk = next;
+    }
+    mark.chunk->next = mark.behind;
+    mark.chunk->used = mark.used;
+    arena->head = mark.chunk;
+    arena->bytes_used = mark.bytes_used;
+    arena->last = NULL;
+}
+
+// Obtain a chunk with room for at least size bytes (not yet linked)
+static ArenaChunk* arena_new_chunk(Arena *arena, size_t size) {
+
+    size_t cap = arena->chunk_size;
+    ArenaChunk *chunk = arena->spare;    // Reuse an emptied chunk first
+
+    if (chunk && size <= chunk->size) {
+        arena->spare = chunk->next;
+        chunk->next = NULL;
+        return chunk;
+    }
+    if (size > cap) cap = size;
+    chunk = (ArenaChunk*)malloc(sizeof(ArenaChunk) + cap);
+    if (!chunk) {
+        perror("Failed to allocate arena chunk");
+        exit(EXIT_FAILURE);
+    }
+    chunk->next = NULL;
+    chunk->size = cap;
+    chunk->used = 0;
+    arena->chunk_count++;
+    return chunk;
+}
+
+// Bump-allocate size bytes at the given alignment (power of two)
+static void* arena_alloc_aligned(Arena *arena, size_t size, size_t align) {
+
+    ArenaChunk *chunk = arena->head;
+    size_t offset = 0;
+    void *p = NULL;
+
+    if (chunk) {
+        offset = align_up(chunk->used, align);
+    }
+    if (!chunk || offset > chunk->size || chunk->size - offset < size) {
+        if (chunk && size > arena->chunk_size / 4) {
+            // Oversized block: give it a private chunk behind the current one
+            // so the space left in the current chunk is not abandoned
+            ArenaChunk *big = arena_new_chunk(arena, size);
+            big->used = size;
+            big->next = chunk->next;
+            chunk->next = big;
+            arena->bytes_used += size;
+            return big->data;
+        }
+        chunk = arena_new_chunk(arena, size);
+        chunk->next = arena->head;
+        arena->head = chunk;
+        offset = 0;
+    }
+    p = chunk->data + offset;
+    arena->bytes_used += offset + size - chunk->used;
+    chunk->used = offset + size;
+    arena->last = p;
+    return p;
+}
+
+void* arena_alloc(Arena *arena, size_t size) {
+    return arena_alloc_aligned(arena, size ? size : 1, ARENA_ALIGN);
+}
+
+void* arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+
+    ArenaChunk *chunk = arena->head;
+    size_t extra = 0;
+    void *p = NULL;
+
+    if (!ptr) {
+        return arena_alloc(arena, new_size);
+    }
+    if (new_size <= old_size) {
+        return ptr;
+    }
+    // Extend the most recent allocation in place when the chunk has room
+    extra = new_size - old_size;
+    if (ptr == arena->last && chunk && (unsigned char*)ptr + old_size == chunk->data + chunk->used &&
+        chunk->size - chunk->used >= extra) {
+        chunk->used += extra;
+        arena->bytes_used += extra;
+        return ptr;
+    }
+    p = arena_alloc(arena, new_size);
+    memcpy(p, ptr, old_size);
+    return p;
+}
+
+char* arena_strndup(Arena *arena, const char *s, size_t len) {
+
+    char *copy = (char*)arena_alloc_aligned(arena, len + 1, 1);
+
+    if (len) memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char* arena_strdup(Arena *arena, const char *s) {
+    return arena_strndup(arena, s, strlen(s));
+}
@@ -0,0 +1,511 @@
+#include "ast_flat.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compi_context.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define COMPI_HAVE_MMAP 1
+#endif
+
+// .cast file header. Sections follow at the given offsets (8-byte aligned)
+// and hold the FlatAst arrays exactly as they are in memory, so a file is
+// only usable on a platform with the same byte order and FlatNode layout.
+typedef struct {
+    char magic[8];          // FLAT_MAGIC
+    uint32_t version;       // FLAT_AST_VERSION
+    uint32_t byte_order;    // FLAT_BYTE_ORDER as stored by the writer
+    uint32_t node_size;     // sizeof(FlatNode)
+    uint32_t reserved;
+    uint64_t node_count;
+    uint64_t child_count;
+    uint64_t strings_len;
+    uint64_t struct_count;
+    uint64_t field_count;
+    uint64_t source_len;
+    uint64_t nodes_at;      // Section offsets from the start of the file
+    uint64_t children_at;
+    uint64_t strings_at;
+    uint64_t structs_at;
+    uint64_t fields_at;
+    uint64_t source_at;
+} FlatFileHeader;
+
+static const char FLAT_MAGIC[8] = { 'C', 'O', 'M', 'P', 'I', 'A', 'S', 'T' };
+#define FLAT_BYTE_ORDER 0x01020304u
+
+// Pending node in the preorder walk: the tree node and where its id goes
+typedef struct {
+    const ASTNode *node;
+    AstId parent;
+    size_t slot;  // Index in child_ids to fill, or SIZE_MAX for the root
+} FlatWork;
+
+static void* grow_array(void *data, size_t *capacity, size_t needed, size_t elem) {
+
+    size_t cap = *capacity ? *capacity : 256;
+    void *grown = NULL;
+
+    if (needed <= *capacity) {
+        return data;
+    }
+    while (cap < needed) cap *= 2;
+    grown = realloc(data, cap * elem);
+    if (!grown) {
+        perror("Failed to allocate flat AST");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = cap;
+    return grown;
+}
+
+static int token_source(FlatAst *ast, const Token *tok) {
+
+    if (!tok->text) {
+        return 0;
+    }
+    if (!ast->source) {
+        ast->source = tok->text - tok->offset;
+    }
+    if (tok->text != ast->source + tok->offset) {
+        return -1;
+    }
+    if (ast->source_len < (size_t)tok->offset + tok->length) {
+        ast->source_len = (size_t)tok->offset + tok->length;
+    }
+    return 1;
+}
+
+// Offset of text in the string pool, adding it on first use. Values are
+// interned, so seen (keyed by pointer) catches nearly every repeat.
+static int add_string(FlatAst *ast, SymbolMap *seen, const char *text, uint32_t *offset) {
+
+    int known = 0;
+    size_t len = 0;
+
+    if (!text) {
+        *offset = FLAT_NO_VALUE;
+        return 0;
+    }
+    known = symbol_map_get(seen, text, 0);
+    if (known >= 0) {
+        *offset = (uint32_t)known;
+        return 0;
+    }
+    len = strlen(text) + 1;
+    if (ast->strings_len + len > (size_t)INT_MAX) {
+        return -1;
+    }
+    ast->strings = (char*)grow_array(ast->strings, &ast->strings_capacity, ast->strings_len + len, 1);
+    memcpy(ast->strings + ast->strings_len, text, len);
+    *offset = (uint32_t)ast->strings_len;
+    symbol_map_put(seen, text, 0, (int)ast->strings_len);
+    ast->strings_len += len;
+    return 0;
+}
+
+// Copy the struct table of the tree's context
+static int add_structs(FlatAst *ast, SymbolMap *seen, const StructTable *table) {
+
+    const StructInfo *info = NULL;
+    FlatField *field = NULL;
+    int s = 0;
+    int f = 0;
+
+    ast->struct_count = (size_t)table->count;
+    for (s = 0; s < table->count; s++) {
+        ast->field_count += (size_t)table->items[s].field_count;
+    }
+    ast->structs = (FlatStruct*)calloc(ast->struct_count ? ast->struct_count : 1, sizeof(FlatStruct));
+    ast->fields = (FlatField*)calloc(ast->field_count ? ast->field_count : 1, sizeof(FlatField));
+    if (!ast->structs || !ast->fields) {
+        perror("Failed to allocate flat AST");
+        exit(EXIT_FAILURE);
+    }
+    field = ast->fields;
+    for (s = 0; s < table->count; s++) {
+        info = &table->items[s];
+        ast->structs[s].first_field = (uint32_t)(field - ast->fields);
+        ast->structs[s].field_count = (uint32_t)info->field_count;
+        if (add_string(ast, seen, info->name, &ast->structs[s].name) != 0) {
+            return -1;
+        }
+        for (f = 0; f < info->field_count; f++, field++) {
+            if (add_string(ast, seen, info->fields[f].field_name, &field->name) != 0 ||
+                add_string(ast, seen, info->fields[f].field_type, &field->type) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int flat_ast_build(FlatAst *ast, const ASTNode *root) {
+
+    FlatWork *stack = NULL;
+    size_t depth = 0;
+    size_t stack_cap = 0;
+    FlatWork work;
+    FlatNode *flat = NULL;
+    SymbolMap seen;
+    AstId id = 0;
+    int has_token = 0;
+    int rc = 0;
+    int i = 0;
+
+    memset(ast, 0, sizeof(*ast));
+    if (!root) {
+        return 0;
+    }
+    ast->ctx = root->ctx;
+    symbol_map_init(&seen);
+
+    // Explicit stack so deep expression chains cannot overflow the C stack
+    stack = (FlatWork*)grow_array(NULL, &stack_cap, 1, sizeof(FlatWork));
+    stack[depth++] = (FlatWork){ root, AST_NO_ID, (size_t)-1 };
+    while (depth > 0 && rc == 0) {
+        work = stack[--depth];
+        has_token = token_source(ast, &work.node->token);
+        if (has_token < 0 || ast->count >= AST_NO_ID || ast->child_count > UINT32_MAX - (uint32_t)work.node->num_children) {
+            rc = -1;
+            break;
+        }
+
+        ast->nodes = (FlatNode*)grow_array(ast->nodes, &ast->capacity, ast->count + 1, sizeof(FlatNode));
+        id = (AstId)ast->count++;
+        flat = &ast->nodes[id];
+        flat->type = (uint8_t)work.node->type;
+        flat->op = (uint8_t)work.node->op;
+        flat->token_type = (uint8_t)work.node->token.type;
+        flat->token_kw = (uint8_t)work.node->token.kw;
+        flat->token_op = (uint8_t)work.node->token.op;
+        flat->flags = has_token ? FLAT_HAS_TOKEN : 0;
+        flat->reserved = 0;
+        flat->line = (uint32_t)work.node->token.line;
+        flat->offset = work.node->token.offset;
+        flat->length = work.node->token.length;
+        flat->parent = work.parent;
+        rc = add_string(ast, &seen, work.node->value, &flat->value);
+        if (work.slot != (size_t)-1) {
+            ast->child_ids[work.slot] = id;
+        }
+
+        // Reserve the child range now; children fill it as they are visited
+        flat->first_child = (uint32_t)ast->child_count;
+        flat->num_children = (uint32_t)work.node->num_children;
+        ast->child_ids = (AstId*)grow_array(ast->child_ids, &ast->child_capacity,
+                                            ast->child_count + flat->num_children, sizeof(AstId));
+        ast->child_count += flat->num_children;
+
+        // Push in reverse so the first child gets the next id
+        stack = (FlatWork*)grow_array(stack, &stack_cap, depth + flat->num_children, sizeof(FlatWork));
+        for (i = work.node->num_children - 1; i >= 0; i--) {
+            stack[depth++] = (FlatWork){ work.node->children[i], id, flat->first_child + (size_t)i };
+        }
+    }
+    if (rc == 0 && ast->ctx) {
+        rc = add_structs(ast, &seen, &ast->ctx->structs);
+    }
+    free(stack);
+    symbol_map_free(&seen);
+    if (rc != 0) {
+        flat_ast_free(ast);
+    }
+    return rc;
+}
+
+void flat_ast_free(FlatAst *ast) {
+
+    if (ast->file) {
+#ifdef COMPI_HAVE_MMAP
+        if (ast->file_mapped) {
+            munmap(ast->file, ast->file_len);
+        } else
+#endif
+        {
+            free(ast->file);
+        }
+    } else {
+        free(ast->nodes);
+        free(ast->child_ids);
+        free(ast->strings);
+        free(ast->structs);
+        free(ast->fields);
+    }
+    free(ast->views);
+    free(ast->view_children);
+    memset(ast, 0, sizeof(*ast));
+}
+
+Token flat_token(const FlatAst *ast, AstId id) {
+
+    const FlatNode *flat = &ast->nodes[id];
+    Token tok = {0};
+
+    tok.type = (TokenType)flat->token_type;
+    tok.kw = (KeywordKind)flat->token_kw;
+    tok.op = (OperatorKind)flat->token_op;
+    tok.line = (int)flat->line;
+    tok.offset = flat->offset;
+    tok.length = flat->length;
+    tok.text = (flat->flags & FLAT_HAS_TOKEN) ? ast->source + flat->offset : NULL;
+    return tok;
+}
+
+ASTNode* flat_ast_view(FlatAst *ast) {
+
+    size_t n = 0;
+    size_t c = 0;
+    const FlatNode *flat = NULL;
+    ASTNode *view = NULL;
+
+    if (ast->views || !ast->count) {
+        return ast->views;
+    }
+    ast->views = (ASTNode*)malloc(ast->count * sizeof(ASTNode));
+    ast->view_children = (ASTNode**)malloc((ast->child_count ? ast->child_count : 1) * sizeof(ASTNode*));
+    if (!ast->views || !ast->view_children) {
+        perror("Failed to allocate AST view");
+        exit(EXIT_FAILURE);
+    }
+    for (c = 0; c < ast->child_count; c++) {
+        ast->view_children[c] = &ast->views[ast->child_ids[c]];
+    }
+    for (n = 0; n < ast->count; n++) {
+        flat = &ast->nodes[n];
+        view = &ast->views[n];
+        view->type = (NodeType)flat->type;
+        view->op = (OperatorKind)flat->op;
+        view->token = flat_token(ast, (AstId)n);
+        view->value = (char*)flat_value(ast, (AstId)n);
+        view->parent = flat->parent == AST_NO_ID ? NULL : &ast->views[flat->parent];
+        view->children = flat->num_children ? &ast->view_children[flat->first_child] : NULL;
+        view->num_children = (int)flat->num_children;
+        view->capacity = (int)flat->num_children;
+        view->ctx = ast->ctx;  // Context views are skipped by free_node
+    }
+    return ast->views;
+}
+
+// Offset of the section after one of `bytes` bytes at `at`
+static uint64_t section_end(uint64_t at, uint64_t bytes) {
+    return (at + bytes + 7) & ~(uint64_t)7;
+}
+
+static int write_section(FILE *out, uint64_t *pos, uint64_t at, const void *data, size_t bytes) {
+
+    static const char zeros[8] = {0};
+
+    if (at > *pos && fwrite(zeros, 1, (size_t)(at - *pos), out) != at - *pos) {
+        return -1;
+    }
+    if (bytes && fwrite(data, 1, bytes, out) != bytes) {
+        return -1;
+    }
+    *pos = at + bytes;
+    return 0;
+}
+
+int flat_ast_save(const FlatAst *ast, FILE *out) {
+
+    FlatFileHeader h;
+    uint64_t pos = 0;
+    int rc = 0;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FLAT_MAGIC, sizeof(h.magic));
+    h.version = FLAT_AST_VERSION;
+    h.byte_order = FLAT_BYTE_ORDER;
+    h.node_size = (uint32_t)sizeof(FlatNode);
+    h.node_count = ast->count;
+    h.child_count = ast->child_count;
+    h.strings_len = ast->strings_len;
+    h.struct_count = ast->struct_count;
+    h.field_count = ast->field_count;
+    h.source_len = ast->source_len;
+    h.nodes_at = section_end(0, sizeof(h));
+    h.children_at = section_end(h.nodes_at, h.node_count * sizeof(FlatNode));
+    h.strings_at = section_end(h.children_at, h.child_count * sizeof(AstId));
+    h.structs_at = section_end(h.strings_at, h.strings_len);
+    h.fields_at = section_end(h.structs_at, h.struct_count * sizeof(FlatStruct));
+    h.source_at = section_end(h.fields_at, h.field_count * sizeof(FlatField));
+
+    rc |= write_section(out, &pos, 0, &h, sizeof(h));
+    rc |= write_section(out, &pos, h.nodes_at, ast->nodes, ast->count * sizeof(FlatNode));
+    rc |= write_section(out, &pos, h.children_at, ast->child_ids, ast->child_count * sizeof(AstId));
+    rc |= write_section(out, &pos, h.strings_at, ast->strings, ast->strings_len);
+    rc |= write_section(out, &pos, h.structs_at, ast->structs, ast->struct_count * sizeof(FlatStruct));
+    rc |= write_section(out, &pos, h.fields_at, ast->fields, ast->field_count * sizeof(FlatField));
+    rc |= write_section(out, &pos, h.source_at, ast->source, ast->source_len);
+    return rc ? -1 : 0;
+}
+
+// Whether a section of count elements fits in the file
+static int section_ok(uint64_t at, uint64_t count, size_t elem, size_t file_len) {
+    return at % 8 == 0 && at <= file_len && count <= (file_len - at) / elem;
+}
+
+static int string_ok(const FlatAst *ast, uint32_t offset) {
+    return offset < ast->strings_len;
+}
+
+// Check everything codegen will follow, so a damaged file is rejected
+// instead of read out of bounds. Children must have larger ids than their
+// parent (preorder), which also rules out cycles.
+static int flat_ast_valid(const FlatAst *ast) {
+
+    const FlatNode *flat = NULL;
+    size_t n = 0;
+    size_t c = 0;
+
+    if (ast->strings_len && ast->strings[ast->strings_len - 1] != '\0') {
+        return 0;
+    }
+    for (n = 0; n < ast->count; n++) {
+        flat = &ast->nodes[n];
+        if (flat->type >= NODE_TYPE_COUNT || flat->op >= OP_COUNT || flat->token_op >= OP_COUNT ||
+            flat->token_type > TOKEN_EOF || flat->token_kw > KW_VOID) {
+            return 0;
+        }
+        if ((n == 0) != (flat->parent == AST_NO_ID) || (n > 0 && flat->parent >= n)) {
+            return 0;
+        }
+        if ((flat->flags & FLAT_HAS_TOKEN) && (uint64_t)flat->offset + flat->length > ast->source_len) {
+            return 0;
+        }
+        if (flat->value != FLAT_NO_VALUE && !string_ok(ast, flat->value)) {
+            return 0;
+        }
+        if ((uint64_t)flat->first_child + flat->num_children > ast->child_count || flat->num_children > INT_MAX) {
+            return 0;
+        }
+        for (c = flat->first_child; c < (size_t)flat->first_child + flat->num_children; c++) {
+            if (ast->child_ids[c] <= n || ast->child_ids[c] >= ast->count) {
+                return 0;
+            }
+        }
+    }
+    for (n = 0; n < ast->struct_count; n++) {
+        if (!string_ok(ast, ast->structs[n].name) ||
+            (uint64_t)ast->structs[n].first_field + ast->structs[n].field_count > ast->field_count ||
+            ast->structs[n].field_count > INT_MAX) {
+            return 0;
+        }
+    }
+    for (n = 0; n < ast->field_count; n++) {
+        if (!string_ok(ast, ast->fields[n].name) || !string_ok(ast, ast->fields[n].type)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Map (regular files) or read the whole stream into ast->file
+static int load_file(FlatAst *ast, FILE *in) {
+
+    size_t cap = 64 * 1024;
+    size_t n = 0;
+    char *buf = NULL;
+    char *grown = NULL;
+
+#ifdef COMPI_HAVE_MMAP
+    {
+        struct stat st;
+        void *map = NULL;
+        int fd = fileno(in);
+
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                ast->file = map;
+                ast->file_len = (size_t)st.st_size;
+                ast->file_mapped = 1;
+                return 0;
+            }
+        }
+    }
+#endif
+
+    // malloc'd, so the sections are as aligned as a mapping would be
+    buf = (char*)malloc(cap);
+    while (buf) {
+        n += fread(buf + n, 1, cap - n, in);
+        if (n < cap) break;
+        cap *= 2;
+        grown = (char*)realloc(buf, cap);
+        if (!grown) free(buf);
+        buf = grown;
+    }
+    if (!buf || ferror(in)) {
+        free(buf);
+        return -1;
+    }
+    ast->file = buf;
+    ast->file_len = n;
+    return 0;
+}
+
+int flat_ast_load(FlatAst *ast, CompiContext *ctx, FILE *in) {
+
+    FlatFileHeader h;
+    const char *base = NULL;
+    const FlatField *field = NULL;
+    size_t s = 0;
+    uint32_t f = 0;
+    int index = 0;
+
+    memset(ast, 0, sizeof(*ast));
+    if (load_file(ast, in) != 0) {
+        return -1;
+    }
+    base = (const char*)ast->file;
+    if (ast->file_len < sizeof(h)) {
+        flat_ast_free(ast);
+        return -2;
+    }
+    memcpy(&h, base, sizeof(h));
+    if (memcmp(h.magic, FLAT_MAGIC, sizeof(h.magic)) != 0 || h.version != FLAT_AST_VERSION ||
+        h.byte_order != FLAT_BYTE_ORDER || h.node_size != sizeof(FlatNode) ||
+        h.node_count >= AST_NO_ID || h.child_count > UINT32_MAX || h.strings_len > INT_MAX ||
+        !section_ok(h.nodes_at, h.node_count, sizeof(FlatNode), ast->file_len) ||
+        !section_ok(h.children_at, h.child_count, sizeof(AstId), ast->file_len) ||
+        !section_ok(h.strings_at, h.strings_len, 1, ast->file_len) ||
+        !section_ok(h.structs_at, h.struct_count, sizeof(FlatStruct), ast->file_len) ||
+        !section_ok(h.fields_at, h.field_count, sizeof(FlatField), ast->file_len) ||
+        !section_ok(h.source_at, h.source_len, 1, ast->file_len)) {
+        flat_ast_free(ast);
+        return -2;
+    }
+
+    // The arrays are used where they lie in the file
+    ast->nodes = (FlatNode*)(base + h.nodes_at);
+    ast->count = ast->capacity = (size_t)h.node_count;
+    ast->child_ids = (AstId*)(base + h.children_at);
+    ast->child_count = ast->child_capacity = (size_t)h.child_count;
+    ast->strings = (char*)(base + h.strings_at);
+    ast->strings_len = ast->strings_capacity = (size_t)h.strings_len;
+    ast->structs = (FlatStruct*)(base + h.structs_at);
+    ast->struct_count = (size_t)h.struct_count;
+    ast->fields = (FlatField*)(base + h.fields_at);
+    ast->field_count = (size_t)h.field_count;
+    ast->source = base + h.source_at;
+    ast->source_len = (size_t)h.source_len;
+    if (!flat_ast_valid(ast)) {
+        flat_ast_free(ast);
+        return -2;
+    }
+
+    // Codegen looks structs up in the context, so register them there
+    ast->ctx = ctx;
+    for (s = 0; s < ast->struct_count; s++) {
+        index = add_struct(ctx, ast->strings + ast->structs[s].name);
+        field = &ast->fields[ast->structs[s].first_field];
+        for (f = 0; f < ast->structs[s].field_count; f++, field++) {
+            add_struct_field(ctx, index, ast->strings + field->name, ast->strings + field->type);
+        }
+    }
+    return 0;
+}
@@ -1,62 +1,167 @@
 #include "astnode.h"
+#include "compi_context.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Create a new AST node
-ASTNode* create_node(NodeType type) {
+ASTNode* create_node(CompiContext *ctx, NodeType type) {
 
-    ASTNode *node = (ASTNode*)malloc(sizeof(ASTNode));
+    ASTNode *node = NULL;
 
-    if (!node) {
-        perror("Failed to allocate memory for AST node");
-        exit(EXIT_FAILURE);
+    if (ctx && ctx->heap_nodes) {
+        ctx = NULL;
+    }
+    if (ctx) {
+        node = (ASTNode*)arena_alloc(&ctx->arena, sizeof(ASTNode));
+    } else {
+        node = (ASTNode*)malloc(sizeof(ASTNode));
+        if (!node) {
+            perror("Failed to allocate memory for AST node");
+            exit(EXIT_FAILURE);
+        }
     }
     
     node->type = type;
+    node->op = OP_NONE;
+    node->token = (Token){0};
     node->value = NULL;
     node->parent = NULL;
     node->children = NULL;
     node->num_children = 0;
     node->capacity = 0;
+    node->ctx = ctx;
     
     return node;
 }
 
-// Free an AST node and all its children
+// Make room for one more entry on a heap work stack
+static void* grow_stack(void *items, size_t *capacity, size_t count, size_t elem) {
+
+    size_t cap = *capacity ? *capacity * 2 : 64;
+    void *grown = NULL;
+
+    if (count < *capacity) {
+        return items;
+    }
+    grown = realloc(items, cap * elem);
+    if (!grown) {
+        perror("Failed to allocate AST work stack");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = cap;
+    return grown;
+}
+
+// Free an AST node and all its children. Context nodes are released
+// together with their context instead. An explicit stack keeps deeply
+// nested trees off the C stack.
 void free_node(ASTNode *node) {
 
-    if (!node) return;
-    
-    for (int i = 0; i < node->num_children; i++) {
-        free_node(node->children[i]);
+    ASTNode **stack = NULL;
+    size_t depth = 0;
+    size_t capacity = 0;
+    int i = 0;
+
+    if (!node || node->ctx) return;
+
+    stack = (ASTNode**)grow_stack(NULL, &capacity, 0, sizeof(ASTNode*));
+    stack[depth++] = node;
+    while (depth > 0) {
+        node = stack[--depth];
+        for (i = 0; i < node->num_children; i++) {
+            if (!node->children[i] || node->children[i]->ctx) continue;
+            stack = (ASTNode**)grow_stack(stack, &capacity, depth, sizeof(ASTNode*));
+            stack[depth++] = node->children[i];
+        }
+        free(node->children);
+        free(node->value);
+        free(node);
     }
-    
-    free(node->children);
-    free(node->value);
-    free(node);
+    free(stack);
 }
 
-// Add a child node
-void add_child(ASTNode *parent, ASTNode *child) {
+// Pending node of ast_walk and its depth below the root
+typedef struct {
+    const ASTNode *node;
+    int depth;
+} WalkItem;
 
-    if (!parent->children) {
-        parent->capacity = 4;  // Start with space for 4 children
-        parent->children = (ASTNode**)malloc(parent->capacity * sizeof(ASTNode*));
-        if (!parent->children) {
-            perror("Failed to allocate memory for child nodes");
-            exit(EXIT_FAILURE);
+void ast_walk(const ASTNode *root, AstVisitor visit, void *arg) {
+
+    WalkItem *stack = NULL;
+    WalkItem item;
+    size_t depth = 0;
+    size_t capacity = 0;
+    int i = 0;
+
+    if (!root) return;
+
+    stack = (WalkItem*)grow_stack(NULL, &capacity, 0, sizeof(WalkItem));
+    stack[depth++] = (WalkItem){ root, 0 };
+    while (depth > 0) {
+        item = stack[--depth];
+        visit(item.node, item.depth, arg);
+        // Push in reverse so the children are visited in order
+        for (i = item.node->num_children - 1; i >= 0; i--) {
+            if (!item.node->children[i]) continue;
+            stack = (WalkItem*)grow_stack(stack, &capacity, depth, sizeof(WalkItem));
+            stack[depth++] = (WalkItem){ item.node->children[i], item.depth + 1 };
         }
     }
-    
+    free(stack);
+}
+
+// Add a child node
+void add_child(ASTNode *parent, ASTNode *child) {
+
+    int old_capacity = parent->capacity;
+
     if (parent->num_children >= parent->capacity) {
-        parent->capacity *= 2;
-        parent->children = (ASTNode**)realloc(parent->children, 
-                                             parent->capacity * sizeof(ASTNode*));
-        if (!parent->children) {
-            perror("Failed to reallocate memory for child nodes");
-            exit(EXIT_FAILURE);
+        parent->capacity = parent->capacity ? parent->capacity * 2 : 4;  // Start with space for 4 children
+        if (parent->ctx) {
+            parent->children = (ASTNode**)arena_grow(&parent->ctx->arena, parent->children,
+                                                     old_capacity * sizeof(ASTNode*),
+                                                     parent->capacity * sizeof(ASTNode*));
+        } else {
+            parent->children = (ASTNode**)realloc(parent->children,
+                                                 parent->capacity * sizeof(ASTNode*));
+            if (!parent->children) {
+                perror("Failed to allocate memory for child nodes");
+                exit(EXIT_FAILURE);
+            }
         }
     }
     
     parent->children[parent->num_children++] = child;
     child->parent = parent;
-}
\ No newline at end of file
+}
+
+// Replace node->value with a copy of len bytes of text. Context nodes share
+// the interned copy, so equal names are stored once.
+void node_set_value_n(ASTNode *node, const char *text, size_t len) {
+
+    char *copy = NULL;
+
+    if (node->ctx) {
+        copy = (char*)intern_n(&node->ctx->names, text, len);
+    } else {
+        copy = (char*)malloc(len + 1);
+        if (!copy) {
+            perror("Failed to allocate node value");
+            exit(EXIT_FAILURE);
+        }
+        if (len) memcpy(copy, text, len);
+        copy[len] = '\0';
+        free(node->value);
+    }
+    node->value = copy;
+}
+
+void node_set_value(ASTNode *node, const char *text) {
+    node_set_value_n(node, text, strlen(text));
+}
+
+void node_set_value_token(ASTNode *node, const Token *tok) {
+    node_set_value_n(node, tok->text, tok->length);
+}
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include "compi_api.h"
+#include "compi_context.h"
+#include "codegen_vhdl.h"
+#include "parse.h"
+#include "out_sink.h"
+#include "preprocess.h"
+
+struct CompiSession {
+    CompiContext ctx;
+    int jobs;
+    char *cache_dir;
+};
+
+CompiSession* compi_session_new(const CompiOptions *opts) {
+
+    CompiSession *session = (CompiSession*)calloc(1, sizeof(CompiSession));
+
+    if (!session) return NULL;
+    compi_context_init(&session->ctx);
+    if (opts) {
+        session->jobs = opts->jobs;
+        if (opts->cache_dir) {
+            session->cache_dir = strdup(opts->cache_dir);
+            if (!session->cache_dir) {
+                compi_session_free(session);
+                return NULL;
+            }
+        }
+    }
+    return session;
+}
+
+void compi_session_free(CompiSession *session) {
+
+    if (!session) return;
+    compi_context_free(&session->ctx);
+    free(session->cache_dir);
+    free(session);
+}
+
+// Copy the context's diagnostics into the result: one text block, plus a
+// list whose entries point into it
+static void take_diagnostics(const CompiContext *ctx, CompiResult *result) {
+
+    const DiagList *diags = &ctx->diags;
+    OutSink text;
+    size_t offset = 0;
+    size_t k = 0;
+
+    sink_init_memory(&text);
+    for (k = 0; k < diags->count; k++) {
+        sink_write(&text, diags->items[k].text, diags->items[k].len);
+    }
+    result->diagnostics = sink_take(&text, &result->diagnostics_len);
+    sink_close(&text);
+    result->error_count = diags->errors;
+    if (!result->diagnostics || diags->count == 0) return;
+
+    result->diag_list = (CompiDiagnostic*)malloc(diags->count * sizeof(CompiDiagnostic));
+    if (!result->diag_list) return;
+    for (k = 0; k < diags->count; k++) {
+        result->diag_list[k].is_error = diags->items[k].severity == DIAG_ERROR;
+        result->diag_list[k].line = diags->items[k].line;
+        result->diag_list[k].text = result->diagnostics + offset;
+        result->diag_list[k].len = diags->items[k].len;
+        offset += diags->items[k].len;
+    }
+    result->diag_count = diags->count;
+}
+
+int compi_session_compile(CompiSession *session, const char *src, size_t len, CompiResult *result) {
+
+    CompiContext *ctx = &session->ctx;
+    ASTNode *program = NULL;
+    OutSink out;
+
+    memset(result, 0, sizeof(*result));
+    compi_context_reset(ctx);
+    ctx->parse_jobs = session->jobs;
+    ctx->codegen_jobs = session->jobs;
+    ctx->cache.dir = session->cache_dir;
+    compi_context_load_buffer(ctx, src, len);
+    sink_init_memory(&out);
+
+    // Errors resync inside parse_program; they are collected, not printed
+    ctx->diag_hold = 1;
+    preprocess_source(ctx, NULL, NULL);
+    program = parse_program(ctx);
+    generate_vhdl_sink(ctx, program, &out);
+    ctx->diag_hold = 0;
+
+    result->vhdl = sink_take(&out, &result->vhdl_len);
+    sink_close(&out);
+    take_diagnostics(ctx, result);
+    result->ok = ctx->diags.errors == 0 && result->vhdl && result->diagnostics;
+    return result->ok ? 0 : -1;
+}
+
+int compi_compile(const char *src, size_t len, const CompiOptions *opts, CompiResult *result) {
+
+    CompiSession *session = compi_session_new(opts);
+    int rc = 0;
+
+    if (!session) {
+        memset(result, 0, sizeof(*result));
+        return -1;
+    }
+    rc = compi_session_compile(session, src, len, result);
+    compi_session_free(session);
+    return rc;
+}
+
+void compi_result_free(CompiResult *result) {
+
+    if (!result) return;
+    free(result->vhdl);
+    free(result->diagnostics);
+    free(result->diag_list);
+    memset(result, 0, sizeof(*result));
+}
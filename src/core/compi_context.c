@@ -0,0 +1,173 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compi_context.h"
+
+void compi_context_init(CompiContext *ctx) {
+
+    memset(ctx, 0, sizeof(*ctx));
+    lexer_init_buffer(&ctx->lexer, NULL, 0);
+    arena_init(&ctx->arena, ARENA_DEFAULT_CHUNK);
+    interner_init(&ctx->names);
+    diag_init(&ctx->diags);
+}
+
+void compi_context_free(CompiContext *ctx) {
+
+    int i = 0;
+
+    for (i = 0; i < ctx->shard_count; i++) {
+        compi_context_free(&ctx->shards[i]);
+    }
+    free(ctx->shards);
+    ctx->shards = NULL;
+    ctx->shard_count = 0;
+    token_buffer_free(&ctx->tokens);
+    lexer_release(&ctx->lexer);
+    interner_free(&ctx->names);
+    arena_free(&ctx->arena);
+    free_arrays(ctx);
+    free_structs(ctx);
+    func_cache_free(&ctx->cache);
+    diag_free(&ctx->diags);
+}
+
+void compi_context_reset(CompiContext *ctx) {
+
+    int i = 0;
+
+    for (i = 0; i < ctx->shard_count; i++) {
+        compi_context_free(&ctx->shards[i]);
+    }
+    free(ctx->shards);
+    ctx->shards = NULL;
+    ctx->shard_count = 0;
+    ctx->tokens.count = 0;
+    ctx->tokens.pos = 0;
+    ctx->tokens.marks = 0;
+    lexer_release(&ctx->lexer);
+    memset(&ctx->current_token, 0, sizeof(ctx->current_token));
+    interner_reset(&ctx->names);
+    arena_reset(&ctx->arena);
+    reset_arrays(ctx);
+    reset_structs(ctx);
+    ctx->loop_depth = 0;
+    func_cache_free(&ctx->cache);
+    ctx->cache.hits = 0;
+    ctx->cache.misses = 0;
+    diag_reset(&ctx->diags);
+}
+
+int compi_context_load_file(CompiContext *ctx, FILE *input) {
+
+    token_buffer_free(&ctx->tokens);
+    lexer_release(&ctx->lexer);
+    return lexer_init_file(&ctx->lexer, input);
+}
+
+void compi_context_load_buffer(CompiContext *ctx, const char *src, size_t len) {
+
+    token_buffer_free(&ctx->tokens);
+    lexer_release(&ctx->lexer);
+    lexer_init_buffer(&ctx->lexer, src, len);
+}
+
+void compi_context_take_buffer(CompiContext *ctx, char *src, size_t len) {
+
+    compi_context_load_buffer(ctx, src, len);
+    ctx->lexer.owned = src;
+}
+
+void compi_context_init_shard(CompiContext *shard, const CompiContext *parent) {
+
+    const StructInfo *from = NULL;
+    int s = 0;
+    int f = 0;
+    int idx = 0;
+
+    compi_context_init(shard);
+    lexer_init_buffer(&shard->lexer, parent->lexer.src, (size_t)(parent->lexer.end - parent->lexer.src));
+    shard->heap_nodes = parent->heap_nodes;
+
+    // Re-register so pointer-compared lookups work against the shard's names
+    for (s = 0; s < parent->structs.count; s++) {
+        from = &parent->structs.items[s];
+        idx = add_struct(shard, from->name);
+        for (f = 0; f < from->field_count; f++) {
+            add_struct_field(shard, idx, from->fields[f].field_name, from->fields[f].field_type);
+        }
+    }
+    shard->stats = parent->stats;   // Set after the copy, which is not user work
+}
+
+void compi_report(CompiContext *ctx, DiagSeverity severity, int line, const char *text, size_t len) {
+
+    diag_add(&ctx->diags, severity, line, text, len);
+    if (ctx->diag_hold) return;
+    if (ctx->diag) {
+        sink_write(ctx->diag, text, len);
+    } else {
+        fwrite(text, 1, len, stdout);
+    }
+}
+
+// Format "<prefix><message>\n" and report it
+static void report_v(CompiContext *ctx, DiagSeverity severity, const char *fmt, va_list args) {
+
+    char local[256];
+    char *text = local;
+    int line = ctx->current_token.line;
+    int head = 0;
+    int body = 0;
+    va_list copy;
+
+    if (severity == DIAG_ERROR) {
+        head = snprintf(local, sizeof(local), "Error (line %d): ", line);
+    } else {
+        head = snprintf(local, sizeof(local), "Warning: ");
+    }
+    va_copy(copy, args);
+    body = vsnprintf(local + head, sizeof(local) - (size_t)head, fmt, copy);
+    va_end(copy);
+    if (body < 0) body = 0;
+    if ((size_t)(head + body) + 2 > sizeof(local)) {
+        text = (char*)malloc((size_t)(head + body) + 2);
+        if (!text) {
+            perror("Failed to allocate diagnostic");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(text, local, (size_t)head);
+        vsnprintf(text + head, (size_t)body + 1, fmt, args);
+    }
+    text[head + body] = '\n';
+    text[head + body + 1] = '\0';
+    compi_report(ctx, severity, line, text, (size_t)(head + body) + 1);
+    if (text != local) free(text);
+}
+
+void compi_error(CompiContext *ctx, const char *fmt, ...) {
+
+    va_list args;
+
+    va_start(args, fmt);
+    report_v(ctx, DIAG_ERROR, fmt, args);
+    va_end(args);
+}
+
+void compi_warning(CompiContext *ctx, const char *fmt, ...) {
+
+    va_list args;
+
+    va_start(args, fmt);
+    report_v(ctx, DIAG_WARNING, fmt, args);
+    va_end(args);
+}
+
+void compi_fail(CompiContext *ctx) {
+
+    fflush(stdout);
+    if (ctx && ctx->fail_env) {
+        longjmp(*ctx->fail_env, 1);
+    }
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,183 @@
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "compi_stats.h"
+#include "lexer.h"
+
+static const char *s_phase_names[PHASE_COUNT] = {
+    "read", "lex", "parse", "symbols", "codegen", "write"
+};
+
+static const char *s_node_names[NODE_TYPE_COUNT] = {
+    "program", "function_decl", "struct_decl", "var_decl", "statement",
+    "expression", "binary_expr", "literal", "identifier", "assignment",
+    "binary_op", "if", "else_if", "else", "while", "for", "break",
+    "continue", "index", "member", "cached_function"
+};
+
+static uint64_t clock_ns(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void compi_stats_init(CompiStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+double compi_stats_now_ms(void) {
+    return (double)clock_ns() / 1e6;
+}
+
+uint64_t compi_stats_symbol_begin(const CompiStats *stats) {
+    return stats ? clock_ns() : 0;
+}
+
+// Shards and codegen workers share one stats block
+void compi_stats_symbol_end(CompiStats *stats, uint64_t start) {
+
+    if (!stats) return;
+    __atomic_fetch_add(&stats->symbol_ns, clock_ns() - start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->symbol_ops, 1, __ATOMIC_RELAXED);
+}
+
+void compi_stats_add(size_t *counter, size_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+void compi_stats_lex(CompiStats *stats, const char *src, size_t len) {
+
+    Lexer lx;
+    double start = compi_stats_now_ms();
+
+    lexer_init_buffer(&lx, src, len);
+    while (lexer_next(&lx).type != TOKEN_EOF) {
+        stats->tokens++;
+    }
+    stats->phase_ms[PHASE_LEX] += compi_stats_now_ms() - start;
+}
+
+static void count_node(const ASTNode *node, int depth, void *arg) {
+
+    CompiStats *stats = (CompiStats*)arg;
+
+    (void)depth;
+    stats->nodes++;
+    if ((int)node->type >= 0 && node->type < NODE_TYPE_COUNT) {
+        stats->nodes_by_type[node->type]++;
+    }
+}
+
+void compi_stats_count_nodes(CompiStats *stats, const ASTNode *root) {
+    ast_walk(root, count_node, stats);
+}
+
+long compi_stats_peak_rss_kb(void) {
+
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss;   // KiB on Linux
+}
+
+// Cost of one begin/end timer pair, taken out of the symbol time;
+// measured once so every report of a run uses the same figure
+static double timer_overhead_ns(void) {
+
+    static double overhead = -1.0;
+    uint64_t start = 0;
+    uint64_t sink = 0;
+    int i = 0;
+
+    if (overhead >= 0) return overhead;
+    start = clock_ns();
+    for (i = 0; i < 1000; i++) {
+        sink += clock_ns();
+        sink -= clock_ns();
+    }
+    (void)sink;
+    overhead = (double)(clock_ns() - start) / 1000.0;
+    return overhead;
+}
+
+static double symbol_ms(const CompiStats *stats) {
+
+    double ns = (double)stats->symbol_ns - (double)stats->symbol_ops * timer_overhead_ns();
+
+    return ns > 0 ? ns / 1e6 : 0.0;
+}
+
+void compi_stats_print(const CompiStats *stats, FILE *out, int counts) {
+
+    int p = 0;
+    int t = 0;
+
+    fprintf(out, "Time report (ms):\n");
+    for (p = 0; p < PHASE_COUNT; p++) {
+        fprintf(out, "  %-8s %10.3f%s\n", s_phase_names[p],
+                p == PHASE_SYMBOLS ? symbol_ms(stats) : stats->phase_ms[p],
+                p == PHASE_SYMBOLS ? "   (within parse and codegen)" : "");
+    }
+    fprintf(out, "  %-8s %10.3f\n", "total", stats->total_ms);
+    if (!counts) return;
+
+    fprintf(out, "Stats:\n");
+    fprintf(out, "  tokens         %zu\n", stats->tokens);
+    fprintf(out, "  AST nodes      %zu\n", stats->nodes);
+    for (t = 0; t < NODE_TYPE_COUNT; t++) {
+        if (stats->nodes_by_type[t]) {
+            fprintf(out, "    %-16s %zu\n", s_node_names[t], stats->nodes_by_type[t]);
+        }
+    }
+    fprintf(out, "  arrays         %zu\n", stats->arrays);
+    fprintf(out, "  structs        %zu (%zu fields)\n", stats->structs, stats->struct_fields);
+    fprintf(out, "  symbol calls   %zu\n", stats->symbol_ops);
+    fprintf(out, "  bytes emitted  %zu\n", stats->bytes_emitted);
+    fprintf(out, "  peak RSS       %ld KiB\n", compi_stats_peak_rss_kb());
+}
+
+static void print_json_string(FILE *out, const char *s) {
+
+    fputc('"', out);
+    for (; s && *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(out, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void compi_stats_print_json(const CompiStats *stats, FILE *out, int counts,
+                            const char *input, const char *output, int ok) {
+
+    int p = 0;
+    int t = 0;
+
+    fprintf(out, "{\"input\": ");
+    print_json_string(out, input);
+    fprintf(out, ", \"output\": ");
+    print_json_string(out, output);
+    fprintf(out, ", \"ok\": %s, \"time_ms\": {", ok ? "true" : "false");
+    for (p = 0; p < PHASE_COUNT; p++) {
+        fprintf(out, "\"%s\": %.3f, ", s_phase_names[p], p == PHASE_SYMBOLS ? symbol_ms(stats) : stats->phase_ms[p]);
+    }
+    fprintf(out, "\"total\": %.3f}", stats->total_ms);
+    if (counts) {
+        fprintf(out, ", \"tokens\": %zu, \"nodes\": {\"total\": %zu", stats->tokens, stats->nodes);
+        for (t = 0; t < NODE_TYPE_COUNT; t++) {
+            if (stats->nodes_by_type[t]) {
+                fprintf(out, ", \"%s\": %zu", s_node_names[t], stats->nodes_by_type[t]);
+            }
+        }
+        fprintf(out, "}, \"symbols\": {\"arrays\": %zu, \"structs\": %zu, \"struct_fields\": %zu, \"calls\": %zu}",
+                stats->arrays, stats->structs, stats->struct_fields, stats->symbol_ops);
+        fprintf(out, ", \"bytes_emitted\": %zu", stats->bytes_emitted);
+    }
+    fputc('}', out);
+}
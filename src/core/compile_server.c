@@ -0,0 +1,421 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "compile_server.h"
+#include "compi_context.h"
+#include "codegen_vhdl.h"
+#include "parse.h"
+#include "work_pool.h"
+#include "out_sink.h"
+#include "preprocess.h"
+
+#define CONN_LINE_MAX 4096
+#define CONN_SOURCE_MAX ((size_t)256 * 1024 * 1024)   // Largest 'source' body
+
+// Buffered reader over a socket, shared by the server and the client
+typedef struct {
+    int fd;
+    char buf[16 * 1024];
+    size_t len;
+    size_t pos;
+} Conn;
+
+typedef struct {
+    int listen_fd;
+    atomic_int stopping;
+} Server;
+
+static void conn_init(Conn *c, int fd) {
+
+    c->fd = fd;
+    c->len = 0;
+    c->pos = 0;
+}
+
+// Returns 1 when more bytes are buffered, 0 on EOF or error
+static int conn_fill(Conn *c) {
+
+    ssize_t n = 0;
+
+    do {
+        n = recv(c->fd, c->buf, sizeof(c->buf), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return 0;
+    c->len = (size_t)n;
+    c->pos = 0;
+    return 1;
+}
+
+// Read one '\n'-terminated line without the terminator. Returns its length,
+// or -1 on EOF, error or a line longer than cap - 1.
+static int conn_read_line(Conn *c, char *line, size_t cap) {
+
+    size_t n = 0;
+    char ch = 0;
+
+    for (;;) {
+        if (c->pos == c->len && !conn_fill(c)) return -1;
+        ch = c->buf[c->pos++];
+        if (ch == '\n') break;
+        if (n + 1 >= cap) return -1;
+        line[n++] = ch;
+    }
+    if (n > 0 && line[n - 1] == '\r') n--;
+    line[n] = '\0';
+    return (int)n;
+}
+
+static int conn_read_exact(Conn *c, char *dst, size_t n) {
+
+    size_t chunk = 0;
+
+    while (n > 0) {
+        if (c->pos == c->len && !conn_fill(c)) return -1;
+        chunk = c->len - c->pos < n ? c->len - c->pos : n;
+        memcpy(dst, c->buf + c->pos, chunk);
+        c->pos += chunk;
+        dst += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+
+    ssize_t n = 0;
+
+    while (len > 0) {
+        n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int send_reply(int fd, int ok, const char *text, size_t len) {
+
+    char head[64];
+    int n = snprintf(head, sizeof(head), "%s %zu\n", ok ? "ok" : "error", len);
+
+    if (send_all(fd, head, (size_t)n) != 0) return -1;
+    return send_all(fd, text, len);
+}
+
+// Compile one request on the worker's context (reset first, so the arena,
+// interner and tables keep their capacity) into out. Returns 1 on success;
+// on failure out holds the error and warning messages instead. With src,
+// include_base names the source file for #include "..." (NULL: the
+// server's directory).
+static int compile_request(CompiContext *ctx, const char *src, size_t len, const char *path,
+                           const char *include_base, int jobs, const char *cache_dir, OutSink *out) {
+
+    ASTNode *program = NULL;
+    FILE *fin = NULL;
+    OutSink diag;
+    int ok = 1;
+
+    compi_context_reset(ctx);
+    ctx->parse_jobs = jobs;
+    ctx->codegen_jobs = jobs;
+    ctx->cache.dir = cache_dir;
+    if (path) {
+        fin = fopen(path, "r");
+        if (!fin || compi_context_load_file(ctx, fin) != 0) {
+            sink_printf(out, "%s: %s: %s\n", path, fin ? "Error reading input file" : "Error opening input file", strerror(errno));
+            if (fin) fclose(fin);
+            return 0;
+        }
+    } else {
+        compi_context_load_buffer(ctx, src, len);
+    }
+
+    // Diagnostics go back to the client rather than to the server's stdout
+    sink_init_memory(&diag);
+    ctx->diag = &diag;
+    // Headers are read per request: a client may have edited them since
+    preprocess_source(ctx, path ? path : include_base, NULL);
+    program = parse_program(ctx);
+    ctx->diag = NULL;
+    if (ctx->diags.errors) {
+        sink_write(out, diag.buf, diag.len);
+        ok = 0;
+    } else if (generate_vhdl_sink(ctx, program, out) != 0) {
+        ok = 0;
+    }
+    sink_close(&diag);
+    if (fin) fclose(fin);
+    return ok;
+}
+
+// Answer requests on one connection until the client closes it. Returns 1
+// when a shutdown was requested.
+static int serve_connection(Server *server, CompiContext *ctx, int fd) {
+
+    Conn *conn = (Conn*)malloc(sizeof(Conn));
+    char header[CONN_LINE_MAX];
+    char path[CONN_LINE_MAX];
+    char cache_dir[CONN_LINE_MAX];
+    char *source = NULL;
+    char *grown = NULL;
+    char *text = NULL;
+    char *value = NULL;
+    char *end = NULL;
+    unsigned long long requested = 0;
+    size_t source_cap = 0;
+    size_t source_len = 0;
+    size_t text_len = 0;
+    int have_source = 0;
+    int have_path = 0;
+    int have_cache = 0;
+    int jobs = 1;
+    int shutdown_requested = 0;
+    int ok = 0;
+    OutSink out;
+
+    if (!conn) return 0;
+    conn_init(conn, fd);
+    for (;;) {
+        have_source = have_path = have_cache = 0;
+        jobs = 1;
+        source_len = 0;
+
+        // Header lines up to the empty line
+        for (;;) {
+            if (conn_read_line(conn, header, sizeof(header)) < 0) goto done;
+            if (header[0] == '\0') break;
+            value = strchr(header, ' ');
+            if (!value) continue;
+            *value++ = '\0';
+            if (strcmp(header, "source") == 0) {
+                errno = 0;
+                requested = strtoull(value, &end, 10);
+                if (value[0] < '0' || value[0] > '9' || *end != '\0' || errno || requested > CONN_SOURCE_MAX) {
+                    // The body cannot be skipped safely: answer and drop the connection
+                    static const char msg[] = "Invalid 'source' length\n";
+                    send_reply(fd, 0, msg, sizeof(msg) - 1);
+                    goto done;
+                }
+                source_len = (size_t)requested;
+                have_source = 1;
+            } else if (strcmp(header, "path") == 0) {
+                snprintf(path, sizeof(path), "%s", value);
+                have_path = 1;
+            } else if (strcmp(header, "jobs") == 0) {
+                jobs = atoi(value);
+            } else if (strcmp(header, "cache-dir") == 0) {
+                snprintf(cache_dir, sizeof(cache_dir), "%s", value);
+                have_cache = 1;
+            } else if (strcmp(header, "shutdown") == 0) {
+                shutdown_requested = atoi(value) != 0;
+            }
+        }
+        if (have_source) {
+            if (source_len + 1 > source_cap) {
+                grown = (char*)realloc(source, source_len + 1);
+                if (!grown) goto done;
+                source = grown;
+                source_cap = source_len + 1;
+            }
+            if (conn_read_exact(conn, source, source_len) != 0) goto done;
+            source[source_len] = '\0';
+        }
+
+        if (shutdown_requested) {
+            send_reply(fd, 1, "", 0);
+            goto done;
+        }
+        sink_init_memory(&out);
+        if (!have_source && !have_path) {
+            sink_lit(&out, "Request has neither 'source' nor 'path'\n");
+            ok = 0;
+        } else {
+            ok = compile_request(ctx, source, source_len, have_source ? NULL : path,
+                                 have_source && have_path ? path : NULL,
+                                 jobs, have_cache ? cache_dir : NULL, &out);
+        }
+        text = sink_take(&out, &text_len);
+        if (!text) {
+            ok = 0;
+            text_len = 0;
+        }
+        if (send_reply(fd, ok, text ? text : "", text_len) != 0) {
+            free(text);
+            goto done;
+        }
+        free(text);
+    }
+
+done:
+    if (shutdown_requested) {
+        atomic_store(&server->stopping, 1);
+        shutdown(server->listen_fd, SHUT_RDWR);   // Wakes the workers in accept
+    }
+    free(source);
+    free(conn);
+    return shutdown_requested;
+}
+
+// One worker: accept and serve connections with a context kept warm across
+// requests, until the server stops
+static void serve_worker(void *arg, size_t index) {
+
+    Server *server = (Server*)arg;
+    CompiContext ctx;
+    int fd = -1;
+
+    (void)index;
+    compi_context_init(&ctx);
+    while (!atomic_load(&server->stopping)) {
+        fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (atomic_load(&server->stopping)) break;
+            perror("compi: accept");
+            usleep(10000);   // e.g. out of descriptors: back off
+            continue;
+        }
+        serve_connection(server, &ctx, fd);
+        close(fd);
+    }
+    compi_context_free(&ctx);
+}
+
+static int socket_address(const char *socket_path, struct sockaddr_un *addr) {
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, socket_path);
+    return 0;
+}
+
+int compile_server_run(const char *socket_path, int jobs) {
+
+    struct sockaddr_un addr;
+    Server server;
+
+    if (socket_address(socket_path, &addr) != 0) {
+        perror("compi: socket path");
+        return -1;
+    }
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.listen_fd < 0) {
+        perror("compi: socket");
+        return -1;
+    }
+    unlink(socket_path);   // Left behind by a server that did not shut down
+    if (bind(server.listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(server.listen_fd, 64) != 0) {
+        perror("compi: bind");
+        close(server.listen_fd);
+        return -1;
+    }
+    atomic_init(&server.stopping, 0);
+    if (jobs <= 0) {
+        jobs = work_pool_default_jobs();
+    }
+    printf("compi: serving on %s with %d workers\n", socket_path, jobs);
+    fflush(stdout);
+
+    work_pool_run(jobs, (size_t)jobs, serve_worker, &server);
+
+    close(server.listen_fd);
+    unlink(socket_path);
+    return 0;
+}
+
+int compile_client_connect(const char *socket_path) {
+
+    struct sockaddr_un addr;
+    int fd = -1;
+
+    if (socket_address(socket_path, &addr) != 0) return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int compile_client_request(int fd, const CompileRequest *req, CompileReply *reply) {
+
+    Conn *conn = NULL;
+    char head[3 * CONN_LINE_MAX];
+    char line[64];
+    size_t used = 0;
+    unsigned long long len = 0;
+    int rc = -1;
+
+    memset(reply, 0, sizeof(*reply));
+    if (req->source) {
+        used = (size_t)snprintf(head, sizeof(head), "source %zu\n", req->len);
+        if (req->path) {
+            used += (size_t)snprintf(head + used, sizeof(head) - used, "path %s\n", req->path);
+        }
+    } else {
+        used = (size_t)snprintf(head, sizeof(head), "path %s\n", req->path ? req->path : "");
+    }
+    if (req->jobs > 0) {
+        used += (size_t)snprintf(head + used, sizeof(head) - used, "jobs %d\n", req->jobs);
+    }
+    if (req->cache_dir) {
+        used += (size_t)snprintf(head + used, sizeof(head) - used, "cache-dir %s\n", req->cache_dir);
+    }
+    used += (size_t)snprintf(head + used, sizeof(head) - used, "\n");
+    if (used >= sizeof(head) || send_all(fd, head, used) != 0) return -1;
+    if (req->source && send_all(fd, req->source, req->len) != 0) return -1;
+
+    conn = (Conn*)malloc(sizeof(Conn));
+    if (!conn) return -1;
+    conn_init(conn, fd);
+    if (conn_read_line(conn, line, sizeof(line)) < 0) goto out;
+    if (sscanf(line, "ok %llu", &len) == 1) {
+        reply->ok = 1;
+    } else if (sscanf(line, "error %llu", &len) != 1) {
+        goto out;
+    }
+    reply->text = (char*)malloc((size_t)len + 1);
+    if (!reply->text || conn_read_exact(conn, reply->text, (size_t)len) != 0) {
+        free(reply->text);
+        reply->text = NULL;
+        goto out;
+    }
+    reply->text[len] = '\0';
+    reply->len = (size_t)len;
+    rc = 0;
+out:
+    free(conn);
+    return rc;
+}
+
+int compile_client_shutdown(const char *socket_path) {
+
+    static const char request[] = "shutdown 1\n\n";
+    Conn *conn = NULL;
+    char line[64];
+    int fd = compile_client_connect(socket_path);
+    int rc = -1;
+
+    if (fd < 0) return -1;
+    conn = (Conn*)malloc(sizeof(Conn));
+    if (conn && send_all(fd, request, sizeof(request) - 1) == 0) {
+        conn_init(conn, fd);
+        if (conn_read_line(conn, line, sizeof(line)) >= 0 && strcmp(line, "ok 0") == 0) {
+            rc = 0;
+        }
+    }
+    free(conn);
+    close(fd);
+    return rc;
+}
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "diag.h"
+
+#define DIAG_TEXT_CHUNK 4096
+
+void diag_init(DiagList *list) {
+
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->errors = 0;
+    arena_init(&list->text, DIAG_TEXT_CHUNK);
+}
+
+void diag_free(DiagList *list) {
+
+    free(list->items);
+    arena_free(&list->text);
+    diag_init(list);
+}
+
+void diag_reset(DiagList *list) {
+
+    list->count = 0;
+    list->errors = 0;
+    arena_reset(&list->text);
+}
+
+const Diagnostic* diag_add(DiagList *list, DiagSeverity severity, int line, const char *text, size_t len) {
+
+    Diagnostic *grown = NULL;
+    Diagnostic *d = NULL;
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        grown = (Diagnostic*)realloc(list->items, list->capacity * sizeof(Diagnostic));
+        if (!grown) {
+            perror("Failed to allocate diagnostics");
+            exit(EXIT_FAILURE);
+        }
+        list->items = grown;
+    }
+    d = &list->items[list->count++];
+    d->severity = severity;
+    d->line = line;
+    d->text = arena_strndup(&list->text, text, len);
+    d->len = len;
+    if (severity == DIAG_ERROR) list->errors++;
+    return d;
+}
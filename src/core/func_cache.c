@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "func_cache.h"
+
+uint64_t func_cache_hash(uint64_t h, const void *data, size_t len) {
+
+    const unsigned char *p = (const unsigned char*)data;
+    size_t i = 0;
+
+    for (i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Slot of key in the memo: its entry, or the empty slot where it goes
+static FuncMemoEntry* memo_slot(const FuncMemo *memo, uint64_t key) {
+
+    size_t mask = memo->capacity - 1;
+    size_t i = (size_t)key & mask;
+
+    while (memo->slots[i].key && memo->slots[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &memo->slots[i];
+}
+
+static void memo_grow(FuncMemo *memo) {
+
+    FuncMemo grown = *memo;
+    size_t i = 0;
+
+    grown.capacity = memo->capacity ? memo->capacity * 2 : 256;
+    grown.slots = (FuncMemoEntry*)calloc(grown.capacity, sizeof(FuncMemoEntry));
+    if (!grown.slots) {
+        perror("Failed to allocate function memo");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < memo->capacity; i++) {
+        if (memo->slots[i].key) *memo_slot(&grown, memo->slots[i].key) = memo->slots[i];
+    }
+    free(memo->slots);
+    *memo = grown;
+}
+
+static const char* memo_load(FuncMemo *memo, uint64_t key) {
+
+    FuncMemoEntry *entry = NULL;
+
+    if (!memo->count) return NULL;
+    entry = memo_slot(memo, key);
+    if (!entry->key) return NULL;
+    entry->pass = memo->pass;
+    return entry->text;
+}
+
+static int memo_store(FuncMemo *memo, uint64_t key, const char *text, size_t len) {
+
+    FuncMemoEntry *entry = NULL;
+    char *copy = (char*)malloc(len + 1);
+
+    if (!copy) return -1;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    if ((memo->count + 1) * 2 > memo->capacity) memo_grow(memo);
+    entry = memo_slot(memo, key);
+    if (entry->key) {
+        free(entry->text);
+    } else {
+        entry->key = key;
+        memo->count++;
+    }
+    entry->text = copy;
+    entry->len = len;
+    entry->pass = memo->pass;
+    return 0;
+}
+
+void func_memo_init(FuncMemo *memo) {
+    memset(memo, 0, sizeof(*memo));
+}
+
+void func_memo_free(FuncMemo *memo) {
+
+    size_t i = 0;
+
+    for (i = 0; i < memo->capacity; i++) {
+        free(memo->slots[i].text);
+    }
+    free(memo->slots);
+    func_memo_init(memo);
+}
+
+void func_memo_sweep(FuncMemo *memo) {
+
+    FuncMemo kept = *memo;
+    size_t i = 0;
+
+    // Rebuild rather than delete in place, which linear probing cannot do
+    kept.slots = memo->capacity ? (FuncMemoEntry*)calloc(memo->capacity, sizeof(FuncMemoEntry)) : NULL;
+    if (memo->capacity && !kept.slots) {
+        perror("Failed to allocate function memo");
+        exit(EXIT_FAILURE);
+    }
+    kept.count = 0;
+    for (i = 0; i < memo->capacity; i++) {
+        if (!memo->slots[i].key) continue;
+        if (memo->slots[i].pass == memo->pass) {
+            *memo_slot(&kept, memo->slots[i].key) = memo->slots[i];
+            kept.count++;
+        } else {
+            free(memo->slots[i].text);
+        }
+    }
+    free(memo->slots);
+    *memo = kept;
+    memo->pass++;
+}
+
+static void entry_path(const FuncCache *cache, uint64_t key, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx.vhdl", cache->dir, (unsigned long long)key);
+}
+
+const char* func_cache_load(FuncCache *cache, uint64_t key) {
+
+    char path[4096];
+    char **grown = NULL;
+    char *text = NULL;
+    FILE *f = NULL;
+    long size = 0;
+
+    if (cache->memory) return memo_load(cache->memory, key);
+    entry_path(cache, key, path, sizeof(path));
+    f = fopen(path, "rb");
+    if (!f) return NULL;
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    text = (char*)malloc((size_t)size + 1);
+    if (!text || fread(text, 1, (size_t)size, f) != (size_t)size) {
+        free(text);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    text[size] = '\0';
+
+    if (cache->fragment_count == cache->fragment_capacity) {
+        cache->fragment_capacity = cache->fragment_capacity ? cache->fragment_capacity * 2 : 64;
+        grown = (char**)realloc(cache->fragments, cache->fragment_capacity * sizeof(char*));
+        if (!grown) {
+            perror("Failed to allocate cache fragments");
+            exit(EXIT_FAILURE);
+        }
+        cache->fragments = grown;
+    }
+    cache->fragments[cache->fragment_count++] = text;
+    return text;
+}
+
+int func_cache_store(FuncCache *cache, uint64_t key, const char *text, size_t len) {
+
+    char path[4096];
+    char tmp[4096];
+    FILE *f = NULL;
+    int fd = -1;
+    int ok = 0;
+
+    if (cache->memory) return memo_store(cache->memory, key, text, len);
+    snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", cache->dir);
+    fd = mkstemp(tmp);
+    if (fd < 0 && errno == ENOENT && mkdir(cache->dir, 0777) == 0) {
+        // First store into a new directory
+        snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", cache->dir);
+        fd = mkstemp(tmp);
+    }
+    if (fd < 0) return -1;
+    f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        remove(tmp);
+        return -1;
+    }
+    ok = fwrite(text, 1, len, f) == len;
+    ok = fclose(f) == 0 && ok;
+    entry_path(cache, key, path, sizeof(path));
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void func_cache_free(FuncCache *cache) {
+
+    size_t i = 0;
+
+    for (i = 0; i < cache->fragment_count; i++) {
+        free(cache->fragments[i]);
+    }
+    free(cache->fragments);
+    free(cache->keys);
+    cache->fragments = NULL;
+    cache->fragment_count = 0;
+    cache->fragment_capacity = 0;
+    cache->keys = NULL;
+    cache->key_count = 0;
+}
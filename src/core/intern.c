@@ -0,0 +1,116 @@
+#include "intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_INITIAL_CAPACITY 256
+
+// FNV-1a
+static uint32_t hash_text(const char *text, size_t len) {
+
+    uint32_t h = 2166136261u;
+    size_t i = 0;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)text[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void interner_init(Interner *in) {
+
+    memset(in, 0, sizeof(*in));
+    arena_init(&in->strings, ARENA_DEFAULT_CHUNK);
+}
+
+void interner_free(Interner *in) {
+
+    free(in->slots);
+    arena_free(&in->strings);
+    memset(in, 0, sizeof(*in));
+}
+
+void interner_reset(Interner *in) {
+
+    if (in->count) {
+        memset(in->slots, 0, in->capacity * sizeof(InternEntry));
+    }
+    in->count = 0;
+    arena_reset(&in->strings);
+}
+
+// Slot holding text, or the empty slot where it would be inserted
+static size_t find_slot(const Interner *in, const char *text, size_t len, uint32_t hash) {
+
+    size_t mask = in->capacity - 1;
+    size_t i = hash & mask;
+
+    while (in->slots[i].str) {
+        if (in->slots[i].hash == hash && in->slots[i].len == len &&
+            memcmp(in->slots[i].str, text, len) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void grow_table(Interner *in) {
+
+    size_t new_cap = in->capacity ? in->capacity * 2 : INTERN_INITIAL_CAPACITY;
+    InternEntry *old = in->slots;
+    size_t old_cap = in->capacity;
+    size_t i = 0;
+    size_t j = 0;
+
+    in->slots = (InternEntry*)calloc(new_cap, sizeof(InternEntry));
+    if (!in->slots) {
+        perror("Failed to allocate intern table");
+        exit(EXIT_FAILURE);
+    }
+    in->capacity = new_cap;
+    for (i = 0; i < old_cap; i++) {
+        if (old[i].str) {
+            j = old[i].hash & (new_cap - 1);
+            while (in->slots[j].str) j = (j + 1) & (new_cap - 1);
+            in->slots[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+const char* intern_n(Interner *in, const char *text, size_t len) {
+
+    uint32_t hash = hash_text(text, len);
+    size_t i = 0;
+
+    // Keep the load factor under 1/2
+    if ((in->count + 1) * 2 > in->capacity) {
+        grow_table(in);
+    }
+    i = find_slot(in, text, len, hash);
+    if (!in->slots[i].str) {
+        in->slots[i].str = arena_strndup(&in->strings, text, len);
+        in->slots[i].hash = hash;
+        in->slots[i].len = (uint32_t)len;
+        in->count++;
+    }
+    return in->slots[i].str;
+}
+
+const char* intern(Interner *in, const char *text) {
+    return intern_n(in, text, strlen(text));
+}
+
+const char* intern_find_n(const Interner *in, const char *text, size_t len) {
+
+    if (!in->capacity) {
+        return NULL;
+    }
+    return in->slots[find_slot(in, text, len, hash_text(text, len))].str;
+}
+
+const char* intern_token(Interner *in, const Token *tok) {
+    return intern_n(in, tok->text, tok->length);
+}
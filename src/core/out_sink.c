@@ -0,0 +1,143 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include "out_sink.h"
+
+static void sink_init(OutSink *sink, SinkKind kind) {
+
+    memset(sink, 0, sizeof(*sink));
+    sink->kind = kind;
+}
+
+void sink_init_file(OutSink *sink, FILE *file) {
+
+    sink_init(sink, SINK_FILE);
+    sink->file = file;
+}
+
+void sink_init_memory(OutSink *sink) {
+    sink_init(sink, SINK_MEMORY);
+}
+
+void sink_init_callback(OutSink *sink, SinkWriteFn write, void *user) {
+
+    sink_init(sink, SINK_CALLBACK);
+    sink->write = write;
+    sink->user = user;
+}
+
+void sink_flush(OutSink *sink) {
+
+    size_t written = 0;
+
+    if (sink->kind == SINK_MEMORY || sink->len == 0) return;
+    if (sink->kind == SINK_FILE) {
+        written = fwrite(sink->buf, 1, sink->len, sink->file);
+    } else {
+        written = sink->write(sink->user, sink->buf, sink->len);
+    }
+    if (written != sink->len) {
+        sink->error = 1;
+    }
+    sink->len = 0;
+}
+
+int sink_close(OutSink *sink) {
+
+    int error = 0;
+
+    sink_flush(sink);
+    error = sink->error;
+    free(sink->buf);
+    sink->buf = NULL;
+    sink->len = 0;
+    sink->cap = 0;
+    return error ? -1 : 0;
+}
+
+char* sink_take(OutSink *sink, size_t *len) {
+
+    char *text = NULL;
+
+    sink_reserve(sink, 1);
+    if (sink->error) {
+        return NULL;
+    }
+    sink->buf[sink->len] = '\0';
+    text = sink->buf;
+    if (len) *len = sink->len;
+    sink->buf = NULL;
+    sink->len = 0;
+    sink->cap = 0;
+    return text;
+}
+
+// Make room for extra bytes: streaming backends drain the buffer first and
+// only grow it for a single append larger than a block
+void sink_reserve(OutSink *sink, size_t extra) {
+
+    size_t cap = sink->cap;
+    char *grown = NULL;
+
+    if (sink->kind != SINK_MEMORY && sink->cap - sink->len < extra) {
+        sink_flush(sink);
+    }
+    if (sink->cap - sink->len >= extra) return;
+
+    if (cap < OUT_SINK_BLOCK) cap = OUT_SINK_BLOCK;
+    while (cap - sink->len < extra) cap *= 2;
+    grown = (char*)realloc(sink->buf, cap);
+    if (!grown) {
+        sink->error = 1;
+        return;
+    }
+    sink->buf = grown;
+    sink->cap = cap;
+}
+
+void sink_printf(OutSink *sink, const char *fmt, ...) {
+
+    va_list args;
+
+    va_start(args, fmt);
+    sink_vprintf(sink, fmt, args);
+    va_end(args);
+}
+
+void sink_vprintf(OutSink *sink, const char *fmt, va_list args) {
+
+    va_list again;
+    int n = 0;
+
+    va_copy(again, args);
+    n = vsnprintf(sink->buf ? sink->buf + sink->len : NULL, sink->cap - sink->len, fmt, args);
+    if (n < 0) {
+        sink->error = 1;
+        va_end(again);
+        return;
+    }
+    if ((size_t)n >= sink->cap - sink->len) {
+        // Did not fit (including the NUL): make room and format again
+        sink_reserve(sink, (size_t)n + 1);
+        if (sink->cap - sink->len <= (size_t)n) {
+            va_end(again);
+            return;
+        }
+        vsnprintf(sink->buf + sink->len, sink->cap - sink->len, fmt, again);
+    }
+    va_end(again);
+    sink->len += (size_t)n;
+}
+
+void sink_put_int(OutSink *sink, long value) {
+
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long v = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) *--p = '-';
+    sink_write(sink, p, (size_t)(digits + sizeof(digits) - p));
+}
@@ -1,4 +1,57 @@
 #include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+void strbuf_append(StrBuf *sb, const char *s, size_t n) {
+
+    size_t cap = sb->cap ? sb->cap : 32;
+    char *grown = NULL;
+
+    while (sb->len + n + 1 > cap) cap *= 2;
+    if (cap != sb->cap) {
+        grown = (char*)realloc(sb->data, cap);
+        if (!grown) {
+            perror("Failed to grow string buffer");
+            exit(EXIT_FAILURE);
+        }
+        sb->data = grown;
+        sb->cap = cap;
+    }
+    if (n) memcpy(sb->data + sb->len, s, n);
+    sb->len += n;
+    sb->data[sb->len] = '\0';
+}
+
+void strbuf_append_str(StrBuf *sb, const char *s) {
+    strbuf_append(sb, s, strlen(s));
+}
+
+void strbuf_append_token(StrBuf *sb, const Token *tok) {
+    strbuf_append(sb, tok->text, tok->length);
+}
+
+const char* strbuf_cstr(const StrBuf *sb) {
+    return sb->data ? sb->data : "";
+}
+
+// Hand the string to the caller (heap-allocated, never NULL)
+char* strbuf_detach(StrBuf *sb) {
+
+    char *s = sb->data ? sb->data : strdup("");
+
+    sb->data = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+    return s;
+}
+
+void strbuf_free(StrBuf *sb) {
+
+    free(sb->data);
+    sb->data = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+}
 
 // Helper function to print tree branches for AST visualization
 void print_tree_prefix(int level, int is_last) {
@@ -53,41 +106,57 @@ int is_negative_literal(const char* value) {
 
 int get_precedence(const char *op) {
 
-    // Higher number = higher precedence (mirrors C precedence ordering)
     if (!op) return -999;
-    if (strcmp(op, "*") == 0 || strcmp(op, "/") == 0) return 7;
-    if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0) return 6;
-    if (strcmp(op, "<<") == 0 || strcmp(op, ">>") == 0) return 5;
-    if (strcmp(op, "<") == 0 || strcmp(op, "<=") == 0 ||
-        strcmp(op, ">") == 0 || strcmp(op, ">=") == 0) return 4;
-    if (strcmp(op, "==") == 0 || strcmp(op, "!=") == 0) return 3;
-    if (strcmp(op, "&") == 0) return 2;
-    if (strcmp(op, "^") == 0) return 1;
-    if (strcmp(op, "|") == 0) return 0;
-    if (strcmp(op, "&&") == 0) return -1; // logical AND
-    if (strcmp(op, "||") == 0) return -2; // logical OR (lowest)
-    return -1000; // unknown
-}
-
-
-// Print the AST recursively in a readable tree format
-void print_ast(ASTNode* node, int level) {
+    return operator_precedence(operator_from_text(op));
+}
 
-    int is_last = 1;
-    int i = 0;
-    ASTNode *parent = NULL;
+// Binary operator precedence, indexed by OperatorKind.
+// Higher number = higher precedence (mirrors C precedence ordering);
+// -1000 marks operators that never bind as binary operators.
+static const int s_precedence[OP_COUNT] = {
+    [OP_NONE] = -1000,
+    [OP_MUL] = 7, [OP_DIV] = 7,
+    [OP_ADD] = 6, [OP_SUB] = 6,
+    [OP_SHL] = 5, [OP_SHR] = 5,
+    [OP_LT] = 4, [OP_LE] = 4, [OP_GT] = 4, [OP_GE] = 4,
+    [OP_EQ] = 3, [OP_NE] = 3,
+    [OP_BIT_AND] = 2,
+    [OP_BIT_XOR] = 1,
+    [OP_BIT_OR] = 0,
+    [OP_LOG_AND] = -1, // logical AND
+    [OP_LOG_OR] = -2,  // logical OR (lowest)
+    [OP_ASSIGN] = -1000, [OP_NOT] = -1000, [OP_BIT_NOT] = -1000, [OP_INC] = -1000,
+    [OP_DEC] = -1000, [OP_DOT] = -1000, [OP_OTHER] = -1000
+};
+
+int operator_precedence(OperatorKind op) {
+    return (op >= 0 && op < OP_COUNT) ? s_precedence[op] : -1000;
+}
+
+// Operators whose result is a VHDL boolean (comparisons and logical ops)
+int operator_is_boolean(OperatorKind op) {
+
+    switch (op) {
+        case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+        case OP_LOG_AND: case OP_LOG_OR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+
+// Print one node of the tree (visitor for print_ast)
+static void print_ast_node(const ASTNode *node, int depth, void *arg) {
 
-    if (!node) return;
+    int level = depth + *(const int*)arg;
+    int is_last = 1;
+    const ASTNode *parent = NULL;
 
-    // Find if this node is the last child
+    // Last child of its parent (O(1) instead of scanning the siblings)
     if (node->parent) {
         parent = node->parent;
-        for (i = 0; i < parent->num_children; i++) {
-            if (parent->children[i] == node) {
-                is_last = (i == parent->num_children - 1);
-                break;
-            }
-        }
+        is_last = parent->num_children > 0 && parent->children[parent->num_children - 1] == node;
     }
 
     print_tree_prefix(level, is_last);
@@ -98,13 +167,13 @@ void print_ast(ASTNode* node, int level) {
             printf("PROGRAM\n");
             break;
         case NODE_FUNCTION_DECL:
-            printf("FUNCTION: %s (returns: %s)\n",
+            printf("FUNCTION: %s (returns: " TOKEN_FMT ")\n",
                    node->value ? node->value : "(null)",
-                   node->token.value);
+                   TOKEN_ARG(node->token));
             break;
         case NODE_VAR_DECL:
-            printf("VAR: %s %s\n",
-                   node->token.value,
+            printf("VAR: " TOKEN_FMT " %s\n",
+                   TOKEN_ARG(node->token),
                    node->value ? node->value : "(null)");
             break;
         case NODE_STATEMENT:
@@ -140,29 +209,48 @@ void print_ast(ASTNode* node, int level) {
         case NODE_CONTINUE_STATEMENT:
             printf("CONTINUE\n");
             break;
+        case NODE_INDEX:
+            printf("INDEX\n");
+            break;
+        case NODE_MEMBER:
+            printf("MEMBER: %s\n", node->value ? node->value : "(null)");
+            break;
+        case NODE_CACHED_FUNCTION:
+            printf("CACHED FUNCTION: " TOKEN_FMT "\n", TOKEN_ARG(node->token));
+            break;
         default:
             printf("NODE_TYPE_%d\n", node->type);
             break;
     }
+}
 
-    for (i = 0; i < node->num_children; i++) {
-        print_ast(node->children[i], level + 1);
-    }
+// Print the AST in a readable tree format
+void print_ast(ASTNode* node, int level) {
+    ast_walk(node, print_ast_node, &level);
 }
 
 // Helper function to map C types to VHDL types
 char* ctype_to_vhdl(const char* ctype) {
 
-    // No local variables needed
-    if (strcmp(ctype, "int") == 0) {
-        return "std_logic_vector(31 downto 0)";
-    } else if (strcmp(ctype, "float") == 0) {
-        return "std_logic_vector(31 downto 0)"; // You may want to use 'real' for advanced VHDL
-    } else if (strcmp(ctype, "double") == 0) {
-        return "std_logic_vector(63 downto 0)"; // Or 'real'
-    } else if (strcmp(ctype, "char") == 0) {
-        return "std_logic_vector(7 downto 0)";
+    return ctype_to_vhdl_n(ctype, strlen(ctype));
+}
+
+// Same mapping for a type name that is not NUL-terminated (token text)
+char* ctype_to_vhdl_n(const char* ctype, size_t len) {
+
+    return keyword_to_vhdl(keyword_lookup(ctype, len));
+}
+
+// Map a primitive type keyword to its VHDL type
+char* keyword_to_vhdl(KeywordKind kw) {
+
+    switch (kw) {
+        case KW_INT:    return "std_logic_vector(31 downto 0)";
+        case KW_FLOAT:  return "std_logic_vector(31 downto 0)"; // You may want to use 'real' for advanced VHDL
+        case KW_DOUBLE: return "std_logic_vector(63 downto 0)"; // Or 'real'
+        case KW_CHAR:   return "std_logic_vector(7 downto 0)";
+        default: break;
     }
     // Default fallback
     return "std_logic_vector(31 downto 0)";
-}
\ No newline at end of file
+}
@@ -0,0 +1,64 @@
+#include "work_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct {
+    WorkFn fn;
+    void *arg;
+    size_t count;
+    atomic_size_t next;
+} WorkQueue;
+
+static void* work_loop(void *p) {
+
+    WorkQueue *q = (WorkQueue*)p;
+    size_t i = 0;
+
+    while ((i = atomic_fetch_add(&q->next, 1)) < q->count) {
+        q->fn(q->arg, i);
+    }
+    return NULL;
+}
+
+void work_pool_run(int jobs, size_t count, WorkFn fn, void *arg) {
+
+    WorkQueue q;
+    pthread_t *threads = NULL;
+    int started = 0;
+    int t = 0;
+
+    q.fn = fn;
+    q.arg = arg;
+    q.count = count;
+    atomic_init(&q.next, 0);
+
+    if (jobs > (int)count) jobs = (int)count;
+    if (jobs > 1) {
+        threads = (pthread_t*)malloc((size_t)(jobs - 1) * sizeof(pthread_t));
+        if (!threads) {
+            perror("Failed to allocate worker threads");
+            exit(EXIT_FAILURE);
+        }
+        for (t = 0; t < jobs - 1; t++) {
+            if (pthread_create(&threads[t], NULL, work_loop, &q) != 0) {
+                break;  // Run with the workers we have
+            }
+            started++;
+        }
+    }
+    work_loop(&q);
+    for (t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+
+int work_pool_default_jobs(void) {
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
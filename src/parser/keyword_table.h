@@ -0,0 +1,31 @@
+// Generated by tools/gen_keyword_hash.py - do not edit.
+#ifndef KEYWORD_TABLE_H
+#define KEYWORD_TABLE_H
+
+#include "token.h"
+
+#define KEYWORD_HASH_SIZE 32
+#define KEYWORD_MIN_LEN 2
+#define KEYWORD_MAX_LEN 8
+
+static inline unsigned keyword_hash(const char *s, size_t len) {
+    return (((unsigned char)s[0] * 1u) ^ ((unsigned char)s[len - 1] * 6u) ^ (unsigned)len) & (KEYWORD_HASH_SIZE - 1);
+}
+
+static const struct { const char *text; unsigned char len; KeywordKind kind; } keyword_table[KEYWORD_HASH_SIZE] = {
+    [0] = { "return", 6, KW_RETURN },
+    [5] = { "break", 5, KW_BREAK },
+    [9] = { "for", 3, KW_FOR },
+    [10] = { "void", 4, KW_VOID },
+    [11] = { "char", 4, KW_CHAR },
+    [12] = { "while", 5, KW_WHILE },
+    [13] = { "struct", 6, KW_STRUCT },
+    [15] = { "if", 2, KW_IF },
+    [18] = { "int", 3, KW_INT },
+    [21] = { "continue", 8, KW_CONTINUE },
+    [27] = { "float", 5, KW_FLOAT },
+    [28] = { "double", 6, KW_DOUBLE },
+    [31] = { "else", 4, KW_ELSE },
+};
+
+#endif // KEYWORD_TABLE_H
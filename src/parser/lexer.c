@@ -0,0 +1,264 @@
+#include "lexer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define COMPI_HAVE_MMAP 1
+#endif
+
+static const char s_empty_source[1] = "";
+
+// Point the token at its lexeme in the source buffer
+static inline void set_lexeme(Token *token, const Lexer *lx, const char *start, const char *stop) {
+
+    token->text = start;
+    token->offset = (uint32_t)(start - lx->src);
+    token->length = (uint32_t)(stop - start);
+}
+
+void lexer_init_buffer(Lexer *lx, const char *src, size_t len) {
+
+    memset(lx, 0, sizeof(*lx));
+    if (!src) {
+        src = s_empty_source;
+        len = 0;
+    }
+    lx->src = src;
+    lx->cur = src;
+    lx->end = src + len;
+    lx->line = 1;
+}
+
+// Read the rest of a non-seekable stream (pipes, terminals) in large chunks
+static int read_all(FILE *input, char **out, size_t *out_len) {
+
+    size_t cap = 1 << 16;
+    size_t len = 0;
+    size_t n = 0;
+    char *buf = (char*)malloc(cap);
+    char *grown = NULL;
+
+    if (!buf) {
+        return -1;
+    }
+    while ((n = fread(buf + len, 1, cap - len, input)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            grown = (char*)realloc(buf, cap);
+            if (!grown) {
+                free(buf);
+                return -1;
+            }
+            buf = grown;
+        }
+    }
+    if (ferror(input)) {
+        free(buf);
+        return -1;
+    }
+    *out = buf;
+    *out_len = len;
+    return 0;
+}
+
+int lexer_init_file(Lexer *lx, FILE *input) {
+
+    char *buf = NULL;
+    size_t len = 0;
+
+    lexer_init_buffer(lx, NULL, 0);
+    if (!input) {
+        return -1;
+    }
+
+#ifdef COMPI_HAVE_MMAP
+    {
+        struct stat st;
+        long pos = 0;
+        void *map = NULL;
+        int fd = fileno(input);
+
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            pos = ftell(input);
+            if (pos >= 0 && st.st_size > (off_t)pos) {
+                map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED) {
+                    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+                    lx->map_base = map;
+                    lx->map_len = (size_t)st.st_size;
+                    lx->src = (const char*)map + pos;
+                    lx->cur = lx->src;
+                    lx->end = (const char*)map + st.st_size;
+                    // Leave the stream at EOF as if it had been read
+                    fseek(input, 0, SEEK_END);
+                    (void)fgetc(input);
+                    return 0;
+                }
+            }
+        }
+    }
+#endif
+
+    if (read_all(input, &buf, &len) != 0) {
+        return -1;
+    }
+    lx->owned = buf;
+    lx->src = buf;
+    lx->cur = buf;
+    lx->end = buf + len;
+    return 0;
+}
+
+void lexer_release(Lexer *lx) {
+
+    if (!lx) return;
+#ifdef COMPI_HAVE_MMAP
+    if (lx->map_base) {
+        munmap(lx->map_base, lx->map_len);
+    }
+#endif
+    free(lx->owned);
+    lexer_init_buffer(lx, NULL, 0);
+}
+
+LexerMark lexer_mark(const Lexer *lx) {
+
+    LexerMark mark;
+
+    mark.offset = (size_t)(lx->cur - lx->src);
+    mark.line = lx->line;
+    return mark;
+}
+
+void lexer_reset(Lexer *lx, LexerMark mark) {
+
+    lx->cur = lx->src + mark.offset;
+    lx->line = mark.line;
+}
+
+Token lexer_next(Lexer *lx) {
+
+    Token token = {0};
+    const char *p = lx->cur;
+    const char *end = lx->end;
+    const char *start = NULL;
+    char c = 0;
+    int d = 0;
+
+    for (;;) {
+        token.line = lx->line; // Track line at start of token
+
+        // Skip whitespace
+        while (p < end && isspace((unsigned char)*p)) {
+            if (*p == '\n') lx->line++;
+            p++;
+        }
+        if (p >= end) {
+            lx->cur = p;
+            token.type = TOKEN_EOF;
+            set_lexeme(&token, lx, p, p);
+            return token;
+        }
+
+        // Comments starting with // or /* */
+        if (*p == '/' && p + 1 < end && p[1] == '/') {
+            p = memchr(p + 2, '\n', (size_t)(end - p - 2));
+            if (!p) {
+                p = end;
+            } else {
+                lx->line++;
+                p++;
+            }
+            continue;
+        }
+        if (*p == '/' && p + 1 < end && p[1] == '*') {
+            p += 2;
+            start = p;
+            while (p < end) {
+                if (*p == '\n') {
+                    lx->line++;
+                } else if (*p == '/' && p > start && p[-1] == '*') {
+                    p++;
+                    break;
+                }
+                p++;
+            }
+            continue;
+        }
+        break;
+    }
+
+    start = p;
+    c = *p++;
+
+    // Identifier or keyword
+    if (isalpha((unsigned char)c) || c == '_') {
+        while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+        lx->cur = p;
+        set_lexeme(&token, lx, start, p);
+        token.kw = keyword_lookup(start, token.length);
+        token.type = token.kw != KW_NONE ? TOKEN_KEYWORD : TOKEN_IDENTIFIER;
+        return token;
+    }
+
+    // Number
+    if (isdigit((unsigned char)c)) {
+        while (p < end && (isdigit((unsigned char)*p) || *p == '.')) p++;
+        lx->cur = p;
+        set_lexeme(&token, lx, start, p);
+        token.type = TOKEN_NUMBER;
+        return token;
+    }
+
+    lx->cur = p;
+    set_lexeme(&token, lx, start, p);
+
+    // Punctuation
+    switch (c) {
+        case ';': token.type = TOKEN_SEMICOLON; return token;
+        case '(': token.type = TOKEN_PARENTHESIS_OPEN; return token;
+        case ')': token.type = TOKEN_PARENTHESIS_CLOSE; return token;
+        case '{': token.type = TOKEN_BRACE_OPEN; return token;
+        case '}': token.type = TOKEN_BRACE_CLOSE; return token;
+        case '[': token.type = TOKEN_BRACKET_OPEN; return token;
+        case ']': token.type = TOKEN_BRACKET_CLOSE; return token;
+        case ',': token.type = TOKEN_COMMA; return token;
+        default: break;
+    }
+
+    // Operators, including multi-char ==, !=, <=, >=, <<, >>, &&, ||, ++, --
+    token.type = TOKEN_OPERATOR;
+    d = (p < end) ? (unsigned char)*p : EOF;
+    switch (c) {
+        case '*': token.op = OP_MUL; break;
+        case '/': token.op = OP_DIV; break;
+        case '^': token.op = OP_BIT_XOR; break;
+        case '~': token.op = OP_BIT_NOT; break;
+        case '.': token.op = OP_DOT; break;
+        case '+': token.op = (d == '+') ? OP_INC : OP_ADD; break;
+        case '-': token.op = (d == '-') ? OP_DEC : OP_SUB; break;
+        case '&': token.op = (d == '&') ? OP_LOG_AND : OP_BIT_AND; break;
+        case '|': token.op = (d == '|') ? OP_LOG_OR : OP_BIT_OR; break;
+        case '=': token.op = (d == '=') ? OP_EQ : OP_ASSIGN; break;
+        case '!': token.op = (d == '=') ? OP_NE : OP_NOT; break;
+        case '<': token.op = (d == '=') ? OP_LE : (d == '<') ? OP_SHL : OP_LT; break;
+        case '>': token.op = (d == '=') ? OP_GE : (d == '>') ? OP_SHR : OP_GT; break;
+        default: token.op = OP_OTHER; break;
+    }
+    switch (token.op) {
+        case OP_INC: case OP_DEC: case OP_LOG_AND: case OP_LOG_OR:
+        case OP_EQ: case OP_NE: case OP_LE: case OP_GE: case OP_SHL: case OP_SHR:
+            lx->cur = p + 1;
+            token.length = 2;
+            break;
+        default:
+            break;
+    }
+    return token;
+}
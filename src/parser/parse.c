@@ -2,8 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include "parse.h"
+#include "compi_context.h"
 #include "utils.h"
 #include "token.h"
+#include "lexer.h"
 #include "symbol_structs.h"
 #include "symbol_arrays.h"
 #include "parse_expression.h"
@@ -11,89 +13,464 @@
 #include "parse_function.h"
 #include "parse_statement.h"
 #include "codegen_vhdl.h"
+#include "work_pool.h"
+#include "func_cache.h"
 #include <ctype.h>
+#include <setjmp.h>
+#include <stdatomic.h>
 
-// Current token shared by parsing modules
-extern Token current_token;
+// A function found by the pre-scan; its body is parsed later on a worker
+typedef struct {
+    Token return_type;
+    Token func_name;
+    LexerMark start;    // Scan position just after the function name
+    size_t end;         // Offset one past the closing '}'
+    size_t child;       // Slot reserved in the program node
+    ASTNode *result;    // Parsed function, filled in by a worker
+    uint64_t idents[4]; // Bloom filter of the identifiers it uses (cache key)
+} FunctionSlice;
 
-// Parse the entire program: delegates to specialized modules
-ASTNode* parse_program(FILE *input) {
+// Functions deferred by the pre-scan and the workers' shared cursor
+typedef struct {
+    CompiContext *ctx;
+    FunctionSlice *items;
+    size_t count;
+    size_t capacity;
+    atomic_size_t next;
+} FunctionSlices;
+
+// Consumer of finished items in streaming mode, and the arena position
+// every item is released back to
+typedef struct {
+    ParseItemFn emit;
+    void *user;
+    ArenaMark mark;
+} ItemStream;
+
+// Bit of an identifier in a 256-bit Bloom filter
+static unsigned identifier_bit(const char *text, size_t len) {
+    return (unsigned)(func_cache_hash(FUNC_CACHE_SEED, text, len) & 255);
+}
+
+static void note_identifier(uint64_t idents[4], const char *text, size_t len) {
+
+    unsigned bit = identifier_bit(text, len);
+
+    idents[bit >> 6] |= 1ULL << (bit & 63);
+}
+
+// Cache key part of one struct definition, computed once per parse rather
+// than once per function that names it
+typedef struct {
+    unsigned bit;    // Bloom filter bit of the struct name
+    uint64_t hash;   // Name and fields
+} StructKey;
+
+// Pre-scan a function sitting at '(' by matching the parameter list and the
+// body braces. On success it is recorded for a worker and a placeholder is
+// returned; otherwise it is parsed serially right here, as it would be
+// without a pre-scan, so malformed input reports the same errors.
+static ASTNode* defer_function(CompiContext *ctx, FunctionSlices *slices, ASTNode *program_node,
+                               Token return_type, Token func_name, LexerMark start) {
+
+    FunctionSlice *grown = NULL;
+    FunctionSlice *slice = NULL;
+    uint64_t idents[4] = {0};
+    int track = func_cache_enabled(&ctx->cache);
+    size_t end = 0;
+    int depth = 0;
+
+    // With the cache on, remember which names the function mentions so its
+    // key can cover the struct definitions it may depend on
+    if (track) note_identifier(idents, return_type.text, return_type.length);
+    advance(ctx); // consume '('
+    while (!match(ctx, TOKEN_PARENTHESIS_CLOSE) && !match(ctx, TOKEN_EOF)) {
+        if (track && match(ctx, TOKEN_IDENTIFIER)) note_identifier(idents, ctx->current_token.text, ctx->current_token.length);
+        advance(ctx);
+    }
+    if (consume(ctx, TOKEN_PARENTHESIS_CLOSE) && match(ctx, TOKEN_BRACE_OPEN)) {
+        do {
+            if (track && match(ctx, TOKEN_IDENTIFIER)) note_identifier(idents, ctx->current_token.text, ctx->current_token.length);
+            if (match(ctx, TOKEN_BRACE_OPEN)) depth++;
+            if (match(ctx, TOKEN_BRACE_CLOSE)) depth--;
+            end = ctx->current_token.offset + ctx->current_token.length;
+            advance(ctx);
+        } while (depth > 0 && !match(ctx, TOKEN_EOF));
+    }
+    if (depth != 0 || end == 0) {
+        lexer_reset(&ctx->lexer, start);
+        advance(ctx);
+        return parse_function(ctx, return_type, func_name);
+    }
+
+    if (slices->count == slices->capacity) {
+        slices->capacity = slices->capacity ? slices->capacity * 2 : 256;
+        grown = (FunctionSlice*)realloc(slices->items, slices->capacity * sizeof(FunctionSlice));
+        if (!grown) {
+            perror("Failed to allocate function slices");
+            exit(EXIT_FAILURE);
+        }
+        slices->items = grown;
+    }
+    slice = &slices->items[slices->count++];
+    slice->return_type = return_type;
+    slice->func_name = func_name;
+    slice->start = start;
+    slice->end = end;
+    slice->child = program_node->num_children;
+    slice->result = NULL;
+    memcpy(slice->idents, idents, sizeof(idents));
+    return create_node(ctx, NODE_FUNCTION_DECL);
+}
+
+static void struct_key(const StructInfo *si, StructKey *key) {
+
+    uint64_t h = func_cache_hash(FUNC_CACHE_SEED, si->name, strlen(si->name) + 1);
+    int f = 0;
+
+    for (f = 0; f < si->field_count; f++) {
+        h = func_cache_hash(h, si->fields[f].field_name, strlen(si->fields[f].field_name) + 1);
+        h = func_cache_hash(h, si->fields[f].field_type, strlen(si->fields[f].field_type) + 1);
+    }
+    key->bit = identifier_bit(si->name, strlen(si->name));
+    key->hash = func_cache_hash(h, &si->field_count, sizeof(si->field_count));
+}
+
+// Cache key of a deferred function: its source bytes plus every struct
+// definition whose name it (probably) mentions. Codegen reads nothing else
+// from outside the function, and the parse does not depend on structs.
+static uint64_t function_key(const CompiContext *ctx, const FunctionSlice *slice, const StructKey *structs) {
+
+    uint64_t h = func_cache_hash(FUNC_CACHE_SEED, FUNC_CACHE_VERSION, sizeof(FUNC_CACHE_VERSION));
+    int s = 0;
+
+    h = func_cache_hash(h, slice->return_type.text, (size_t)(ctx->lexer.src + slice->end - slice->return_type.text));
+    for (s = 0; s < ctx->structs.count; s++) {
+        if (!((slice->idents[structs[s].bit >> 6] >> (structs[s].bit & 63)) & 1)) continue;
+        h = func_cache_hash(h, &structs[s].hash, sizeof(structs[s].hash));
+    }
+    return h ? h : 1;
+}
+
+// Look every deferred function up in the cache. Hits become finished
+// NODE_CACHED_FUNCTION children; misses stay in slices to be parsed, and
+// their keys are left in ctx->cache.keys for codegen to store the output.
+static void reuse_cached_functions(CompiContext *ctx, ASTNode *program_node, FunctionSlices *slices) {
+
+    FuncCache *cache = &ctx->cache;
+    FunctionSlice *slice = NULL;
+    StructKey *structs = NULL;
+    ASTNode *node = NULL;
+    const char *text = NULL;
+    uint64_t key = 0;
+    size_t kept = 0;
+    size_t k = 0;
+    int s = 0;
+
+    cache->key_count = (size_t)program_node->num_children;
+    cache->keys = (uint64_t*)calloc(cache->key_count ? cache->key_count : 1, sizeof(uint64_t));
+    structs = (StructKey*)malloc((ctx->structs.count ? (size_t)ctx->structs.count : 1) * sizeof(StructKey));
+    if (!cache->keys || !structs) {
+        perror("Failed to allocate cache keys");
+        exit(EXIT_FAILURE);
+    }
+    for (s = 0; s < ctx->structs.count; s++) {
+        struct_key(&ctx->structs.items[s], &structs[s]);
+    }
+    for (k = 0; k < slices->count; k++) {
+        slice = &slices->items[k];
+        key = function_key(ctx, slice, structs);
+        text = func_cache_load(cache, key);
+        if (text) {
+            node = program_node->children[slice->child];
+            node->type = NODE_CACHED_FUNCTION;
+            node->token = slice->func_name;
+            node->value = (char*)text;
+            cache->hits++;
+            continue;
+        }
+        cache->keys[slice->child] = key;
+        cache->misses++;
+        slices->items[kept++] = *slice;
+    }
+    slices->count = kept;
+    free(structs);
+}
+
+// Worker loop: parse deferred functions on one shard context until the
+// shared cursor runs out. Errors resync inside a body; one in a header
+// leaves that function's result NULL.
+static void parse_slices_on_shard(void *arg, size_t shard_index) {
+
+    FunctionSlices *slices = (FunctionSlices*)arg;
+    CompiContext *w = &slices->ctx->shards[shard_index];
+    FunctionSlice *slice = NULL;
+    jmp_buf env;
+    size_t i = 0;
+
+    w->recover = 1;
+    w->fail_env = &env;
+    while ((i = atomic_fetch_add(&slices->next, 1)) < slices->count) {
+        slice = &slices->items[i];
+        if (setjmp(env) != 0) continue;
+        // Scan only this function's bytes; offsets stay relative to the source
+        w->lexer.end = w->lexer.src + slice->end;
+        lexer_reset(&w->lexer, slice->start);
+        w->tokens.count = w->tokens.pos = 0; // Drop lookahead past the last slice
+        w->loop_depth = 0;
+        advance(w); // '('
+        slice->result = parse_function(w, slice->return_type, slice->func_name);
+    }
+    w->fail_env = NULL;
+}
+
+// Order of a diagnostic collected from the shards: source line, then the
+// order it was gathered in
+typedef struct {
+    const Diagnostic *diag;
+    size_t seq;
+} HeldDiag;
+
+static int held_diag_cmp(const void *a, const void *b) {
+
+    const HeldDiag *x = (const HeldDiag*)a;
+    const HeldDiag *y = (const HeldDiag*)b;
+
+    if (x->diag->line != y->diag->line) return x->diag->line < y->diag->line ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+// Report what the shards held back in source order, as a serial parse would
+static void report_shard_diags(CompiContext *ctx) {
+
+    HeldDiag *held = NULL;
+    const DiagList *list = NULL;
+    size_t count = 0;
+    size_t k = 0;
+    int i = 0;
+
+    for (i = 0; i < ctx->shard_count; i++) {
+        count += ctx->shards[i].diags.count;
+    }
+    if (count == 0) return;
+    held = (HeldDiag*)malloc(count * sizeof(HeldDiag));
+    if (!held) {
+        perror("Failed to allocate diagnostics");
+        exit(EXIT_FAILURE);
+    }
+    count = 0;
+    for (i = 0; i < ctx->shard_count; i++) {
+        list = &ctx->shards[i].diags;
+        for (k = 0; k < list->count; k++, count++) {
+            held[count].diag = &list->items[k];
+            held[count].seq = count;
+        }
+    }
+    qsort(held, count, sizeof(HeldDiag), held_diag_cmp);
+    for (k = 0; k < count; k++) {
+        compi_report(ctx, held[k].diag->severity, held[k].diag->line, held[k].diag->text, held[k].diag->len);
+    }
+    free(held);
+}
+
+// Remove the children left NULL by functions that failed to parse (the
+// cache keys are indexed by child, so they move along)
+static void drop_failed_functions(CompiContext *ctx, ASTNode *program_node) {
+
+    FuncCache *cache = &ctx->cache;
+    int kept = 0;
+    int i = 0;
+
+    for (i = 0; i < program_node->num_children; i++) {
+        if (!program_node->children[i]) continue;
+        if (cache->keys && (size_t)i < cache->key_count) {
+            cache->keys[kept] = cache->keys[i];
+        }
+        program_node->children[kept++] = program_node->children[i];
+    }
+    if (cache->keys && cache->key_count > (size_t)kept) {
+        cache->key_count = (size_t)kept;
+    }
+    program_node->num_children = kept;
+}
+
+// Attach a finished top-level item, or in streaming mode hand it over and
+// release its nodes (NULL items still release what they allocated)
+static void keep_item(CompiContext *ctx, ASTNode *program_node, ASTNode *item, ItemStream *stream) {
+
+    if (!stream) {
+        if (item) add_child(program_node, item);
+        return;
+    }
+    if (item) {
+        stream->emit(stream->user, ctx, item);
+        free_node(item); // Only heap nodes; arena nodes go with the rewind
+    }
+    arena_rewind(&ctx->arena, stream->mark);
+}
+
+// Top-level loop shared by the serial, parallel and streaming parses. With
+// slices set, function bodies are only brace-matched and left for the
+// workers; with stream set, items are emitted and released one by one.
+static void parse_top_level(CompiContext *ctx, ASTNode *program_node, FunctionSlices *slices, ItemStream *stream) {
+    jmp_buf *outer = ctx->fail_env;
+    jmp_buf env;
     Token func_name = (Token){0};
     Token return_type = (Token){0};
     Token struct_name_tok = (Token){0};
+    LexerMark start = {0};
     ASTNode *func_node = NULL;
-    ASTNode *program_node = NULL;
     ASTNode *s = NULL;
 
-    program_node = create_node(NODE_PROGRAM);
+    advance(ctx); // prime tokenizer
 
-    advance(input); // prime tokenizer
-
-    while (!match(TOKEN_EOF)) {
+    // An error that escapes a function body (its header, a struct) skips
+    // to the next ';' or past the next '{ ... }' group
+    ctx->fail_env = &env;
+    if (setjmp(env) != 0) {
+        if (stream) arena_rewind(&ctx->arena, stream->mark);
+        parse_resync(ctx);
+    }
+    while (!match(ctx, TOKEN_EOF)) {
         #ifdef DEBUG
-        printf("Parsing token: type=%d, value='%s'\n", current_token.type, current_token.value ? current_token.value : "");
+        printf("Parsing token: type=%d, value='" TOKEN_FMT "'\n", ctx->current_token.type, TOKEN_ARG(ctx->current_token));
         #endif
-        if (match(TOKEN_KEYWORD)) {
-            if (strcmp(current_token.value, "struct") == 0) {
-                advance(input); // consume 'struct'
-                if (match(TOKEN_IDENTIFIER)) {
-                    struct_name_tok = current_token;
-                    advance(input);
-                    if (match(TOKEN_BRACE_OPEN)) { // struct definition
-                        s = parse_struct(input, struct_name_tok);
-                        if (s) {
-                            add_child(program_node, s);
-                        }
+        if (match(ctx, TOKEN_KEYWORD)) {
+            if (ctx->current_token.kw == KW_STRUCT) {
+                advance(ctx); // consume 'struct'
+                if (match(ctx, TOKEN_IDENTIFIER)) {
+                    struct_name_tok = ctx->current_token;
+                    advance(ctx);
+                    if (match(ctx, TOKEN_BRACE_OPEN)) { // struct definition
+                        s = parse_struct(ctx, struct_name_tok);
+                        keep_item(ctx, program_node, s, stream);
                         continue;
                     }
-                    if (match(TOKEN_IDENTIFIER)) { // function returning struct
+                    if (match(ctx, TOKEN_IDENTIFIER)) { // function returning struct
                         return_type = struct_name_tok;
-                        func_name = current_token;
-                        advance(input);
-                        if (match(TOKEN_PARENTHESIS_OPEN)) {
-                            func_node = parse_function(input, return_type, func_name);
-                            if (func_node) {
-                                add_child(program_node, func_node);
-                            }
+                        func_name = ctx->current_token;
+                        start = lexer_mark(&ctx->lexer);
+                        advance(ctx);
+                        if (match(ctx, TOKEN_PARENTHESIS_OPEN)) {
+                            func_node = slices ? defer_function(ctx, slices, program_node, return_type, func_name, start)
+                                               : parse_function(ctx, return_type, func_name);
+                            keep_item(ctx, program_node, func_node, stream);
                             continue;
                         } else {
-                            printf("Warning: Expected '(' after function name for struct return function '%s'\n", func_name.value);
+                            compi_warning(ctx, "Expected '(' after function name for struct return function '" TOKEN_FMT "'", TOKEN_ARG(func_name));
                         }
                     } else {
-                        printf("Warning: 'struct %s' not followed by function name or '{'\n", struct_name_tok.value);
+                        compi_warning(ctx, "'struct " TOKEN_FMT "' not followed by function name or '{'", TOKEN_ARG(struct_name_tok));
                     }
                 } else {
-                    printf("Warning: 'struct' without name at line %d\n", current_token.line);
+                    compi_warning(ctx, "'struct' without name at line %d", ctx->current_token.line);
                 }
                 continue;
             }
             // primitive or known type function
-            return_type = current_token;
-            advance(input);
-            if (match(TOKEN_IDENTIFIER)) {
-                func_name = current_token;
-                advance(input);
-                if (match(TOKEN_PARENTHESIS_OPEN)) {
-                    func_node = parse_function(input, return_type, func_name);
-                    if (func_node) {
-                        add_child(program_node, func_node);
-                    }
+            return_type = ctx->current_token;
+            advance(ctx);
+            if (match(ctx, TOKEN_IDENTIFIER)) {
+                func_name = ctx->current_token;
+                start = lexer_mark(&ctx->lexer);
+                advance(ctx);
+                if (match(ctx, TOKEN_PARENTHESIS_OPEN)) {
+                    func_node = slices ? defer_function(ctx, slices, program_node, return_type, func_name, start)
+                                       : parse_function(ctx, return_type, func_name);
+                    keep_item(ctx, program_node, func_node, stream);
                 } else {
-                    printf("Warning: Global variable declarations not yet implemented\n");
-                    while (!match(TOKEN_SEMICOLON) && !match(TOKEN_EOF)) {
-                        advance(input);
+                    compi_warning(ctx, "Global variable declarations not yet implemented");
+                    while (!match(ctx, TOKEN_SEMICOLON) && !match(ctx, TOKEN_EOF)) {
+                        advance(ctx);
                     }
-                    if (match(TOKEN_SEMICOLON)) {
-                        advance(input);
+                    if (match(ctx, TOKEN_SEMICOLON)) {
+                        advance(ctx);
                     }
                 }
             } else {
-                printf("Warning: Expected identifier after type at line %d\n", current_token.line);
-                advance(input);
+                compi_warning(ctx, "Expected identifier after type at line %d", ctx->current_token.line);
+                advance(ctx);
             }
         } else {
-            advance(input); // Skip unknown token
+            advance(ctx); // Skip unknown token
         }
     }
+    ctx->fail_env = outer;
+}
+
+// Parse the entire program: delegates to specialized modules. Errors are
+// collected in ctx->diags rather than aborting: a function with errors is
+// left out of the tree and parsing resumes after it.
+ASTNode* parse_program(CompiContext *ctx) {
+    ASTNode *program_node = NULL;
+    FunctionSlices slices;
+    FunctionSlice *slice = NULL;
+    int recover = ctx->recover;
+    int jobs = ctx->parse_jobs;
+    int i = 0;
+    size_t k = 0;
+
+    program_node = create_node(ctx, NODE_PROGRAM);
+    ctx->recover = 1;
+
+    if (jobs <= 1 && !func_cache_enabled(&ctx->cache)) {
+        parse_top_level(ctx, program_node, NULL, NULL);
+        ctx->recover = recover;
+        return program_node;
+    }
+
+    // Pass 1 (serial): register structs, keep top-level order and find the
+    // byte range of every function body
+    memset(&slices, 0, sizeof(slices));
+    slices.ctx = ctx;
+    atomic_init(&slices.next, 0);
+    parse_top_level(ctx, program_node, &slices, NULL);
+
+    // Unchanged functions come from the cache; only the rest are parsed
+    if (func_cache_enabled(&ctx->cache)) {
+        reuse_cached_functions(ctx, program_node, &slices);
+    }
+    if (jobs < 1) jobs = 1;
+
+    // Pass 2 (parallel unless jobs is 1): one shard context per worker, which sees the full
+    // struct table and keeps its nodes alive for the lifetime of ctx
+    if ((size_t)jobs > slices.count) jobs = (int)slices.count;
+    if (jobs > 0) {
+        ctx->shards = (CompiContext*)calloc((size_t)jobs, sizeof(CompiContext));
+        if (!ctx->shards) {
+            perror("Failed to allocate parser shards");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < jobs; i++) {
+            compi_context_init_shard(&ctx->shards[i], ctx);
+            ctx->shards[i].diag_hold = 1;
+        }
+        ctx->shard_count = jobs;
+        work_pool_run(jobs, (size_t)jobs, parse_slices_on_shard, &slices);
+        report_shard_diags(ctx);
+    }
+
+    // Stitch the functions back into their source-order slots
+    for (k = 0; k < slices.count; k++) {
+        slice = &slices.items[k];
+        if (slice->result) slice->result->parent = program_node;
+        program_node->children[slice->child] = slice->result;
+    }
+    free(slices.items);
+    drop_failed_functions(ctx, program_node);
+    ctx->recover = recover;
     return program_node;
-}
\ No newline at end of file
+}
+
+void parse_program_stream(CompiContext *ctx, ParseItemFn emit, void *user) {
+
+    ItemStream stream;
+    int recover = ctx->recover;
+
+    stream.emit = emit;
+    stream.user = user;
+    stream.mark = arena_mark(&ctx->arena);
+    ctx->recover = 1;
+    parse_top_level(ctx, NULL, NULL, &stream);
+    ctx->recover = recover;
+}
@@ -2,210 +2,347 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include "token.h"
+#include "compi_context.h"
 #include "utils.h"
 #include "parse_expression.h"
 #include "symbol_arrays.h"
 #include "symbol_structs.h"
 
-// Safe append helper to avoid strncat truncation warnings
-static inline void safe_append(char *dst, size_t dst_size, const char *src) {
-    size_t used = strlen(dst);
-    if (used >= dst_size - 1) {
-        return;
+// Operand: identifier or number (field and array access follow in
+// parse_access)
+static ASTNode* parse_operand(CompiContext *ctx) {
+    ASTNode *node = NULL;
+
+    if (match(ctx, TOKEN_IDENTIFIER) || match(ctx, TOKEN_NUMBER)) {
+        node = create_node(ctx, NODE_EXPRESSION);
+        node_set_value_token(node, &ctx->current_token);
+        advance(ctx);
+        return node;
+    }
+    return NULL;
+}
+
+// Value of an integer constant expression (decimal literals under
+// arithmetic, shift and bitwise operators). Gives up on anything else,
+// and below CONST_DEPTH levels, so it never recurses far.
+#define CONST_DEPTH 16
+
+static int const_value(const ASTNode *node, int depth, long long *out) {
+    long long l = 0;
+    long long r = 0;
+
+    if (!node || depth > CONST_DEPTH) return 0;
+    if (node->type == NODE_EXPRESSION) {
+        if (!is_number_str(node->value) || strlen(node->value) > 11) return 0;
+        *out = atoll(node->value);
+        return *out >= INT_MIN && *out <= INT_MAX;
+    }
+    if (node->type == NODE_BINARY_OP && node->op == OP_BIT_NOT && node->num_children == 1) {
+        if (!const_value(node->children[0], depth + 1, &l)) return 0;
+        *out = ~l;
+        return 1;
+    }
+    if (node->type != NODE_BINARY_EXPR || node->num_children != 2 ||
+        !const_value(node->children[0], depth + 1, &l) || !const_value(node->children[1], depth + 1, &r)) {
+        return 0;
     }
-    size_t avail = dst_size - 1 - used;
-    size_t copy = strlen(src);
-    if (copy > avail) {
-        copy = avail;
+    switch (node->op) {
+        case OP_ADD:     *out = l + r; break;
+        case OP_SUB:     *out = l - r; break;
+        case OP_MUL:     *out = l * r; break;
+        case OP_DIV:     if (r == 0) return 0; *out = l / r; break;
+        case OP_SHL:     if (l < 0 || r < 0 || r > 30) return 0; *out = l << r; break;
+        case OP_SHR:     if (r < 0 || r > 31) return 0; *out = l >> r; break;
+        case OP_BIT_AND: *out = l & r; break;
+        case OP_BIT_OR:  *out = l | r; break;
+        case OP_BIT_XOR: *out = l ^ r; break;
+        default: return 0;
     }
-    memcpy(dst + used, src, copy);
-    dst[used + copy] = '\0';
+    return *out >= INT_MIN && *out <= INT_MAX;
 }
 
-static inline void safe_copy(char *dst, size_t dst_size, const char *src) {
-    if (!dst_size) {
-        return;
+// base[index]. A constant index is checked against the array's declared
+// size and folded into a single literal.
+static ASTNode* make_index(CompiContext *ctx, ASTNode *base, ASTNode *index) {
+    ASTNode *node = create_node(ctx, NODE_INDEX);
+    ASTNode *folded = NULL;
+    long long value = 0;
+    int arr_size = 0;
+    char text[16];
+
+    if (const_value(index, 0, &value)) {
+        if (base->type == NODE_EXPRESSION) {
+            arr_size = find_array_size(ctx, base->value);
+        }
+        if (arr_size > 0 && (value < 0 || value >= arr_size)) {
+            compi_error(ctx, "Array index %lld out of bounds for '%s' with size %d", value, base->value, arr_size);
+            compi_fail(ctx);
+        }
+        if (index->type != NODE_EXPRESSION) {
+            folded = create_node(ctx, NODE_EXPRESSION);
+            snprintf(text, sizeof(text), "%lld", value);
+            node_set_value(folded, text);
+            free_node(index);
+            index = folded;
+        }
     }
-    size_t n = strlen(src);
-    if (n >= dst_size) {
-        n = dst_size - 1;
+    add_child(node, base);
+    add_child(node, index);
+    return node;
+}
+
+// Fold count unary minus signs in front of a named or literal operand into
+// its value ("-x", "--x", ...), built once instead of once per sign
+static ASTNode* negate_value(CompiContext *ctx, ASTNode *inner, size_t count) {
+    ASTNode *node = NULL;
+    StrBuf text = {0};
+
+    while (count-- > 0) {
+        strbuf_append(&text, "-", 1);
     }
-    memcpy(dst, src, n);
-    dst[n] = '\0';
+    strbuf_append_str(&text, inner->value);
+    node = create_node(ctx, NODE_EXPRESSION);
+    node_set_value_n(node, strbuf_cstr(&text), text.len);
+    strbuf_free(&text);
+    free_node(inner);
+    return node;
 }
 
-// Primary: identifiers, numbers, unary minus, logical/bitwise NOT, parentheses, field & array access
-ASTNode* parse_primary(FILE *input) {
-    ASTNode *inner = NULL;
+// Unary minus, logical NOT or bitwise NOT applied to a parsed operand.
+// Minus folds into names and literals, stays a unary node on array
+// elements and fields, and becomes 0 - x on anything else.
+static ASTNode* apply_prefix(CompiContext *ctx, OperatorKind op, ASTNode *inner) {
     ASTNode *node = NULL;
     ASTNode *zero = NULL;
-    ASTNode *bin = NULL;
-    char buf[128] = {0};
-    char ident_buf[128] = {0};
-    char idx_buf[512] = {0};
-    char val_buf[700] = {0};
-    int paren_depth = 0;
-    int idx_val = 0;
-    int arr_size = 0;
 
-    if (match(TOKEN_OPERATOR) && strcmp(current_token.value, "!") == 0) {
-        advance(input);
-        inner = parse_primary(input);
-        if (!inner) {
-            return NULL;
-        }
-        node = create_node(NODE_BINARY_OP);
-        node->value = strdup("!");
-        add_child(node, inner);
-        return node;
+    if (!inner) {
+        return NULL;
     }
-    if (match(TOKEN_OPERATOR) && strcmp(current_token.value, "~") == 0) {
-        advance(input);
-        inner = parse_primary(input);
-        if (!inner) {
-            return NULL;
+    if (op == OP_SUB && inner->type != NODE_INDEX && inner->type != NODE_MEMBER) {
+        if (inner->type == NODE_EXPRESSION && inner->value) {
+            return negate_value(ctx, inner, 1);
         }
-        node = create_node(NODE_BINARY_OP);
-        node->value = strdup("~");
+        zero = create_node(ctx, NODE_EXPRESSION);
+        node_set_value(zero, "0");
+        node = create_node(ctx, NODE_BINARY_EXPR);
+        node->op = OP_SUB;
+        node_set_value(node, "-");
+        add_child(node, zero);
         add_child(node, inner);
         return node;
     }
-    if (match(TOKEN_OPERATOR) && strcmp(current_token.value, "-") == 0) {
-        advance(input);
-        inner = parse_primary(input);
-        if (!inner) {
-            return NULL;
-        }
-        if (inner->type == NODE_EXPRESSION && inner->value) {
-            snprintf(buf, sizeof(buf), "-%s", inner->value);
-            node = create_node(NODE_EXPRESSION);
-            node->value = strdup(buf);
-            free_node(inner);
-            return node;
-        } else {
-            zero = create_node(NODE_EXPRESSION);
-            zero->value = strdup("0");
-            bin = create_node(NODE_BINARY_EXPR);
-            bin->value = strdup("-");
-            add_child(bin, zero);
-            add_child(bin, inner);
-            return bin;
-        }
+    node = create_node(ctx, NODE_BINARY_OP);
+    node->op = op;
+    node_set_value(node, operator_text(op));
+    add_child(node, inner);
+    return node;
+}
+
+// Pending work of the expression parser: a prefix operator waiting for its
+// operand, an open parenthesis or '[' (with the minimum precedence outside
+// it), or a binary operator with its left operand
+typedef enum { PENDING_PREFIX, PENDING_PAREN, PENDING_INDEX, PENDING_BINARY } PendingKind;
+
+typedef struct {
+    PendingKind kind;
+    OperatorKind op;
+    int prec;           // Binary: precedence; paren, index: enclosing minimum
+    ASTNode *left;      // Binary: left operand; index: the indexed value
+} Pending;
+
+typedef struct {
+    Pending *items;
+    size_t count;
+    size_t capacity;
+} PendingStack;
+
+// Starts in a caller buffer and moves to the arena when deeper nesting
+// needs it, so a parse error unwinding through compi_fail leaks nothing
+static void pending_push(CompiContext *ctx, PendingStack *st, Pending item) {
+
+    if (st->count == st->capacity) {
+        st->items = (Pending*)arena_grow(&ctx->arena, st->items, st->capacity * sizeof(Pending),
+                                         st->capacity * 2 * sizeof(Pending));
+        st->capacity *= 2;
     }
-    if (match(TOKEN_PARENTHESIS_OPEN)) {
-        advance(input);
-        node = parse_expression_prec(input, 1);
-        if (!consume(input, TOKEN_PARENTHESIS_CLOSE)) {
-            printf("Error (line %d): Expected ')' after expression\n", current_token.line);
-            exit(EXIT_FAILURE);
+    st->items[st->count++] = item;
+}
+
+static ASTNode* make_binary(CompiContext *ctx, OperatorKind op, ASTNode *left, ASTNode *right) {
+
+    ASTNode *bin = create_node(ctx, NODE_BINARY_EXPR);
+
+    bin->op = op;
+    node_set_value(bin, operator_text(op));
+    add_child(bin, left);
+    add_child(bin, right);
+    return bin;
+}
+
+// Field and array accesses after a name: a.b wraps the operand in a
+// NODE_MEMBER; '[' opens an index level on the stack and returns 1, so the
+// index expression is parsed next
+static int parse_access(CompiContext *ctx, PendingStack *st, ASTNode **operand, int *level_min) {
+    ASTNode *member = NULL;
+
+    for (;;) {
+        if (match_op(ctx, OP_DOT)) {
+            advance(ctx);
+            if (!match(ctx, TOKEN_IDENTIFIER)) {
+                compi_error(ctx, "Expected field name after '.'");
+                compi_fail(ctx);
+            }
+            member = create_node(ctx, NODE_MEMBER);
+            member->token = ctx->current_token;
+            node_set_value_token(member, &ctx->current_token);
+            add_child(member, *operand);
+            *operand = member;
+            advance(ctx);
+        } else if (match(ctx, TOKEN_BRACKET_OPEN)) {
+            pending_push(ctx, st, (Pending){ PENDING_INDEX, OP_NONE, *level_min, *operand });
+            *level_min = operator_precedence(OP_LOG_OR);  // A full expression
+            advance(ctx);
+            return 1;
+        } else {
+            return 0;
         }
-        return node;
     }
-    if (match(TOKEN_IDENTIFIER)) {
-        safe_copy(ident_buf, sizeof(ident_buf), current_token.value);
-        advance(input);
-        while (match(TOKEN_OPERATOR) && strcmp(current_token.value, ".") == 0) {
-            advance(input);
-            if (!match(TOKEN_IDENTIFIER)) {
-                printf("Error (line %d): Expected field name after '.'\n", current_token.line);
-                exit(EXIT_FAILURE);
+}
+
+// Precedence climbing on an explicit stack, so nesting depth (parentheses,
+// indexes, prefix chains) costs heap instead of C stack. Binary operators are left
+// associative; inside parentheses only precedence >= 1 binds. With
+// primary_only the outermost level stops after one operand.
+static ASTNode* parse_expression_iter(CompiContext *ctx, int min_prec, int primary_only) {
+    Pending local[32];
+    PendingStack st = { local, 0, sizeof(local) / sizeof(local[0]) };
+    Pending *top = NULL;
+    ASTNode *operand = NULL;
+    OperatorKind op = OP_NONE;
+    size_t run = 0;
+    int level_min = min_prec;
+    int prec = 0;
+    int is_name = 0;
+
+    for (;;) {
+        // Operand position: prefixes and open parentheses, then a leaf
+        for (;;) {
+            if (match_op(ctx, OP_NOT) || match_op(ctx, OP_BIT_NOT) || match_op(ctx, OP_SUB)) {
+                pending_push(ctx, &st, (Pending){ PENDING_PREFIX, ctx->current_token.op, 0, NULL });
+                advance(ctx);
+            } else if (match(ctx, TOKEN_PARENTHESIS_OPEN)) {
+                pending_push(ctx, &st, (Pending){ PENDING_PAREN, OP_NONE, level_min, NULL });
+                level_min = 1;
+                advance(ctx);
+            } else {
+                break;
             }
-            safe_append(ident_buf, sizeof(ident_buf), "__");
-            safe_append(ident_buf, sizeof(ident_buf), current_token.value);
-            advance(input);
         }
-        if (match(TOKEN_BRACKET_OPEN)) {
-            advance(input);
-            paren_depth = 0;
-            while (!match(TOKEN_EOF)) {
-                if (match(TOKEN_BRACKET_CLOSE) && paren_depth == 0) {
-                    break;
+        is_name = match(ctx, TOKEN_IDENTIFIER);
+        operand = parse_operand(ctx);
+        if (is_name && parse_access(ctx, &st, &operand, &level_min)) {
+            continue;
+        }
+
+        // Reduce until a binary operator continues the expression
+        for (;;) {
+            while (st.count > 0 && st.items[st.count - 1].kind == PENDING_PREFIX) {
+                if (operand && operand->type == NODE_EXPRESSION && operand->value) {
+                    for (run = 0; run < st.count && st.items[st.count - 1 - run].kind == PENDING_PREFIX &&
+                                  st.items[st.count - 1 - run].op == OP_SUB; run++) {
+                    }
+                    if (run > 1) {
+                        operand = negate_value(ctx, operand, run);
+                        st.count -= run;
+                        continue;
+                    }
                 }
-                if (match(TOKEN_PARENTHESIS_OPEN)) {
-                    safe_append(idx_buf, sizeof(idx_buf), "(");
-                    advance(input);
-                    paren_depth++;
-                    continue;
+                operand = apply_prefix(ctx, st.items[st.count - 1].op, operand);
+                st.count--;
+            }
+            top = st.count > 0 ? &st.items[st.count - 1] : NULL;
+            if (!operand) {
+                // A missing operand ends its level at once
+                if (top && top->kind == PENDING_BINARY) {
+                    compi_error(ctx, "Expected right operand after operator '%s'", operator_text(top->op));
+                    compi_fail(ctx);
                 }
-                if (match(TOKEN_PARENTHESIS_CLOSE)) {
-                    safe_append(idx_buf, sizeof(idx_buf), ")");
-                    advance(input);
-                    if (paren_depth > 0) {
-                        paren_depth--;
-                    }
-                    continue;
+                if (!top) {
+                    return NULL;
                 }
-                if (current_token.value) {
-                    safe_append(idx_buf, sizeof(idx_buf), current_token.value);
+            } else if (match(ctx, TOKEN_OPERATOR) && (top || !primary_only)) {
+                op = ctx->current_token.op;
+                prec = operator_precedence(op);
+                if (prec >= level_min) {
+                    while (st.count > 0 && st.items[st.count - 1].kind == PENDING_BINARY &&
+                           st.items[st.count - 1].prec >= prec) {
+                        top = &st.items[st.count - 1];
+                        operand = make_binary(ctx, top->op, top->left, operand);
+                        st.count--;
+                    }
+                    pending_push(ctx, &st, (Pending){ PENDING_BINARY, op, prec, operand });
+                    advance(ctx);
+                    break;
                 }
-                advance(input);
             }
-            if (!consume(input, TOKEN_BRACKET_CLOSE)) {
-                printf("Error (line %d): Expected ']' after array index in expression\n", current_token.line);
-                exit(EXIT_FAILURE);
+            // End of the level: fold its operators, then close its parenthesis
+            // or index
+            while (operand && st.count > 0 && st.items[st.count - 1].kind == PENDING_BINARY) {
+                top = &st.items[st.count - 1];
+                operand = make_binary(ctx, top->op, top->left, operand);
+                st.count--;
+            }
+            if (st.count == 0) {
+                return operand;
             }
-            node = create_node(NODE_EXPRESSION);
-            snprintf(val_buf, sizeof(val_buf), "%s[%s]", ident_buf, idx_buf);
-            node->value = strdup(val_buf);
-            if (is_number_str(idx_buf)) {
-                idx_val = atoi(idx_buf);
-                arr_size = find_array_size(ident_buf);
-                if (arr_size > 0 && (idx_val < 0 || idx_val >= arr_size)) {
-                    printf("Error (line %d): Array index %d out of bounds for '%s' with size %d\n", current_token.line, idx_val, ident_buf, arr_size);
-                    exit(EXIT_FAILURE);
+            top = &st.items[st.count - 1];
+            if (top->kind == PENDING_INDEX) {
+                if (!operand) {
+                    compi_error(ctx, "Expected array index after '['");
+                    compi_fail(ctx);
                 }
+                if (!consume(ctx, TOKEN_BRACKET_CLOSE)) {
+                    compi_error(ctx, "Expected ']' after array index");
+                    compi_fail(ctx);
+                }
+                level_min = top->prec;
+                st.count--;
+                operand = make_index(ctx, top->left, operand);
+                if (parse_access(ctx, &st, &operand, &level_min)) {
+                    break;
+                }
+                continue;
             }
-            return node;
-        } else {
-            node = create_node(NODE_EXPRESSION);
-            node->value = strdup(ident_buf);
-            return node;
+            if (!consume(ctx, TOKEN_PARENTHESIS_CLOSE)) {
+                compi_error(ctx, "Expected ')' after expression");
+                compi_fail(ctx);
+            }
+            level_min = st.items[st.count - 1].prec;
+            st.count--;
         }
     }
-    if (match(TOKEN_NUMBER)) {
-        node = create_node(NODE_EXPRESSION);
-        node->value = strdup(current_token.value);
-        advance(input);
-        return node;
-    }
-    return NULL;
 }
 
-ASTNode* parse_expression_prec(FILE *input, int min_prec) {
-    ASTNode *left = NULL;
-    ASTNode *right = NULL;
-    ASTNode *bin = NULL;
-    const char *op = NULL;
-    int prec = 0;
-    char op_buf[8] = {0};
+// Primary: identifiers, numbers, unary minus, logical/bitwise NOT, parentheses, field & array access
+ASTNode* parse_primary(CompiContext *ctx) {
+    return parse_expression_iter(ctx, 1, 1);
+}
 
-    left = parse_primary(input);
-    if (!left) {
-        return NULL;
-    }
-    while (match(TOKEN_OPERATOR)) {
-        op = current_token.value;
-        prec = get_precedence(op);
-        if (prec < min_prec) {
-            break;
-        }
-        safe_copy(op_buf, sizeof(op_buf), op);
-        advance(input);
-        right = parse_expression_prec(input, prec + 1);
-        if (!right) {
-            printf("Error (line %d): Expected right operand after operator '%s'\n", current_token.line, op_buf);
-            exit(EXIT_FAILURE);
-        }
-        bin = create_node(NODE_BINARY_EXPR);
-        bin->value = strdup(op_buf);
-        add_child(bin, left);
-        add_child(bin, right);
-        left = bin;
-    }
-    return left;
+ASTNode* parse_expression_prec(CompiContext *ctx, int min_prec) {
+    return parse_expression_iter(ctx, min_prec, 0);
+}
+
+ASTNode* parse_expression(CompiContext *ctx) { 
+    return parse_expression_prec(ctx, -2); 
 }
 
-ASTNode* parse_expression(FILE *input) { 
-    return parse_expression_prec(input, -2); 
+int parse_const_expression(CompiContext *ctx, long long *value) {
+
+    ASTNode *expr = parse_expression(ctx);
+    int ok = const_value(expr, 0, value);
+
+    free_node(expr);
+    return ok;
 }
@@ -2,97 +2,102 @@
 #include <stdlib.h>
 #include <string.h>
 #include "parse_function.h"
+#include "compi_context.h"
 #include "parse_statement.h"
 #include "symbol_arrays.h"
 #include "parse.h" // create_node/add_child
 #include "token.h"
 
-extern Token current_token;
-extern ArrayInfo g_arrays[128];
-extern int g_array_count;
-
-ASTNode* parse_function(FILE *input, Token return_type, Token func_name) {
+ASTNode* parse_function(CompiContext *ctx, Token return_type, Token func_name) {
     Token param_type = (Token){0};
     Token param_name = (Token){0};
     Token possible_struct_token = (Token){0}; (void)possible_struct_token;
     ASTNode *param_node = NULL;
     ASTNode *func_node = NULL;
     int brace_depth = 1;
+    size_t errors = ctx->diags.errors;
 
     memset(&param_type, 0, sizeof(Token));
     memset(&param_name, 0, sizeof(Token));
-    func_node = create_node(NODE_FUNCTION_DECL);
-    g_array_count = 0;
+    func_node = create_node(ctx, NODE_FUNCTION_DECL);
+    reset_arrays(ctx);
 
     func_node->token = return_type;
-    func_node->value = strdup(func_name.value);
+    node_set_value_token(func_node, &func_name);
 
-    if (!consume(input, TOKEN_PARENTHESIS_OPEN)) {
-        printf("Error (line %d): Expected '(' after function name\n", current_token.line);
+    if (!consume(ctx, TOKEN_PARENTHESIS_OPEN)) {
+        compi_error(ctx, "Expected '(' after function name");
         free_node(func_node);
-        exit(EXIT_FAILURE);
+        compi_fail(ctx);
     }
 
-    while (!match(TOKEN_PARENTHESIS_CLOSE) && !match(TOKEN_EOF)) {
-        if (match(TOKEN_KEYWORD)) {
-            if (strcmp(current_token.value, "struct") == 0) {
-                advance(input);
-                if (match(TOKEN_IDENTIFIER)) {
-                    param_type = current_token;
-                    advance(input);
+    while (!match(ctx, TOKEN_PARENTHESIS_CLOSE) && !match(ctx, TOKEN_EOF)) {
+        if (match(ctx, TOKEN_KEYWORD)) {
+            if (ctx->current_token.kw == KW_STRUCT) {
+                advance(ctx);
+                if (match(ctx, TOKEN_IDENTIFIER)) {
+                    param_type = ctx->current_token;
+                    advance(ctx);
                 } else {
-                    printf("Error (line %d): Expected struct name in parameter list\n", current_token.line);
+                    compi_error(ctx, "Expected struct name in parameter list");
                     break;
                 }
             } else {
-                param_type = current_token;
-                advance(input);
+                param_type = ctx->current_token;
+                advance(ctx);
             }
-            if (match(TOKEN_IDENTIFIER)) {
-                param_name = current_token;
-                advance(input);
-                param_node = create_node(NODE_VAR_DECL);
+            if (match(ctx, TOKEN_IDENTIFIER)) {
+                param_name = ctx->current_token;
+                advance(ctx);
+                param_node = create_node(ctx, NODE_VAR_DECL);
                 param_node->token = param_type;
-                param_node->value = strdup(param_name.value);
+                node_set_value_token(param_node, &param_name);
                 add_child(func_node, param_node);
-                if (match(TOKEN_COMMA)) {
-                    advance(input);
+                if (match(ctx, TOKEN_COMMA)) {
+                    advance(ctx);
                 }
             } else {
-                printf("Error (line %d): Expected parameter name\n", current_token.line);
+                compi_error(ctx, "Expected parameter name");
                 break;
             }
         } else {
-            advance(input);
+            advance(ctx);
         }
     }
 
-    if (!consume(input, TOKEN_PARENTHESIS_CLOSE)) {
-        printf("Error (line %d): Expected ')' after parameter list\n", current_token.line);
+    if (!consume(ctx, TOKEN_PARENTHESIS_CLOSE)) {
+        compi_error(ctx, "Expected ')' after parameter list");
         free_node(func_node);
-        exit(EXIT_FAILURE);
+        compi_fail(ctx);
     }
-    if (!consume(input, TOKEN_BRACE_OPEN)) {
-        printf("Error (line %d): Expected '{' to start function body\n", current_token.line);
+    if (!consume(ctx, TOKEN_BRACE_OPEN)) {
+        compi_error(ctx, "Expected '{' to start function body");
         free_node(func_node);
-        exit(EXIT_FAILURE);
+        compi_fail(ctx);
     }
 
     brace_depth = 1;
-    while (brace_depth > 0 && !match(TOKEN_EOF)) {
-        if (match(TOKEN_BRACE_OPEN)) {
+    while (brace_depth > 0 && !match(ctx, TOKEN_EOF)) {
+        if (match(ctx, TOKEN_BRACE_OPEN)) {
             brace_depth++;
-            advance(input);
-        } else if (match(TOKEN_BRACE_CLOSE)) {
+            push_scope(ctx);
+            advance(ctx);
+        } else if (match(ctx, TOKEN_BRACE_CLOSE)) {
             brace_depth--;
-            advance(input);
+            pop_scope(ctx);
+            advance(ctx);
         } else {
-            ASTNode* stmt = parse_statement(input);
+            ASTNode* stmt = parse_statement(ctx);
             if (stmt) {
                 add_child(func_node, stmt);
             }
         }
     }
 
+    // Statements resync after errors; a function with errors is dropped
+    if (ctx->diags.errors > errors) {
+        free_node(func_node);
+        return NULL;
+    }
     return func_node;
 }
@@ -2,50 +2,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <setjmp.h>
+#include <limits.h>
 #include "parse_statement.h"
+#include "compi_context.h"
 #include "parse_expression.h"
 #include "symbol_structs.h"
 #include "symbol_arrays.h"
 #include "utils.h"
 #include "parse.h" // create_node/add_child
 #include "token.h"
+#include "lexer.h"
 
-static inline void safe_append(char *dst, size_t dst_size, const char *src) {
-    size_t used = strlen(dst);
-    if (used >= dst_size - 1) {
-        return;
-    }
-    size_t avail = dst_size - 1 - used;
-    size_t copy = strlen(src);
-    if (copy > avail) {
-        copy = avail;
-    }
-    memcpy(dst + used, src, copy);
-    dst[used + copy] = '\0';
-}
+// Open block of an if/else-if/else/while/for. Nested blocks are kept on an
+// explicit stack, so the C stack does not grow with nesting depth.
+typedef enum { BLOCK_IF, BLOCK_ELSE_IF, BLOCK_ELSE, BLOCK_WHILE, BLOCK_FOR } BlockKind;
 
-static inline void safe_copy(char *dst, size_t dst_size, const char *src, size_t nlimit) {
-    if (!dst_size) {
-        return;
-    }
-    size_t n = strlen(src);
-    if (n > nlimit) {
-        n = nlimit;
-    }
-    if (n >= dst_size) {
-        n = dst_size - 1;
-    }
-    memcpy(dst, src, n);
-    dst[n] = '\0';
-}
+typedef struct {
+    BlockKind kind;
+    ASTNode *stmt;      // Statement that receives owner when the construct ends
+    ASTNode *owner;     // The if/while/for node
+    ASTNode *body;      // Node the block's statements go to (owner or a branch)
+    ASTNode *incr;      // for: increment, added after the body
+} BlockFrame;
 
-extern Token current_token;
-extern int g_array_count;
-extern ArrayInfo g_arrays[128];
+static const char *s_block_names[] = { "if block", "else if block", "else block", "while block", "for body" };
 
-static int s_loop_depth = 0;
-
-ASTNode* parse_statement(FILE *input) {
+// Parse one statement. A compound statement stops after its opening '{'
+// and describes the open block in *block (block->owner is NULL otherwise).
+static ASTNode* parse_statement_head(CompiContext *ctx, BlockFrame *block) {
     ASTNode *stmt_node = NULL;
     ASTNode *var_decl_node = NULL;
     ASTNode *init_expr = NULL;
@@ -56,10 +41,6 @@ ASTNode* parse_statement(FILE *input) {
     ASTNode *init_list = NULL;
     ASTNode *elem = NULL;
     ASTNode *cond_expr = NULL;
-    ASTNode *elseif_cond = NULL;
-    ASTNode *elseif_node = NULL;
-    ASTNode *else_node = NULL;
-    ASTNode *inner_stmt = NULL;
     ASTNode *while_node = NULL;
     ASTNode *init_node = NULL;
     ASTNode *init_stmt = NULL;
@@ -76,383 +57,229 @@ ASTNode* parse_statement(FILE *input) {
     ASTNode *for_node = NULL;
     ASTNode *br = NULL;
     ASTNode *cn = NULL;
-    ASTNode *inner = NULL;
     ASTNode *if_node = NULL;
     Token type_token = {0};
     Token name_token = {0};
-    Token lhs_token = {0};
     Token temp_lhs = {0};
     Token inc_lhs = {0};
-    Token saved_token = {0};
-    long saved_pos = 0;
+    Token next_tok = {0};
     int is_struct = 0;
     int is_array = 0;
-    int paren_depth = 0;
-    int arr_size = 0;
-    int idx_val = 0;
-    size_t len = 0;
-    char arr_size_buf[256] = {0};
-    char lhs_buf[1024] = {0};
-    char idx_buf[512] = {0};
-    char base_name[128] = {0};
-    char buf[1024] = {0};
-    const char *delim = NULL;
+    long long array_size = 0;
+    char size_text[24];
+    StrBuf lhs_buf = {0};
 
-    stmt_node = create_node(NODE_STATEMENT);
+    stmt_node = create_node(ctx, NODE_STATEMENT);
 
-    if (match(TOKEN_KEYWORD) && (
-        strcmp(current_token.value, "int") == 0 ||
-        strcmp(current_token.value, "float") == 0 ||
-        strcmp(current_token.value, "char") == 0 ||
-        strcmp(current_token.value, "double") == 0 ||
-        strcmp(current_token.value, "struct") == 0)) {
-        type_token = current_token;
-        advance(input);
+    if (match_kw(ctx, KW_INT) || match_kw(ctx, KW_FLOAT) || match_kw(ctx, KW_CHAR) ||
+        match_kw(ctx, KW_DOUBLE) || match_kw(ctx, KW_STRUCT)) {
+        type_token = ctx->current_token;
+        advance(ctx);
     is_struct = 0;
-        if (strcmp(type_token.value, "struct") == 0) {
-            if (!match(TOKEN_IDENTIFIER)) {
-                printf("Error (line %d): Expected struct name after 'struct'\n", current_token.line);
-                exit(EXIT_FAILURE);
+        if (type_token.kw == KW_STRUCT) {
+            if (!match(ctx, TOKEN_IDENTIFIER)) {
+                compi_error(ctx, "Expected struct name after 'struct'");
+                compi_fail(ctx);
             }
-            type_token = current_token;
-            advance(input);
+            type_token = ctx->current_token;
+            advance(ctx);
             is_struct = 1;
         }
-        if (match(TOKEN_IDENTIFIER)) {
-            name_token = current_token;
-            advance(input);
-            var_decl_node = create_node(NODE_VAR_DECL);
+        if (match(ctx, TOKEN_IDENTIFIER)) {
+            name_token = ctx->current_token;
+            advance(ctx);
+            var_decl_node = create_node(ctx, NODE_VAR_DECL);
             var_decl_node->token = type_token;
-            var_decl_node->value = strdup(name_token.value);
+            node_set_value_token(var_decl_node, &name_token);
             is_array = 0;
-            memset(arr_size_buf, 0, sizeof(arr_size_buf));
-            if (match(TOKEN_BRACKET_OPEN)) {
+            if (match(ctx, TOKEN_BRACKET_OPEN)) {
                 is_array = 1;
-                advance(input);
-                if (match(TOKEN_NUMBER)) {
-                    snprintf(arr_size_buf, sizeof(arr_size_buf), "%s", current_token.value);
-                    memset(buf, 0, sizeof(buf));
-                    snprintf(buf, sizeof(buf), "%s[%s]", name_token.value, current_token.value);
-                    free(var_decl_node->value);
-                    var_decl_node->value = strdup(buf);
-                    advance(input);
-                    register_array(name_token.value, atoi(arr_size_buf));
-                } else {
-                    printf("Error (line %d): Expected array size after '['\n", current_token.line);
-                    exit(EXIT_FAILURE);
+                advance(ctx);
+                if (!parse_const_expression(ctx, &array_size) || array_size <= 0 || array_size > INT_MAX) {
+                    compi_error(ctx, "Expected a constant array size between 1 and %d after '['", INT_MAX);
+                    compi_fail(ctx);
                 }
-                if (!consume(input, TOKEN_BRACKET_CLOSE)) {
-                    printf("Error (line %d): Expected ']' after array size\n", current_token.line);
-                    exit(EXIT_FAILURE);
+                // The folded size: "a[2 * 4]" reads "a[8]"
+                snprintf(size_text, sizeof(size_text), "[%lld]", array_size);
+                strbuf_append_token(&lhs_buf, &name_token);
+                strbuf_append_str(&lhs_buf, size_text);
+                register_array(ctx, var_decl_node->value, (int)array_size);
+                node_set_value_n(var_decl_node, strbuf_cstr(&lhs_buf), lhs_buf.len);
+                strbuf_free(&lhs_buf);
+                if (!consume(ctx, TOKEN_BRACKET_CLOSE)) {
+                    compi_error(ctx, "Expected ']' after array size");
+                    compi_fail(ctx);
                 }
             }
-            if (match(TOKEN_OPERATOR) && strcmp(current_token.value, "=") == 0) {
-                advance(input);
-                if (is_array && match(TOKEN_BRACE_OPEN)) {
-                    advance(input);
-                    init_list = create_node(NODE_EXPRESSION);
-                    init_list->value = strdup("array_init");
-                    while (!match(TOKEN_BRACE_CLOSE) && !match(TOKEN_EOF)) {
-                        if (match(TOKEN_NUMBER) || match(TOKEN_IDENTIFIER)) {
-                            elem = create_node(NODE_EXPRESSION);
-                            elem->value = strdup(current_token.value);
+            if (match_op(ctx, OP_ASSIGN)) {
+                advance(ctx);
+                if (is_array && match(ctx, TOKEN_BRACE_OPEN)) {
+                    advance(ctx);
+                    init_list = create_node(ctx, NODE_EXPRESSION);
+                    node_set_value(init_list, "array_init");
+                    while (!match(ctx, TOKEN_BRACE_CLOSE) && !match(ctx, TOKEN_EOF)) {
+                        if (match(ctx, TOKEN_NUMBER) || match(ctx, TOKEN_IDENTIFIER)) {
+                            elem = create_node(ctx, NODE_EXPRESSION);
+                            node_set_value_token(elem, &ctx->current_token);
                             add_child(init_list, elem);
-                            advance(input);
-                        } else if (match(TOKEN_COMMA)) {
-                            advance(input);
+                            advance(ctx);
+                        } else if (match(ctx, TOKEN_COMMA)) {
+                            advance(ctx);
                         } else {
-                            advance(input);
+                            advance(ctx);
                         }
                     }
-                    if (!consume(input, TOKEN_BRACE_CLOSE)) {
-                        printf("Error (line %d): Expected '}' after array initializer\n", current_token.line);
-                        exit(EXIT_FAILURE);
+                    if (!consume(ctx, TOKEN_BRACE_CLOSE)) {
+                        compi_error(ctx, "Expected '}' after array initializer");
+                        compi_fail(ctx);
                     }
                     add_child(var_decl_node, init_list);
-                } else if (is_struct && match(TOKEN_BRACE_OPEN)) {
-                    advance(input);
-                    init_list = create_node(NODE_EXPRESSION);
-                    init_list->value = strdup("struct_init");
-                    while (!match(TOKEN_BRACE_CLOSE) && !match(TOKEN_EOF)) {
-                        if (match(TOKEN_NUMBER) || match(TOKEN_IDENTIFIER)) {
-                            elem = create_node(NODE_EXPRESSION);
-                            elem->value = strdup(current_token.value);
+                } else if (is_struct && match(ctx, TOKEN_BRACE_OPEN)) {
+                    advance(ctx);
+                    init_list = create_node(ctx, NODE_EXPRESSION);
+                    node_set_value(init_list, "struct_init");
+                    while (!match(ctx, TOKEN_BRACE_CLOSE) && !match(ctx, TOKEN_EOF)) {
+                        if (match(ctx, TOKEN_NUMBER) || match(ctx, TOKEN_IDENTIFIER)) {
+                            elem = create_node(ctx, NODE_EXPRESSION);
+                            node_set_value_token(elem, &ctx->current_token);
                             add_child(init_list, elem);
-                            advance(input);
-                        } else if (match(TOKEN_COMMA)) {
-                            advance(input);
+                            advance(ctx);
+                        } else if (match(ctx, TOKEN_COMMA)) {
+                            advance(ctx);
                         } else {
-                            advance(input);
+                            advance(ctx);
                         }
                     }
-                    if (!consume(input, TOKEN_BRACE_CLOSE)) {
-                        printf("Error (line %d): Expected '}' after struct initializer\n", current_token.line);
-                        exit(EXIT_FAILURE);
+                    if (!consume(ctx, TOKEN_BRACE_CLOSE)) {
+                        compi_error(ctx, "Expected '}' after struct initializer");
+                        compi_fail(ctx);
                     }
                     add_child(var_decl_node, init_list);
                 } else {
-                    init_expr = parse_expression(input);
+                    init_expr = parse_expression(ctx);
                     if (init_expr) {
                         add_child(var_decl_node, init_expr);
                     }
-                    while (!match(TOKEN_SEMICOLON) && !match(TOKEN_EOF)) {
-                        advance(input);
+                    while (!match(ctx, TOKEN_SEMICOLON) && !match(ctx, TOKEN_EOF)) {
+                        advance(ctx);
                     }
                 }
             }
-            if (!consume(input, TOKEN_SEMICOLON)) {
-                printf("Error (line %d): Expected ';' after variable declaration\n", current_token.line);
-                exit(EXIT_FAILURE);
+            if (!consume(ctx, TOKEN_SEMICOLON)) {
+                compi_error(ctx, "Expected ';' after variable declaration");
+                compi_fail(ctx);
             }
             add_child(stmt_node, var_decl_node);
             return stmt_node;
         } else {
-            printf("Error (line %d): Expected variable name after type\n", current_token.line);
-            exit(EXIT_FAILURE);
+            compi_error(ctx, "Expected variable name after type");
+            compi_fail(ctx);
         }
     }
 
-    if (match(TOKEN_IDENTIFIER)) {
-        lhs_token = current_token;
-        advance(input);
-    memset(lhs_buf, 0, sizeof(lhs_buf));
-    snprintf(lhs_buf, sizeof(lhs_buf), "%s", lhs_token.value);
-        while (match(TOKEN_OPERATOR) && current_token.value && strcmp(current_token.value, ".") == 0) {
-            advance(input);
-            if (!match(TOKEN_IDENTIFIER)) {
-                printf("Error (line %d): Expected field name after '.' in assignment\n", current_token.line);
-                exit(EXIT_FAILURE);
-            }
-            safe_append(lhs_buf, sizeof(lhs_buf), "__");
-            safe_append(lhs_buf, sizeof(lhs_buf), current_token.value);
-            advance(input);
-        }
-        if (match(TOKEN_BRACKET_OPEN)) {
-            advance(input);
-            memset(idx_buf, 0, sizeof(idx_buf));
-            paren_depth = 0;
-            while (!match(TOKEN_EOF)) {
-                if (match(TOKEN_BRACKET_CLOSE) && paren_depth == 0) {
-                    break;
-                }
-                if (match(TOKEN_PARENTHESIS_OPEN)) {
-                    safe_append(idx_buf, sizeof(idx_buf), "(");
-                    advance(input);
-                    paren_depth++;
-                    continue;
-                }
-                if (match(TOKEN_PARENTHESIS_CLOSE)) {
-                    safe_append(idx_buf, sizeof(idx_buf), ")");
-                    advance(input);
-                    if (paren_depth > 0) {
-                        paren_depth--;
-                    }
-                    continue;
-                }
-                if (current_token.value) {
-                    safe_append(idx_buf, sizeof(idx_buf), current_token.value);
-                }
-                advance(input);
-            }
-            if (!consume(input, TOKEN_BRACKET_CLOSE)) {
-                printf("Error (line %d): Expected ']' after array index in assignment\n", current_token.line);
-                exit(EXIT_FAILURE);
-            }
-            safe_append(lhs_buf, sizeof(lhs_buf), "[");
-            safe_append(lhs_buf, sizeof(lhs_buf), idx_buf);
-            safe_append(lhs_buf, sizeof(lhs_buf), "]");
-            if (is_number_str(idx_buf)) {
-                memset(base_name, 0, sizeof(base_name));
-                delim = strstr(lhs_buf, "__");
-                len = delim ? (size_t)(delim - lhs_buf) : strcspn(lhs_buf, "[");
-                if (len >= sizeof(base_name)) {
-                    len = sizeof(base_name) - 1;
-                }
-                safe_copy(base_name, sizeof(base_name), lhs_buf, len);
-                arr_size = find_array_size(base_name);
-                if (arr_size > 0) {
-                    idx_val = atoi(idx_buf);
-                    if (idx_val < 0 || idx_val >= arr_size) {
-                        printf("Error (line %d): Array index %d out of bounds for '%s' with size %d\n", current_token.line, idx_val, base_name, arr_size);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            }
-        }
-        lhs_expr = create_node(NODE_EXPRESSION);
-        lhs_expr->value = strdup(lhs_buf);
-        if (match(TOKEN_OPERATOR) && strcmp(current_token.value, "=") == 0) {
-            advance(input);
-            assign_node = create_node(NODE_ASSIGNMENT);
+    if (match(ctx, TOKEN_IDENTIFIER)) {
+        // Target: a name with any field and array accesses
+        lhs_expr = parse_primary(ctx);
+        if (match_op(ctx, OP_ASSIGN)) {
+            advance(ctx);
+            assign_node = create_node(ctx, NODE_ASSIGNMENT);
             add_child(assign_node, lhs_expr);
-            rhs_node = parse_expression(input);
+            rhs_node = parse_expression(ctx);
             if (rhs_node) {
                 add_child(assign_node, rhs_node);
             }
-            if (!consume(input, TOKEN_SEMICOLON)) {
-                printf("Error (line %d): Expected ';' after assignment\n", current_token.line);
-                exit(EXIT_FAILURE);
+            if (!consume(ctx, TOKEN_SEMICOLON)) {
+                compi_error(ctx, "Expected ';' after assignment");
+                compi_fail(ctx);
             }
             add_child(stmt_node, assign_node);
             return stmt_node;
         } else {
-            while (!match(TOKEN_SEMICOLON) && !match(TOKEN_EOF)) {
-                advance(input);
+            while (!match(ctx, TOKEN_SEMICOLON) && !match(ctx, TOKEN_EOF)) {
+                advance(ctx);
             }
-            if (match(TOKEN_SEMICOLON)) {
-                advance(input);
+            if (match(ctx, TOKEN_SEMICOLON)) {
+                advance(ctx);
             }
             free_node(lhs_expr);
             return stmt_node;
         }
     }
 
-    if (match(TOKEN_KEYWORD) && strcmp(current_token.value, "return") == 0) {
-        stmt_node->token = current_token;
-        advance(input);
-        return_expr = parse_expression(input);
+    if (match_kw(ctx, KW_RETURN)) {
+        stmt_node->token = ctx->current_token;
+        advance(ctx);
+        return_expr = parse_expression(ctx);
         if (return_expr) {
             add_child(stmt_node, return_expr);
         }
-        if (!consume(input, TOKEN_SEMICOLON)) {
-            printf("Error (line %d): Expected ';' after return statement\n", current_token.line);
-            exit(EXIT_FAILURE);
+        if (!consume(ctx, TOKEN_SEMICOLON)) {
+            compi_error(ctx, "Expected ';' after return statement");
+            compi_fail(ctx);
         }
         return stmt_node;
     }
 
-    if (match(TOKEN_KEYWORD) && strcmp(current_token.value, "if") == 0) {
-        advance(input);
-        if (!consume(input, TOKEN_PARENTHESIS_OPEN)) {
-            printf("Error (line %d): Expected '(' after 'if'\n", current_token.line);
-            exit(EXIT_FAILURE);
-        }
-    cond_expr = parse_expression(input);
-        if (!consume(input, TOKEN_PARENTHESIS_CLOSE)) {
-            printf("Error (line %d): Expected ')' after if condition\n", current_token.line);
-            exit(EXIT_FAILURE);
-        }
-        if (!consume(input, TOKEN_BRACE_OPEN)) {
-            printf("Error (line %d): Expected '{' after if condition\n", current_token.line);
-            exit(EXIT_FAILURE);
-        }
-    if_node = create_node(NODE_IF_STATEMENT);
+    if (match_kw(ctx, KW_IF)) {
+        advance(ctx);
+        if (!consume(ctx, TOKEN_PARENTHESIS_OPEN)) {
+            compi_error(ctx, "Expected '(' after 'if'");
+            compi_fail(ctx);
+        }
+    cond_expr = parse_expression(ctx);
+        if (!consume(ctx, TOKEN_PARENTHESIS_CLOSE)) {
+            compi_error(ctx, "Expected ')' after if condition");
+            compi_fail(ctx);
+        }
+        if (!consume(ctx, TOKEN_BRACE_OPEN)) {
+            compi_error(ctx, "Expected '{' after if condition");
+            compi_fail(ctx);
+        }
+    if_node = create_node(ctx, NODE_IF_STATEMENT);
         if (cond_expr) {
             add_child(if_node, cond_expr);
         }
-        while (!match(TOKEN_BRACE_CLOSE) && !match(TOKEN_EOF)) {
-            inner_stmt = parse_statement(input);
-            if (inner_stmt) {
-                add_child(if_node, inner_stmt);
-            }
-        }
-        if (!consume(input, TOKEN_BRACE_CLOSE)) {
-            printf("Error (line %d): Expected '}' after if block\n", current_token.line);
-            exit(EXIT_FAILURE);
-        }
-        while (match(TOKEN_KEYWORD) && strcmp(current_token.value, "else") == 0) {
-            advance(input);
-            if (match(TOKEN_KEYWORD) && strcmp(current_token.value, "if") == 0) {
-                advance(input);
-                if (!consume(input, TOKEN_PARENTHESIS_OPEN)) {
-                    printf("Error (line %d): Expected '(' after 'else if'\n", current_token.line);
-                    exit(EXIT_FAILURE);
-                }
-                elseif_cond = parse_expression(input);
-                if (!consume(input, TOKEN_PARENTHESIS_CLOSE)) {
-                    printf("Error (line %d): Expected ')' after else if condition\n", current_token.line);
-                    exit(EXIT_FAILURE);
-                }
-                if (!consume(input, TOKEN_BRACE_OPEN)) {
-                    printf("Error (line %d): Expected '{' after else if condition\n", current_token.line);
-                    exit(EXIT_FAILURE);
-                }
-                elseif_node = create_node(NODE_ELSE_IF_STATEMENT);
-                if (elseif_cond) {
-                    add_child(elseif_node, elseif_cond);
-                }
-                while (!match(TOKEN_BRACE_CLOSE) && !match(TOKEN_EOF)) {
-                    inner_stmt = parse_statement(input);
-                    if (inner_stmt) {
-                        add_child(elseif_node, inner_stmt);
-                    }
-                }
-                if (!consume(input, TOKEN_BRACE_CLOSE)) {
-                    printf("Error (line %d): Expected '}' after else if block\n", current_token.line);
-                    exit(EXIT_FAILURE);
-                }
-                add_child(if_node, elseif_node);
-            } else {
-                if (!consume(input, TOKEN_BRACE_OPEN)) {
-                    printf("Error (line %d): Expected '{' after else\n", current_token.line);
-                    exit(EXIT_FAILURE);
-                }
-                else_node = create_node(NODE_ELSE_STATEMENT);
-                while (!match(TOKEN_BRACE_CLOSE) && !match(TOKEN_EOF)) {
-                    inner_stmt = parse_statement(input);
-                    if (inner_stmt) {
-                        add_child(else_node, inner_stmt);
-                    }
-                }
-                if (!consume(input, TOKEN_BRACE_CLOSE)) {
-                    printf("Error (line %d): Expected '}' after else block\n", current_token.line);
-                    exit(EXIT_FAILURE);
-                }
-                add_child(if_node, else_node);
-                break;
-            }
-        }
-        add_child(stmt_node, if_node);
+        push_scope(ctx);
+        *block = (BlockFrame){ BLOCK_IF, stmt_node, if_node, if_node, NULL };
         return stmt_node;
     }
 
-    if (match(TOKEN_KEYWORD) && strcmp(current_token.value, "while") == 0) {
-        advance(input);
-        if (!consume(input, TOKEN_PARENTHESIS_OPEN)) {
-            printf("Error (line %d): Expected '(' after 'while'\n", current_token.line);
-            exit(EXIT_FAILURE);
-        }
-    cond_expr = parse_expression(input);
-        if (!consume(input, TOKEN_PARENTHESIS_CLOSE)) {
-            printf("Error (line %d): Expected ')' after while condition\n", current_token.line);
-            exit(EXIT_FAILURE);
-        }
-        if (!consume(input, TOKEN_BRACE_OPEN)) {
-            printf("Error (line %d): Expected '{' after while condition\n", current_token.line);
-            exit(EXIT_FAILURE);
-        }
-    while_node = create_node(NODE_WHILE_STATEMENT);
+    if (match_kw(ctx, KW_WHILE)) {
+        advance(ctx);
+        if (!consume(ctx, TOKEN_PARENTHESIS_OPEN)) {
+            compi_error(ctx, "Expected '(' after 'while'");
+            compi_fail(ctx);
+        }
+    cond_expr = parse_expression(ctx);
+        if (!consume(ctx, TOKEN_PARENTHESIS_CLOSE)) {
+            compi_error(ctx, "Expected ')' after while condition");
+            compi_fail(ctx);
+        }
+        if (!consume(ctx, TOKEN_BRACE_OPEN)) {
+            compi_error(ctx, "Expected '{' after while condition");
+            compi_fail(ctx);
+        }
+    while_node = create_node(ctx, NODE_WHILE_STATEMENT);
         if (cond_expr) {
             add_child(while_node, cond_expr);
         }
-        s_loop_depth++;
-        while (!match(TOKEN_BRACE_CLOSE) && !match(TOKEN_EOF)) {
-            inner_stmt = parse_statement(input);
-            if (inner_stmt) {
-                add_child(while_node, inner_stmt);
-            }
-        }
-        s_loop_depth--;
-        if (!consume(input, TOKEN_BRACE_CLOSE)) {
-            printf("Error (line %d): Expected '}' after while block\n", current_token.line);
-            exit(EXIT_FAILURE);
-        }
-        add_child(stmt_node, while_node);
+        ctx->loop_depth++;
+        push_scope(ctx);
+        *block = (BlockFrame){ BLOCK_WHILE, stmt_node, while_node, while_node, NULL };
         return stmt_node;
     }
 
-    if (match(TOKEN_KEYWORD) && strcmp(current_token.value, "for") == 0) {
-        advance(input);
-        if (!consume(input, TOKEN_PARENTHESIS_OPEN)) {
-            printf("Error (line %d): Expected '(' after 'for'\n", current_token.line);
-            exit(EXIT_FAILURE);
+    if (match_kw(ctx, KW_FOR)) {
+        advance(ctx);
+        if (!consume(ctx, TOKEN_PARENTHESIS_OPEN)) {
+            compi_error(ctx, "Expected '(' after 'for'");
+            compi_fail(ctx);
         }
+        push_scope(ctx); // Covers the init clause and the body
     init_node = NULL;
-        if (!match(TOKEN_SEMICOLON)) {
-            saved_pos = ftell(input);
-            saved_token = current_token;
-            if (match(TOKEN_KEYWORD) && (strcmp(current_token.value, "int") == 0 || strcmp(current_token.value, "float") == 0 || strcmp(current_token.value, "char") == 0 || strcmp(current_token.value, "double") == 0)) {
-                init_stmt = parse_statement(input);
+        if (!match(ctx, TOKEN_SEMICOLON)) {
+            if (match_kw(ctx, KW_INT) || match_kw(ctx, KW_FLOAT) || match_kw(ctx, KW_CHAR) || match_kw(ctx, KW_DOUBLE)) {
+                init_stmt = parse_statement(ctx);
                 if (init_stmt && init_stmt->num_children > 0) {
                     child0 = init_stmt->children[0];
                     if (child0->type == NODE_VAR_DECL || child0->type == NODE_ASSIGNMENT) {
@@ -460,69 +287,70 @@ ASTNode* parse_statement(FILE *input) {
                     }
                 }
             } else {
-                if (match(TOKEN_IDENTIFIER)) {
-                    temp_lhs = current_token;
-                    advance(input);
-                    if (match(TOKEN_OPERATOR) && strcmp(current_token.value, "=") == 0) {
-                        advance(input);
-                        assign_tmp = create_node(NODE_ASSIGNMENT);
-                        lhs_expr_tmp = create_node(NODE_EXPRESSION);
-                        lhs_expr_tmp->value = strdup(temp_lhs.value);
+                // Only "name = expr" is taken here; one token of lookahead
+                // decides without consuming anything
+                if (match(ctx, TOKEN_IDENTIFIER)) {
+                    next_tok = peek_token(ctx, 1);
+                    if (next_tok.type == TOKEN_OPERATOR && next_tok.op == OP_ASSIGN) {
+                        temp_lhs = ctx->current_token;
+                        advance(ctx);
+                        advance(ctx);
+                        assign_tmp = create_node(ctx, NODE_ASSIGNMENT);
+                        lhs_expr_tmp = create_node(ctx, NODE_EXPRESSION);
+                        node_set_value_token(lhs_expr_tmp, &temp_lhs);
                         add_child(assign_tmp, lhs_expr_tmp);
-                        rhs_expr = parse_expression(input);
+                        rhs_expr = parse_expression(ctx);
                         if (rhs_expr) {
                             add_child(assign_tmp, rhs_expr);
                         }
-                        if (!consume(input, TOKEN_SEMICOLON)) {
-                            printf("Error (line %d): Expected ';' after for-init assignment\n", current_token.line);
-                            exit(EXIT_FAILURE);
+                        if (!consume(ctx, TOKEN_SEMICOLON)) {
+                            compi_error(ctx, "Expected ';' after for-init assignment");
+                            compi_fail(ctx);
                         }
                         init_node = assign_tmp;
-                    } else {
-                        fseek(input, saved_pos, SEEK_SET);
-                        current_token = saved_token;
                     }
                 }
             }
         }
-        if (match(TOKEN_SEMICOLON)) {
-            advance(input);
+        if (match(ctx, TOKEN_SEMICOLON)) {
+            advance(ctx);
         }
     cond_expr = NULL;
-        if (!match(TOKEN_SEMICOLON)) {
-            cond_expr = parse_expression(input);
+        if (!match(ctx, TOKEN_SEMICOLON)) {
+            cond_expr = parse_expression(ctx);
         }
-        if (!consume(input, TOKEN_SEMICOLON)) {
-            printf("Error (line %d): Expected ';' after for condition\n", current_token.line);
-            exit(EXIT_FAILURE);
+        if (!consume(ctx, TOKEN_SEMICOLON)) {
+            compi_error(ctx, "Expected ';' after for condition");
+            compi_fail(ctx);
         }
     incr_expr = NULL;
-        if (!match(TOKEN_PARENTHESIS_CLOSE)) {
-            if (match(TOKEN_IDENTIFIER)) {
-                inc_lhs = current_token;
-                advance(input);
-                if (match(TOKEN_OPERATOR) && (strcmp(current_token.value, "++") == 0 || strcmp(current_token.value, "--") == 0)) {
-                    incr_expr = create_node(NODE_ASSIGNMENT);
-                    lhs = create_node(NODE_EXPRESSION);
-                    lhs->value = strdup(inc_lhs.value);
+        if (!match(ctx, TOKEN_PARENTHESIS_CLOSE)) {
+            if (match(ctx, TOKEN_IDENTIFIER)) {
+                inc_lhs = ctx->current_token;
+                advance(ctx);
+                if ((match_op(ctx, OP_INC) || match_op(ctx, OP_DEC))) {
+                    incr_expr = create_node(ctx, NODE_ASSIGNMENT);
+                    lhs = create_node(ctx, NODE_EXPRESSION);
+                    node_set_value_token(lhs, &inc_lhs);
                     add_child(incr_expr, lhs);
-                    rhs = create_node(NODE_BINARY_EXPR);
-                    rhs->value = strdup(strcmp(current_token.value, "++") == 0 ? "+" : "-");
-                    op_l = create_node(NODE_EXPRESSION);
-                    op_l->value = strdup(inc_lhs.value);
-                    op_r = create_node(NODE_EXPRESSION);
-                    op_r->value = strdup("1");
+                    rhs = create_node(ctx, NODE_BINARY_EXPR);
+                    rhs->op = match_op(ctx, OP_INC) ? OP_ADD : OP_SUB;
+                    node_set_value(rhs, operator_text(rhs->op));
+                    op_l = create_node(ctx, NODE_EXPRESSION);
+                    node_set_value_token(op_l, &inc_lhs);
+                    op_r = create_node(ctx, NODE_EXPRESSION);
+                    node_set_value(op_r, "1");
                     add_child(rhs, op_l);
                     add_child(rhs, op_r);
                     add_child(incr_expr, rhs);
-                    advance(input);
-                } else if (match(TOKEN_OPERATOR) && strcmp(current_token.value, "=") == 0) {
-                    advance(input);
-                    incr_expr = create_node(NODE_ASSIGNMENT);
-                    lhs = create_node(NODE_EXPRESSION);
-                    lhs->value = strdup(inc_lhs.value);
+                    advance(ctx);
+                } else if (match_op(ctx, OP_ASSIGN)) {
+                    advance(ctx);
+                    incr_expr = create_node(ctx, NODE_ASSIGNMENT);
+                    lhs = create_node(ctx, NODE_EXPRESSION);
+                    node_set_value_token(lhs, &inc_lhs);
                     add_child(incr_expr, lhs);
-                    rhs = parse_expression(input);
+                    rhs = parse_expression(ctx);
                     if (rhs) {
                         add_child(incr_expr, rhs);
                     }
@@ -531,79 +359,232 @@ ASTNode* parse_statement(FILE *input) {
                 }
             }
         }
-        if (!consume(input, TOKEN_PARENTHESIS_CLOSE)) {
-            printf("Error (line %d): Expected ')' after for header\n", current_token.line);
-            exit(EXIT_FAILURE);
+        if (!consume(ctx, TOKEN_PARENTHESIS_CLOSE)) {
+            compi_error(ctx, "Expected ')' after for header");
+            compi_fail(ctx);
         }
-        if (!consume(input, TOKEN_BRACE_OPEN)) {
-            printf("Error (line %d): Expected '{' after for header\n", current_token.line);
-            exit(EXIT_FAILURE);
+        if (!consume(ctx, TOKEN_BRACE_OPEN)) {
+            compi_error(ctx, "Expected '{' after for header");
+            compi_fail(ctx);
         }
-    for_node = create_node(NODE_FOR_STATEMENT);
+    for_node = create_node(ctx, NODE_FOR_STATEMENT);
         if (init_node) {
             add_child(for_node, init_node);
         }
         if (cond_expr) {
             add_child(for_node, cond_expr);
         } else {
-            true_expr = create_node(NODE_EXPRESSION);
-            true_expr->value = strdup("1");
+            true_expr = create_node(ctx, NODE_EXPRESSION);
+            node_set_value(true_expr, "1");
             add_child(for_node, true_expr);
         }
-        s_loop_depth++;
-        while (!match(TOKEN_BRACE_CLOSE) && !match(TOKEN_EOF)) {
-            inner = parse_statement(input);
-            if (inner) {
-                add_child(for_node, inner);
-            }
-        }
-        s_loop_depth--;
-        if (!consume(input, TOKEN_BRACE_CLOSE)) {
-            printf("Error (line %d): Expected '}' after for body\n", current_token.line);
-            exit(EXIT_FAILURE);
-        }
-        if (incr_expr) {
-            add_child(for_node, incr_expr);
-        }
-        add_child(stmt_node, for_node);
+        ctx->loop_depth++;
+        *block = (BlockFrame){ BLOCK_FOR, stmt_node, for_node, for_node, incr_expr };
         return stmt_node;
     }
 
-    if ((match(TOKEN_KEYWORD) && strcmp(current_token.value, "break") == 0) || (match(TOKEN_IDENTIFIER) && strcmp(current_token.value, "break") == 0)) {
-        if (s_loop_depth <= 0) {
-            printf("Error (line %d): 'break' not within a loop\n", current_token.line);
-            exit(EXIT_FAILURE);
+    if (match_kw(ctx, KW_BREAK)) {
+        if (ctx->loop_depth <= 0) {
+            compi_error(ctx, "'break' not within a loop");
+            compi_fail(ctx);
         }
-        advance(input);
-        if (!consume(input, TOKEN_SEMICOLON)) {
-            printf("Error (line %d): Expected ';' after 'break'\n", current_token.line);
-            exit(EXIT_FAILURE);
+        advance(ctx);
+        if (!consume(ctx, TOKEN_SEMICOLON)) {
+            compi_error(ctx, "Expected ';' after 'break'");
+            compi_fail(ctx);
         }
-    br = create_node(NODE_BREAK_STATEMENT);
+    br = create_node(ctx, NODE_BREAK_STATEMENT);
     add_child(stmt_node, br);
         return stmt_node;
     }
 
-    if ((match(TOKEN_KEYWORD) && strcmp(current_token.value, "continue") == 0) || (match(TOKEN_IDENTIFIER) && strcmp(current_token.value, "continue") == 0)) {
-        if (s_loop_depth <= 0) {
-            printf("Error (line %d): 'continue' not within a loop\n", current_token.line);
-            exit(EXIT_FAILURE);
+    if (match_kw(ctx, KW_CONTINUE)) {
+        if (ctx->loop_depth <= 0) {
+            compi_error(ctx, "'continue' not within a loop");
+            compi_fail(ctx);
         }
-        advance(input);
-        if (!consume(input, TOKEN_SEMICOLON)) {
-            printf("Error (line %d): Expected ';' after 'continue'\n", current_token.line);
-            exit(EXIT_FAILURE);
+        advance(ctx);
+        if (!consume(ctx, TOKEN_SEMICOLON)) {
+            compi_error(ctx, "Expected ';' after 'continue'");
+            compi_fail(ctx);
         }
-    cn = create_node(NODE_CONTINUE_STATEMENT);
+    cn = create_node(ctx, NODE_CONTINUE_STATEMENT);
     add_child(stmt_node, cn);
         return stmt_node;
     }
 
-    while (!match(TOKEN_SEMICOLON) && !match(TOKEN_BRACE_CLOSE) && !match(TOKEN_EOF)) {
-        advance(input);
+    while (!match(ctx, TOKEN_SEMICOLON) && !match(ctx, TOKEN_BRACE_CLOSE) && !match(ctx, TOKEN_EOF)) {
+        advance(ctx);
     }
-    if (match(TOKEN_SEMICOLON)) {
-        advance(input);
+    if (match(ctx, TOKEN_SEMICOLON)) {
+        advance(ctx);
     }
     return stmt_node;
 }
+
+// Close the innermost block at its '}' (or EOF). An if or else-if block
+// may be followed by another branch, which reuses the frame and returns
+// NULL; otherwise the finished statement is returned.
+static ASTNode* close_block(CompiContext *ctx, BlockFrame *block) {
+    ASTNode *cond = NULL;
+
+    pop_scope(ctx);
+    if (block->kind == BLOCK_WHILE || block->kind == BLOCK_FOR) {
+        ctx->loop_depth--;
+    }
+    if (!consume(ctx, TOKEN_BRACE_CLOSE)) {
+        compi_error(ctx, "Expected '}' after %s", s_block_names[block->kind]);
+        compi_fail(ctx);
+    }
+    switch (block->kind) {
+        case BLOCK_ELSE_IF:
+            add_child(block->owner, block->body);
+            /* fall through */
+        case BLOCK_IF:
+            if (!match_kw(ctx, KW_ELSE)) {
+                break;
+            }
+            advance(ctx);
+            if (match_kw(ctx, KW_IF)) {
+                advance(ctx);
+                if (!consume(ctx, TOKEN_PARENTHESIS_OPEN)) {
+                    compi_error(ctx, "Expected '(' after 'else if'");
+                    compi_fail(ctx);
+                }
+                cond = parse_expression(ctx);
+                if (!consume(ctx, TOKEN_PARENTHESIS_CLOSE)) {
+                    compi_error(ctx, "Expected ')' after else if condition");
+                    compi_fail(ctx);
+                }
+                if (!consume(ctx, TOKEN_BRACE_OPEN)) {
+                    compi_error(ctx, "Expected '{' after else if condition");
+                    compi_fail(ctx);
+                }
+                block->kind = BLOCK_ELSE_IF;
+                block->body = create_node(ctx, NODE_ELSE_IF_STATEMENT);
+                if (cond) {
+                    add_child(block->body, cond);
+                }
+            } else {
+                if (!consume(ctx, TOKEN_BRACE_OPEN)) {
+                    compi_error(ctx, "Expected '{' after else");
+                    compi_fail(ctx);
+                }
+                block->kind = BLOCK_ELSE;
+                block->body = create_node(ctx, NODE_ELSE_STATEMENT);
+            }
+            push_scope(ctx);
+            return NULL;
+        case BLOCK_ELSE:
+            add_child(block->owner, block->body);
+            break;
+        case BLOCK_FOR:
+            if (block->incr) {
+                add_child(block->owner, block->incr);
+            }
+            break;
+        case BLOCK_WHILE:
+            break;
+    }
+    add_child(block->stmt, block->owner);
+    return block->stmt;
+}
+
+void parse_resync(CompiContext *ctx) {
+
+    int nest = 0;
+
+    while (!match(ctx, TOKEN_EOF)) {
+        if (match(ctx, TOKEN_BRACE_OPEN)) {
+            nest++;
+        } else if (match(ctx, TOKEN_BRACE_CLOSE)) {
+            if (nest == 0) return;
+            if (--nest == 0) {
+                advance(ctx);
+                return;
+            }
+        } else if (match(ctx, TOKEN_SEMICOLON) && nest == 0) {
+            advance(ctx);
+            return;
+        }
+        advance(ctx);
+    }
+}
+
+// Number of open while/for frames (each also counts in ctx->loop_depth)
+static int open_loops(const BlockFrame *blocks, size_t depth) {
+
+    int loops = 0;
+    size_t i = 0;
+
+    for (i = 0; i < depth; i++) {
+        if (blocks[i].kind == BLOCK_WHILE || blocks[i].kind == BLOCK_FOR) loops++;
+    }
+    return loops;
+}
+
+ASTNode* parse_statement(CompiContext *ctx) {
+    BlockFrame local[16];
+    BlockFrame *volatile blocks = local;
+    BlockFrame opened;
+    ASTNode *stmt = NULL;
+    volatile size_t depth = 0;
+    volatile size_t capacity = sizeof(local) / sizeof(local[0]);
+    volatile int closing = 0;
+    jmp_buf *outer = ctx->fail_env;
+    jmp_buf env;
+    int base_scope = ctx->arrays.depth;
+    int base_loops = ctx->loop_depth;
+
+    if (ctx->recover) {
+        ctx->fail_env = &env;
+        if (setjmp(env) != 0) {
+            // A frame whose close failed is dropped along with its statement.
+            // Every open frame holds one scope, and loops one loop level.
+            if (closing) depth--;
+            closing = 0;
+            while (ctx->arrays.depth > base_scope + (int)depth) {
+                pop_scope(ctx);
+            }
+            ctx->loop_depth = base_loops + open_loops(blocks, depth);
+            parse_resync(ctx);
+            if (match(ctx, TOKEN_EOF) || (depth == 0 && match(ctx, TOKEN_BRACE_CLOSE))) {
+                while (ctx->arrays.depth > base_scope) pop_scope(ctx);
+                ctx->loop_depth = base_loops;
+                ctx->fail_env = outer;
+                return NULL;
+            }
+        }
+    }
+
+    for (;;) {
+        if (depth > 0 && (match(ctx, TOKEN_BRACE_CLOSE) || match(ctx, TOKEN_EOF))) {
+            closing = 1;
+            stmt = close_block(ctx, &blocks[depth - 1]);
+            closing = 0;
+            if (!stmt) {
+                continue;   // Next branch of the same if
+            }
+            depth--;
+        } else {
+            opened.owner = NULL;
+            stmt = parse_statement_head(ctx, &opened);
+            if (opened.owner) {
+                // Deep nesting moves the frames to the arena (nothing to
+                // free if a parse error unwinds through compi_fail)
+                if (depth == capacity) {
+                    blocks = (BlockFrame*)arena_grow(&ctx->arena, blocks, capacity * sizeof(BlockFrame),
+                                                     capacity * 2 * sizeof(BlockFrame));
+                    capacity *= 2;
+                }
+                blocks[depth++] = opened;
+                continue;
+            }
+        }
+        if (depth == 0) {
+            ctx->fail_env = outer;
+            return stmt;
+        }
+        add_child(blocks[depth - 1].body, stmt);
+    }
+}
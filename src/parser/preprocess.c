@@ -0,0 +1,923 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "preprocess.h"
+#include "parse.h"
+#include "symbol_map.h"
+#include "utils.h"
+
+#define PP_MAX_INCLUDE_DEPTH 32
+#define PP_MAX_EXPANSION_DEPTH 64
+#define PP_MAX_CONDITIONS 64
+
+// Cached header: everything an includer takes from it, copied out of the
+// private context it was parsed in
+typedef struct {
+    char *name;
+    char *type;
+} PPField;
+
+typedef struct {
+    char *name;
+    PPField *fields;
+    int field_count;
+} PPStruct;
+
+typedef struct {
+    char *name;
+    char *value;
+} PPDefine;
+
+typedef struct {
+    DiagSeverity severity;
+    char *text;            // "In file: ..." form of the header's message
+    size_t len;
+} PPDiag;
+
+typedef struct IncludeEntry IncludeEntry;
+
+struct IncludeEntry {
+    char *path;            // Resolved path (the cache key)
+    int loading;           // Being read (reaching it again is a cycle)
+    int guarded;           // #pragma once or an include guard
+    int cycle_safe;        // While loading: guarded so far (a cycle is harmless)
+    IncludeEntry **nested; // Headers it includes, in order
+    size_t nested_count;
+    PPStruct *structs;     // Its own struct definitions
+    size_t struct_count;
+    PPDefine *defines;     // Macros defined at its end
+    size_t define_count;
+    PPDiag *diags;
+    size_t diag_count;
+    IncludeEntry *next;
+};
+
+struct IncludeCache {
+    pthread_mutex_t lock;  // Recursive: loading a header loads its includes
+    IncludeEntry *entries;
+};
+
+typedef struct {
+    const char *name;      // Interned in ctx->names
+    char *value;
+    int active;            // Being expanded (a self-reference stays as is)
+} PPMacro;
+
+typedef struct {
+    int active;            // Lines are kept
+    int parent_active;
+    int taken;             // The branch condition held
+    int seen_else;
+} PPCondition;
+
+// State of one file being preprocessed (the compiled source or a header)
+typedef struct {
+    CompiContext *ctx;
+    IncludeCache *cache;
+    const char *file;              // For "..." includes (NULL: current directory)
+    int depth;                     // Include depth
+    IncludeEntry *entry;           // Header being loaded (NULL: the source)
+    PPMacro *macros;
+    size_t macro_count;
+    size_t macro_capacity;
+    SymbolMap macro_index;         // name -> index in macros (-1: undefined)
+    IncludeEntry **included;       // Every header seen, nested ones too
+    size_t included_count;
+    size_t included_capacity;
+    IncludeEntry **direct;         // Headers this file includes itself
+    size_t direct_count;
+    size_t direct_capacity;
+    PPCondition conds[PP_MAX_CONDITIONS];
+    int cond_count;
+    int line;
+    int content_seen;              // Code or a directive so far (guard detection)
+    int line_code;                 // The current line has code
+    const char *guard;             // #ifndef of a possible include guard
+    int guard_closed;              // Its #endif was seen
+    int pragma_once;
+    StrBuf out;
+} PPState;
+
+static void pp_report(PPState *st, DiagSeverity severity, const char *fmt, ...)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+static void pp_report(PPState *st, DiagSeverity severity, const char *fmt, ...) {
+
+    char msg[512];
+    char text[600];
+    int len = 0;
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    if (severity == DIAG_ERROR) {
+        len = snprintf(text, sizeof(text), "Error (line %d): %s\n", st->line, msg);
+    } else {
+        len = snprintf(text, sizeof(text), "Warning: %s\n", msg);
+    }
+    if (len < 0) return;
+    if ((size_t)len >= sizeof(text)) len = (int)sizeof(text) - 1;
+    compi_report(st->ctx, severity, st->line, text, (size_t)len);
+}
+
+static char* dup_n(const char *text, size_t len) {
+
+    char *copy = (char*)malloc(len + 1);
+
+    if (!copy) {
+        perror("Failed to allocate preprocessor string");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static void* grow(void *items, size_t *capacity, size_t size) {
+
+    size_t new_capacity = *capacity ? *capacity * 2 : 8;
+
+    items = realloc(items, new_capacity * size);
+    if (!items) {
+        perror("Failed to grow preprocessor table");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = new_capacity;
+    return items;
+}
+
+static int is_ident_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_ident_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static const char* skip_space(const char *p, const char *end) {
+    while (p < end && isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+static const char* skip_ident(const char *p, const char *end) {
+    while (p < end && is_ident_char(*p)) p++;
+    return p;
+}
+
+static int pp_active(const PPState *st) {
+    return st->cond_count == 0 || st->conds[st->cond_count - 1].active;
+}
+
+static void pp_init(PPState *st, CompiContext *ctx, IncludeCache *cache, const char *file, int depth) {
+
+    memset(st, 0, sizeof(*st));
+    st->ctx = ctx;
+    st->cache = cache;
+    st->file = file;
+    st->depth = depth;
+    symbol_map_init(&st->macro_index);
+}
+
+static void pp_free(PPState *st) {
+
+    size_t k = 0;
+
+    for (k = 0; k < st->macro_count; k++) {
+        free(st->macros[k].value);
+    }
+    free(st->macros);
+    symbol_map_free(&st->macro_index);
+    free(st->included);
+    free(st->direct);
+    strbuf_free(&st->out);
+}
+
+// ---- Macros ----
+
+static PPMacro* find_macro(const PPState *st, const char *text, size_t len) {
+
+    const char *name = intern_find_n(&st->ctx->names, text, len);
+    int idx = name ? symbol_map_get(&st->macro_index, name, 0) : -1;
+
+    return idx < 0 ? NULL : &st->macros[idx];
+}
+
+static void define_macro(PPState *st, const char *name, size_t name_len, const char *value, size_t value_len) {
+
+    PPMacro *macro = find_macro(st, name, name_len);
+    const char *key = NULL;
+
+    if (macro) {
+        if (strlen(macro->value) != value_len || memcmp(macro->value, value, value_len) != 0) {
+            pp_report(st, DIAG_WARNING, "Macro '%.*s' redefined", (int)name_len, name);
+        }
+        free(macro->value);
+        macro->value = dup_n(value, value_len);
+        return;
+    }
+    key = intern_n(&st->ctx->names, name, name_len);
+    if (st->macro_count == st->macro_capacity) {
+        st->macros = (PPMacro*)grow(st->macros, &st->macro_capacity, sizeof(PPMacro));
+    }
+    st->macros[st->macro_count].name = key;
+    st->macros[st->macro_count].value = dup_n(value, value_len);
+    st->macros[st->macro_count].active = 0;
+    symbol_map_put(&st->macro_index, key, 0, (int)st->macro_count);
+    st->macro_count++;
+}
+
+static void undefine_macro(PPState *st, const char *name, size_t len) {
+
+    PPMacro *macro = find_macro(st, name, len);
+
+    if (!macro) return;
+    symbol_map_put(&st->macro_index, macro->name, 0, -1);
+    // Keep the slot (indices stay valid) but mark it gone for export
+    macro->name = NULL;
+}
+
+static void copy_text(PPState *st, const char *p, const char *end, int *in_comment, int depth);
+
+// Append a macro's replacement, unless it is already being expanded. The
+// replacement is spaced off from its neighbours so it cannot paste
+// into them ("-N" with N = -1 must not read "--1").
+static int expand_macro(PPState *st, PPMacro *macro, char next, int depth) {
+
+    int in_comment = 0;
+
+    if (macro->active) return 0;
+    if (depth >= PP_MAX_EXPANSION_DEPTH) {
+        pp_report(st, DIAG_ERROR, "Macro '%s' expands too deeply", macro->name);
+        return 0;
+    }
+    if (st->out.len > 0 && !isspace((unsigned char)st->out.data[st->out.len - 1])) {
+        strbuf_append(&st->out, " ", 1);
+    }
+    macro->active = 1;
+    copy_text(st, macro->value, macro->value + strlen(macro->value), &in_comment, depth + 1);
+    macro->active = 0;
+    if (next && !isspace((unsigned char)next)) {
+        strbuf_append(&st->out, " ", 1);
+    }
+    return 1;
+}
+
+// Copy [p, end) to the output, replacing macros outside comments and
+// literals. *in_comment carries a block comment across lines.
+static void copy_text(PPState *st, const char *p, const char *end, int *in_comment, int depth) {
+
+    const char *start = p;
+    const char *q = NULL;
+    PPMacro *macro = NULL;
+
+    while (p < end) {
+        if (*in_comment) {
+            while (p < end && !(p[0] == '*' && p + 1 < end && p[1] == '/')) p++;
+            if (p < end) {
+                p += 2;
+                *in_comment = 0;
+            }
+            continue;
+        }
+        if (p[0] == '/' && p + 1 < end && p[1] == '/') break;
+        if (p[0] == '/' && p + 1 < end && p[1] == '*') {
+            *in_comment = 1;
+            p += 2;
+            continue;
+        }
+        if (*p == '"' || *p == '\'') {
+            q = p + 1;
+            while (q < end && *q != *p) {
+                if (*q == '\\' && q + 1 < end) q++;
+                q++;
+            }
+            p = q < end ? q + 1 : end;
+            st->line_code = 1;
+            continue;
+        }
+        if (isdigit((unsigned char)*p)) {
+            // Number with any suffix ("10u", "1e5"): never a macro
+            while (p < end && (is_ident_char(*p) || *p == '.')) p++;
+            st->line_code = 1;
+            continue;
+        }
+        if (is_ident_start(*p)) {
+            q = skip_ident(p, end);
+            st->line_code = 1;
+            macro = st->macro_count > 0 ? find_macro(st, p, (size_t)(q - p)) : NULL;
+            if (macro) {
+                strbuf_append(&st->out, start, (size_t)(p - start));
+                start = expand_macro(st, macro, q < end ? *q : '\0', depth) ? q : p;
+            }
+            p = q;
+            continue;
+        }
+        if (!isspace((unsigned char)*p)) st->line_code = 1;
+        p++;
+    }
+    strbuf_append(&st->out, start, (size_t)(end - start));
+}
+
+// Skip a block comment state through the line without output
+static void skip_text(const char *p, const char *end, int *in_comment) {
+
+    const char *q = NULL;
+
+    while (p < end) {
+        if (*in_comment) {
+            while (p < end && !(p[0] == '*' && p + 1 < end && p[1] == '/')) p++;
+            if (p < end) {
+                p += 2;
+                *in_comment = 0;
+            }
+            continue;
+        }
+        if (p[0] == '/' && p + 1 < end && p[1] == '/') return;
+        if (p[0] == '/' && p + 1 < end && p[1] == '*') {
+            *in_comment = 1;
+            p += 2;
+            continue;
+        }
+        if (*p == '"' || *p == '\'') {
+            q = p + 1;
+            while (q < end && *q != *p) {
+                if (*q == '\\' && q + 1 < end) q++;
+                q++;
+            }
+            p = q < end ? q + 1 : end;
+            continue;
+        }
+        p++;
+    }
+}
+
+// ---- Headers ----
+
+static void entry_free(IncludeEntry *entry) {
+
+    size_t k = 0;
+    int f = 0;
+
+    for (k = 0; k < entry->struct_count; k++) {
+        for (f = 0; f < entry->structs[k].field_count; f++) {
+            free(entry->structs[k].fields[f].name);
+            free(entry->structs[k].fields[f].type);
+        }
+        free(entry->structs[k].fields);
+        free(entry->structs[k].name);
+    }
+    for (k = 0; k < entry->define_count; k++) {
+        free(entry->defines[k].name);
+        free(entry->defines[k].value);
+    }
+    for (k = 0; k < entry->diag_count; k++) {
+        free(entry->diags[k].text);
+    }
+    free(entry->structs);
+    free(entry->defines);
+    free(entry->diags);
+    free(entry->nested);
+    free(entry->path);
+    free(entry);
+}
+
+IncludeCache* include_cache_new(void) {
+
+    IncludeCache *cache = (IncludeCache*)calloc(1, sizeof(IncludeCache));
+    pthread_mutexattr_t attr;
+
+    if (!cache) return NULL;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&cache->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return cache;
+}
+
+void include_cache_free(IncludeCache *cache) {
+
+    IncludeEntry *entry = NULL;
+    IncludeEntry *next = NULL;
+
+    if (!cache) return;
+    for (entry = cache->entries; entry; entry = next) {
+        next = entry->next;
+        entry_free(entry);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+size_t include_cache_count(IncludeCache *cache) {
+
+    IncludeEntry *entry = NULL;
+    size_t count = 0;
+
+    pthread_mutex_lock(&cache->lock);
+    for (entry = cache->entries; entry; entry = entry->next) count++;
+    pthread_mutex_unlock(&cache->lock);
+    return count;
+}
+
+const char* include_cache_path(IncludeCache *cache, size_t index) {
+
+    IncludeEntry *entry = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    for (entry = cache->entries; entry && index > 0; entry = entry->next) index--;
+    pthread_mutex_unlock(&cache->lock);
+    return entry ? entry->path : NULL;
+}
+
+static void pp_run(PPState *st, const char *src, size_t len);
+
+// Read, preprocess and parse a header in a context of its own, and keep
+// what includers need. Called with the cache locked.
+static void load_header(PPState *st, IncludeEntry *entry) {
+
+    FILE *in = fopen(entry->path, "rb");
+    CompiContext hctx;
+    PPState hs;
+    ASTNode *program = NULL;
+    StructInfo *info = NULL;
+    char prefix[PATH_MAX + 8];
+    int first_own = 0;
+    int s = 0;
+    int f = 0;
+    size_t k = 0;
+    size_t n = 0;
+    int plen = 0;
+
+    compi_context_init(&hctx);
+    hctx.diag_hold = 1;
+    if (!in || compi_context_load_file(&hctx, in) != 0) {
+        pp_report(st, DIAG_ERROR, "Cannot read '%s': %s", entry->path, strerror(errno));
+        if (in) fclose(in);
+        compi_context_free(&hctx);
+        return;
+    }
+    fclose(in);
+
+    pp_init(&hs, &hctx, st->cache, entry->path, st->depth + 1);
+    hs.entry = entry;
+    pp_run(&hs, hctx.lexer.src, (size_t)(hctx.lexer.end - hctx.lexer.src));
+    if (hctx.diags.errors == 0) {
+        compi_context_load_buffer(&hctx, hs.out.data, hs.out.len);
+        // Structs registered so far came from nested includes
+        first_own = hctx.structs.count;
+        program = parse_program(&hctx);
+        for (s = 0; program && s < program->num_children; s++) {
+            if (program->children[s]->type != NODE_STRUCT_DECL) {
+                hctx.current_token = program->children[s]->token;
+                compi_error(&hctx, "Only struct definitions, macros and includes are allowed in a header");
+                break;
+            }
+        }
+    }
+    entry->guarded = hs.pragma_once || (hs.guard && hs.guard_closed);
+
+    entry->struct_count = (size_t)(hctx.structs.count - first_own);
+    entry->structs = (PPStruct*)calloc(entry->struct_count + 1, sizeof(PPStruct));
+    for (s = first_own; entry->structs && s < hctx.structs.count; s++) {
+        info = &hctx.structs.items[s];
+        entry->structs[n].name = dup_n(info->name, strlen(info->name));
+        entry->structs[n].fields = (PPField*)calloc((size_t)info->field_count + 1, sizeof(PPField));
+        for (f = 0; entry->structs[n].fields && f < info->field_count; f++) {
+            entry->structs[n].fields[f].name = dup_n(info->fields[f].field_name, strlen(info->fields[f].field_name));
+            entry->structs[n].fields[f].type = dup_n(info->fields[f].field_type, strlen(info->fields[f].field_type));
+            entry->structs[n].field_count++;
+        }
+        n++;
+    }
+    entry->struct_count = n;
+
+    entry->defines = (PPDefine*)calloc(hs.macro_count + 1, sizeof(PPDefine));
+    for (k = 0; entry->defines && k < hs.macro_count; k++) {
+        if (!hs.macros[k].name) continue;
+        entry->defines[entry->define_count].name = dup_n(hs.macros[k].name, strlen(hs.macros[k].name));
+        entry->defines[entry->define_count].value = dup_n(hs.macros[k].value, strlen(hs.macros[k].value));
+        entry->define_count++;
+    }
+
+    entry->nested = hs.direct;
+    entry->nested_count = hs.direct_count;
+    hs.direct = NULL;
+
+    plen = snprintf(prefix, sizeof(prefix), "In %s: ", entry->path);
+    if (plen < 0 || (size_t)plen >= sizeof(prefix)) plen = 0;
+    entry->diags = (PPDiag*)calloc(hctx.diags.count + 1, sizeof(PPDiag));
+    for (k = 0; entry->diags && k < hctx.diags.count; k++) {
+        entry->diags[k].severity = hctx.diags.items[k].severity;
+        entry->diags[k].len = (size_t)plen + hctx.diags.items[k].len;
+        entry->diags[k].text = (char*)malloc(entry->diags[k].len + 1);
+        if (!entry->diags[k].text) break;
+        memcpy(entry->diags[k].text, prefix, (size_t)plen);
+        memcpy(entry->diags[k].text + plen, hctx.diags.items[k].text, hctx.diags.items[k].len + 1);
+        entry->diag_count++;
+    }
+
+    pp_free(&hs);
+    compi_context_free(&hctx);
+}
+
+// Cached entry for path, loading it on first use; NULL on an include cycle
+static IncludeEntry* get_header(PPState *st, const char *path) {
+
+    IncludeEntry *entry = NULL;
+
+    pthread_mutex_lock(&st->cache->lock);
+    for (entry = st->cache->entries; entry; entry = entry->next) {
+        if (strcmp(entry->path, path) == 0) break;
+    }
+    if (entry && entry->loading) {
+        pthread_mutex_unlock(&st->cache->lock);
+        if (!entry->cycle_safe) {
+            pp_report(st, DIAG_ERROR, "Include cycle through '%s'", path);
+        }
+        return NULL;
+    }
+    if (!entry) {
+        entry = (IncludeEntry*)calloc(1, sizeof(IncludeEntry));
+        if (!entry) {
+            perror("Failed to allocate include cache entry");
+            exit(EXIT_FAILURE);
+        }
+        entry->path = dup_n(path, strlen(path));
+        entry->next = st->cache->entries;
+        st->cache->entries = entry;
+        entry->loading = 1;
+        load_header(st, entry);
+        entry->loading = 0;
+    }
+    pthread_mutex_unlock(&st->cache->lock);
+    return entry;
+}
+
+static int was_included(const PPState *st, const IncludeEntry *entry) {
+
+    size_t k = 0;
+
+    for (k = 0; k < st->included_count; k++) {
+        if (st->included[k] == entry) return 1;
+    }
+    return 0;
+}
+
+// Bring a loaded header into the file being preprocessed: its includes
+// first, then its structs, macros and diagnostics
+static void import_header(PPState *st, const IncludeEntry *entry) {
+
+    int idx = 0;
+    size_t k = 0;
+    int f = 0;
+
+    if (was_included(st, entry)) return;
+    if (st->included_count == st->included_capacity) {
+        st->included = (IncludeEntry**)grow(st->included, &st->included_capacity, sizeof(IncludeEntry*));
+    }
+    st->included[st->included_count++] = (IncludeEntry*)entry;
+
+    for (k = 0; k < entry->nested_count; k++) {
+        import_header(st, entry->nested[k]);
+    }
+    // A header's own copy already includes its nested diagnostics
+    for (k = 0; !st->entry && k < entry->diag_count; k++) {
+        compi_report(st->ctx, entry->diags[k].severity, st->line, entry->diags[k].text, entry->diags[k].len);
+    }
+    for (k = 0; k < entry->struct_count; k++) {
+        idx = add_struct(st->ctx, entry->structs[k].name);
+        for (f = 0; f < entry->structs[k].field_count; f++) {
+            add_struct_field(st->ctx, idx, entry->structs[k].fields[f].name, entry->structs[k].fields[f].type);
+        }
+    }
+    for (k = 0; k < entry->define_count; k++) {
+        define_macro(st, entry->defines[k].name, strlen(entry->defines[k].name),
+                     entry->defines[k].value, strlen(entry->defines[k].value));
+    }
+}
+
+static void include_file(PPState *st, const char *name, size_t len) {
+
+    char path[PATH_MAX];
+    char resolved[PATH_MAX];
+    const char *slash = st->file && strcmp(st->file, "-") != 0 ? strrchr(st->file, '/') : NULL;
+    IncludeEntry *entry = NULL;
+    int dir_len = slash ? (int)(slash - st->file) + 1 : 0;
+    int n = 0;
+
+    if (st->depth >= PP_MAX_INCLUDE_DEPTH) {
+        pp_report(st, DIAG_ERROR, "#include nested too deeply");
+        return;
+    }
+    if (len > 0 && name[0] == '/') dir_len = 0;
+    n = snprintf(path, sizeof(path), "%.*s%.*s", dir_len, dir_len ? st->file : "", (int)len, name);
+    if (n < 0 || (size_t)n >= sizeof(path) || !realpath(path, resolved)) {
+        pp_report(st, DIAG_ERROR, "Cannot open include file '%.*s'", (int)len, name);
+        return;
+    }
+
+    entry = get_header(st, resolved);
+    if (!entry) return;
+    if (st->entry) {
+        if (st->direct_count == st->direct_capacity) {
+            st->direct = (IncludeEntry**)grow(st->direct, &st->direct_capacity, sizeof(IncludeEntry*));
+        }
+        st->direct[st->direct_count++] = entry;
+    }
+    if (was_included(st, entry)) {
+        if (!entry->guarded) {
+            pp_report(st, DIAG_WARNING, "'%.*s' included again; it has no include guard and is only read once",
+                      (int)len, name);
+        }
+        return;
+    }
+    import_header(st, entry);
+}
+
+// ---- Directives ----
+
+static void push_condition(PPState *st, int taken) {
+
+    PPCondition *cond = NULL;
+    int parent = pp_active(st);
+
+    if (st->cond_count == PP_MAX_CONDITIONS) {
+        pp_report(st, DIAG_ERROR, "Conditionals nested too deeply");
+        return;
+    }
+    cond = &st->conds[st->cond_count++];
+    cond->parent_active = parent;
+    cond->taken = taken;
+    cond->active = parent && taken;
+    cond->seen_else = 0;
+}
+
+// One directive, continuation lines joined and comments removed: d is the
+// text after '#'
+static void handle_directive(PPState *st, const char *d, const char *end) {
+
+    const char *name = skip_space(d, end);
+    const char *name_end = skip_ident(name, end);
+    const char *arg = skip_space(name_end, end);
+    const char *arg_end = end;
+    const char *word_end = skip_ident(arg, end);
+    size_t name_len = (size_t)(name_end - name);
+    int first = !st->content_seen;
+    PPCondition *cond = st->cond_count > 0 ? &st->conds[st->cond_count - 1] : NULL;
+
+    while (arg_end > arg && isspace((unsigned char)arg_end[-1])) arg_end--;
+    st->content_seen = 1;
+    if (st->guard_closed) st->guard = NULL;  // Directive after the guard
+    if (name_len == 0) {
+        if (name < end && pp_active(st)) pp_report(st, DIAG_ERROR, "Invalid preprocessor directive");
+        return;
+    }
+
+#define IS(word) (name_len == sizeof(word) - 1 && memcmp(name, word, sizeof(word) - 1) == 0)
+    if (IS("ifdef") || IS("ifndef")) {
+        if (word_end == arg) {
+            if (pp_active(st)) pp_report(st, DIAG_ERROR, "Expected a macro name after #%.*s", (int)name_len, name);
+            push_condition(st, 0);
+            return;
+        }
+        push_condition(st, (find_macro(st, arg, (size_t)(word_end - arg)) != NULL) == IS("ifdef"));
+        if (first && IS("ifndef") && st->cond_count == 1) {
+            st->guard = intern_n(&st->ctx->names, arg, (size_t)(word_end - arg));
+            if (st->entry) st->entry->cycle_safe = 1;
+        }
+        return;
+    }
+    if (IS("if") || IS("elif")) {
+        if (pp_active(st) || (IS("elif") && cond && cond->parent_active)) {
+            pp_report(st, DIAG_ERROR, "#%.*s is not supported; use #ifdef or #ifndef", (int)name_len, name);
+        }
+        if (IS("if")) push_condition(st, 0);
+        return;
+    }
+    if (IS("else")) {
+        if (!cond || cond->seen_else) {
+            pp_report(st, DIAG_ERROR, cond ? "#else after #else" : "#else without #ifdef");
+            return;
+        }
+        cond->seen_else = 1;
+        cond->active = cond->parent_active && !cond->taken;
+        return;
+    }
+    if (IS("endif")) {
+        if (!cond) {
+            pp_report(st, DIAG_ERROR, "#endif without #ifdef");
+            return;
+        }
+        st->cond_count--;
+        if (st->cond_count == 0 && st->guard) st->guard_closed = 1;
+        return;
+    }
+    if (!pp_active(st)) return;
+
+    if (IS("define")) {
+        if (word_end == arg || !is_ident_start(*arg)) {
+            pp_report(st, DIAG_ERROR, "Expected a macro name after #define");
+            return;
+        }
+        if (word_end < end && *word_end == '(') {
+            pp_report(st, DIAG_ERROR, "Function-like macro '%.*s' is not supported", (int)(word_end - arg), arg);
+            return;
+        }
+        name = skip_space(word_end, arg_end);
+        define_macro(st, arg, (size_t)(word_end - arg), name, (size_t)(arg_end - name));
+        return;
+    }
+    if (IS("undef")) {
+        if (word_end == arg) {
+            pp_report(st, DIAG_ERROR, "Expected a macro name after #undef");
+            return;
+        }
+        undefine_macro(st, arg, (size_t)(word_end - arg));
+        return;
+    }
+    if (IS("include")) {
+        if (arg < arg_end && *arg == '<') {
+            pp_report(st, DIAG_WARNING, "System header %.*s ignored", (int)(arg_end - arg), arg);
+            return;
+        }
+        if (arg_end - arg < 3 || *arg != '"' || arg_end[-1] != '"') {
+            pp_report(st, DIAG_ERROR, "Expected \"file\" after #include");
+            return;
+        }
+        include_file(st, arg + 1, (size_t)(arg_end - arg - 2));
+        return;
+    }
+    if (IS("pragma")) {
+        if (word_end - arg == 4 && memcmp(arg, "once", 4) == 0) {
+            st->pragma_once = 1;
+            if (st->entry) st->entry->cycle_safe = 1;
+        }
+        return;  // Other pragmas are ignored
+    }
+    if (IS("error")) {
+        pp_report(st, DIAG_ERROR, "#error %.*s", (int)(arg_end - arg), arg);
+        return;
+    }
+    if (IS("warning")) {
+        pp_report(st, DIAG_WARNING, "#warning %.*s", (int)(arg_end - arg), arg);
+        return;
+    }
+    if (IS("line")) return;
+#undef IS
+    pp_report(st, DIAG_ERROR, "Unknown preprocessor directive '#%.*s'", (int)name_len, name);
+}
+
+// Remove the comments of a directive (a comment becomes a space; one left
+// open runs into the following lines)
+static void strip_comments(StrBuf *text, int *in_comment) {
+
+    const char *p = text->data ? text->data : "";
+    const char *end = p + text->len;
+    const char *q = NULL;
+    StrBuf clean = {0};
+
+    while (p < end) {
+        if (p[0] == '/' && p + 1 < end && p[1] == '/') break;
+        if (p[0] == '/' && p + 1 < end && p[1] == '*') {
+            q = p + 2;
+            while (q + 1 < end && !(q[0] == '*' && q[1] == '/')) q++;
+            if (q + 1 >= end) {
+                *in_comment = 1;
+                break;
+            }
+            strbuf_append(&clean, " ", 1);
+            p = q + 2;
+            continue;
+        }
+        if (*p == '"') {
+            q = p + 1;
+            while (q < end && *q != '"') {
+                if (*q == '\\' && q + 1 < end) q++;
+                q++;
+            }
+            if (q < end) q++;
+            strbuf_append(&clean, p, (size_t)(q - p));
+            p = q;
+            continue;
+        }
+        strbuf_append(&clean, p, 1);
+        p++;
+    }
+    strbuf_free(text);
+    *text = clean;
+}
+
+// Directive starting at the '#' in [hash, src_end): joins '\'-continued
+// lines and strips comments into text. Returns the end of its last line
+// and counts the lines it spans.
+static const char* read_directive(const char *hash, const char *src_end, StrBuf *text, int *lines, int *in_comment) {
+
+    const char *p = hash + 1;
+    const char *eol = NULL;
+    const char *last = NULL;
+
+    *lines = 1;
+    for (;;) {
+        eol = (const char*)memchr(p, '\n', (size_t)(src_end - p));
+        if (!eol) eol = src_end;
+        last = eol;
+        while (last > p && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) last--;
+        if (last > p && last[-1] == '\\' && eol < src_end) {
+            strbuf_append(text, p, (size_t)(last - 1 - p));
+            strbuf_append(text, " ", 1);
+            p = eol + 1;
+            (*lines)++;
+            continue;
+        }
+        strbuf_append(text, p, (size_t)(eol - p));
+        break;
+    }
+
+    strip_comments(text, in_comment);
+    return eol;
+}
+
+static void pp_run(PPState *st, const char *src, size_t len) {
+
+    const char *p = src;
+    const char *end = src + len;
+    const char *eol = NULL;
+    const char *q = NULL;
+    int in_comment = 0;
+    int lines = 0;
+    int k = 0;
+    StrBuf text = {0};
+
+    st->line = 1;
+    while (p < end) {
+        eol = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        q = p;
+        while (q < eol && (*q == ' ' || *q == '\t')) q++;
+
+        if (!in_comment && q < eol && *q == '#') {
+            text.len = 0;
+            eol = read_directive(q, end, &text, &lines, &in_comment);
+            handle_directive(st, text.data ? text.data : "", (text.data ? text.data : "") + text.len);
+            strbuf_free(&text);
+            for (k = 0; k < lines; k++) {
+                if (k < lines - 1 || eol < end) strbuf_append(&st->out, "\n", 1);
+            }
+            st->line += lines;
+            p = eol < end ? eol + 1 : end;
+            continue;
+        }
+
+        if (pp_active(st)) {
+            st->line_code = 0;
+            copy_text(st, p, eol, &in_comment, 0);
+            if (st->line_code) {
+                st->content_seen = 1;
+                if (st->guard_closed) st->guard = NULL;  // Code after the guard
+            }
+        } else {
+            skip_text(p, eol, &in_comment);
+        }
+        if (eol < end) strbuf_append(&st->out, "\n", 1);
+        st->line++;
+        p = eol < end ? eol + 1 : end;
+    }
+    if (st->cond_count > 0) {
+        st->line--;
+        pp_report(st, DIAG_ERROR, "Missing #endif");
+    }
+}
+
+void preprocess_source(CompiContext *ctx, const char *path, IncludeCache *includes) {
+
+    const char *src = ctx->lexer.src;
+    size_t len = (size_t)(ctx->lexer.end - ctx->lexer.src);
+    IncludeCache *own = NULL;
+    PPState st;
+
+    if (!memchr(src, '#', len)) return;
+    if (!includes) {
+        own = include_cache_new();
+        if (!own) {
+            perror("Failed to allocate include cache");
+            exit(EXIT_FAILURE);
+        }
+        includes = own;
+    }
+
+    pp_init(&st, ctx, includes, path, 0);
+    pp_run(&st, src, len);
+    len = st.out.len;
+    compi_context_take_buffer(ctx, strbuf_detach(&st.out), len);
+    pp_free(&st);
+    include_cache_free(own);
+}
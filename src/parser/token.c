@@ -1,192 +1,209 @@
 #include "token.h"
+#include "lexer.h"
+#include "compi_context.h"
+#include "keyword_table.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
-// Current token and functions to manage the token stream
-Token current_token;
-int current_line = 1; // Track current line number
+// Functions to manage the token stream of a context
 
-// List of C keywords
-const char *keywords[] = {
-    "if", "else", "while", "for", "return", "break", "continue",
-    "struct",
-    "int", "float", "char", "double", "void",
-    NULL
-};
-
-// Get the next token and update current_token
-void advance(FILE *input) {
-    current_token = get_next_token(input);
+// Get the next token and update ctx->current_token
+void advance(CompiContext *ctx) {
+    ctx->current_token = get_next_token(ctx);
 }
 
 
 // Check if current token matches expected type
-int match(TokenType type) {
-    return current_token.type == type;
+int match(const CompiContext *ctx, TokenType type) {
+    return ctx->current_token.type == type;
 }
 
 
 // Consume the current token if it matches expected type
-int consume(FILE *input, TokenType type) {
+int consume(CompiContext *ctx, TokenType type) {
 
-    if (match(type)) {
-        advance(input);
+    if (match(ctx, type)) {
+        advance(ctx);
         return 1;
     }
     return 0;
 }
 
+// Check if current token is the given keyword
+int match_kw(const CompiContext *ctx, KeywordKind kw) {
+    return ctx->current_token.type == TOKEN_KEYWORD && ctx->current_token.kw == kw;
+}
+
+
+// Check if current token is the given operator
+int match_op(const CompiContext *ctx, OperatorKind op) {
+    return ctx->current_token.type == TOKEN_OPERATOR && ctx->current_token.op == op;
+}
+
 // Check if a string is a keyword
 int is_keyword(const char *str) {
 
+    return keyword_lookup(str, strlen(str)) != KW_NONE;
+}
+
+// Perfect-hash keyword lookup: one hash, one length check, one memcmp
+KeywordKind keyword_lookup(const char *str, size_t len) {
+
+    unsigned h = 0;
+
+    if (len < KEYWORD_MIN_LEN || len > KEYWORD_MAX_LEN) {
+        return KW_NONE;
+    }
+    h = keyword_hash(str, len);
+    if (keyword_table[h].len == len && memcmp(str, keyword_table[h].text, len) == 0) {
+        return keyword_table[h].kind;
+    }
+    return KW_NONE;
+}
+
+// Operator spellings, indexed by OperatorKind
+static const char *s_operator_text[OP_COUNT] = {
+    [OP_NONE] = "", [OP_MUL] = "*", [OP_DIV] = "/", [OP_ADD] = "+", [OP_SUB] = "-",
+    [OP_SHL] = "<<", [OP_SHR] = ">>", [OP_LT] = "<", [OP_LE] = "<=", [OP_GT] = ">",
+    [OP_GE] = ">=", [OP_EQ] = "==", [OP_NE] = "!=", [OP_BIT_AND] = "&", [OP_BIT_XOR] = "^",
+    [OP_BIT_OR] = "|", [OP_LOG_AND] = "&&", [OP_LOG_OR] = "||", [OP_ASSIGN] = "=",
+    [OP_NOT] = "!", [OP_BIT_NOT] = "~", [OP_INC] = "++", [OP_DEC] = "--", [OP_DOT] = ".",
+    [OP_OTHER] = "?"
+};
+
+const char* operator_text(OperatorKind op) {
+    return (op >= 0 && op < OP_COUNT) ? s_operator_text[op] : "?";
+}
+
+OperatorKind operator_from_text(const char *str) {
+
     int i = 0;
-    for (i = 0; keywords[i] != NULL; i++) {
-        if (strcmp(str, keywords[i]) == 0) {
-            return 1;
+
+    if (!str) return OP_NONE;
+    for (i = OP_NONE + 1; i < OP_OTHER; i++) {
+        if (strcmp(str, s_operator_text[i]) == 0) {
+            return (OperatorKind)i;
         }
     }
-    return 0;
+    return OP_OTHER;
 }
 
-// Get the next token from input
-Token get_next_token(FILE *input) {
-    
-    Token token = {0};
-    int c = 0;
-    int d = 0;
-    int i = 0;
-    int prev = 0;
+char* token_strdup(const Token *tok) {
 
-    token.line = current_line; // Track line at start of token
+    char *s = (char*)malloc(tok->length + 1);
 
-    // Skip whitespace
-    while ((c = fgetc(input)) != EOF && isspace(c)) {
-        if (c == '\n') current_line++; // Increment line on newline
+    if (!s) {
+        perror("Failed to allocate token text");
+        exit(EXIT_FAILURE);
     }
-    if (c == EOF) {
-        token.type = TOKEN_EOF;
-        token.value[0] = '\0';
-        return token;
+    if (tok->length) {
+        memcpy(s, tok->text, tok->length);
     }
+    s[tok->length] = '\0';
+    return s;
+}
+
+char* token_copy(const Token *tok, char *buf, size_t size) {
+
+    size_t n = tok->length;
+
+    if (!size) return buf;
+    if (n >= size) n = size - 1;
+    if (n) memcpy(buf, tok->text, n);
+    buf[n] = '\0';
+    return buf;
+}
+
+static void token_buffer_push(TokenBuffer *tb, Token tok) {
+
+    Token *grown = NULL;
 
-    // Handle comments starting with // or /* */
-    if (c == '/') {
-        d = fgetc(input);
-        if (d == '/') {
-            // Line comment
-            while ((c = fgetc(input)) != EOF && c != '\n');
-            if (c == '\n') current_line++; // Increment line on comment newline
-            return get_next_token(input);
-        } else if (d == '*') {
-            // Block comment
-            prev = 0;
-            while ((c = fgetc(input)) != EOF) {
-                if (c == '\n') current_line++;
-                if (prev == '*' && c == '/') break;
-                prev = c;
-            }
-            return get_next_token(input);
-        } else {
-            // It's just the division operator
-            if (d != EOF) ungetc(d, input);
-            token.type = TOKEN_OPERATOR;
-            token.value[0] = '/';
-            token.value[1] = '\0';
-            return token;
+    if (tb->count == tb->capacity) {
+        tb->capacity = tb->capacity ? tb->capacity * 2 : 16;
+        grown = (Token*)realloc(tb->items, tb->capacity * sizeof(Token));
+        if (!grown) {
+            perror("Failed to allocate token buffer");
+            exit(EXIT_FAILURE);
         }
+        tb->items = grown;
     }
+    tb->items[tb->count++] = tok;
+}
 
-    // Identifier or keyword
-    if (isalpha(c) || c == '_') {
-        i = 0;
-        token.value[i++] = c;
-        while ((c = fgetc(input)) != EOF && (isalnum(c) || c == '_')) {
-            if (i < 255) token.value[i++] = c;
-        }
-        token.value[i] = '\0';
-        if (c != EOF) ungetc(c, input);
-        token.type = is_keyword(token.value) ? TOKEN_KEYWORD : TOKEN_IDENTIFIER;
-        return token;
-    } 
-    // Number
-    else if (isdigit(c)) {
-        i = 0;
-        token.value[i++] = c;
-        while ((c = fgetc(input)) != EOF && (isdigit(c) || c == '.')) {
-            if (i < 255) token.value[i++] = c;
-        }
-        token.value[i] = '\0';
-        if (c != EOF) ungetc(c, input);
-        token.type = TOKEN_NUMBER;
-        return token;
-    } 
-    // Operators and punctuation (including multi-char ops)
-    else {
-        d = fgetc(input);
-        token.value[0] = (char)c;
-        token.value[1] = '\0';
-        token.value[2] = '\0';
-        // Punctuation
-        switch (c) {
-            case ';': token.type = TOKEN_SEMICOLON; if (d != EOF) ungetc(d, input); return token;
-            case '(': token.type = TOKEN_PARENTHESIS_OPEN; if (d != EOF) ungetc(d, input); return token;
-            case ')': token.type = TOKEN_PARENTHESIS_CLOSE; if (d != EOF) ungetc(d, input); return token;
-            case '{': token.type = TOKEN_BRACE_OPEN; if (d != EOF) ungetc(d, input); return token;
-            case '}': token.type = TOKEN_BRACE_CLOSE; if (d != EOF) ungetc(d, input); return token;
-            case '[': token.type = TOKEN_BRACKET_OPEN; if (d != EOF) ungetc(d, input); return token;
-            case ']': token.type = TOKEN_BRACKET_CLOSE; if (d != EOF) ungetc(d, input); return token;
-            case ',': token.type = TOKEN_COMMA; if (d != EOF) ungetc(d, input); return token;
-            default: break;
-        }
-        // Multi-character operators: ==, !=, <=, >=, <<, >>, &&, ||, ++, --
-        token.type = TOKEN_OPERATOR;
-        if (c == '=' && d == '=') {
-            token.value[0] = '=';
-            token.value[1] = '=';
-            token.value[2] = '\0';
-        } else if (c == '!' && d == '=') {
-            token.value[0] = '!';
-            token.value[1] = '=';
-            token.value[2] = '\0';
-        } else if (c == '<' && d == '=') {
-            token.value[0] = '<';
-            token.value[1] = '=';
-            token.value[2] = '\0';
-        } else if (c == '>' && d == '=') {
-            token.value[0] = '>';
-            token.value[1] = '=';
-            token.value[2] = '\0';
-        } else if (c == '<' && d == '<') {
-            token.value[0] = '<';
-            token.value[1] = '<';
-            token.value[2] = '\0';
-        } else if (c == '>' && d == '>') {
-            token.value[0] = '>';
-            token.value[1] = '>';
-            token.value[2] = '\0';
-        } else if (c == '&' && d == '&') {
-            token.value[0] = '&';
-            token.value[1] = '&';
-            token.value[2] = '\0';
-        } else if (c == '|' && d == '|') {
-            token.value[0] = '|';
-            token.value[1] = '|';
-            token.value[2] = '\0';
-        } else if (c == '+' && d == '+') {
-            token.value[0] = '+';
-            token.value[1] = '+';
-            token.value[2] = '\0';
-        } else if (c == '-' && d == '-') {
-            token.value[0] = '-';
-            token.value[1] = '-';
-            token.value[2] = '\0';
-        } else {
-            // Single-character operator
-            if (d != EOF) ungetc(d, input);
-            token.value[0] = (char)c;
-            token.value[1] = '\0';
+// Drop tokens that can no longer be replayed (nothing marked before pos)
+static void token_buffer_trim(TokenBuffer *tb) {
+
+    if (tb->marks > 0 || tb->pos == 0) return;
+    if (tb->pos < tb->count) {
+        memmove(tb->items, tb->items + tb->pos, (tb->count - tb->pos) * sizeof(Token));
+    }
+    tb->count -= tb->pos;
+    tb->pos = 0;
+}
+
+// Get the next token from the context's source (buffered tokens first)
+Token get_next_token(CompiContext *ctx) {
+
+    TokenBuffer *tb = &ctx->tokens;
+    Token tok;
+
+    if (tb->pos < tb->count) {
+        tok = tb->items[tb->pos++];
+        if (tb->marks == 0 && tb->pos == tb->count) {
+            tb->pos = tb->count = 0;
         }
-        return token;
+        return tok;
+    }
+    tok = lexer_next(&ctx->lexer);
+    if (tb->marks > 0) {
+        token_buffer_push(tb, tok);
+        tb->pos++;
+    }
+    return tok;
+}
+
+Token peek_token(CompiContext *ctx, size_t k) {
+
+    TokenBuffer *tb = &ctx->tokens;
+
+    if (k == 0) {
+        return ctx->current_token;
+    }
+    while (tb->count - tb->pos < k) {
+        token_buffer_push(tb, lexer_next(&ctx->lexer));
     }
+    return tb->items[tb->pos + k - 1];
+}
+
+TokenMark token_mark(CompiContext *ctx) {
+
+    TokenMark mark;
+
+    mark.current = ctx->current_token;
+    mark.pos = ctx->tokens.pos;
+    ctx->tokens.marks++;
+    return mark;
+}
+
+void token_reset(CompiContext *ctx, TokenMark mark) {
+
+    ctx->current_token = mark.current;
+    ctx->tokens.pos = mark.pos;
+    ctx->tokens.marks--;
+    token_buffer_trim(&ctx->tokens);
+}
+
+void token_release(CompiContext *ctx, TokenMark mark) {
+
+    (void)mark;
+    ctx->tokens.marks--;
+    token_buffer_trim(&ctx->tokens);
+}
+
+void token_buffer_free(TokenBuffer *tb) {
+
+    free(tb->items);
+    memset(tb, 0, sizeof(*tb));
 }
@@ -1,47 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include "symbol_arrays.h"
+#include "compi_context.h"
 
-ArrayInfo g_arrays[128];
-int g_array_count = 0;
+int find_array_size(const CompiContext *ctx, const char *name) {
 
-int find_array_size(const char *name) {
-
-    int i = 0;
     if (!name) {
         return -1;
     }
 
-    for (i = 0; i < g_array_count; i++) {
-        if (strcmp(g_arrays[i].name, name) == 0) {
-            return g_arrays[i].size;
-        }
+    return find_array_size_n(ctx, name, strlen(name));
+}
+
+// Lookup by a name that is not NUL-terminated (e.g. a prefix of "a__b")
+int find_array_size_n(const CompiContext *ctx, const char *name, size_t len) {
+
+    uint64_t start = compi_stats_symbol_begin(ctx->stats);
+    const char *key = NULL;
+    int i = -1;
+
+    if (!name || ctx->arrays.count == 0) {
+        compi_stats_symbol_end(ctx->stats, start);
+        return -1;
     }
 
-    return -1;
+    // Names never interned were never registered
+    key = intern_find_n(&ctx->names, name, len);
+    i = symbol_map_get(&ctx->arrays.visible, key, 0);
+
+    compi_stats_symbol_end(ctx->stats, start);
+    return i >= 0 ? ctx->arrays.items[i].size : -1;
 }
 
-void register_array(const char *name, int size) {
+static void insert_array(CompiContext *ctx, const char *name, int size) {
 
-    int i = 0;
+    ArrayTable *t = &ctx->arrays;
+    ArrayInfo *grown = NULL;
+    const char *key = NULL;
+    int i = -1;
 
     if (!name || size <= 0) {
         return;
     }
-    if (g_array_count >= (int)(sizeof(g_arrays) / sizeof(g_arrays[0]))) {
+
+    // Redeclaring in the same scope updates the size; an inner scope shadows
+    key = intern(&ctx->names, name);
+    i = symbol_map_get(&t->visible, key, 0);
+    if (i >= 0 && t->items[i].depth == t->depth) {
+        t->items[i].size = size;
         return;
     }
 
-    // Prevent duplicates; update size if already present
-    for (i = 0; i < g_array_count; i++) {
-        if (strcmp(g_arrays[i].name, name) == 0) {
-            g_arrays[i].size = size;
-            return;
+    if (t->count == t->capacity) {
+        t->capacity = t->capacity ? t->capacity * 2 : 32;
+        grown = (ArrayInfo*)realloc(t->items, (size_t)t->capacity * sizeof(ArrayInfo));
+        if (!grown) {
+            perror("Failed to allocate array table");
+            exit(EXIT_FAILURE);
         }
+        t->items = grown;
     }
+    t->items[t->count].name = key;
+    t->items[t->count].size = size;
+    t->items[t->count].shadowed = i;
+    t->items[t->count].depth = t->depth;
+    symbol_map_put(&t->visible, key, 0, t->count);
+    t->count++;
+}
+
+void register_array(CompiContext *ctx, const char *name, int size) {
+
+    uint64_t start = compi_stats_symbol_begin(ctx->stats);
+
+    insert_array(ctx, name, size);
+    compi_stats_symbol_end(ctx->stats, start);
+    if (ctx->stats) compi_stats_add(&ctx->stats->arrays, 1);
+}
+
+void push_scope(CompiContext *ctx) {
+
+    ArrayTable *t = &ctx->arrays;
+    int *grown = NULL;
+
+    if (t->depth == t->scope_capacity) {
+        t->scope_capacity = t->scope_capacity ? t->scope_capacity * 2 : 16;
+        grown = (int*)realloc(t->scope_starts, (size_t)t->scope_capacity * sizeof(int));
+        if (!grown) {
+            perror("Failed to allocate scope stack");
+            exit(EXIT_FAILURE);
+        }
+        t->scope_starts = grown;
+    }
+    t->scope_starts[t->depth++] = t->count;
+}
+
+void pop_scope(CompiContext *ctx) {
+
+    ArrayTable *t = &ctx->arrays;
+    ArrayInfo *a = NULL;
+    int start = 0;
+
+    if (t->depth == 0) {
+        return;
+    }
+    // Unwind newest first so each name ends up at the binding it shadowed
+    start = t->scope_starts[--t->depth];
+    while (t->count > start) {
+        a = &t->items[--t->count];
+        symbol_map_put(&t->visible, a->name, 0, a->shadowed);
+    }
+}
+
+void reset_arrays(CompiContext *ctx) {
+
+    ctx->arrays.count = 0;
+    ctx->arrays.depth = 0;
+    symbol_map_clear(&ctx->arrays.visible);
+}
+
+void free_arrays(CompiContext *ctx) {
 
-    strncpy(g_arrays[g_array_count].name, name, sizeof(g_arrays[g_array_count].name) - 1);
-    g_arrays[g_array_count].name[sizeof(g_arrays[g_array_count].name) - 1] = '\0';
-    g_arrays[g_array_count].size = size;
-    g_array_count++;
+    free(ctx->arrays.items);
+    free(ctx->arrays.scope_starts);
+    symbol_map_free(&ctx->arrays.visible);
+    memset(&ctx->arrays, 0, sizeof(ctx->arrays));
 }
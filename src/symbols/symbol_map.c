@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symbol_map.h"
+
+#define SYMBOL_MAP_INITIAL_CAPACITY 64
+
+// Interned names are unique addresses; mix the bits so aligned pointers
+// spread over the table
+static size_t hash_key(const char *name, uintptr_t qualifier) {
+
+    uint64_t h = (uint64_t)(uintptr_t)name ^ ((uint64_t)qualifier * 0x9E3779B97F4A7C15ull);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+static size_t find_slot(const SymbolMap *map, const char *name, uintptr_t qualifier) {
+
+    size_t mask = map->capacity - 1;
+    size_t i = hash_key(name, qualifier) & mask;
+
+    while (map->slots[i].name) {
+        if (map->slots[i].name == name && map->slots[i].qualifier == qualifier) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void grow_map(SymbolMap *map) {
+
+    size_t new_cap = map->capacity ? map->capacity * 2 : SYMBOL_MAP_INITIAL_CAPACITY;
+    SymbolSlot *old = map->slots;
+    size_t old_cap = map->capacity;
+    size_t i = 0;
+    size_t j = 0;
+
+    map->slots = (SymbolSlot*)calloc(new_cap, sizeof(SymbolSlot));
+    if (!map->slots) {
+        perror("Failed to allocate symbol table");
+        exit(EXIT_FAILURE);
+    }
+    map->capacity = new_cap;
+    for (i = 0; i < old_cap; i++) {
+        if (old[i].name) {
+            j = find_slot(map, old[i].name, old[i].qualifier);
+            map->slots[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+void symbol_map_init(SymbolMap *map) {
+    memset(map, 0, sizeof(*map));
+}
+
+void symbol_map_free(SymbolMap *map) {
+
+    free(map->slots);
+    memset(map, 0, sizeof(*map));
+}
+
+void symbol_map_clear(SymbolMap *map) {
+
+    if (map->count == 0) return;
+    memset(map->slots, 0, map->capacity * sizeof(SymbolSlot));
+    map->count = 0;
+}
+
+int symbol_map_get(const SymbolMap *map, const char *name, uintptr_t qualifier) {
+
+    size_t i = 0;
+
+    if (!name || map->count == 0) {
+        return -1;
+    }
+    i = find_slot(map, name, qualifier);
+    return map->slots[i].name ? map->slots[i].value : -1;
+}
+
+void symbol_map_put(SymbolMap *map, const char *name, uintptr_t qualifier, int value) {
+
+    size_t i = 0;
+
+    if (!name) return;
+    if ((map->count + 1) * 2 > map->capacity) {
+        grow_map(map);
+    }
+    i = find_slot(map, name, qualifier);
+    if (!map->slots[i].name) {
+        map->slots[i].name = name;
+        map->slots[i].qualifier = qualifier;
+        map->count++;
+    }
+    map->slots[i].value = value;
+}
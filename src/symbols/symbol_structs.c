@@ -1,45 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "symbol_structs.h"
+#include "compi_context.h"
 
-// Definition of global struct table
-StructInfo g_structs[64];
-int g_struct_count = 0;
+int add_struct(CompiContext *ctx, const char *name) {
 
-int find_struct_index(const char *name) {
-    int i = 0;
+    uint64_t start = compi_stats_symbol_begin(ctx->stats);
+    StructTable *t = &ctx->structs;
+    StructInfo *grown = NULL;
+    const char *key = intern(&ctx->names, name);
+
+    if (t->count == t->capacity) {
+        t->capacity = t->capacity ? t->capacity * 2 : 16;
+        grown = (StructInfo*)realloc(t->items, (size_t)t->capacity * sizeof(StructInfo));
+        if (!grown) {
+            perror("Failed to allocate struct table");
+            exit(EXIT_FAILURE);
+        }
+        t->items = grown;
+    }
+    memset(&t->items[t->count], 0, sizeof(StructInfo));
+    t->items[t->count].name = key;
+    // A redefinition is listed again but lookups keep finding the first one
+    if (symbol_map_get(&t->by_name, key, 0) < 0) {
+        symbol_map_put(&t->by_name, key, 0, t->count);
+    }
+    compi_stats_symbol_end(ctx->stats, start);
+    return t->count++;
+}
+
+void add_struct_field(CompiContext *ctx, int struct_index, const char *field_name, const char *field_type) {
+
+    uint64_t start = compi_stats_symbol_begin(ctx->stats);
+    StructInfo *si = &ctx->structs.items[struct_index];
+    StructField *grown = NULL;
+    const char *key = intern(&ctx->names, field_name);
+
+    if (si->field_count == si->field_capacity) {
+        si->field_capacity = si->field_capacity ? si->field_capacity * 2 : 8;
+        grown = (StructField*)realloc(si->fields, (size_t)si->field_capacity * sizeof(StructField));
+        if (!grown) {
+            perror("Failed to allocate struct fields");
+            exit(EXIT_FAILURE);
+        }
+        si->fields = grown;
+    }
+    si->fields[si->field_count].field_name = key;
+    si->fields[si->field_count].field_type = intern(&ctx->names, field_type);
+    if (symbol_map_get(&ctx->structs.fields, key, (uintptr_t)struct_index) < 0) {
+        symbol_map_put(&ctx->structs.fields, key, (uintptr_t)struct_index, si->field_count);
+    }
+    si->field_count++;
+    compi_stats_symbol_end(ctx->stats, start);
+}
+
+int find_struct_index(const CompiContext *ctx, const char *name) {
 
     if (!name) {
         return -1;
     }
 
-    for (i = 0; i < g_struct_count; i++) {
-        if (strcmp(g_structs[i].name, name) == 0) {
-            return i;
-        }
+    return find_struct_index_n(ctx, name, strlen(name));
+}
+
+static int struct_index_of(const CompiContext *ctx, const char *name, size_t len) {
+
+    if (!name || ctx->structs.count == 0) {
+        return -1;
     }
 
-    return -1;
+    return symbol_map_get(&ctx->structs.by_name, intern_find_n(&ctx->names, name, len), 0);
+}
+
+// Lookup by a name that is not NUL-terminated (e.g. token text)
+int find_struct_index_n(const CompiContext *ctx, const char *name, size_t len) {
+
+    uint64_t start = compi_stats_symbol_begin(ctx->stats);
+    int idx = struct_index_of(ctx, name, len);
+
+    compi_stats_symbol_end(ctx->stats, start);
+    return idx;
 }
 
-const char* struct_field_type(const char *struct_name, const char *field_name) {
+const char* struct_field_type(const CompiContext *ctx, const char *struct_name, const char *field_name) {
+    uint64_t start = compi_stats_symbol_begin(ctx->stats);
     int idx = -1;
-    int f = 0;
+    int f = -1;
 
-    if (!struct_name || !field_name) {
-        return NULL;
+    if (struct_name && field_name) {
+        idx = struct_index_of(ctx, struct_name, strlen(struct_name));
+    }
+    if (idx >= 0) {
+        f = symbol_map_get(&ctx->structs.fields, intern_find_n(&ctx->names, field_name, strlen(field_name)), (uintptr_t)idx);
     }
+    compi_stats_symbol_end(ctx->stats, start);
 
-    idx = find_struct_index(struct_name);
+    return f >= 0 ? ctx->structs.items[idx].fields[f].field_type : NULL;
+}
 
-    if (idx < 0) {
-        return NULL;
-    }
+void reset_structs(CompiContext *ctx) {
 
-    for (f = 0; f < g_structs[idx].field_count; f++) {
-        if (strcmp(g_structs[idx].fields[f].field_name, field_name) == 0) {
-            return g_structs[idx].fields[f].field_type;
-        }
+    int i = 0;
+
+    for (i = 0; i < ctx->structs.count; i++) {
+        free(ctx->structs.items[i].fields);
     }
+    ctx->structs.count = 0;
+    symbol_map_clear(&ctx->structs.by_name);
+    symbol_map_clear(&ctx->structs.fields);
+}
+
+void free_structs(CompiContext *ctx) {
 
-    return NULL;
+    reset_structs(ctx);
+    free(ctx->structs.items);
+    symbol_map_free(&ctx->structs.by_name);
+    symbol_map_free(&ctx->structs.fields);
+    memset(&ctx->structs, 0, sizeof(ctx->structs));
 }
@@ -3,26 +3,44 @@ extern "C" {
 #include "astnode.h"
 #include "parse.h"
 #include "token.h"
+#include "lexer.h"
+#include "arena.h"
+#include "compi_context.h"
+#include "intern.h"
+#include "ast_flat.h"
+#include "codegen_vhdl.h"
+#include "symbol_structs.h"
 #include "utils.h"
 #include "symbol_arrays.h"
+#include "work_pool.h"
+#include "out_sink.h"
+#include "compile_server.h"
+#include "compi_stats.h"
+#include "compi_api.h"
+#include "preprocess.h"
 }
 #include <cstdio>
+#include <csetjmp>
+#include <climits>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
-
-// Provide externs for internal globals needed by tests
-extern "C" {
-    extern int g_array_count; // declared in utils.c
-    extern Token current_token; // defined in token.c
-}
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 // Existing basic AST creation test
 TEST(ASTNodeTests, CreateAndLink) {
-    ASTNode* program = create_node(NODE_PROGRAM);
+    ASTNode* program = create_node(nullptr, NODE_PROGRAM);
     ASSERT_NE(program, nullptr);
     EXPECT_EQ(program->num_children, 0);
 
-    ASTNode* child = create_node(NODE_STATEMENT);
+    ASTNode* child = create_node(nullptr, NODE_STATEMENT);
     add_child(program, child);
     EXPECT_EQ(program->num_children, 1);
     EXPECT_EQ(program->children[0], child);
@@ -32,11 +50,11 @@ TEST(ASTNodeTests, CreateAndLink) {
 
 // Test dynamic expansion of children array (capacity growth)
 TEST(ASTNodeTests, DynamicChildGrowth) {
-    ASTNode* parent = create_node(NODE_STATEMENT);
+    ASTNode* parent = create_node(nullptr, NODE_STATEMENT);
     // Add more than initial capacity (4) to force realloc path
     const int kAdd = 10;
     for (int i = 0; i < kAdd; ++i) {
-        ASTNode* c = create_node(NODE_EXPRESSION);
+        ASTNode* c = create_node(nullptr, NODE_EXPRESSION);
         add_child(parent, c);
         EXPECT_EQ(parent->children[i], c);
         EXPECT_EQ(c->parent, parent);
@@ -72,14 +90,17 @@ TEST(UtilsTests, IsNumberStr) {
 
 // Test registering and querying array sizes (no duplicates)
 TEST(UtilsTests, RegisterArrayAndLookup) {
-    g_array_count = 0; // reset global state for test isolation
-    register_array("arr", 5);
-    EXPECT_EQ(find_array_size("arr"), 5);
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    register_array(&ctx, "arr", 5);
+    EXPECT_EQ(find_array_size(&ctx, "arr"), 5);
     // Re-register with different size should update
-    register_array("arr", 8);
-    EXPECT_EQ(find_array_size("arr"), 8);
+    register_array(&ctx, "arr", 8);
+    EXPECT_EQ(find_array_size(&ctx, "arr"), 8);
+    EXPECT_EQ(ctx.arrays.count, 1);
     // Unknown array
-    EXPECT_EQ(find_array_size("none"), -1);
+    EXPECT_EQ(find_array_size(&ctx, "none"), -1);
+    compi_context_free(&ctx);
 }
 
 // Test tokenization of identifiers, numbers, and multi-char operators
@@ -89,36 +110,1241 @@ TEST(TokenTests, BasicLexing) {
     ASSERT_NE(f, nullptr);
     fwrite(src, 1, strlen(src), f);
     rewind(f);
-    current_line = 1; // reset line tracking
-    advance(f); // prime first token
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    ASSERT_EQ(compi_context_load_file(&ctx, f), 0);
+    const Token& current_token = ctx.current_token;
+    advance(&ctx); // prime first token
     // int
     EXPECT_EQ(current_token.type, TOKEN_KEYWORD);
-    EXPECT_STREQ(current_token.value, "int");
-    advance(f); // x
+    EXPECT_TRUE(token_is(&current_token, "int"));
+    advance(&ctx); // x
     EXPECT_EQ(current_token.type, TOKEN_IDENTIFIER);
-    advance(f); // =
+    advance(&ctx); // =
     EXPECT_EQ(current_token.type, TOKEN_OPERATOR);
-    advance(f); // a
+    advance(&ctx); // a
     EXPECT_EQ(current_token.type, TOKEN_IDENTIFIER);
-    advance(f); // +
+    advance(&ctx); // +
     EXPECT_EQ(current_token.type, TOKEN_OPERATOR);
-    advance(f); // 42
+    advance(&ctx); // 42
     EXPECT_EQ(current_token.type, TOKEN_NUMBER);
     // Skip to end of first statement ;
-    while (current_token.type != TOKEN_SEMICOLON && current_token.type != TOKEN_EOF) advance(f);
-    if (current_token.type == TOKEN_SEMICOLON) advance(f);
+    while (current_token.type != TOKEN_SEMICOLON && current_token.type != TOKEN_EOF) advance(&ctx);
+    if (current_token.type == TOKEN_SEMICOLON) advance(&ctx);
     // if
-    while (current_token.type != TOKEN_KEYWORD && current_token.type != TOKEN_EOF) advance(f);
+    while (current_token.type != TOKEN_KEYWORD && current_token.type != TOKEN_EOF) advance(&ctx);
     EXPECT_EQ(current_token.type, TOKEN_KEYWORD);
-    EXPECT_STREQ(current_token.value, "if");
+    EXPECT_TRUE(token_is(&current_token, "if"));
     // scan until ==
     bool saw_eqeq = false;
     while (current_token.type != TOKEN_EOF) {
-        if (current_token.type == TOKEN_OPERATOR && strcmp(current_token.value, "==") == 0) { saw_eqeq = true; break; }
-        advance(f);
+        if (current_token.type == TOKEN_OPERATOR && token_is(&current_token, "==")) { saw_eqeq = true; break; }
+        advance(&ctx);
     }
     EXPECT_TRUE(saw_eqeq);
+    compi_context_free(&ctx);
+    fclose(f);
+}
+
+// Buffered lexer: comments, multi-char operators and line tracking on a plain buffer
+TEST(LexerTests, BufferScanning) {
+    const char* src = "a /* x\n y */ b // c\n>= <<x\n12.5";
+    Lexer lx;
+    lexer_init_buffer(&lx, src, strlen(src));
+    Token t = lexer_next(&lx);
+    EXPECT_EQ(t.type, TOKEN_IDENTIFIER);
+    EXPECT_TRUE(token_is(&t, "a"));
+    t = lexer_next(&lx);
+    EXPECT_TRUE(token_is(&t, "b"));
+    EXPECT_EQ(lx.line, 2);
+    t = lexer_next(&lx);
+    EXPECT_EQ(t.type, TOKEN_OPERATOR);
+    EXPECT_TRUE(token_is(&t, ">="));
+    LexerMark mark = lexer_mark(&lx);
+    t = lexer_next(&lx);
+    EXPECT_TRUE(token_is(&t, "<<"));
+    lexer_reset(&lx, mark);
+    t = lexer_next(&lx);
+    EXPECT_TRUE(token_is(&t, "<<"));
+    t = lexer_next(&lx);
+    EXPECT_TRUE(token_is(&t, "x"));
+    t = lexer_next(&lx);
+    EXPECT_EQ(t.type, TOKEN_NUMBER);
+    EXPECT_TRUE(token_is(&t, "12.5"));
+    EXPECT_EQ(lx.line, 4);
+    EXPECT_EQ(lexer_next(&lx).type, TOKEN_EOF);
+    lexer_release(&lx);
+}
+
+// Token lookahead: peeked tokens are lexed once, marks replay consumed ones
+TEST(TokenTests, PeekMarkReset) {
+    const char* src = "a b c d e";
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, src, strlen(src));
+    advance(&ctx);
+    Token t = peek_token(&ctx, 3);
+    EXPECT_TRUE(token_is(&t, "d"));
+    t = peek_token(&ctx, 1);
+    EXPECT_TRUE(token_is(&t, "b"));
+    EXPECT_TRUE(token_is(&ctx.current_token, "a"));
+
+    TokenMark mark = token_mark(&ctx);
+    advance(&ctx);
+    advance(&ctx);
+    advance(&ctx);
+    advance(&ctx);
+    EXPECT_TRUE(token_is(&ctx.current_token, "e"));
+    token_reset(&ctx, mark);
+    EXPECT_TRUE(token_is(&ctx.current_token, "a"));
+
+    mark = token_mark(&ctx);
+    advance(&ctx);
+    token_release(&ctx, mark);
+    EXPECT_TRUE(token_is(&ctx.current_token, "b"));
+    const char* rest[] = { "c", "d", "e" };
+    for (const char* r : rest) {
+        advance(&ctx);
+        EXPECT_TRUE(token_is(&ctx.current_token, r)) << r;
+    }
+    advance(&ctx);
+    EXPECT_EQ(ctx.current_token.type, TOKEN_EOF);
+    EXPECT_EQ(ctx.tokens.count, 0u);
+    compi_context_free(&ctx);
+}
+
+// Contexts share no parser state: two sources can be lexed interleaved
+TEST(ContextTests, IndependentTokenStreams) {
+    const char* srcs[2] = { "alpha beta", "gamma delta" };
+    CompiContext ctx[2];
+    for (int i = 0; i < 2; ++i) {
+        compi_context_init(&ctx[i]);
+        compi_context_load_buffer(&ctx[i], srcs[i], strlen(srcs[i]));
+        advance(&ctx[i]);
+    }
+    EXPECT_TRUE(token_is(&ctx[0].current_token, "alpha"));
+    EXPECT_TRUE(token_is(&ctx[1].current_token, "gamma"));
+    advance(&ctx[1]);
+    EXPECT_TRUE(token_is(&ctx[0].current_token, "alpha"));
+    EXPECT_TRUE(token_is(&ctx[1].current_token, "delta"));
+    register_array(&ctx[0], "arr", 4);
+    EXPECT_EQ(find_array_size(&ctx[1], "arr"), -1);
+    for (int i = 0; i < 2; ++i) {
+        compi_context_free(&ctx[i]);
+    }
+}
+
+// Tokens are compact views into the source; long identifiers are kept whole
+TEST(TokenTests, LongIdentifierNotTruncated) {
+    EXPECT_LE(sizeof(Token), 32u);
+    std::string ident(300, 'a');
+    std::string src = ident + " + 1;";
+    FILE* f = tmpfile();
+    ASSERT_NE(f, nullptr);
+    fwrite(src.data(), 1, src.size(), f);
+    rewind(f);
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    ASSERT_EQ(compi_context_load_file(&ctx, f), 0);
+    advance(&ctx);
+    EXPECT_EQ(ctx.current_token.type, TOKEN_IDENTIFIER);
+    EXPECT_EQ(ctx.current_token.length, 300u);
+    EXPECT_EQ(ctx.current_token.offset, 0u);
+    char* text = token_strdup(&ctx.current_token);
+    EXPECT_EQ(ident, text);
+    free(text);
+    ASTNode* expr = parse_expression(&ctx);
+    ASSERT_NE(expr, nullptr);
+    ASSERT_EQ(expr->num_children, 2);
+    EXPECT_EQ(ident, expr->children[0]->value);
+    compi_context_free(&ctx);
     fclose(f);
+
+    // A long array name reaches the VHDL whole
+    std::string arr(200, 'b');
+    std::string prog = "int f(int x) { int " + arr + "[4]; " + arr + "[0] = x; return " + arr + "[0]; }\n";
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, prog.c_str(), prog.size());
+    ASTNode* program = parse_program(&ctx);
+    ASSERT_NE(program, nullptr);
+    FILE* out = tmpfile();
+    ASSERT_NE(out, nullptr);
+    EXPECT_EQ(generate_vhdl(&ctx, program, out), 0);
+    std::string vhdl(static_cast<size_t>(ftell(out)), '\0');
+    rewind(out);
+    ASSERT_EQ(fread(&vhdl[0], 1, vhdl.size(), out), vhdl.size());
+    EXPECT_NE(vhdl.find("  type " + arr + "_type is array (0 to 3) of"), std::string::npos);
+    EXPECT_NE(vhdl.find("  signal " + arr + " : " + arr + "_type;\n"), std::string::npos);
+    fclose(out);
+    compi_context_free(&ctx);
+}
+
+// Generated keyword table: every keyword maps to its code, near misses do not
+TEST(TokenTests, KeywordPerfectHash) {
+    const struct { const char* text; KeywordKind kw; } cases[] = {
+        {"if", KW_IF}, {"else", KW_ELSE}, {"while", KW_WHILE}, {"for", KW_FOR},
+        {"return", KW_RETURN}, {"break", KW_BREAK}, {"continue", KW_CONTINUE},
+        {"struct", KW_STRUCT}, {"int", KW_INT}, {"float", KW_FLOAT},
+        {"char", KW_CHAR}, {"double", KW_DOUBLE}, {"void", KW_VOID},
+    };
+    for (const auto& c : cases) {
+        EXPECT_EQ(keyword_lookup(c.text, strlen(c.text)), c.kw) << c.text;
+    }
+    for (const char* s : {"iff", "in", "structs", "x", "doubles", "whilE", "fo", "continues"}) {
+        EXPECT_EQ(keyword_lookup(s, strlen(s)), KW_NONE) << s;
+    }
+}
+
+// Operator codes are assigned once by the lexer
+TEST(TokenTests, OperatorCodes) {
+    const char* src = "== != <= >= << >> && || ++ -- = ! ~ . < > & | ^ + - * / #";
+    const OperatorKind expected[] = {
+        OP_EQ, OP_NE, OP_LE, OP_GE, OP_SHL, OP_SHR, OP_LOG_AND, OP_LOG_OR, OP_INC, OP_DEC,
+        OP_ASSIGN, OP_NOT, OP_BIT_NOT, OP_DOT, OP_LT, OP_GT, OP_BIT_AND, OP_BIT_OR, OP_BIT_XOR,
+        OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_OTHER,
+    };
+    Lexer lx;
+    lexer_init_buffer(&lx, src, strlen(src));
+    for (OperatorKind op : expected) {
+        Token t = lexer_next(&lx);
+        ASSERT_EQ(t.type, TOKEN_OPERATOR);
+        EXPECT_EQ(t.op, op) << operator_text(op);
+        if (op != OP_OTHER) {
+            EXPECT_TRUE(token_is(&t, operator_text(op)));
+            EXPECT_EQ(operator_precedence(op), get_precedence(operator_text(op)));
+        }
+    }
+    EXPECT_EQ(lexer_next(&lx).type, TOKEN_EOF);
+    lexer_release(&lx);
+}
+
+TEST(ArenaTests, AlignmentGrowthAndStrings) {
+    Arena arena;
+    arena_init(&arena, 256);
+    void* a = arena_alloc(&arena, 3);
+    void* b = arena_alloc(&arena, 8);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % alignof(max_align_t), 0u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % alignof(max_align_t), 0u);
+    EXPECT_EQ(arena.chunk_count, 1u);
+    // Growing the most recent block extends it in place
+    void* g = arena_grow(&arena, b, 8, 64);
+    EXPECT_EQ(g, b);
+    char* s = arena_strndup(&arena, "counter_value", 7);
+    EXPECT_STREQ(s, "counter");
+    // Requests past the chunk size get their own chunk
+    void* big = arena_alloc(&arena, 4096);
+    ASSERT_NE(big, nullptr);
+    memset(big, 0xab, 4096);
+    EXPECT_EQ(arena.chunk_count, 2u);
+    EXPECT_STREQ(s, "counter");
+    arena_free(&arena);
+    EXPECT_EQ(arena.head, nullptr);
+    EXPECT_EQ(arena.chunk_count, 0u);
+}
+
+// Reset keeps the standard chunks and hands them out again
+TEST(ArenaTests, ResetReusesChunks) {
+    Arena arena;
+    arena_init(&arena, 256);
+    for (int i = 0; i < 40; ++i) arena_alloc(&arena, 64);
+    arena_alloc(&arena, 4096);
+    size_t chunks = arena.chunk_count;
+    arena_reset(&arena);
+    EXPECT_EQ(arena.bytes_used, 0u);
+    EXPECT_EQ(arena.chunk_count, chunks - 1);  // The oversized chunk is freed
+    for (int i = 0; i < 40; ++i) arena_alloc(&arena, 64);
+    EXPECT_EQ(arena.chunk_count, chunks - 1);
+    arena_free(&arena);
+    EXPECT_EQ(arena.chunk_count, 0u);
+}
+
+// Rewinding drops the chunks and oversized blocks allocated after the mark
+TEST(ArenaTests, MarkAndRewind) {
+    Arena arena;
+    arena_init(&arena, 256);
+    char* kept = arena_strdup(&arena, "kept");
+    ArenaMark mark = arena_mark(&arena);
+    size_t chunks = arena.chunk_count;
+    arena_alloc(&arena, 4096);
+    for (int i = 0; i < 20; ++i) arena_alloc(&arena, 64);
+    arena_alloc(&arena, 4096);
+    arena_rewind(&arena, mark);
+    EXPECT_EQ(arena.bytes_used, mark.bytes_used);
+    EXPECT_STREQ(kept, "kept");
+    size_t held = arena.chunk_count;
+    for (int i = 0; i < 20; ++i) arena_alloc(&arena, 64);
+    EXPECT_EQ(arena.chunk_count, held);  // Spare chunks are reused
+    EXPECT_GE(held, chunks);
+    arena_free(&arena);
+}
+
+TEST(ArenaTests, ContextOwnsParsedTree) {
+    const char* src = "a + b * (c - 1);";
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, src, strlen(src));
+    advance(&ctx);
+    ASTNode* expr = parse_expression(&ctx);
+    ASSERT_NE(expr, nullptr);
+    EXPECT_EQ(expr->ctx, &ctx);
+    ASSERT_EQ(expr->num_children, 2);
+    EXPECT_STREQ(expr->value, "+");
+    EXPECT_STREQ(expr->children[0]->value, "a");
+    // Equal values share one interned copy
+    EXPECT_EQ(expr->children[1]->children[1]->children[1]->value, intern(&ctx.names, "1"));
+    free_node(expr); // No-op for arena nodes
+    compi_context_free(&ctx);
+    ASTNode* heap = create_node(nullptr, NODE_EXPRESSION);
+    EXPECT_EQ(heap->ctx, nullptr);
+    free_node(heap);
+}
+
+TEST(InternTests, EqualNamesSharePointer) {
+    Interner in;
+    interner_init(&in);
+    const char* a = intern(&in, "counter");
+    const char* b = intern_n(&in, "counter_next", 7);
+    EXPECT_EQ(a, b);
+    EXPECT_STREQ(a, "counter");
+    EXPECT_EQ(intern_find_n(&in, "missing", 7), nullptr);
+    EXPECT_EQ(in.count, 1u);
+    // Pointers stay stable while the table grows
+    for (int i = 0; i < 1000; ++i) {
+        std::string name = "sig_" + std::to_string(i);
+        intern(&in, name.c_str());
+    }
+    EXPECT_EQ(intern(&in, "counter"), a);
+    EXPECT_EQ(in.count, 1001u);
+    interner_free(&in);
+}
+
+TEST(InternTests, StructLookupThroughContext) {
+    const char* src = "struct Point { int x; double y; };";
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, src, strlen(src));
+    ASTNode* program = parse_program(&ctx);
+    ASSERT_NE(program, nullptr);
+    int idx = find_struct_index(&ctx, "Point");
+    ASSERT_GE(idx, 0);
+    EXPECT_EQ(ctx.structs.items[idx].name, intern_find_n(&ctx.names, "Point", 5));
+    EXPECT_STREQ(struct_field_type(&ctx, "Point", "y"), "double");
+    EXPECT_EQ(struct_field_type(&ctx, "Point", "z"), nullptr);
+    compi_context_free(&ctx);
+    EXPECT_EQ(ctx.structs.count, 0);
+}
+
+// Block scopes shadow and unwind; no fixed caps on arrays, structs or fields
+TEST(SymbolTests, ScopedArraysAndUncappedTables) {
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    register_array(&ctx, "a", 2);
+    push_scope(&ctx);
+    register_array(&ctx, "a", 8);
+    register_array(&ctx, "b", 3);
+    EXPECT_EQ(find_array_size(&ctx, "a"), 8);
+    push_scope(&ctx);
+    EXPECT_EQ(find_array_size(&ctx, "b"), 3);
+    pop_scope(&ctx);
+    pop_scope(&ctx);
+    EXPECT_EQ(find_array_size(&ctx, "a"), 2);
+    EXPECT_EQ(find_array_size(&ctx, "b"), -1);
+
+    // Far past the old 128-array / 64-struct / 32-field limits
+    char name[32];
+    for (int i = 0; i < 200000; ++i) {
+        snprintf(name, sizeof(name), "arr%d", i);
+        register_array(&ctx, name, i + 1);
+    }
+    for (int i = 0; i < 200000; i += 997) {
+        snprintf(name, sizeof(name), "arr%d", i);
+        EXPECT_EQ(find_array_size(&ctx, name), i + 1);
+    }
+    for (int i = 0; i < 300; ++i) {
+        snprintf(name, sizeof(name), "S%d", i);
+        int idx = add_struct(&ctx, name);
+        for (int f = 0; f < 100; ++f) {
+            snprintf(name, sizeof(name), "f%d", f);
+            add_struct_field(&ctx, idx, name, f % 2 ? "double" : "int");
+        }
+    }
+    EXPECT_EQ(find_struct_index(&ctx, "S299"), 299);
+    EXPECT_STREQ(struct_field_type(&ctx, "S250", "f99"), "double");
+    EXPECT_EQ(struct_field_type(&ctx, "S250", "f100"), nullptr);
+    reset_arrays(&ctx);
+    EXPECT_EQ(find_array_size(&ctx, "a"), -1);
+    compi_context_free(&ctx);
+}
+
+// Bounds checks see the array visible in the current block
+TEST(SymbolTests, BoundsCheckFollowsScopes) {
+    const char* inner_ok = "int f(int x) { int a[2]; if (x) { int a[8]; a[5] = 1; } return x; }\n";
+    const char* outer_bad = "int f(int x) { int a[2]; if (x) { int a[8]; a[5] = 1; } a[5] = 1; return x; }\n";
+    for (const char* src : {inner_ok, outer_bad}) {
+        CompiContext ctx;
+        compi_context_init(&ctx);
+        compi_context_load_buffer(&ctx, src, strlen(src));
+        ctx.diag_hold = 1;
+        parse_program(&ctx);
+        EXPECT_EQ(ctx.diags.errors, src == outer_bad ? 1u : 0u) << src;
+        compi_context_free(&ctx);
+    }
+}
+
+// Array sizes must fold to 1..INT_MAX; the declaration and the bounds
+// check then agree on the size
+TEST(SymbolTests, ArraySizeMustBePositiveInt) {
+    for (const char* size : {"0", "1 - 2", "65536 * 65536", "x"}) {
+        std::string src = std::string("int f(int x) { int a[") + size + "]; return x; }\n";
+        CompiContext ctx;
+        compi_context_init(&ctx);
+        compi_context_load_buffer(&ctx, src.c_str(), src.size());
+        ctx.diag_hold = 1;
+        parse_program(&ctx);
+        ASSERT_EQ(ctx.diags.errors, 1u) << size;
+        EXPECT_STREQ(ctx.diags.items[0].text,
+                     "Error (line 1): Expected a constant array size between 1 and 2147483647 after '['\n") << size;
+        compi_context_free(&ctx);
+    }
+}
+
+// Read a whole stream back as a string
+static std::string slurp(FILE* f) {
+    std::string text;
+    char buf[4096];
+    size_t n = 0;
+    rewind(f);
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) text.append(buf, n);
+    return text;
+}
+
+TEST(FlatAstTests, PreorderLayoutAndView) {
+    const char* src =
+        "struct Point { int x; int y; };\n"
+        "int f(int a, struct Point p) {\n"
+        "    int arr[4] = {1, 2, 3, 4};\n"
+        "    int t = a + arr[1] * p.x;\n"
+        "    if (t > 3 && a != 0) {\n"
+        "        t = t - 1;\n"
+        "    }\n"
+        "    return t;\n"
+        "}\n";
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, src, strlen(src));
+    ASTNode* program = parse_program(&ctx);
+    ASSERT_NE(program, nullptr);
+
+    FlatAst flat;
+    ASSERT_EQ(flat_ast_build(&flat, program), 0);
+    EXPECT_LE(sizeof(FlatNode), 40u);
+    ASSERT_GT(flat.count, 1u);
+    EXPECT_EQ(flat.nodes[0].type, NODE_PROGRAM);
+    EXPECT_EQ(flat.nodes[0].parent, AST_NO_ID);
+    EXPECT_EQ(flat.child_count, flat.count - 1);
+    for (AstId id = 0; id < flat.count; ++id) {
+        for (uint32_t i = 0; i < flat.nodes[id].num_children; ++i) {
+            AstId child = flat_child(&flat, id, i);
+            EXPECT_GT(child, id); // Preorder: children follow their parent
+            EXPECT_EQ(flat.nodes[child].parent, id);
+        }
+    }
+    AstId fn = flat_child(&flat, 0, 1);
+    EXPECT_EQ(flat.nodes[fn].type, NODE_FUNCTION_DECL);
+    Token ret = flat_token(&flat, fn);
+    EXPECT_TRUE(token_is(&ret, "int"));
+
+    // Code generated from the view matches the pointer tree
+    FILE* out_tree = tmpfile();
+    FILE* out_view = tmpfile();
+    ASSERT_NE(out_tree, nullptr);
+    ASSERT_NE(out_view, nullptr);
+    generate_vhdl(&ctx, program, out_tree);
+    ASTNode* view = flat_ast_view(&flat);
+    ASSERT_NE(view, nullptr);
+    EXPECT_EQ(view[fn].parent, &view[0]);
+    generate_vhdl(&ctx, view, out_view);
+    EXPECT_EQ(slurp(out_tree), slurp(out_view));
+
+    flat_ast_free(&flat);
+    compi_context_free(&ctx);
+    fclose(out_tree);
+    fclose(out_view);
+}
+
+TEST(FlatAstTests, SaveAndLoadRoundTrip) {
+    const char* src =
+        "struct Pair { int lo; int hi; };\n"
+        "int f(int a, struct Pair p) {\n"
+        "    int arr[3] = {1, 2, 3};\n"
+        "    int t = a + arr[2] * p.hi;\n"
+        "    while (t > 0) { t = t - 1; }\n"
+        "    return t;\n"
+        "}\n";
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, src, strlen(src));
+    ASTNode* program = parse_program(&ctx);
+    ASSERT_NE(program, nullptr);
+    FILE* out_tree = tmpfile();
+    ASSERT_NE(out_tree, nullptr);
+    generate_vhdl(&ctx, program, out_tree);
+
+    FlatAst flat;
+    ASSERT_EQ(flat_ast_build(&flat, program), 0);
+    EXPECT_EQ(flat.struct_count, 1u);
+    EXPECT_EQ(flat.field_count, 2u);
+    FILE* file = tmpfile();
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(flat_ast_save(&flat, file), 0);
+    flat_ast_free(&flat);
+    compi_context_free(&ctx);
+
+    // Loaded into a fresh context: no source, no parse
+    rewind(file);
+    CompiContext loaded;
+    compi_context_init(&loaded);
+    ASSERT_EQ(flat_ast_load(&flat, &loaded, file), 0);
+    EXPECT_EQ(loaded.structs.count, 1);
+    EXPECT_STREQ(flat_value(&flat, 0), nullptr);
+    ASTNode* view = flat_ast_view(&flat);
+    ASSERT_NE(view, nullptr);
+    FILE* out_view = tmpfile();
+    ASSERT_NE(out_view, nullptr);
+    generate_vhdl(&loaded, view, out_view);
+    EXPECT_EQ(slurp(out_tree), slurp(out_view));
+    flat_ast_free(&flat);
+    compi_context_free(&loaded);
+
+    // A damaged header is rejected
+    rewind(file);
+    fputc('X', file);
+    rewind(file);
+    compi_context_init(&loaded);
+    EXPECT_EQ(flat_ast_load(&flat, &loaded, file), -2);
+    compi_context_free(&loaded);
+    fclose(file);
+    fclose(out_tree);
+    fclose(out_view);
+}
+
+// Compile one source in a fresh context and return the generated VHDL
+static std::string compile_to_string(const char* src, int parse_jobs = 1, int codegen_jobs = 1) {
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    ctx.parse_jobs = parse_jobs;
+    ctx.codegen_jobs = codegen_jobs;
+    compi_context_load_buffer(&ctx, src, strlen(src));
+    ASTNode* program = parse_program(&ctx);
+    std::string text;
+    FILE* out = tmpfile();
+    if (program && out) {
+        generate_vhdl(&ctx, program, out);
+        text = slurp(out);
+    }
+    if (out) fclose(out);
+    compi_context_free(&ctx);
+    return text;
+}
+
+// One context per thread: concurrent compilations match a serial one
+TEST(ContextTests, ConcurrentCompilation) {
+    const char* srcs[2] = {
+        "struct Vec { int x; int y; };\n"
+        "int f(int a, struct Vec v) { int arr[3] = {1, 2, 3}; int t = arr[2] + v.x; return t; }\n",
+        "int g(int a, int b) { int i = 0; while (i < 4) { if (i == 2) { break; } i = i + 1; } return a + b; }\n",
+    };
+    std::string expected[2] = { compile_to_string(srcs[0]), compile_to_string(srcs[1]) };
+    ASSERT_FALSE(expected[0].empty());
+    ASSERT_NE(expected[0], expected[1]);
+    std::string results[8];
+    std::vector<std::thread> workers;
+    for (int i = 0; i < 8; ++i) {
+        workers.emplace_back([&, i] { results[i] = compile_to_string(srcs[i % 2]); });
+    }
+    for (auto& w : workers) w.join();
+    for (int i = 0; i < 8; ++i) {
+        EXPECT_EQ(results[i], expected[i % 2]) << "thread " << i;
+    }
+}
+
+// for-init takes "name = expr" via one token of lookahead; anything else is left alone
+TEST(ParserTests, ForInitLookahead) {
+    std::string out = compile_to_string(
+        "int f(int n) { int s = 0; int i = 0; for (i = 2; i < n; i++) { s = s + i; } for (; i < n; i++) { s = s + 1; } return s; }\n");
+    EXPECT_NE(out.find("      i <= 2;\n      while unsigned(i) < unsigned(n) loop"), std::string::npos) << out;
+    EXPECT_NE(out.find("      while unsigned(i) < unsigned(n) loop\n      s <= s + 1;"), std::string::npos) << out;
+}
+
+static void collect_access(const ASTNode* node, int, void* arg) {
+    if (node->type == NODE_INDEX || node->type == NODE_MEMBER) {
+        static_cast<std::vector<const ASTNode*>*>(arg)->push_back(node);
+    }
+}
+
+// a[i] and a.b are NODE_INDEX / NODE_MEMBER nodes with expression children;
+// constant indexes are folded and bounds-checked
+TEST(ParserTests, IndexAndMemberNodes) {
+    const char* src =
+        "struct Vec { int x; int y; };\n"
+        "int f(int a, struct Vec v) { int arr[4] = {1, 2, 3, 4};"
+        " int t = arr[a + 1] + v.x; arr[1 + 2] = v.y; return arr[arr[0]]; }\n";
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    ctx.heap_nodes = 1;
+    compi_context_load_buffer(&ctx, src, strlen(src));
+    ASTNode* program = parse_program(&ctx);
+    ASSERT_NE(program, nullptr);
+    std::vector<const ASTNode*> found;
+    ast_walk(program, collect_access, &found);
+    ASSERT_EQ(found.size(), 6u);
+    EXPECT_EQ(found[0]->type, NODE_INDEX);
+    EXPECT_STREQ(found[0]->children[0]->value, "arr");
+    EXPECT_EQ(found[0]->children[1]->type, NODE_BINARY_EXPR);
+    EXPECT_EQ(found[1]->type, NODE_MEMBER);
+    EXPECT_STREQ(found[1]->value, "x");
+    EXPECT_STREQ(found[1]->children[0]->value, "v");
+    EXPECT_EQ(found[2]->children[1]->type, NODE_EXPRESSION);
+    EXPECT_STREQ(found[2]->children[1]->value, "3");
+    EXPECT_EQ(found[4]->children[1], found[5]);
+    free_node(program);
+    compi_context_free(&ctx);
+
+    std::string out = compile_to_string(src);
+    EXPECT_NE(out.find("t <= arr(a + 1) + v.x;"), std::string::npos) << out;
+    EXPECT_NE(out.find("arr(3) <= v.y;"), std::string::npos) << out;
+    EXPECT_NE(out.find("result <= arr(arr(0));"), std::string::npos) << out;
+
+    const char* bad = "int f(int a) { int arr[4]; arr[2 * 2] = a; return a; }\n";
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, bad, strlen(bad));
+    ctx.diag_hold = 1;
+    program = parse_program(&ctx);
+    EXPECT_EQ(ctx.diags.errors, 1u);
+    EXPECT_EQ(program->num_children, 0);
+    compi_context_free(&ctx);
+}
+
+static void max_depth(const ASTNode*, int depth, void* arg) {
+    int* deepest = static_cast<int*>(arg);
+    if (depth > *deepest) *deepest = depth;
+}
+
+// 100k-deep blocks, parentheses and unary chains compile and free on a 256 KiB stack
+static void* compile_deep(void* arg) {
+    std::string* texts = static_cast<std::string*>(arg);
+    const int depth = 100000;
+    std::string blocks = "int f(int a) { ", parens = "int g(int a) { int r = ", unary = "int h(int a) { int r = ";
+    for (int i = 0; i < depth; ++i) {
+        blocks += i % 2 ? "while (a < 7) { " : "if (a < 7) { ";
+        parens += "(a + ";
+        unary += i % 2 ? "~" : "!";
+    }
+    blocks += "a = a + 1; break; ";
+    for (int i = 0; i < depth; ++i) blocks += "} ";
+    parens += "1" + std::string(depth, ')');
+    blocks += "return a; }\n";
+    parens += "; return r; }\n";
+    unary += "a; return r; }\n";
+    texts[0] = compile_to_string(blocks.c_str());
+    texts[1] = compile_to_string((parens + unary).c_str());
+
+    // Heap nodes: free_node walks the whole tree itself
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    ctx.heap_nodes = 1;
+    compi_context_load_buffer(&ctx, blocks.c_str(), blocks.size());
+    ASTNode* program = parse_program(&ctx);
+    int deepest = 0;
+    if (program) {
+        ast_walk(program, max_depth, &deepest);
+        free_node(program);
+    }
+    compi_context_free(&ctx);
+    texts[2] = std::to_string(deepest);
+    return nullptr;
+}
+
+TEST(ParserTests, DeepNestingUsesBoundedStack) {
+    std::string texts[3];
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+    ASSERT_EQ(pthread_create(&thread, &attr, compile_deep, texts), 0);
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attr);
+
+    ASSERT_FALSE(texts[0].empty());
+    ASSERT_FALSE(texts[1].empty());
+    size_t loops = 0;
+    for (size_t at = texts[0].find("end loop;"); at != std::string::npos; at = texts[0].find("end loop;", at + 1)) {
+        ++loops;
+    }
+    EXPECT_EQ(loops, 50000u);
+    EXPECT_GT(std::stoi(texts[2]), 100000);
+}
+
+// Pre-scan + parallel function parsing produces the serial output
+TEST(ParserTests, ParallelParseMatchesSerial) {
+    std::string src = "struct Vec { int x; int y; };\n";
+    for (int i = 0; i < 64; ++i) {
+        std::string n = std::to_string(i);
+        if (i == 20) src += "int g;\nstruct Pair { int a; int b; };\n";
+        src += "int f" + n + "(int a, struct Vec v) { int arr[2] = {1, " + n + "};"
+               " while (a < " + n + ") { if (a == 3) { break; } a = a + arr[1]; } return a + v.x; }\n";
+    }
+    std::string serial = compile_to_string(src.c_str());
+    ASSERT_FALSE(serial.empty());
+    EXPECT_EQ(compile_to_string(src.c_str(), 4), serial);
+    EXPECT_EQ(compile_to_string(src.c_str(), 64), serial);
+}
+
+// Per-function buffers merged in source order give the serial output
+TEST(CodegenTests, ParallelOutputMatchesSerial) {
+    std::string src = "struct Vec { int x; int y; };\n";
+    for (int i = 0; i < 40; ++i) {
+        std::string n = std::to_string(i);
+        src += "struct Vec mk" + n + "(int a) { struct Vec v; v.x = a; v.y = " + n + "; return v; }\n";
+        src += "int h" + n + "(int a) { for (int i = 0; i < " + n + "; i++) { a = a * 2; } return a; }\n";
+    }
+    std::string serial = compile_to_string(src.c_str());
+    ASSERT_FALSE(serial.empty());
+    EXPECT_EQ(compile_to_string(src.c_str(), 1, 3), serial);
+    EXPECT_EQ(compile_to_string(src.c_str(), 4, 8), serial);
+}
+
+// Streaming: items are generated as they are parsed and their nodes
+// released, so the arena never holds more than one function
+struct StreamCapture {
+    OutSink sink;
+    size_t items;
+    size_t peak_arena;
+};
+
+static void capture_item(void* user, CompiContext* ctx, ASTNode* item) {
+    StreamCapture* sc = static_cast<StreamCapture*>(user);
+    sc->items++;
+    sc->peak_arena = std::max(sc->peak_arena, ctx->arena.bytes_used);
+    generate_vhdl_item(ctx, item, &sc->sink);
+}
+
+static std::string compile_streaming(const char* src, int heap_nodes, StreamCapture* sc) {
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    ctx.heap_nodes = heap_nodes;
+    compi_context_load_buffer(&ctx, src, strlen(src));
+    sink_init_memory(&sc->sink);
+    generate_vhdl_header(&ctx, &sc->sink);
+    parse_program_stream(&ctx, capture_item, sc);
+    size_t len = 0;
+    char* text = sink_take(&sc->sink, &len);
+    std::string out(text ? text : "", len);
+    free(text);
+    sink_close(&sc->sink);
+    compi_context_free(&ctx);
+    return out;
+}
+
+TEST(CodegenTests, StreamingMatchesWholeTree) {
+    std::string src = "struct Vec { int x; int y; };\n";
+    for (int i = 0; i < 200; ++i) {
+        std::string n = std::to_string(i);
+        src += "int f" + n + "(int a, struct Vec v) { int arr[2] = {1, " + n + "};"
+               " while (a < " + n + ") { if (a == 3) { break; } a = a + arr[1] + v.y; } return a + v.x; }\n";
+    }
+    std::string whole = compile_to_string(src.c_str());
+    ASSERT_FALSE(whole.empty());
+
+    CompiContext tree;
+    compi_context_init(&tree);
+    compi_context_load_buffer(&tree, src.c_str(), src.size());
+    ASSERT_NE(parse_program(&tree), nullptr);
+    size_t tree_bytes = tree.arena.bytes_used;
+    compi_context_free(&tree);
+
+    StreamCapture sc = {};
+    EXPECT_EQ(compile_streaming(src.c_str(), 0, &sc), whole);
+    EXPECT_EQ(sc.items, 201u);
+    EXPECT_LT(sc.peak_arena * 50, tree_bytes);
+
+    StreamCapture heap = {};
+    EXPECT_EQ(compile_streaming(src.c_str(), 1, &heap), whole);
+}
+
+// Counters match the source; parallel shards report into the parent's stats
+TEST(StatsTests, CountsTokensNodesAndSymbols) {
+    const char* src =
+        "struct Vec { int x; int y; };\n"
+        "int f(int a, struct Vec v) { int arr[2] = {1, 2}; return arr[1] + v.x; }\n"
+        "int g(int a) { int buf[4]; return a; }\n";
+    for (int jobs : {1, 4}) {
+        CompiStats stats;
+        CompiContext ctx;
+        compi_stats_init(&stats);
+        compi_context_init(&ctx);
+        ctx.stats = &stats;
+        ctx.parse_jobs = jobs;
+        ctx.codegen_jobs = jobs;
+        compi_context_load_buffer(&ctx, src, strlen(src));
+        compi_stats_lex(&stats, src, strlen(src));
+        ASTNode* program = parse_program(&ctx);
+        ASSERT_NE(program, nullptr);
+        compi_stats_count_nodes(&stats, program);
+        FILE* out = tmpfile();
+        generate_vhdl(&ctx, program, out);
+        fclose(out);
+        compi_context_free(&ctx);
+
+        EXPECT_EQ(stats.tokens, 62u) << "jobs " << jobs;
+        EXPECT_EQ(stats.nodes_by_type[NODE_PROGRAM], 1u);
+        EXPECT_EQ(stats.nodes_by_type[NODE_FUNCTION_DECL], 2u);
+        EXPECT_EQ(stats.nodes_by_type[NODE_STRUCT_DECL], 1u);
+        EXPECT_EQ(stats.arrays, 2u);
+        EXPECT_GT(stats.symbol_ops, stats.arrays);
+        EXPECT_GT(stats.nodes, 10u);
+    }
+}
+
+// Buffer-to-buffer API: VHDL and diagnostics come back in memory, and a
+// failed compile does not disturb the next one on the same session
+TEST(ApiTests, CompileBufferToBuffer) {
+    const char* good =
+        "struct Vec { int x; int y; };\n"
+        "int f(int a, struct Vec v) { int arr[2] = {1, 2}; return arr[1] + v.x; }\n"
+        "int g;\n";
+    const char* bad = "int f(int a) { return a; }\nint h(int a) { a = ; return a }\n";
+    std::string expected = compile_to_string(good);
+    ASSERT_FALSE(expected.empty());
+
+    testing::internal::CaptureStdout();
+    CompiResult result;
+    ASSERT_EQ(compi_compile(good, strlen(good), nullptr, &result), 0);
+    EXPECT_TRUE(result.ok);
+    EXPECT_EQ(std::string(result.vhdl, result.vhdl_len), expected);
+    EXPECT_STREQ(result.diagnostics, "Warning: Global variable declarations not yet implemented\n");
+    compi_result_free(&result);
+
+    CompiOptions opts = { 4, nullptr };
+    CompiSession* session = compi_session_new(&opts);
+    ASSERT_NE(session, nullptr);
+    std::string partial = compile_to_string("int f(int a) { return a; }\n");
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(compi_session_compile(session, bad, strlen(bad), &result), -1);
+        EXPECT_FALSE(result.ok);
+        EXPECT_EQ(std::string(result.vhdl, result.vhdl_len), partial);  // h is left out
+        EXPECT_STREQ(result.diagnostics, "Error (line 2): Expected ';' after return statement\n");
+        ASSERT_EQ(result.diag_count, 1u);
+        EXPECT_EQ(result.error_count, 1u);
+        EXPECT_TRUE(result.diag_list[0].is_error);
+        EXPECT_EQ(result.diag_list[0].line, 2);
+        EXPECT_EQ(result.diag_list[0].text, result.diagnostics);
+        compi_result_free(&result);
+        EXPECT_EQ(compi_session_compile(session, good, strlen(good), &result), 0);
+        EXPECT_EQ(std::string(result.vhdl, result.vhdl_len), expected);
+        compi_result_free(&result);
+    }
+    compi_session_free(session);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+}
+
+// Compile with a function cache; reports how many functions were reused
+static std::string compile_cached(const std::string& src, const char* dir, size_t* hits, size_t* misses) {
+    CompiContext ctx;
+    compi_context_init(&ctx);
+    ctx.cache.dir = dir;
+    compi_context_load_buffer(&ctx, src.c_str(), src.size());
+    ASTNode* program = parse_program(&ctx);
+    OutSink sink;
+    sink_init_memory(&sink);
+    generate_vhdl_sink(&ctx, program, &sink);
+    size_t len = 0;
+    char* text = sink_take(&sink, &len);
+    std::string result(text, len);
+    free(text);
+    *hits = ctx.cache.hits;
+    *misses = ctx.cache.misses;
+    compi_context_free(&ctx);
+    return result;
+}
+
+// Only edited functions, or those naming an edited struct, are regenerated
+TEST(CodegenTests, FunctionCacheReusesUnchangedFunctions) {
+    char dir[] = "/tmp/compi_cache_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string cache = std::string(dir) + "/cache";  // Created on first store
+    auto program = [](const char* vec, int k) {
+        std::string src = std::string("struct Vec { ") + vec + " };\n";
+        for (int i = 0; i < 10; ++i) {
+            std::string n = std::to_string(i);
+            src += "int f" + n + "(int a) { int t = a + " + std::to_string(i == 3 ? k : i) + "; return t; }\n";
+        }
+        src += "struct Vec mk(int a) { struct Vec v; v.x = a; return v; }\n";
+        return src;
+    };
+    size_t hits = 0, misses = 0;
+    std::string src = program("int x; int y;", 0);
+    std::string out = compile_cached(src, cache.c_str(), &hits, &misses);
+    EXPECT_EQ(out, compile_to_string(src.c_str()));
+    EXPECT_EQ(hits, 0u);
+    EXPECT_EQ(misses, 11u);
+    EXPECT_EQ(compile_cached(src, cache.c_str(), &hits, &misses), out);
+    EXPECT_EQ(hits, 11u);
+    EXPECT_EQ(misses, 0u);
+
+    src = program("int x; int y;", 42);
+    EXPECT_EQ(compile_cached(src, cache.c_str(), &hits, &misses), compile_to_string(src.c_str()));
+    EXPECT_EQ(misses, 1u);
+    src = program("int x; double y;", 42);
+    EXPECT_EQ(compile_cached(src, cache.c_str(), &hits, &misses), compile_to_string(src.c_str()));
+    EXPECT_EQ(misses, 1u);  // Only mk names struct Vec
+
+    std::string cmd = std::string("rm -rf ") + dir;
+    EXPECT_EQ(system(cmd.c_str()), 0);
+}
+
+// The in-memory store of --watch: one warm context recompiles edits, and
+// each sweep keeps only the functions of the last compile
+TEST(CodegenTests, FunctionMemoFollowsEdits) {
+    CompiContext ctx;
+    FuncMemo memo;
+    compi_context_init(&ctx);
+    func_memo_init(&memo);
+    ctx.cache.memory = &memo;
+    auto compile = [&](const std::string& src) {
+        compi_context_reset(&ctx);
+        compi_context_load_buffer(&ctx, src.c_str(), src.size());
+        ASTNode* program = parse_program(&ctx);
+        OutSink sink;
+        sink_init_memory(&sink);
+        generate_vhdl_sink(&ctx, program, &sink);
+        size_t len = 0;
+        char* text = sink_take(&sink, &len);
+        std::string result(text, len);
+        free(text);
+        func_memo_sweep(&memo);
+        return result;
+    };
+    std::string f = "int f(int a) { return a + 1; }\n";
+    std::string g = "int g(int a) { return a * 2; }\n";
+    std::string h = "int h(int a) { return a - 3; }\n";
+    std::string src = f + g + h;
+    EXPECT_EQ(compile(src), compile_to_string(src.c_str()));
+    EXPECT_EQ(ctx.cache.misses, 3u);
+    EXPECT_EQ(memo.count, 3u);
+
+    src = f + "int g(int a) { return a * 4; }\n" + h;
+    EXPECT_EQ(compile(src), compile_to_string(src.c_str()));
+    EXPECT_EQ(ctx.cache.hits, 2u);
+    EXPECT_EQ(ctx.cache.misses, 1u);
+    EXPECT_EQ(memo.count, 3u);  // The old g is gone
+
+    src = f + h;
+    EXPECT_EQ(compile(src), compile_to_string(src.c_str()));
+    EXPECT_EQ(ctx.cache.hits, 2u);
+    EXPECT_EQ(memo.count, 2u);
+
+    compi_context_free(&ctx);
+    func_memo_free(&memo);
+}
+
+// A server answers several requests per connection with a warm context
+TEST(ServerTests, CompilesOverUnixSocket) {
+    std::string sock = "/tmp/compi_test_" + std::to_string(getpid()) + ".sock";
+    std::thread server([&] { EXPECT_EQ(compile_server_run(sock.c_str(), 2), 0); });
+    int fd = -1;
+    for (int tries = 0; tries < 200 && fd < 0; ++tries) {
+        fd = compile_client_connect(sock.c_str());
+        if (fd < 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_GE(fd, 0);
+
+    const char* srcs[2] = {
+        "struct Vec { int x; int y; };\nstruct Vec mk(int a) { struct Vec v; v.x = a; return v; }\n",
+        "int g(int a) { int i = 0; while (i < 4) { i = i + 1; } return a; }\n",
+    };
+    for (int round = 0; round < 3; ++round) {
+        for (const char* src : srcs) {
+            CompileRequest req = {};
+            req.source = src;
+            req.len = strlen(src);
+            req.jobs = round;
+            CompileReply reply;
+            ASSERT_EQ(compile_client_request(fd, &req, &reply), 0);
+            EXPECT_TRUE(reply.ok);
+            EXPECT_EQ(std::string(reply.text, reply.len), compile_to_string(src));
+            free(reply.text);
+        }
+    }
+    // Includes are found next to the client's file, not in the server's cwd
+    char dir[] = "/tmp/compi_srv_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string header = std::string(dir) + "/sizes.h";
+    std::string file = std::string(dir) + "/u.c";
+    FILE* h = fopen(header.c_str(), "w");
+    ASSERT_NE(h, nullptr);
+    fputs("#define N 4\n", h);
+    fclose(h);
+    const char* with_include = "#include \"sizes.h\"\nint f(int a) { int t[N]; t[N - 1] = a; return t[3]; }\n";
+    CompileRequest inc = {};
+    inc.source = with_include;
+    inc.len = strlen(with_include);
+    inc.path = file.c_str();
+    CompileReply inc_reply;
+    ASSERT_EQ(compile_client_request(fd, &inc, &inc_reply), 0);
+    EXPECT_TRUE(inc_reply.ok) << inc_reply.text;
+    EXPECT_NE(std::string(inc_reply.text, inc_reply.len).find("array (0 to 3)"), std::string::npos);
+    free(inc_reply.text);
+    std::string cmd = std::string("rm -rf ") + dir;
+    EXPECT_EQ(system(cmd.c_str()), 0);
+
+    const char* bad = "int main() { x = 1 }\n";
+    CompileRequest req = {};
+    req.source = bad;
+    req.len = strlen(bad);
+    CompileReply reply;
+    ASSERT_EQ(compile_client_request(fd, &req, &reply), 0);
+    EXPECT_FALSE(reply.ok);
+    EXPECT_EQ(std::string(reply.text, reply.len), "Error (line 1): Expected ';' after assignment\n");
+    free(reply.text);
+    close(fd);
+
+    // A bad or oversized source length gets an error and closes only that
+    // connection; the server keeps answering
+    for (const char* length : {"18446744073709551615", "300000000", "-1", "12x"}) {
+        int raw = compile_client_connect(sock.c_str());
+        ASSERT_GE(raw, 0);
+        std::string head = std::string("source ") + length + "\n\n";
+        ASSERT_EQ(send(raw, head.data(), head.size(), MSG_NOSIGNAL), (ssize_t)head.size());
+        std::string answer;
+        char buf[256];
+        ssize_t n = 0;
+        while ((n = recv(raw, buf, sizeof(buf), 0)) > 0) answer.append(buf, (size_t)n);
+        close(raw);
+        EXPECT_EQ(answer, "error 24\nInvalid 'source' length\n") << length;
+
+        int next = compile_client_connect(sock.c_str());
+        ASSERT_GE(next, 0);
+        CompileRequest again = {};
+        again.source = srcs[1];
+        again.len = strlen(srcs[1]);
+        CompileReply again_reply;
+        ASSERT_EQ(compile_client_request(next, &again, &again_reply), 0) << length;
+        EXPECT_TRUE(again_reply.ok);
+        free(again_reply.text);
+        close(next);
+    }
+
+    EXPECT_EQ(compile_client_shutdown(sock.c_str()), 0);
+    server.join();
+}
+
+// Sink appends land in order across backends and block boundaries
+static size_t collect_block(void* user, const char* data, size_t len) {
+    static_cast<std::string*>(user)->append(data, len);
+    return len;
+}
+
+TEST(OutSinkTests, MemoryAndCallbackBackends) {
+    std::string expected;
+    OutSink mem;
+    sink_init_memory(&mem);
+    std::string via_callback;
+    OutSink cb;
+    sink_init_callback(&cb, collect_block, &via_callback);
+    std::string big(OUT_SINK_BLOCK + 17, 'x');
+    for (OutSink* s : {&mem, &cb}) {
+        for (int i = 0; i < 5000; ++i) {
+            sink_lit(s, "sig_");
+            sink_put_int(s, i - 2500);
+            sink_putc(s, ';');
+            sink_printf(s, " %s=%d\n", "v", i);
+        }
+        sink_puts(s, big.c_str());
+        sink_puts(s, nullptr);
+    }
+    for (int i = 0; i < 5000; ++i) {
+        expected += "sig_" + std::to_string(i - 2500) + "; v=" + std::to_string(i) + "\n";
+    }
+    expected += big + "(null)";
+
+    size_t len = 0;
+    char* text = sink_take(&mem, &len);
+    ASSERT_NE(text, nullptr);
+    EXPECT_EQ(std::string(text, len), expected);
+    free(text);
+    EXPECT_EQ(sink_close(&cb), 0);
+    EXPECT_EQ(via_callback, expected);
+}
+
+// Every index is handed out exactly once, whatever the job count
+static void count_index(void* arg, size_t index) {
+    static_cast<std::atomic<int>*>(arg)[index]++;
+}
+
+TEST(WorkPoolTests, RunsEveryIndexOnce) {
+    for (int jobs : {1, 3, 16}) {
+        std::atomic<int> hits[100] = {};
+        work_pool_run(jobs, 100, count_index, hits);
+        for (int i = 0; i < 100; ++i) {
+            EXPECT_EQ(hits[i].load(), 1) << "jobs " << jobs << " index " << i;
+        }
+    }
+    work_pool_run(4, 0, count_index, nullptr);
+    EXPECT_GE(work_pool_default_jobs(), 1);
+}
+
+// Outside parse_program, with fail_env set a parse error unwinds to the
+// caller instead of exiting
+TEST(ContextTests, ParseErrorUnwindsToFailEnv) {
+    const char* src = "x = 1 }\n";
+    CompiContext ctx;
+    jmp_buf env;
+    compi_context_init(&ctx);
+    compi_context_load_buffer(&ctx, src, strlen(src));
+    ctx.fail_env = &env;
+    ctx.diag_hold = 1;
+    bool failed = false;
+    advance(&ctx);
+    if (setjmp(env) == 0) {
+        parse_statement(&ctx);
+    } else {
+        failed = true;
+    }
+    EXPECT_EQ(ctx.diags.errors, 1u);
+    compi_context_free(&ctx);
+    EXPECT_TRUE(failed);
+}
+
+// One pass reports every error: statements resync at ';' or '}', functions
+// with errors are left out and the rest are generated, serial or parallel
+TEST(ParserTests, RecoversAndReportsEveryError) {
+    const char* src =
+        "struct P { int a; int b c; int d; };\n"
+        "int ok1(int a) { return a + 1; }\n"
+        "int bad1(int a) {\n"
+        "  a = ;\n"
+        "  while (a < 3) {\n"
+        "    a = a + ;\n"
+        "    if (a == 2 { break; }\n"
+        "    a = a * 2\n"
+        "  }\n"
+        "  return a;\n"
+        "}\n"
+        "int ok2(int a) { for (int i = 0; i < 2; i++) { a = a + i; } return a; }\n"
+        "int bad2(int) { return 1; }\n"
+        "int bad3(int a) { break; continue; return a; }\n"
+        "int ok3(struct P p) { return p.a; }\n";
+    const char* expected =
+        "Error (line 1): Expected ';' after struct field\n"
+        "Error (line 6): Expected right operand after operator '+'\n"
+        "Error (line 7): Expected ')' after if condition\n"
+        "Error (line 8): Expected ';' after assignment\n"
+        "Error (line 13): Expected parameter name\n"
+        "Error (line 14): 'break' not within a loop\n"
+        "Error (line 14): 'continue' not within a loop\n";
+    std::string good = compile_to_string(
+        "struct P { int a; int b; int d; };\n"
+        "int ok1(int a) { return a + 1; }\n"
+        "int ok2(int a) { for (int i = 0; i < 2; i++) { a = a + i; } return a; }\n"
+        "int ok3(struct P p) { return p.a; }\n");
+    for (int jobs : {1, 4}) {
+        CompiContext ctx;
+        compi_context_init(&ctx);
+        ctx.parse_jobs = jobs;
+        compi_context_load_buffer(&ctx, src, strlen(src));
+        OutSink diag;
+        sink_init_memory(&diag);
+        ctx.diag = &diag;
+        ASTNode* program = parse_program(&ctx);
+        std::string text(diag.buf ? diag.buf : "", diag.len);
+        EXPECT_EQ(text, expected) << "jobs " << jobs;
+        EXPECT_EQ(ctx.diags.errors, 7u);
+        EXPECT_EQ(ctx.loop_depth, 0);
+        EXPECT_EQ(ctx.arrays.depth, 0);
+        ASSERT_EQ(program->num_children, 4);
+        FILE* out = tmpfile();
+        generate_vhdl(&ctx, program, out);
+        EXPECT_EQ(slurp(out), good);
+        fclose(out);
+        sink_close(&diag);
+        compi_context_free(&ctx);
+    }
+}
+
+// Macros size arrays, a guarded header included twice is read once, and a
+// shared include cache parses each header once
+TEST(PreprocessorTests, MacrosAndCachedIncludes) {
+    char dir[] = "/tmp/compi_pp_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string header = std::string(dir) + "/vec.h";
+    std::string main_c = std::string(dir) + "/main.c";
+    auto write = [](const std::string& path, const char* text) {
+        FILE* f = fopen(path.c_str(), "w");
+        ASSERT_NE(f, nullptr);
+        fputs(text, f);
+        fclose(f);
+    };
+    write(header, "#ifndef VEC_H\n#define VEC_H\n#define VEC_N 4\nstruct Vec { int x; int y; };\n#endif\n");
+    const char* src =
+        "#include \"vec.h\"\n"
+        "#include \"vec.h\"\n"
+        "#define SIZE (VEC_N * 2)\n"
+        "int f(struct Vec v) {\n"
+        "  int a[SIZE];\n"
+        "  a[SIZE - 1] = v.x;\n"
+        "  return a[SIZE - 2] + a[VEC_N + 3];\n"
+        "}\n";
+    auto compile = [&](IncludeCache* includes, std::string* vhdl = nullptr) {
+        CompiContext ctx;
+        compi_context_init(&ctx);
+        compi_context_load_buffer(&ctx, src, strlen(src));
+        OutSink diag;
+        sink_init_memory(&diag);
+        ctx.diag = &diag;
+        preprocess_source(&ctx, main_c.c_str(), includes);
+        ASTNode* program = parse_program(&ctx);
+        std::string text(diag.buf ? diag.buf : "", diag.len);
+        if (vhdl) {
+            FILE* out = tmpfile();
+            generate_vhdl(&ctx, program, out);
+            *vhdl = slurp(out);
+            fclose(out);
+        }
+        sink_close(&diag);
+        compi_context_free(&ctx);
+        return text;
+    };
+
+    std::string vhdl;
+    EXPECT_EQ(compile(nullptr, &vhdl), "");
+    EXPECT_NE(vhdl.find("type Vec_t is record"), std::string::npos);
+    EXPECT_NE(vhdl.find("array (0 to 7)"), std::string::npos);
+    EXPECT_NE(vhdl.find("a(7) <= v.x;"), std::string::npos);
+    EXPECT_NE(vhdl.find("result <= a(6) + a(7);"), std::string::npos);
+
+    // A cached header is not read again: the edit only shows without the cache
+    IncludeCache* includes = include_cache_new();
+    ASSERT_NE(includes, nullptr);
+    compile(includes);
+    char resolved[PATH_MAX];
+    ASSERT_NE(realpath(header.c_str(), resolved), nullptr);
+    ASSERT_EQ(include_cache_count(includes), 1u);  // What --watch watches
+    EXPECT_STREQ(include_cache_path(includes, 0), resolved);
+    write(header, "#pragma once\n#define VEC_N 1\nstruct Vec { int x; int y; };\n");
+    EXPECT_EQ(compile(includes, &vhdl), "");
+    EXPECT_NE(vhdl.find("array (0 to 7)"), std::string::npos);
+    // Line numbers survive the expansion
+    EXPECT_EQ(compile(nullptr), "Error (line 7): Array index 4 out of bounds for 'a' with size 2\n");
+    include_cache_free(includes);
+
+    write(header, "int g(int a) { return a; }\nstruct Vec { int x; int y; };\n");
+    EXPECT_EQ(compile(nullptr),
+              "In " + std::string(resolved) + ": Error (line 1): Only struct definitions, macros and includes are allowed in a header\n"
+              "Warning: 'vec.h' included again; it has no include guard and is only read once\n"
+              "Error (line 5): Expected a constant array size between 1 and 2147483647 after '['\n");
+    std::string cmd = std::string("rm -rf ") + dir;
+    EXPECT_EQ(system(cmd.c_str()), 0);
 }
 
 // Test negative literal detection utility
@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Generate src/parser/keyword_table.h: a collision-free hash table for the
+C keywords recognised by the lexer.
+
+Hash: ((first * A) ^ (last * B) ^ len) & (SIZE - 1). The script searches for
+the smallest table and multipliers that map every keyword to its own slot.
+
+Usage: python3 tools/gen_keyword_hash.py > src/parser/keyword_table.h
+"""
+import sys
+
+# Keyword text -> KeywordKind enumerator (see include/token.h)
+KEYWORDS = [
+    ("if", "KW_IF"), ("else", "KW_ELSE"), ("while", "KW_WHILE"),
+    ("for", "KW_FOR"), ("return", "KW_RETURN"), ("break", "KW_BREAK"),
+    ("continue", "KW_CONTINUE"), ("struct", "KW_STRUCT"),
+    ("int", "KW_INT"), ("float", "KW_FLOAT"), ("char", "KW_CHAR"),
+    ("double", "KW_DOUBLE"), ("void", "KW_VOID"),
+]
+
+
+def slot(word, a, b, size):
+    return ((ord(word[0]) * a) ^ (ord(word[-1]) * b) ^ len(word)) & (size - 1)
+
+
+def search():
+    size = 16
+    while size <= 1024:
+        for a in range(1, 64):
+            for b in range(1, 64):
+                slots = {slot(w, a, b, size) for w, _ in KEYWORDS}
+                if len(slots) == len(KEYWORDS):
+                    return size, a, b
+        size *= 2
+    sys.exit("no perfect hash found")
+
+
+def main():
+    size, a, b = search()
+    table = [None] * size
+    for word, kind in KEYWORDS:
+        table[slot(word, a, b, size)] = (word, kind)
+    lens = [len(w) for w, _ in KEYWORDS]
+
+    out = sys.stdout
+    out.write("// Generated by tools/gen_keyword_hash.py - do not edit.\n")
+    out.write("#ifndef KEYWORD_TABLE_H\n#define KEYWORD_TABLE_H\n\n")
+    out.write('#include "token.h"\n\n')
+    out.write("#define KEYWORD_HASH_SIZE %d\n" % size)
+    out.write("#define KEYWORD_MIN_LEN %d\n" % min(lens))
+    out.write("#define KEYWORD_MAX_LEN %d\n\n" % max(lens))
+    out.write("static inline unsigned keyword_hash(const char *s, size_t len) {\n")
+    out.write("    return (((unsigned char)s[0] * %du) ^ ((unsigned char)s[len - 1] * %du) ^ (unsigned)len) & (KEYWORD_HASH_SIZE - 1);\n" % (a, b))
+    out.write("}\n\n")
+    out.write("static const struct { const char *text; unsigned char len; KeywordKind kind; } keyword_table[KEYWORD_HASH_SIZE] = {\n")
+    for i, entry in enumerate(table):
+        if entry:
+            out.write('    [%d] = { "%s", %d, %s },\n' % (i, entry[0], len(entry[0]), entry[1]))
+    out.write("};\n\n#endif // KEYWORD_TABLE_H\n")
+
+
+if __name__ == "__main__":
+    main()